@@ -745,8 +745,8 @@ typedef union _CAN_BUS_DIAGNOSTIC {
         uint16_t errorFreeMsgCount;
         CAN_BUS_DIAG_FLAGS flag;
     } bF;
-    uint32_t dword[2];
-    uint8_t bytes[8];
+    uint32_t dword[3];
+    uint8_t bytes[12];
 } CAN_BUS_DIAGNOSTIC;
 
 //! TXREQ Channel Bits
@@ -966,4 +966,4 @@ typedef enum {
     OSC_CLKO_DIV10
 } OSC_CLKO_DIVIDE;
 
-#endif // _DRV_CANFDSPI_DEFINES_H
+#endif // _DRV_CANFDSPI_DEFINES_H
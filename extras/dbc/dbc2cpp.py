@@ -0,0 +1,293 @@
+#!/usr/bin/env python3
+# Generate typed encode/decode functions for the messages of a DBC file
+#
+#   dbc2cpp.py vehicle.dbc -o vehicle_dbc.h [--prefix VEHICLE]
+#
+# For every message the header holds a struct of raw signal values and
+#
+#   <PFX>_<MSG>_Encode(const <PFX>_<MSG> *m, CAN_TX_MSGOBJ *txObj, uint8_t *txd)
+#   <PFX>_<MSG>_Decode(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd, <PFX>_<MSG> *m)
+#
+# txd/rxd are the arrays passed to TransmitChannelLoad() and filled by
+# ReceiveMessageGet(). Bit positions are resolved here, so each data byte
+# is one straight-line expression: no loops or branches per signal.
+# Signals with a factor or offset also get _Phys()/_Raw() conversions.
+# Multiplexed signals are left out.
+
+import argparse
+import os
+import re
+import sys
+
+BO_RE = re.compile(r'^BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+(\w+)')
+SG_RE = re.compile(r'^SG_\s+(\w+)\s*(M|m\d+M?)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*'
+                   r'\(\s*([^,]+)\s*,\s*([^)]+)\)\s*\[\s*([^|]*)\|([^\]]*)\]\s*"([^"]*)"')
+BA_RE = re.compile(r'^BA_\s+"(\w+)"\s+BO_\s+(\d+)\s+(\d+)\s*;')
+
+CAN_EXT_FLAG = 0x80000000
+
+
+class Signal:
+    def __init__(self, name, start, length, intel, signed, factor, offset, unit):
+        self.name = name
+        self.start = start
+        self.length = length
+        self.intel = intel
+        self.signed = signed
+        self.factor = factor
+        self.offset = offset
+        self.unit = unit
+
+    def bits(self):
+        """Frame bit position of each value bit, LSB first."""
+        if self.intel:
+            return [self.start + k for k in range(self.length)]
+        # Motorola: start is the MSB; lower bits run down the byte, then on into the next one
+        pos = self.start
+        msb_first = []
+        for _ in range(self.length):
+            msb_first.append(pos)
+            pos = pos + 15 if pos % 8 == 0 else pos - 1
+        return list(reversed(msb_first))
+
+    def segments(self):
+        """(byte, bit in byte, value bit, width) runs."""
+        runs = []
+        for k, pos in enumerate(self.bits()):
+            byte, bit = pos // 8, pos % 8
+            if runs and runs[-1][0] == byte and runs[-1][1] + runs[-1][3] == bit and runs[-1][2] + runs[-1][3] == k:
+                runs[-1][3] += 1
+            else:
+                runs.append([byte, bit, k, 1])
+        return runs
+
+    def ctype(self):
+        for n in (8, 16, 32, 64):
+            if self.length <= n:
+                return ('int%d_t' if self.signed else 'uint%d_t') % n
+
+    def word(self):
+        return 'uint32_t' if self.length <= 32 else 'uint64_t'
+
+    def scaled(self):
+        return self.factor != 1.0 or self.offset != 0.0
+
+
+class Message:
+    def __init__(self, can_id, name, length):
+        self.ext = bool(can_id & CAN_EXT_FLAG)
+        self.id = can_id & ~CAN_EXT_FLAG
+        self.name = name
+        self.length = length
+        self.fd = length > 8
+        self.brs = True
+        self.signals = []
+        self.skipped = []
+
+    def dlc(self):
+        n = self.length
+        if n <= 8:
+            return n
+        if n <= 24:
+            return 8 + (n - 5) // 4
+        return 13 if n <= 32 else 14 if n <= 48 else 15
+
+    def size(self):
+        return (0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64)[self.dlc()]
+
+
+def parse(path):
+    messages = {}
+    current = None
+    with open(path, encoding='latin-1') as f:
+        for line in f:
+            line = line.strip()
+            m = BO_RE.match(line)
+            if m:
+                current = Message(int(m.group(1)), m.group(2), int(m.group(3)))
+                messages[int(m.group(1))] = current
+                continue
+            m = SG_RE.match(line)
+            if m and current is not None:
+                if m.group(2) and m.group(2) != 'M':
+                    current.skipped.append(m.group(1))
+                    continue
+                current.signals.append(Signal(m.group(1), int(m.group(3)), int(m.group(4)),
+                                              m.group(5) == '1', m.group(6) == '-',
+                                              float(m.group(7)), float(m.group(8)), m.group(11)))
+                continue
+            if not line.startswith('SG_'):
+                current = None
+            m = BA_RE.match(line)
+            if m and int(m.group(2)) in messages:
+                msg = messages[int(m.group(2))]
+                if m.group(1) == 'VFrameFormat':
+                    msg.fd = msg.fd or int(m.group(3)) in (14, 15)
+                elif m.group(1) == 'CANFD_BRS':
+                    msg.brs = int(m.group(3)) != 0
+    for msg in messages.values():
+        for s in msg.signals:
+            if max(s.bits()) >= 8 * msg.size() or min(s.bits()) < 0:
+                sys.exit('%s.%s: signal outside the frame' % (msg.name, s.name))
+    return [messages[k] for k in messages if messages[k].name != 'VECTOR__INDEPENDENT_SIG_MSG']
+
+
+def flt(x):
+    return repr(float(x)) + 'f'
+
+
+def hexmask(width):
+    return '0x%02X' % ((1 << width) - 1)
+
+
+def emit_message(out, pfx, msg):
+    t = '%s_%s' % (pfx, msg.name)
+    size = msg.size()
+
+    out.append('// *****************************************************************************')
+    out.append('//! %s, 0x%X%s, %d bytes' % (msg.name, msg.id, ' extended' if msg.ext else '', msg.length))
+    if msg.skipped:
+        out.append('/*!')
+        out.append('   Multiplexed signals not generated: %s' % ', '.join(msg.skipped))
+        out.append('*/')
+    out.append('')
+    out.append('#define %s_ID    0x%XUL' % (t, msg.id))
+    out.append('#define %s_DLC   %d' % (t, msg.dlc()))
+    out.append('')
+    out.append('typedef struct {')
+    for s in msg.signals:
+        unit = ' [%s]' % s.unit if s.unit else ''
+        out.append('  %s %s;%s' % (s.ctype(), s.name, ('   // x %g %+g%s' % (s.factor, s.offset, unit)) if s.scaled() or unit else ''))
+    if not msg.signals:
+        out.append('  uint8_t unused;')
+    out.append('} %s;' % t)
+    out.append('')
+
+    for s in msg.signals:
+        if not s.scaled():
+            continue
+        out.append('static inline float %s_%s_Phys(%s raw)' % (t, s.name, s.ctype()))
+        out.append('{')
+        phys = 'raw * %s' % flt(s.factor) if s.factor != 1.0 else 'raw'
+        if s.offset:
+            phys += ' %s %s' % ('-' if s.offset < 0 else '+', flt(abs(s.offset)))
+        out.append('  return %s;' % phys)
+        out.append('}')
+        out.append('')
+        out.append('static inline %s %s_%s_Raw(float phys)' % (s.ctype(), t, s.name))
+        out.append('{')
+        raw = 'phys'
+        if s.offset:
+            raw = '(phys %s %s)' % ('+' if s.offset < 0 else '-', flt(abs(s.offset)))
+        if s.factor != 1.0:
+            raw += ' / %s' % flt(s.factor)
+        out.append('  float r = %s;' % raw)
+        out.append('')
+        out.append('  return (%s) (r + (r < 0 ? -0.5f : 0.5f));' % s.ctype())
+        out.append('}')
+        out.append('')
+
+    # Encode: one assignment per data byte
+    by_byte = [[] for _ in range(size)]
+    for s in msg.signals:
+        for byte, bit, k, width in s.segments():
+            v = '(%s) m->%s' % (s.word(), s.name)
+            if k:
+                v = '(%s >> %d)' % (v, k)
+            term = '(%s & %s)' % (v, hexmask(width))
+            if bit:
+                term = '(%s << %d)' % (term, bit)
+            by_byte[byte].append(term)
+
+    out.append('static inline void %s_Encode(const %s *m, CAN_TX_MSGOBJ *txObj, uint8_t *txd)' % (t, t))
+    out.append('{')
+    out.append('  txObj->word[0] = 0;')
+    out.append('  txObj->word[1] = 0;')
+    if msg.ext:
+        out.append('  txObj->bF.id.SID = %s_ID >> 18;' % t)
+        out.append('  txObj->bF.id.EID = %s_ID & 0x3FFFF;' % t)
+        out.append('  txObj->bF.ctrl.IDE = 1;')
+    else:
+        out.append('  txObj->bF.id.SID = %s_ID;' % t)
+    out.append('  txObj->bF.ctrl.DLC = %s_DLC;' % t)
+    if msg.fd:
+        out.append('  txObj->bF.ctrl.FDF = 1;')
+        if msg.brs:
+            out.append('  txObj->bF.ctrl.BRS = 1;')
+    out.append('')
+    for byte, terms in enumerate(by_byte):
+        if terms:
+            out.append('  txd[%d] = (uint8_t) (%s);' % (byte, ' | '.join(terms)))
+        else:
+            out.append('  txd[%d] = 0;' % byte)
+    out.append('}')
+    out.append('')
+
+    # Decode: one expression per signal
+    out.append('static inline bool %s_Decode(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd, %s *m)' % (t, t))
+    out.append('{')
+    if msg.ext:
+        out.append('  if (!rxObj->bF.ctrl.IDE || ((((uint32_t) rxObj->bF.id.SID << 18) | rxObj->bF.id.EID) != %s_ID) ||' % t)
+    else:
+        out.append('  if (rxObj->bF.ctrl.IDE || (rxObj->bF.id.SID != %s_ID) ||' % t)
+    out.append('      (DLC_DataLength[rxObj->bF.ctrl.DLC] < %d)) {' % msg.length)
+    out.append('    return false;')
+    out.append('  }')
+    out.append('')
+    for s in msg.signals:
+        terms = []
+        for byte, bit, k, width in s.segments():
+            term = 'rxd[%d]' % byte
+            if bit:
+                term = '(%s >> %d)' % (term, bit)
+            if bit + width < 8:
+                term = '(%s & %s)' % (term, hexmask(width))
+            term = '(%s) %s' % (s.word(), term)
+            if k:
+                term = '(%s << %d)' % (term, k)
+            terms.append(term)
+        raw = ' | '.join(terms)
+        if s.signed and s.length < (32 if s.length <= 32 else 64):
+            sign = '0x%XUL' % (1 << (s.length - 1)) if s.length <= 32 else '0x%XULL' % (1 << (s.length - 1))
+            out.append('  m->%s = (%s) (((%s) ^ %s) - %s);' % (s.name, s.ctype(), raw, sign, sign))
+        else:
+            out.append('  m->%s = (%s) (%s);' % (s.name, s.ctype(), raw))
+    out.append('')
+    out.append('  return true;')
+    out.append('}')
+    out.append('')
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Generate mcp2517fd encode/decode functions from a DBC file')
+    ap.add_argument('dbc')
+    ap.add_argument('-o', '--output', help='header to write, default stdout')
+    ap.add_argument('--prefix', help='name prefix, default the DBC file name')
+    args = ap.parse_args()
+
+    base = os.path.splitext(os.path.basename(args.dbc))[0]
+    pfx = args.prefix or re.sub(r'\W', '_', base).upper()
+    guard = '%s_DBC_H' % pfx
+
+    out = ['/*',
+           '  Generated by dbc2cpp.py from %s; do not edit' % os.path.basename(args.dbc),
+           '*/',
+           '#ifndef\t%s' % guard,
+           '#define\t%s' % guard,
+           '',
+           '#include "mcp2517fd.h"',
+           '']
+    for msg in parse(args.dbc):
+        emit_message(out, pfx, msg)
+    out.append('#endif')
+
+    text = '\n'.join(out) + '\n'
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == '__main__':
+    main()
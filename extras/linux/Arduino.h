@@ -0,0 +1,61 @@
+/*
+  Arduino.h - Minimal Arduino core for building the mcp2517fd driver on Linux
+
+  Only what the driver uses is provided. CS and INT pins are routed to the
+  transport attached to them with mcp2517fd_host_attach().
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_HOST_ARDUINO_H
+#define	MCP2517FD_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef MCP2517FD_PORTLESS_IO
+  #error "the Linux build needs -DMCP2517FD_PORTLESS_IO"
+#endif
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+
+#define NOT_A_PIN 0
+#define F(s) (s)
+
+class mcp2517fd_transport;
+
+// *****************************************************************************
+//! Route a CS/INT pin pair to a transport
+/*!
+   Call once per controller before its Init(). Pin numbers are only keys here;
+   any value below 256 will do as long as each controller has its own pair.
+*/
+
+void mcp2517fd_host_attach(uint8_t cs_pin, uint8_t intr_pin, mcp2517fd_transport *transport);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Port register access does not exist on the host; kept so code that only
+// stores the pointers still links
+uint32_t digitalPinToBitMask(uint8_t pin);
+uint8_t digitalPinToPort(uint8_t pin);
+volatile uint32_t *portOutputRegister(uint8_t port);
+volatile uint32_t *portInputRegister(uint8_t port);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  SPI.h - Minimal Arduino SPI class for building the mcp2517fd driver on Linux
+
+  Transfers go to the transport whose CS pin is currently driven low.
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_HOST_SPI_H
+#define	MCP2517FD_HOST_SPI_H
+
+#include "Arduino.h"
+
+class SPISettings {
+  public:
+    SPISettings() : clock(1000000UL) {}
+    SPISettings(uint32_t clk, uint8_t bitOrder, uint8_t dataMode) : clock(clk) {}
+
+    uint32_t clock;
+};
+
+class SPIClass {
+  public:
+    void begin() {}
+    void end() {}
+    void beginTransaction(SPISettings settings) {}
+    void endTransaction() {}
+
+    // *****************************************************************************
+    //! Full duplex transfer of one byte
+    uint8_t transfer(uint8_t data);
+
+    // *****************************************************************************
+    //! Full duplex transfer of a buffer, received bytes replace the sent ones
+    void transfer(void *buf, size_t count);
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,131 @@
+/*
+  host_io.cpp - Arduino pin, timing and SPI shims on top of mcp2517fd_transport
+*/
+#include <time.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "mcp2517fd_transport.h"
+
+SPIClass SPI;
+
+// Pin number -> transport; written during setup only
+static mcp2517fd_transport *cs_map[256];
+static mcp2517fd_transport *intr_map[256];
+
+// Transport with CS low; one per thread so each thread can own a controller
+static thread_local mcp2517fd_transport *selected = NULL;
+
+static volatile uint32_t dummy_port;
+
+void mcp2517fd_host_attach(uint8_t cs_pin, uint8_t intr_pin, mcp2517fd_transport *transport)
+{
+  cs_map[cs_pin] = transport;
+  intr_map[intr_pin] = transport;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Pins
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  mcp2517fd_transport *t = cs_map[pin];
+
+  if (!t) {
+    return;
+  }
+
+  if (val == LOW) {
+    selected = t;
+    t->Select();
+  } else if (selected == t) {
+    t->Deselect();
+    selected = NULL;
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  mcp2517fd_transport *t = intr_map[pin];
+
+  return t ? t->InterruptLevel() : HIGH;
+}
+
+uint32_t digitalPinToBitMask(uint8_t pin)
+{
+  return 1UL << (pin & 31);
+}
+
+uint8_t digitalPinToPort(uint8_t pin)
+{
+  return 0;
+}
+
+volatile uint32_t *portOutputRegister(uint8_t port)
+{
+  return &dummy_port;
+}
+
+volatile uint32_t *portInputRegister(uint8_t port)
+{
+  return &dummy_port;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Time
+static uint64_t monotonic_us()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long millis()
+{
+  return (unsigned long) (monotonic_us() / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long) monotonic_us();
+}
+
+void delay(unsigned long ms)
+{
+  usleep(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  usleep(us);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: SPI
+uint8_t SPIClass::transfer(uint8_t data)
+{
+  if (selected) {
+    selected->Transfer(&data, 1);
+    return data;
+  }
+
+  return 0xFF;
+}
+
+void SPIClass::transfer(void *buf, size_t count)
+{
+  if (selected) {
+    selected->Transfer((uint8_t *) buf, count);
+  } else {
+    memset(buf, 0xFF, count);
+  }
+}
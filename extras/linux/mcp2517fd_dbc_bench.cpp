@@ -0,0 +1,320 @@
+/*
+  mcp2517fd_dbc_bench.cpp - Correctness and speed of dbc2cpp.py generated codecs
+
+  Built against mcp2517fd_dbc_bench_dbc.h, which the Makefile generates from
+  mcp2517fd_dbc_bench.dbc: Intel and Motorola signals, signed and unsigned,
+  byte aligned and not, standard and extended IDs, classic and CAN FD.
+
+  For every message, random signal values are encoded and the frame is
+  compared with one built bit by bit from the DBC definition. Random frames
+  are decoded and every signal is compared with the value read back bit by
+  bit. Decode(Encode(m)) must give m back. Then encode and decode are timed
+  on a batch of frames.
+
+    mcp2517fd_dbc_bench -n 1000000 -s 7
+
+  Exits with 1 if any frame or signal does not match.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mcp2517fd_dbc_bench_dbc.h"
+
+#define BENCH_BATCH   1024
+
+// Signal lists matching mcp2517fd_dbc_bench.dbc: name, start bit, length, Intel, signed
+#define ENGINE_SIGNALS(X) \
+  X(Speed, 0, 16, true, false) \
+  X(Coolant, 16, 8, true, true) \
+  X(Throttle, 24, 10, true, false) \
+  X(Gear, 34, 4, true, false) \
+  X(Torque, 40, 13, true, true) \
+  X(Running, 63, 1, true, false)
+
+#define BRAKE_SIGNALS(X) \
+  X(Pressure, 7, 16, false, false) \
+  X(Slip, 23, 12, false, true) \
+  X(Counter, 27, 4, false, false) \
+  X(Yaw, 37, 14, false, true) \
+  X(Checksum, 55, 16, false, false)
+
+#define ODOMETER_SIGNALS(X) \
+  X(Distance, 0, 32, true, true) \
+  X(Trip, 32, 20, true, false) \
+  X(Status, 63, 8, false, true)
+
+#define TRACE_SIGNALS(X) \
+  X(Stamp, 0, 64, true, false) \
+  X(Offset, 64, 40, true, true) \
+  X(Level, 135, 24, false, false) \
+  X(Drift, 159, 48, false, true) \
+  X(Sequence, 504, 8, true, false)
+
+typedef struct {
+  uint32_t frames;
+  uint32_t errors;
+  double encode_ns;
+  double decode_ns;
+} BENCH_RESULT;
+
+static uint64_t state;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n <frames>     random frames per message and direction (default 100000)\n"
+          "  -s <seed>       PRNG seed (default 1)\n",
+          prog);
+}
+
+static uint64_t random64()
+{
+  // xorshift64
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+
+  return state;
+}
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Reference
+
+// Straight from the DBC rules, one bit at a time. Motorola signals are walked
+// in big endian bit order: start is the MSB, numbered 7..0 within a byte.
+
+static uint64_t ref_get(const uint8_t *d, uint16_t start, uint8_t length, bool intel)
+{
+  uint64_t v = 0;
+
+  if (intel) {
+    for (uint8_t k = 0; k < length; k++) {
+      uint16_t p = start + k;
+
+      v |= (uint64_t) ((d[p / 8] >> (p % 8)) & 1) << k;
+    }
+  } else {
+    uint16_t s = (start / 8) * 8 + 7 - (start % 8);
+
+    for (uint8_t k = 0; k < length; k++) {
+      uint16_t q = s + k;
+
+      v = (v << 1) | ((d[q / 8] >> (7 - (q % 8))) & 1);
+    }
+  }
+
+  return v;
+}
+
+static void ref_set(uint8_t *d, uint16_t start, uint8_t length, bool intel, uint64_t v)
+{
+  if (intel) {
+    for (uint8_t k = 0; k < length; k++) {
+      uint16_t p = start + k;
+
+      d[p / 8] = (d[p / 8] & ~(1 << (p % 8))) | (((v >> k) & 1) << (p % 8));
+    }
+  } else {
+    uint16_t s = (start / 8) * 8 + 7 - (start % 8);
+
+    for (uint8_t k = 0; k < length; k++) {
+      uint16_t q = s + k;
+      uint8_t b = (v >> (length - 1 - k)) & 1;
+
+      d[q / 8] = (d[q / 8] & ~(0x80 >> (q % 8))) | (b << (7 - (q % 8)));
+    }
+  }
+}
+
+static uint64_t mask(uint8_t length)
+{
+  return (length < 64) ? ((1ULL << length) - 1) : ~0ULL;
+}
+
+// Raw bits as the signal value the struct should hold
+static int64_t value(uint64_t raw, uint8_t length, bool is_signed)
+{
+  if (is_signed && (length < 64) && (raw >> (length - 1))) {
+    raw |= ~mask(length);
+  }
+
+  return (int64_t) raw;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Checks
+
+#define SIGNAL_RANDOM(sig, start, length, intel, is_signed) \
+  m.sig = value(random64() & mask(length), length, is_signed);
+
+#define SIGNAL_SET(sig, start, length, intel, is_signed) \
+  ref_set(expect, start, length, intel, (uint64_t) m.sig & mask(length));
+
+#define SIGNAL_CHECK(sig, start, length, intel, is_signed) \
+  if ((int64_t) d.sig != value(ref_get(rxd, start, length, intel), length, is_signed)) { \
+    if (!res->errors++) { \
+      fprintf(stderr, "%s.%s: decoded %lld, expected %lld\n", name, #sig, \
+              (long long) d.sig, (long long) value(ref_get(rxd, start, length, intel), length, is_signed)); \
+    } \
+  }
+
+#define SIGNAL_SAME(sig, start, length, intel, is_signed) \
+  if (d.sig != m.sig) { \
+    if (!res->errors++) { \
+      fprintf(stderr, "%s.%s: round trip gave %lld for %lld\n", name, #sig, (long long) d.sig, (long long) m.sig); \
+    } \
+  }
+
+#define SIGNAL_SUM(sig, start, length, intel, is_signed) \
+  sum += (uint64_t) d.sig;
+
+// Encode against the reference, decode against the reference, round trip, then time both
+#define MESSAGE_BENCH(fn, T, SIGNALS) \
+static void fn(const char *name, uint32_t frames, BENCH_RESULT *res) \
+{ \
+  static T batch[BENCH_BATCH]; \
+  static uint8_t data[BENCH_BATCH][MAX_DATA_BYTES]; \
+  CAN_TX_MSGOBJ txObj; \
+  CAN_RX_MSGOBJ rxObj; \
+  uint8_t txd[MAX_DATA_BYTES]; \
+  uint8_t rxd[MAX_DATA_BYTES]; \
+  uint8_t expect[MAX_DATA_BYTES]; \
+  uint8_t size = DLC_DataLength[T##_DLC]; \
+  T m, d; \
+  \
+  memset(res, 0, sizeof(*res)); \
+  memset(&d, 0, sizeof(d)); \
+  res->frames = frames; \
+  \
+  for (uint32_t i = 0; i < frames; i++) { \
+    memset(&m, 0, sizeof(m)); \
+    SIGNALS(SIGNAL_RANDOM) \
+    memset(expect, 0, sizeof(expect)); \
+    SIGNALS(SIGNAL_SET) \
+    T##_Encode(&m, &txObj, txd); \
+    \
+    if (memcmp(txd, expect, size) || (txObj.bF.ctrl.DLC != T##_DLC)) { \
+      if (!res->errors++) { \
+        fprintf(stderr, "%s: encoded frame differs from the reference\n", name); \
+      } \
+    } \
+    \
+    rxObj.word[0] = txObj.word[0]; \
+    rxObj.word[1] = txObj.word[1]; \
+    rxObj.word[2] = 0; \
+    memcpy(rxd, txd, size); \
+    \
+    if (!T##_Decode(&rxObj, rxd, &d)) { \
+      if (!res->errors++) { \
+        fprintf(stderr, "%s: own frame rejected\n", name); \
+      } \
+      continue; \
+    } \
+    SIGNALS(SIGNAL_SAME) \
+    \
+    for (uint8_t j = 0; j < size; j++) { \
+      rxd[j] = (uint8_t) random64(); \
+    } \
+    T##_Decode(&rxObj, rxd, &d); \
+    SIGNALS(SIGNAL_CHECK) \
+  } \
+  \
+  for (uint32_t i = 0; i < BENCH_BATCH; i++) { \
+    SIGNALS(SIGNAL_RANDOM) \
+    batch[i] = m; \
+  } \
+  \
+  uint64_t t = now_ns(); \
+  \
+  for (uint32_t i = 0; i < frames; i++) { \
+    T##_Encode(&batch[i % BENCH_BATCH], &txObj, data[i % BENCH_BATCH]); \
+  } \
+  \
+  res->encode_ns = (double) (now_ns() - t) / frames; \
+  \
+  uint64_t sum = 0; \
+  \
+  t = now_ns(); \
+  \
+  for (uint32_t i = 0; i < frames; i++) { \
+    T##_Decode(&rxObj, data[i % BENCH_BATCH], &d); \
+    SIGNALS(SIGNAL_SUM) \
+  } \
+  \
+  res->decode_ns = (double) (now_ns() - t) / frames; \
+  \
+  /* Keeps the decode loop from being optimised away */ \
+  if (sum == 1) { \
+    fprintf(stderr, "%llu\n", (unsigned long long) sum); \
+  } \
+}
+
+MESSAGE_BENCH(engine_bench, BENCH_Engine, ENGINE_SIGNALS)
+MESSAGE_BENCH(brake_bench, BENCH_Brake, BRAKE_SIGNALS)
+MESSAGE_BENCH(odometer_bench, BENCH_Odometer, ODOMETER_SIGNALS)
+MESSAGE_BENCH(trace_bench, BENCH_Trace, TRACE_SIGNALS)
+
+static const struct {
+  const char *name;
+  const char *kind;
+  void (*bench)(const char *name, uint32_t frames, BENCH_RESULT *res);
+} messages[] = {
+  {"Engine", "std, Intel", engine_bench},
+  {"Brake", "std, Motorola", brake_bench},
+  {"Odometer", "ext, mixed", odometer_bench},
+  {"Trace", "FD 64, mixed", trace_bench},
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t frames = 100000;
+  uint64_t seed = 1;
+  uint32_t errors = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+    switch (opt) {
+      case 'n': frames = strtoul(optarg, NULL, 0); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if (!frames) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  state = seed ? seed : 1;
+
+  printf("%-10s %-14s %8s %7s %10s %10s\n", "message", "layout", "frames", "errors", "encode_ns", "decode_ns");
+
+  for (uint8_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+    BENCH_RESULT res;
+
+    messages[i].bench(messages[i].name, frames, &res);
+    errors += res.errors;
+
+    printf("%-10s %-14s %8u %7u %10.1f %10.1f\n", messages[i].name, messages[i].kind,
+           res.frames, res.errors, res.encode_ns, res.decode_ns);
+  }
+
+  return errors ? 1 : 0;
+}
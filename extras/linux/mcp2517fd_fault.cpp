@@ -0,0 +1,205 @@
+/*
+  mcp2517fd_fault.cpp - Fault injecting wrapper around an mcp2517fd_transport
+*/
+#include <math.h>
+#include <string.h>
+
+#include "mcp2517fd_fault.h"
+
+mcp2517fd_fault::mcp2517fd_fault(mcp2517fd_transport &transport, uint32_t seed)
+{
+  inner = &transport;
+  enabled = true;
+  first = 0;
+  last = 0xFFF;
+  header_len = 0;
+  dropped = false;
+
+  memset(rate, 0, sizeof(rate));
+  memset(pending, 0, sizeof(pending));
+
+  Seed(seed);
+  StatsClear();
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Transport
+void mcp2517fd_fault::Select()
+{
+  transactions++;
+  header_len = 0;
+  dropped = false;
+
+  inner->Select();
+}
+
+void mcp2517fd_fault::Deselect()
+{
+  // A dropped CS has already ended the transaction on the controller side
+  if (!dropped) {
+    inner->Deselect();
+  }
+
+  dropped = false;
+}
+
+void mcp2517fd_fault::Transfer(uint8_t *buf, size_t n)
+{
+  bytes += n;
+
+  // The address comes from the header as the host sent it
+  for (size_t i = 0; (i < n) && (header_len < 2); i++) {
+    header[header_len++] = buf[i];
+  }
+
+  if (dropped) {
+    memset(buf, 0xFF, n);
+    return;
+  }
+
+  bool in_range = (first == 0) && (last >= 0xFFF);
+
+  if (header_len == 2) {
+    uint16_t a = ((header[0] & 0x0F) << 8) | header[1];
+
+    in_range = (a >= first) && (a <= last);
+  }
+
+  if (!enabled || !in_range || !n) {
+    inner->Transfer(buf, n);
+    return;
+  }
+
+  size_t cut = n;
+  bool drop = false;
+
+  if (Roll(MCP2517FD_FAULT_CS_DROP)) {
+    cut = Random() % n;
+    drop = true;
+    faults[MCP2517FD_FAULT_CS_DROP]++;
+  } else if (Roll(MCP2517FD_FAULT_TRUNCATE)) {
+    cut = Random() % n;
+    faults[MCP2517FD_FAULT_TRUNCATE]++;
+  }
+
+  Flip(buf, cut, MCP2517FD_FAULT_MOSI_FLIP);
+
+  inner->Transfer(buf, cut);
+
+  if (drop) {
+    inner->Deselect();
+    dropped = true;
+  }
+
+  // Bytes never clocked read as the idle level of MISO
+  memset(buf + cut, 0xFF, n - cut);
+
+  Flip(buf, cut, MCP2517FD_FAULT_MISO_FLIP);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Fault Setup
+void mcp2517fd_fault::RateSet(MCP2517FD_FAULT_KIND kind, uint32_t ppm)
+{
+  rate[kind] = ppm;
+
+  if (kind <= MCP2517FD_FAULT_MISO_FLIP) {
+    flip_distance[kind] = FlipDistance(ppm);
+  }
+}
+
+void mcp2517fd_fault::Inject(MCP2517FD_FAULT_KIND kind, uint32_t count)
+{
+  pending[kind] += count;
+}
+
+void mcp2517fd_fault::AddressRangeSet(uint16_t f, uint16_t l)
+{
+  first = f;
+  last = l;
+}
+
+void mcp2517fd_fault::Seed(uint32_t seed)
+{
+  state = seed ? seed : 1;
+
+  flip_distance[MCP2517FD_FAULT_MOSI_FLIP] = FlipDistance(rate[MCP2517FD_FAULT_MOSI_FLIP]);
+  flip_distance[MCP2517FD_FAULT_MISO_FLIP] = FlipDistance(rate[MCP2517FD_FAULT_MISO_FLIP]);
+}
+
+void mcp2517fd_fault::StatsClear()
+{
+  memset(faults, 0, sizeof(faults));
+  transactions = 0;
+  bytes = 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Private
+uint32_t mcp2517fd_fault::Random()
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+
+  return state;
+}
+
+uint64_t mcp2517fd_fault::FlipDistance(uint32_t ppm)
+{
+  if (ppm == 0) {
+    return UINT64_MAX;
+  }
+
+  if (ppm >= 1000000UL) {
+    return 0;
+  }
+
+  // Geometric distribution: one draw per flip instead of one per bit
+  double u = (Random() + 1.0) / 4294967296.0;
+
+  return (uint64_t) (log(u) / log1p(-(ppm / 1e6)));
+}
+
+void mcp2517fd_fault::Flip(uint8_t *buf, size_t n, MCP2517FD_FAULT_KIND kind)
+{
+  uint64_t bits = (uint64_t) n * 8;
+
+  if (!bits) {
+    return;
+  }
+
+  if (pending[kind]) {
+    uint32_t b = Random() % bits;
+
+    buf[b / 8] ^= 0x80 >> (b % 8);
+    pending[kind]--;
+    faults[kind]++;
+  }
+
+  uint64_t d = flip_distance[kind];
+
+  while (d < bits) {
+    buf[d / 8] ^= 0x80 >> (d % 8);
+    faults[kind]++;
+
+    uint64_t next = FlipDistance(rate[kind]);
+
+    d = (next == UINT64_MAX) ? next : d + 1 + next;
+  }
+
+  flip_distance[kind] = (d == UINT64_MAX) ? d : d - bits;
+}
+
+bool mcp2517fd_fault::Roll(MCP2517FD_FAULT_KIND kind)
+{
+  if (pending[kind]) {
+    pending[kind]--;
+    return true;
+  }
+
+  return rate[kind] && ((Random() % 1000000UL) < rate[kind]);
+}
@@ -0,0 +1,148 @@
+/*
+  mcp2517fd_fault.h - Fault injecting wrapper around an mcp2517fd_transport
+
+  Sits between the driver and a transport (usually mcp2517fd_sim) and
+  disturbs the SPI link the way a noisy board would: bit flips in either
+  direction at a bit error rate, chip select released early, transfers cut
+  short. Faults can be limited to a range of register or RAM addresses.
+  All randomness comes from a seeded PRNG, so a run repeats exactly.
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_FAULT_H
+#define	MCP2517FD_FAULT_H
+
+#include "mcp2517fd_transport.h"
+
+// *****************************************************************************
+//! Fault kinds
+
+typedef enum {
+  MCP2517FD_FAULT_MOSI_FLIP,   // bit flipped on the way to the controller
+  MCP2517FD_FAULT_MISO_FLIP,   // bit flipped on the way to the host
+  MCP2517FD_FAULT_CS_DROP,     // CS released in the middle of a transfer; the rest of the transaction is lost
+  MCP2517FD_FAULT_TRUNCATE,    // the tail of a transfer is never clocked
+  MCP2517FD_FAULT_KINDS
+} MCP2517FD_FAULT_KIND;
+
+class mcp2517fd_fault : public mcp2517fd_transport {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Transport
+
+    void Select();
+    void Deselect();
+    void Transfer(uint8_t *buf, size_t n);
+
+    inline uint8_t InterruptLevel()
+    {
+      return inner->InterruptLevel();
+    }
+
+    inline int InterruptFd()
+    {
+      return inner->InterruptFd();
+    }
+
+    inline void InterruptAck()
+    {
+      inner->InterruptAck();
+    }
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Fault Setup
+
+    // *****************************************************************************
+    //! Set the rate of a fault kind in ppm
+    /*!
+       Bit flips: per bit clocked in that direction. CS drop and truncation:
+       per Transfer() call, at a random byte within it. 0 turns the kind off.
+    */
+
+    void RateSet(MCP2517FD_FAULT_KIND kind, uint32_t ppm);
+
+    // *****************************************************************************
+    //! Fault the next count transfers with kind, regardless of rate
+    void Inject(MCP2517FD_FAULT_KIND kind, uint32_t count = 1);
+
+    // *****************************************************************************
+    //! Only fault transactions addressing first..last
+    /*!
+       Bit flips in the instruction/address bytes count as hitting the
+       address the host sent. Default: the whole address space.
+    */
+
+    void AddressRangeSet(uint16_t first = 0, uint16_t last = 0xFFF);
+
+    // *****************************************************************************
+    //! Restart the PRNG
+    void Seed(uint32_t seed);
+
+    // *****************************************************************************
+    //! Pass everything through untouched while false
+    inline void Enable(bool on)
+    {
+      enabled = on;
+    }
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Statistics
+
+    // *****************************************************************************
+    //! Faults applied of a kind
+    inline uint32_t FaultCount(MCP2517FD_FAULT_KIND kind)
+    {
+      return faults[kind];
+    }
+
+    // *****************************************************************************
+    //! Transactions (CS low to high) and bytes seen
+    inline uint32_t TransactionCount()
+    {
+      return transactions;
+    }
+
+    inline uint64_t ByteCount()
+    {
+      return bytes;
+    }
+
+    // *****************************************************************************
+    //! Clear the statistics
+    void StatsClear();
+
+    mcp2517fd_fault(mcp2517fd_transport &transport, uint32_t seed = 1);
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private
+
+    uint32_t Random();
+    uint64_t FlipDistance(uint32_t ppm);
+    void Flip(uint8_t *buf, size_t n, MCP2517FD_FAULT_KIND kind);
+    bool Roll(MCP2517FD_FAULT_KIND kind);
+
+    mcp2517fd_transport *inner;
+    bool enabled;
+    uint32_t state;                        // xorshift32
+    uint32_t rate[MCP2517FD_FAULT_KINDS];
+    uint32_t pending[MCP2517FD_FAULT_KINDS];
+    uint64_t flip_distance[2];             // bits until the next MOSI/MISO flip
+    uint16_t first, last;
+
+    // Current transaction
+    uint8_t header[2];
+    uint8_t header_len;
+    bool dropped;
+
+    uint32_t faults[MCP2517FD_FAULT_KINDS];
+    uint32_t transactions;
+    uint64_t bytes;
+};
+
+#endif
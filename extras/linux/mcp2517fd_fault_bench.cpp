@@ -0,0 +1,355 @@
+/*
+  mcp2517fd_fault_bench.cpp - Message path behaviour on a noisy SPI link
+
+  Runs the driver against the simulated controller in internal loopback,
+  with mcp2517fd_fault between the two, and checks every frame that comes
+  back: intact, corrupted without anybody noticing, lost or duplicated. A
+  node that stops making progress (a flipped bit in a FIFO or mode register
+  can wedge it) is re-initialised over a clean link; the time from the
+  first idle round to the next frame is its recovery time.
+
+    mcp2517fd_fault_bench -e 100                  100 ppm bit errors both ways
+    mcp2517fd_fault_bench -e 100 -c 3             the same with SPI CRC, 3 retries
+    mcp2517fd_fault_bench -d 1000 -a 0x400-0xbff  CS drops on message RAM only
+    mcp2517fd_fault_bench -S                      sweep bit error rates, CRC off and on
+    mcp2517fd_fault_bench -S -r object            the same through the zero-copy RX path
+
+  Runs are deterministic for a given seed, apart from the timing figures.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../mcp2517fd.h"
+#include "mcp2517fd_fault.h"
+#include "mcp2517fd_sim.h"
+
+#define BENCH_CS_PIN      10
+#define BENCH_INT_PIN     11
+#define BENCH_TX_CH       CAN_FIFO_CH1
+#define BENCH_RX_CH       CAN_FIFO_CH2
+#define BENCH_STALL       100   // rounds without progress before re-initialising
+
+typedef enum {
+  BENCH_RX_GET,      // ReceiveMessageGet()
+  BENCH_RX_BUFFER,   // ReceiveMessageBufferGet()
+  BENCH_RX_OBJECT    // ReceiveObjectRead()
+} BENCH_RX_PATH;
+
+static const char *rx_paths[] = {"get", "buffer", "object"};
+
+typedef struct {
+  uint32_t ber_ppm;
+  uint32_t drop_ppm;
+  uint32_t truncate_ppm;
+  uint16_t first;
+  uint16_t last;
+  uint8_t retries;
+  uint32_t frames;
+  uint8_t len;
+  uint32_t seed;
+  BENCH_RX_PATH rx_path;
+} BENCH_CONFIG;
+
+typedef struct {
+  uint32_t good;
+  uint32_t corrupt;       // passed to the application with wrong ID or data
+  uint32_t lost;
+  uint32_t duplicate;
+  uint32_t tx_fail;       // TransmitChannelLoad() errors other than FIFO full
+  uint32_t rx_fail;       // ReceiveMessageGet() gave up
+  uint32_t crc_errors;
+  uint32_t recoveries;
+  uint64_t recovery_us_sum;
+  uint32_t recovery_us_max;
+  uint64_t spi_bytes;
+  double seconds;
+  uint32_t faults[MCP2517FD_FAULT_KINDS];
+} BENCH_RESULT;
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -e <ppm>        bit error rate on MOSI and MISO\n"
+          "  -d <ppm>        CS drop rate per transfer\n"
+          "  -t <ppm>        truncation rate per transfer\n"
+          "  -a <lo-hi>      only disturb accesses to these addresses\n"
+          "  -c <retries>    SPI CRC on the message paths (default off)\n"
+          "  -n <frames>     frames to send (default 100000)\n"
+          "  -l <bytes>      payload, 4 to 64; above 8 as CAN FD (default 8)\n"
+          "  -s <seed>       PRNG seed (default 1)\n"
+          "  -r <path>       receive with get, buffer or object (default get)\n"
+          "  -S              sweep bit error rates with CRC off and on\n",
+          prog);
+}
+
+static uint8_t pattern(uint32_t seq, uint8_t i)
+{
+  return (uint8_t) (seq * 31 + i * 7);
+}
+
+static bool node_start(mcp2517fd &can, mcp2517fd_fault &link, uint8_t retries)
+{
+  CAN_FILTEROBJ_ID fobj;
+  CAN_MASKOBJ_ID mobj;
+
+  link.Enable(false);
+
+  can.Init(CAN_500K_2M, BENCH_TX_CH, BENCH_RX_CH);
+
+  memset(&fobj, 0, sizeof(fobj));
+  memset(&mobj, 0, sizeof(mobj));
+  can.FilterObjectConfigure(CAN_FILTER0, &fobj);
+  can.FilterMaskConfigure(CAN_FILTER0, &mobj);
+  can.FilterToFifoLink(CAN_FILTER0, true, BENCH_RX_CH);
+  can.SpiCrcRetriesSet(retries);
+
+  bool ok = (can.OperationModeSwitch(CAN_INTERNAL_LOOPBACK_MODE) >= 0);
+
+  link.Enable(true);
+
+  return ok;
+}
+
+static void run(const BENCH_CONFIG *cfg, BENCH_RESULT *res)
+{
+  mcp2517fd_sim sim;
+  mcp2517fd_fault link(sim, cfg->seed);
+  mcp2517fd can(BENCH_CS_PIN, BENCH_INT_PIN);
+  CAN_TX_MSGOBJ txObj;
+  CAN_RX_MSGOBJ rxObj;
+  uint8_t txd[MAX_DATA_BYTES];
+  uint8_t rxd[MAX_DATA_BYTES];
+  uint8_t obj[CAN_OBJECT_BUFFER_SIZE];
+
+  memset(res, 0, sizeof(*res));
+  mcp2517fd_host_attach(BENCH_CS_PIN, BENCH_INT_PIN, &link);
+
+  link.RateSet(MCP2517FD_FAULT_MOSI_FLIP, cfg->ber_ppm);
+  link.RateSet(MCP2517FD_FAULT_MISO_FLIP, cfg->ber_ppm);
+  link.RateSet(MCP2517FD_FAULT_CS_DROP, cfg->drop_ppm);
+  link.RateSet(MCP2517FD_FAULT_TRUNCATE, cfg->truncate_ppm);
+  link.AddressRangeSet(cfg->first, cfg->last);
+
+  if (!node_start(can, link, cfg->retries)) {
+    fprintf(stderr, "controller does not enter loopback mode\n");
+    exit(1);
+  }
+
+  link.StatsClear();
+
+  txObj.word[0] = 0;
+  txObj.word[1] = 0;
+  txObj.bF.ctrl.DLC = can.DataLengthtoDLC(cfg->len);
+  txObj.bF.ctrl.FDF = (cfg->len > 8) ? 1 : 0;
+  txObj.bF.ctrl.BRS = txObj.bF.ctrl.FDF;
+
+  uint32_t seq = 0;
+  uint32_t expect = 0;
+  uint32_t idle = 0;
+  unsigned long idle_since = 0;
+  bool recovering = false;
+  unsigned long start = micros();
+
+  // Keep going until every frame is sent and the FIFOs have run dry
+  while ((seq < cfg->frames) || (idle < BENCH_STALL)) {
+    bool progress = false;
+
+    if (seq < cfg->frames) {
+      txObj.bF.id.SID = seq & 0x7FF;
+      txd[0] = (uint8_t) seq;
+      txd[1] = (uint8_t) (seq >> 8);
+      txd[2] = (uint8_t) (seq >> 16);
+      txd[3] = (uint8_t) (seq >> 24);
+      for (uint8_t i = 4; i < cfg->len; i++) {
+        txd[i] = pattern(seq, i);
+      }
+
+      int8_t r = can.TransmitChannelLoad(&txObj, txd, cfg->len, BENCH_TX_CH, true);
+
+      if (r == 1) {
+        seq++;
+        progress = true;
+      } else if (r != -3) {
+        res->tx_fail++;
+      }
+    }
+
+    sim.Loopback();
+
+    while (can.available()) {
+      const uint8_t *d = rxd;
+
+      if (cfg->rx_path == BENCH_RX_GET) {
+        d = can.ReceiveMessageGet(&rxObj, rxd, cfg->len, BENCH_RX_CH) ? rxd : NULL;
+      } else if (cfg->rx_path == BENCH_RX_BUFFER) {
+        d = can.ReceiveMessageBufferGet(&rxObj, BENCH_RX_CH);
+      } else {
+        uint8_t *o = can.ReceiveObjectRead(BENCH_RX_CH, obj);
+
+        // Transmit object: header, then data
+        if (o != NULL) {
+          memcpy(rxObj.word, o, 8);
+          d = o + 8;
+        } else {
+          d = NULL;
+        }
+      }
+
+      if (d == NULL) {
+        res->rx_fail++;
+        break;
+      }
+
+      progress = true;
+
+      uint32_t s = d[0] | ((uint32_t) d[1] << 8) | ((uint32_t) d[2] << 16) | ((uint32_t) d[3] << 24);
+      bool intact = (rxObj.bF.id.SID == (s & 0x7FF)) && !rxObj.bF.ctrl.IDE &&
+                    (rxObj.bF.ctrl.DLC == txObj.bF.ctrl.DLC) && (s < seq);
+
+      for (uint8_t i = 4; intact && (i < cfg->len); i++) {
+        intact = (d[i] == pattern(s, i));
+      }
+
+      if (!intact) {
+        res->corrupt++;
+      } else if (s < expect) {
+        res->duplicate++;
+      } else {
+        res->lost += s - expect;
+        res->good++;
+        expect = s + 1;
+      }
+    }
+
+    if (progress) {
+      if (recovering) {
+        uint32_t t = micros() - idle_since;
+
+        res->recovery_us_sum += t;
+        if (t > res->recovery_us_max) {
+          res->recovery_us_max = t;
+        }
+        recovering = false;
+      }
+      idle = 0;
+    } else if (idle++ == 0) {
+      idle_since = micros();
+    } else if ((idle == BENCH_STALL) && (seq < cfg->frames)) {
+      // Wedged: whatever is still queued is lost
+      node_start(can, link, cfg->retries);
+      res->recoveries++;
+      recovering = true;
+      idle = 0;
+    }
+  }
+
+  res->lost += seq - expect;
+  res->seconds = (micros() - start) * 1e-6;
+  res->crc_errors = can.SpiCrcErrorCount();
+  res->spi_bytes = link.ByteCount();
+
+  for (uint8_t k = 0; k < MCP2517FD_FAULT_KINDS; k++) {
+    res->faults[k] = link.FaultCount((MCP2517FD_FAULT_KIND) k);
+  }
+}
+
+static void report_header()
+{
+  printf("%8s %4s %8s %8s %7s %7s %5s %7s %7s %7s %9s %10s %10s\n",
+         "ber_ppm", "crc", "good/s", "good", "corrupt", "lost", "dup", "txfail", "rxfail", "crcerr", "spi_B/frm", "recoveries", "recov_us");
+}
+
+static void report(const BENCH_CONFIG *cfg, const BENCH_RESULT *res)
+{
+  printf("%8u %4u %8.0f %8u %7u %7u %5u %7u %7u %7u %9.1f %10u %5.0f/%-4u\n",
+         cfg->ber_ppm, cfg->retries, res->good / res->seconds, res->good, res->corrupt, res->lost, res->duplicate,
+         res->tx_fail, res->rx_fail, res->crc_errors, res->good ? (double) res->spi_bytes / res->good : 0.0,
+         res->recoveries, res->recoveries ? (double) res->recovery_us_sum / res->recoveries : 0.0, res->recovery_us_max);
+}
+
+int main(int argc, char **argv)
+{
+  BENCH_CONFIG cfg;
+  BENCH_RESULT res;
+  bool sweep = false;
+  int opt;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.last = 0xFFF;
+  cfg.frames = 100000;
+  cfg.len = 8;
+  cfg.seed = 1;
+
+  while ((opt = getopt(argc, argv, "e:d:t:a:c:n:l:s:r:Sh")) != -1) {
+    switch (opt) {
+      case 'e': cfg.ber_ppm = strtoul(optarg, NULL, 0); break;
+      case 'd': cfg.drop_ppm = strtoul(optarg, NULL, 0); break;
+      case 't': cfg.truncate_ppm = strtoul(optarg, NULL, 0); break;
+      case 'c': cfg.retries = strtoul(optarg, NULL, 0); break;
+      case 'n': cfg.frames = strtoul(optarg, NULL, 0); break;
+      case 'l': cfg.len = strtoul(optarg, NULL, 0); break;
+      case 's': cfg.seed = strtoul(optarg, NULL, 0); break;
+      case 'S': sweep = true; break;
+      case 'r': {
+        uint8_t p = 0;
+
+        while ((p < 3) && strcmp(optarg, rx_paths[p])) {
+          p++;
+        }
+
+        if (p == 3) {
+          fprintf(stderr, "unknown receive path %s\n", optarg);
+          return 2;
+        }
+
+        cfg.rx_path = (BENCH_RX_PATH) p;
+        break;
+      }
+      case 'a': {
+        char *end;
+
+        cfg.first = strtoul(optarg, &end, 0);
+        cfg.last = (*end == '-') ? strtoul(end + 1, NULL, 0) : cfg.first;
+        break;
+      }
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  mcp2517fd probe(BENCH_CS_PIN, BENCH_INT_PIN);
+
+  if ((cfg.len < 4) || (cfg.len > 64) || (probe.DataLengthtoDLC(cfg.len) < 0)) {
+    fprintf(stderr, "payload must be a CAN FD data length from 4 to 64\n");
+    return 2;
+  }
+
+  printf("receive path: %s\n", rx_paths[cfg.rx_path]);
+  report_header();
+
+  if (!sweep) {
+    run(&cfg, &res);
+    report(&cfg, &res);
+    printf("faults: %u MOSI flips, %u MISO flips, %u CS drops, %u truncations\n",
+           res.faults[MCP2517FD_FAULT_MOSI_FLIP], res.faults[MCP2517FD_FAULT_MISO_FLIP],
+           res.faults[MCP2517FD_FAULT_CS_DROP], res.faults[MCP2517FD_FAULT_TRUNCATE]);
+    return 0;
+  }
+
+  static const uint32_t rates[] = {0, 1, 10, 100, 1000};
+
+  for (uint8_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    for (uint8_t crc = 0; crc < 2; crc++) {
+      cfg.ber_ppm = rates[r];
+      cfg.retries = crc ? 3 : 0;
+      run(&cfg, &res);
+      report(&cfg, &res);
+    }
+  }
+
+  return 0;
+}
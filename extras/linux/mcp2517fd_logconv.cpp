@@ -0,0 +1,161 @@
+/*
+  mcp2517fd_logconv.cpp - Convert mcp2517fd_capture logs to candump or Vector ASC text
+
+    mcp2517fd_logconv capture.bin > capture.log          candump -L format
+    mcp2517fd_logconv -a capture.bin > capture.asc       Vector ASC
+    mcp2517fd_logconv -i vcan0 -o 1700000000 - < capture.bin
+
+  Times are relative to the controller time base unless -o gives the Unix
+  time at which it started. TEF entries hold no data: ASC shows them as Tx
+  frames without data bytes, candump leaves them out.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../mcp2517fd_capture.h"
+
+static void candump_write(FILE *out, const char *ifname, double t, const MCP2517FD_CAPTURE_RECORD *r)
+{
+  char id[9];
+
+  snprintf(id, sizeof(id), (r->flags & MCP2517FD_CAPTURE_IDE) ? "%08X" : "%03X", (unsigned) r->id);
+  fprintf(out, "(%.6f) %s %s#", t, ifname, id);
+
+  if (r->flags & MCP2517FD_CAPTURE_FDF) {
+    fprintf(out, "#%X", ((r->flags & MCP2517FD_CAPTURE_BRS) ? 1 : 0) | ((r->flags & MCP2517FD_CAPTURE_ESI) ? 2 : 0));
+  } else if (r->flags & MCP2517FD_CAPTURE_RTR) {
+    fputc('R', out);
+    if (r->dlc) {
+      fprintf(out, "%u", r->dlc);
+    }
+  }
+
+  for (uint8_t i = 0; i < r->len; i++) {
+    fprintf(out, "%02X", r->data[i]);
+  }
+
+  fputc('\n', out);
+}
+
+static void asc_write(FILE *out, unsigned channel, double t, const MCP2517FD_CAPTURE_RECORD *r)
+{
+  char id[10];
+  const char *dir = (r->flags & MCP2517FD_CAPTURE_TX) ? "Tx" : "Rx";
+
+  snprintf(id, sizeof(id), (r->flags & MCP2517FD_CAPTURE_IDE) ? "%Xx" : "%X", (unsigned) r->id);
+
+  if (r->flags & MCP2517FD_CAPTURE_FDF) {
+    unsigned flags = 0x1000 | ((r->flags & MCP2517FD_CAPTURE_BRS) ? 0x2000 : 0) | ((r->flags & MCP2517FD_CAPTURE_ESI) ? 0x4000 : 0);
+
+    fprintf(out, "%11.6f CANFD %3u %s %8s %32s %u %u %x %2u", t, channel, dir, id, "",
+            (r->flags & MCP2517FD_CAPTURE_BRS) ? 1 : 0, (r->flags & MCP2517FD_CAPTURE_ESI) ? 1 : 0,
+            r->dlc, DLC_DataLength[r->dlc]);
+    for (uint8_t i = 0; i < r->len; i++) {
+      fprintf(out, " %02X", r->data[i]);
+    }
+    fprintf(out, " %8u %4u %8x %8x %8x %8x %8x %8x\n", 0, 0, flags, 0, 0, 0, 0, 0);
+  } else {
+    fprintf(out, "%11.6f %u  %-15s %s   %c %u", t, channel, id, dir, (r->flags & MCP2517FD_CAPTURE_RTR) ? 'r' : 'd', r->dlc);
+    for (uint8_t i = 0; i < r->len; i++) {
+      fprintf(out, " %02X", r->data[i]);
+    }
+    fputc('\n', out);
+  }
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-a] [-i ifname] [-c channel] [-o unix_start] log|-\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *ifname = "can0";
+  unsigned channel = 1;
+  double offset = 0;
+  bool asc = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ai:c:o:h")) != -1) {
+    switch (opt) {
+      case 'a': asc = true; break;
+      case 'i': ifname = optarg; break;
+      case 'c': channel = strtoul(optarg, NULL, 0); break;
+      case 'o': offset = strtod(optarg, NULL); break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  FILE *in = strcmp(argv[optind], "-") ? fopen(argv[optind], "rb") : stdin;
+
+  if (in == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  uint8_t hdr[MCP2517FD_CAPTURE_HEADER_SIZE];
+  uint32_t tick_ps;
+
+  if ((fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr)) || !(tick_ps = mcp2517fd_capture::HeaderParse(hdr))) {
+    fprintf(stderr, "%s: not an mcp2517fd capture log\n", argv[optind]);
+    return 1;
+  }
+
+  if (asc) {
+    time_t now = time(NULL);
+    char date[64];
+
+    strftime(date, sizeof(date), "%a %b %d %I:%M:%S %p %Y", localtime(&now));
+    printf("date %s\nbase hex  timestamps absolute\nno internal events logged\nBegin Triggerblock %s\n", date, date);
+    printf("%11.6f Start of measurement\n", 0.0);
+  }
+
+  uint8_t rec[256];
+  uint64_t ticks = 0;
+  unsigned long frames = 0;
+  unsigned long skipped = 0;
+  int status = 0;
+
+  while (fread(rec, 1, 1, in) == 1) {
+    MCP2517FD_CAPTURE_RECORD r;
+
+    if ((fread(&rec[1], 1, rec[0], in) != rec[0]) || !mcp2517fd_capture::RecordParse(rec, &ticks, &r)) {
+      fprintf(stderr, "truncated or malformed record after %lu frames\n", frames);
+      status = 1;
+      break;
+    }
+
+    double t = offset + (double) r.ticks * tick_ps * 1e-12;
+
+    if (asc) {
+      asc_write(stdout, channel, t, &r);
+    } else if (r.flags & MCP2517FD_CAPTURE_TX) {
+      skipped++;
+      continue;
+    } else {
+      candump_write(stdout, ifname, t, &r);
+    }
+
+    frames++;
+  }
+
+  if (asc) {
+    printf("End TriggerBlock\n");
+  }
+
+  if (skipped) {
+    fprintf(stderr, "%lu TEF entries without data left out\n", skipped);
+  }
+
+  return status;
+}
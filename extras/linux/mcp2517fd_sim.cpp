@@ -0,0 +1,1139 @@
+/*
+  mcp2517fd_sim.cpp - Register level model of the MCP2517FD behind an SPI transport
+*/
+#include <string.h>
+#include <time.h>
+
+#include "mcp2517fd_sim.h"
+
+#define SIM_OPMOD(m)    ((m)[cREGADDR_CiCON + 2] >> 5)
+#define SIM_REG_END     0x2F0   // end of the filter objects
+
+static const uint8_t payload_size[8] = {8, 12, 16, 20, 24, 32, 48, 64};
+
+static uint64_t monotonic_ns(void *context)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint16_t crc16_update(uint16_t crc, uint8_t d)
+{
+  return (crc << 8) ^ crc16_table[(uint8_t) (crc >> 8) ^ d];
+}
+
+mcp2517fd_sim::mcp2517fd_sim()
+{
+  pthread_mutex_init(&lock, NULL);
+
+  clock = monotonic_ns;
+  clock_context = NULL;
+  crc_errors = 0;
+  phase = SIM_IGNORE;
+
+  PowerOnReset();
+}
+
+mcp2517fd_sim::~mcp2517fd_sim()
+{
+  pthread_mutex_destroy(&lock);
+}
+
+void mcp2517fd_sim::ClockSet(mcp2517fd_sim_clock c, void *context)
+{
+  pthread_mutex_lock(&lock);
+
+  TimeBaseRefresh();
+  clock = c;
+  clock_context = context;
+  tbc_epoch = Reg(cREGADDR_CiTBC);
+  tbc_epoch_ns = clock(clock_context);
+
+  pthread_mutex_unlock(&lock);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Helpers
+uint32_t mcp2517fd_sim::Reg(uint16_t a)
+{
+  uint32_t v;
+
+  memcpy(&v, &mem[a], 4);
+
+  return v;
+}
+
+void mcp2517fd_sim::RegSet(uint16_t a, uint32_t v)
+{
+  memcpy(&mem[a], &v, 4);
+}
+
+bool mcp2517fd_sim::IsTx(uint8_t m)
+{
+  if (m == 0) {
+    return (Reg(cREGADDR_CiCON) >> 20) & 1;   // TXQEN
+  }
+
+  return mem[cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET] & 0x80;   // TXEN
+}
+
+uint32_t mcp2517fd_sim::MsgId(uint32_t word0, uint8_t ide)
+{
+  if (ide) {
+    return ((word0 & 0x7FF) << 18) | ((word0 >> 11) & 0x3FFFF);
+  }
+
+  return word0 & 0x7FF;
+}
+
+uint32_t mcp2517fd_sim::MsgWord0(uint32_t id, uint8_t ide)
+{
+  if (ide) {
+    return ((id >> 18) & 0x7FF) | ((id & 0x3FFFF) << 11);
+  }
+
+  return id & 0x7FF;
+}
+
+void mcp2517fd_sim::FifoReset(SIM_FIFO *f)
+{
+  f->head = 0;
+  f->tail = 0;
+  f->count = 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Reset and Layout
+void mcp2517fd_sim::PowerOnReset()
+{
+  memset(mem, 0, sizeof(mem));
+
+  for (uint8_t i = 0; i < N_CAN_CTRL_REGS; i++) {
+    RegSet(i * 4, canControlResetValues[i]);
+  }
+
+  for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+    // FRESET reads back as done
+    RegSet(cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET, canFifoResetValues[0] & ~0x400);
+  }
+
+  RegSet(cREGADDR_CiTEFCON, 0);
+
+  for (uint8_t i = 0; i < N_MCP2517_CTRL_REGS; i++) {
+    RegSet(cREGADDR_OSC + i * 4, mcp2517ControlResetValues[i]);
+  }
+
+  memset(fifo, 0, sizeof(fifo));
+  memset(&tef, 0, sizeof(tef));
+  tec = 0;
+  rec = 0;
+
+  tbc_epoch = 0;
+  tbc_epoch_ns = clock(clock_context);
+
+  Update();
+}
+
+void mcp2517fd_sim::Layout()
+{
+  uint32_t con = Reg(cREGADDR_CiCON);
+  uint16_t a = 0;
+
+  // Objects that do not fit into RAM stay unallocated
+  uint32_t tefcon = Reg(cREGADDR_CiTEFCON);
+
+  tef.base = a;
+  tef.depth = 0;
+  tef.obj_size = 8 + ((tefcon & 0x20) ? 4 : 0);
+  if ((con >> 19) & 1) {
+    uint8_t depth = ((tefcon >> 24) & 0x1F) + 1;
+
+    if (a + depth * tef.obj_size <= cRAM_SIZE) {
+      tef.depth = depth;
+      a += depth * tef.obj_size;
+    }
+  }
+  FifoReset(&tef);
+
+  for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+    SIM_FIFO *f = &fifo[m];
+    uint32_t fifocon = Reg(cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET);
+    uint8_t depth = ((fifocon >> 24) & 0x1F) + 1;
+
+    f->base = a;
+    f->depth = 0;
+    f->obj_size = 8 + payload_size[fifocon >> 29];
+    FifoReset(f);
+
+    if ((m == 0) && !((con >> 20) & 1)) {
+      continue;   // TXQ disabled
+    }
+
+    if (!IsTx(m) && (fifocon & 0x20)) {
+      f->obj_size += 4;   // RX time stamp
+    }
+
+    if (a + depth * f->obj_size <= cRAM_SIZE) {
+      f->depth = depth;
+      a += depth * f->obj_size;
+    }
+  }
+}
+
+void mcp2517fd_sim::ModeRequest(uint8_t mode)
+{
+  uint8_t cur = SIM_OPMOD(mem);
+
+  if (mode == cur) {
+    return;
+  }
+
+  if (mode == CAN_CONFIGURATION_MODE) {
+    // FIFOs, TEF and error counters are reset in configuration mode
+    for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+      FifoReset(&fifo[m]);
+      mem[cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET + 1] &= ~0x02;
+      mem[cREGADDR_CiFIFOSTA + m * CiFIFO_OFFSET] = 0;
+    }
+    FifoReset(&tef);
+    mem[cREGADDR_CiTEFSTA] = 0;
+    ErrorCountersSet(0, 0);
+  } else if (cur == CAN_CONFIGURATION_MODE) {
+    Layout();
+  }
+
+  mem[cREGADDR_CiCON + 2] = (mem[cREGADDR_CiCON + 2] & 0x1F) | (mode << 5);
+  mem[cREGADDR_CiINT] |= 0x08;   // MODIF
+}
+
+void mcp2517fd_sim::ErrorCountersSet(int t, int r)
+{
+  tec = (t < 0) ? 0 : ((t > 256) ? 256 : t);
+  rec = (r < 0) ? 0 : ((r > 255) ? 255 : r);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Time Base
+void mcp2517fd_sim::TimeBaseRefresh()
+{
+  uint32_t tscon = Reg(cREGADDR_CiTSCON);
+  uint64_t now = clock(clock_context);
+
+  if (!(tscon & (1UL << 16))) {
+    tbc_epoch = Reg(cREGADDR_CiTBC);
+    tbc_epoch_ns = now;
+    return;
+  }
+
+  uint64_t ticks = (now - tbc_epoch_ns) * (MCP2517FD_SIM_SYSCLK / 1000000UL) / 1000 / ((tscon & 0x3FF) + 1);
+  uint32_t old = Reg(cREGADDR_CiTBC);
+  uint32_t tbc = tbc_epoch + (uint32_t) ticks;
+
+  if (tbc < old) {
+    mem[cREGADDR_CiINT] |= 0x04;   // TBCIF
+  }
+
+  RegSet(cREGADDR_CiTBC, tbc);
+}
+
+uint32_t mcp2517fd_sim::TimeStamp()
+{
+  TimeBaseRefresh();
+
+  return Reg(cREGADDR_CiTBC);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Derived Registers
+void mcp2517fd_sim::Update()
+{
+  uint32_t rxif = 0, txif = 0, rxovif = 0, txatif = 0, txreq = 0;
+  uint8_t rxcode = CAN_RXCODE_NO_INT, txcode = CAN_TXCODE_NO_INT;
+
+  for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+    SIM_FIFO *f = &fifo[m];
+    uint16_t a = cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET;
+    uint32_t con = Reg(a);
+    uint32_t sta = Reg(a + 4) & 0xF8;   // sticky event flags
+    uint32_t ua;
+
+    if (m == 0) {
+      con |= 0x80;   // TXQ always reads as transmit
+    }
+
+    if (IsTx(m)) {
+      bool nf = f->count < f->depth;
+      bool he = f->count <= f->depth / 2;
+      bool em = f->count == 0;
+
+      if (em) {
+        con &= ~(1UL << 9);   // TXREQ clears when all objects are sent
+      }
+
+      sta |= (nf ? 0x01 : 0) | (he ? 0x02 : 0) | (em ? 0x04 : 0);
+      sta |= (uint32_t) f->tail << 8;
+      ua = f->base + f->head * f->obj_size;
+
+      if (((con & 0x01) && nf) || ((con & 0x02) && he) || ((con & 0x04) && em)) {
+        txif |= 1UL << m;
+      }
+
+      if (con & (1UL << 9)) {
+        txreq |= 1UL << m;
+      }
+    } else {
+      bool ne = f->count > 0;
+      bool hf = ne && (f->count >= f->depth / 2);
+      bool fu = ne && (f->count == f->depth);
+
+      sta |= (ne ? 0x01 : 0) | (hf ? 0x02 : 0) | (fu ? 0x04 : 0);
+      sta |= (uint32_t) f->head << 8;
+      ua = f->base + f->tail * f->obj_size;
+
+      if (((con & 0x01) && ne) || ((con & 0x02) && hf) || ((con & 0x04) && fu)) {
+        rxif |= 1UL << m;
+      }
+    }
+
+    if (sta & 0x08) {
+      rxovif |= 1UL << m;
+    }
+
+    if (sta & 0x10) {
+      txatif |= 1UL << m;
+    }
+
+    RegSet(a, con);
+    RegSet(a + 4, sta);
+    RegSet(a + 8, ua);
+  }
+
+  RegSet(cREGADDR_CiRXIF, rxif);
+  RegSet(cREGADDR_CiTXIF, txif);
+  RegSet(cREGADDR_CiRXOVIF, rxovif);
+  RegSet(cREGADDR_CiTXATIF, txatif);
+  RegSet(cREGADDR_CiTXREQ, txreq);
+
+  // TEF
+  uint32_t tefcon = Reg(cREGADDR_CiTEFCON);
+  uint32_t tefsta = Reg(cREGADDR_CiTEFSTA) & 0x08;
+  bool tne = tef.count > 0;
+  bool thf = tne && (tef.count >= tef.depth / 2);
+  bool tfu = tne && (tef.count == tef.depth);
+
+  tefsta |= (tne ? 0x01 : 0) | (thf ? 0x02 : 0) | (tfu ? 0x04 : 0);
+  RegSet(cREGADDR_CiTEFSTA, tefsta);
+  RegSet(cREGADDR_CiTEFUA, tef.base + tef.tail * tef.obj_size);
+
+  bool tefif = ((tefcon & 0x01) && tne) || ((tefcon & 0x02) && thf) || ((tefcon & 0x04) && tfu) || ((tefcon & 0x08) && (tefsta & 0x08));
+
+  // Error counters
+  uint32_t trec = rec | ((tec > 255 ? 255 : tec) << 8);
+
+  if ((tec >= 96) || (rec >= 96)) trec |= 1UL << 16;
+  if (rec >= 96) trec |= 1UL << 17;
+  if (tec >= 96) trec |= 1UL << 18;
+  if (rec >= 128) trec |= 1UL << 19;
+  if (tec >= 128) trec |= 1UL << 20;
+  if (tec > 255) trec |= 1UL << 21;
+  RegSet(cREGADDR_CiTREC, trec);
+
+  // Module interrupt flags: derived ones are recomputed, sticky ones kept
+  uint32_t intr = Reg(cREGADDR_CiINT);
+  uint32_t flags = intr & 0xF00C;
+
+  if (txif) flags |= 0x0001;
+  if (rxif) flags |= 0x0002;
+  if (tefif) flags |= 0x0010;
+  if (Reg(cREGADDR_ECCSTA) & 0x06) flags |= 0x0100;
+  if (mem[cREGADDR_CRC + 2] & 0x03) flags |= 0x0200;
+  if (txatif) flags |= 0x0400;
+  if (rxovif) flags |= 0x0800;
+
+  intr = (intr & 0xFFFF0000) | flags;
+  RegSet(cREGADDR_CiINT, intr);
+
+  // Vector register
+  uint32_t pending = flags & (intr >> 16);
+  uint8_t icode = CAN_ICODE_NO_INT;
+
+  for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+    if ((rxcode == CAN_RXCODE_NO_INT) && (rxif & (1UL << m))) rxcode = m;
+    if ((txcode == CAN_TXCODE_NO_INT) && (txif & (1UL << m))) txcode = m;
+  }
+
+  if ((pending & 0x0002) && (rxcode != CAN_RXCODE_NO_INT)) {
+    icode = rxcode;
+  } else if ((pending & 0x0001) && (txcode != CAN_TXCODE_NO_INT)) {
+    icode = txcode;
+  } else if (pending & 0x2000) {
+    icode = CAN_ICODE_CERRIF;
+  } else if (pending & 0x4000) {
+    icode = CAN_ICODE_WAKIF;
+  } else if (pending & 0x0800) {
+    icode = CAN_ICODE_RXOVIF;
+  } else if (pending & 0x1000) {
+    icode = CAN_ICODE_ADDRERR_SERRIF;
+  } else if (pending & 0x0004) {
+    icode = CAN_ICODE_TBCIF;
+  } else if (pending & 0x0008) {
+    icode = CAN_ICODE_MODIF;
+  } else if (pending & 0x8000) {
+    icode = CAN_ICODE_IVMIF;
+  } else if (pending & 0x0010) {
+    icode = CAN_ICODE_TEFIF;
+  } else if (pending & 0x0400) {
+    icode = CAN_ICODE_TXATIF;
+  }
+
+  mem[cREGADDR_CiVEC] = icode;
+  mem[cREGADDR_CiVEC + 2] = txcode;
+  mem[cREGADDR_CiVEC + 3] = rxcode;
+
+  // GPIO levels of output pins follow their latches
+  uint32_t iocon = Reg(cREGADDR_IOCON);
+  uint8_t gpio = mem[cREGADDR_IOCON + 2] & ~0x03;
+
+  if (!(iocon & 0x01)) gpio |= (iocon >> 8) & 0x01;
+  if (!(iocon & 0x02)) gpio |= (iocon >> 8) & 0x02;
+  mem[cREGADDR_IOCON + 2] = gpio;
+
+  // Oscillator status
+  uint8_t osc = mem[cREGADDR_OSC];
+
+  mem[cREGADDR_OSC + 1] = ((osc & 0x01) ? 0x01 : 0) | ((osc & 0x04) ? 0 : 0x04) | 0x10;
+}
+
+uint8_t mcp2517fd_sim::InterruptLevel()
+{
+  uint8_t level;
+
+  pthread_mutex_lock(&lock);
+
+  // INT1 in interrupt mode signals RXIF
+  if (mem[cREGADDR_IOCON + 3] & 0x02) {
+    level = (mem[cREGADDR_IOCON + 2] >> 1) & 1;
+  } else {
+    level = (mem[cREGADDR_CiINT] & 0x02) ? 0 : 1;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return level;
+}
+
+uint8_t mcp2517fd_sim::MainInterruptLevel()
+{
+  uint32_t intr;
+
+  pthread_mutex_lock(&lock);
+  intr = Reg(cREGADDR_CiINT);
+  pthread_mutex_unlock(&lock);
+
+  return (intr & (intr >> 16) & 0xFFFF) ? 0 : 1;
+}
+
+CAN_OPERATION_MODE mcp2517fd_sim::Mode()
+{
+  uint8_t mode;
+
+  pthread_mutex_lock(&lock);
+  mode = SIM_OPMOD(mem);
+  pthread_mutex_unlock(&lock);
+
+  return (CAN_OPERATION_MODE) mode;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Register Writes
+uint8_t mcp2517fd_sim::MemRead(uint16_t a)
+{
+  a &= 0xFFF;
+
+  return mem[a];
+}
+
+void mcp2517fd_sim::MemWrite(uint16_t a, uint8_t d)
+{
+  a &= 0xFFF;
+
+  if ((a >= cRAMADDR_START) && (a < cRAMADDR_END)) {
+    mem[a] = d;
+    return;
+  }
+
+  RegWrite(a, d);
+}
+
+void mcp2517fd_sim::FifoConWrite(uint8_t m, uint8_t byte, uint8_t d)
+{
+  uint16_t a = cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET + byte;
+  bool cfg = (SIM_OPMOD(mem) == CAN_CONFIGURATION_MODE);
+  SIM_FIFO *f = &fifo[m];
+
+  switch (byte) {
+    case 0:
+      if (m == 0) {
+        mem[a] = (d & 0x15) | 0x80;
+      } else if (cfg) {
+        mem[a] = d;
+      } else {
+        mem[a] = (mem[a] & 0xE0) | (d & 0x1F);
+      }
+      break;
+
+    case 1:
+      if (d & 0x04) {
+        // FRESET
+        FifoReset(f);
+        mem[a] &= ~0x02;
+        break;
+      }
+
+      if (cfg) {
+        break;
+      }
+
+      if (d & 0x01) {
+        // UINC
+        if (IsTx(m)) {
+          if (f->count < f->depth) {
+            f->head = (f->head + 1) % f->depth;
+            f->count++;
+          }
+        } else if (f->count) {
+          f->tail = (f->tail + 1) % f->depth;
+          f->count--;
+        }
+      }
+
+      if (IsTx(m)) {
+        if (d & 0x02) {
+          mem[a] |= 0x02;
+        } else if (mem[a] & 0x02) {
+          // Clearing a set TXREQ aborts the FIFO
+          mem[a] &= ~0x02;
+          mem[a + 4] |= 0x80;
+        }
+      }
+      break;
+
+    case 2:
+      mem[a] = d & 0x7F;
+      break;
+
+    case 3:
+      if (cfg) {
+        mem[a] = d;
+      }
+      break;
+  }
+}
+
+void mcp2517fd_sim::RegWrite(uint16_t a, uint8_t d)
+{
+  bool cfg = (SIM_OPMOD(mem) == CAN_CONFIGURATION_MODE);
+  uint8_t byte = a & 3;
+
+  if (a < 0x004) {
+    switch (byte) {
+      case 0:
+        if (cfg) mem[a] = d;
+        break;
+      case 1:
+        if (cfg) mem[a] = (mem[a] & 0x08) | (d & ~0x08);
+        break;
+      case 2:
+        if (cfg) mem[a] = (mem[a] & 0xE0) | (d & 0x1F);
+        break;
+      case 3:
+        mem[a] = d & ~0x08;
+        if (d & 0x08) {
+          // ABAT
+          for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+            uint16_t c = cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET;
+
+            if (mem[c + 1] & 0x02) {
+              mem[c + 1] &= ~0x02;
+              mem[c + 4] |= 0x80;
+            }
+          }
+        }
+        ModeRequest(d & 0x07);
+        break;
+    }
+  } else if (a < cREGADDR_CiTBC) {
+    if (cfg) mem[a] = d;
+  } else if (a < cREGADDR_CiTSCON) {
+    TimeBaseRefresh();
+    mem[a] = d;
+    tbc_epoch = Reg(cREGADDR_CiTBC);
+    tbc_epoch_ns = clock(clock_context);
+  } else if (a < cREGADDR_CiVEC) {
+    TimeBaseRefresh();
+    mem[a] = d;
+    tbc_epoch = Reg(cREGADDR_CiTBC);
+    tbc_epoch_ns = clock(clock_context);
+  } else if (a < cREGADDR_CiINT) {
+    // CiVEC is read only
+  } else if (a < cREGADDR_CiRXIF) {
+    static const uint8_t clearable[2] = {0x0C, 0xF0};
+
+    if (byte < 2) {
+      mem[a] &= d | ~clearable[byte];
+    } else {
+      mem[a] = d;
+    }
+  } else if (a < cREGADDR_CiTXREQ) {
+    // Event summaries are read only
+  } else if (a < cREGADDR_CiTREC) {
+    for (uint8_t b = 0; b < 8; b++) {
+      uint8_t m = byte * 8 + b;
+
+      if ((d & (1 << b)) && !cfg && IsTx(m)) {
+        mem[cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET + 1] |= 0x02;
+      }
+    }
+  } else if (a < cREGADDR_CiBDIAG0) {
+    // CiTREC is read only
+  } else if (a < cREGADDR_CiTEFCON) {
+    mem[a] = d;
+  } else if (a < cREGADDR_CiTEFSTA) {
+    switch (byte) {
+      case 0:
+        mem[a] = cfg ? (d & 0x2F) : ((mem[a] & 0x20) | (d & 0x0F));
+        break;
+      case 1:
+        if (d & 0x04) {
+          FifoReset(&tef);
+        } else if ((d & 0x01) && tef.count) {
+          tef.tail = (tef.tail + 1) % tef.depth;
+          tef.count--;
+        }
+        break;
+      case 3:
+        if (cfg) mem[a] = d & 0x1F;
+        break;
+    }
+  } else if (a < cREGADDR_CiTEFUA) {
+    if (byte == 0) {
+      mem[a] &= d | ~0x08;
+    }
+  } else if (a < cREGADDR_CiFIFOCON) {
+    // CiTEFUA and CiFIFOBA are read only
+  } else if (a < cREGADDR_CiFLTCON) {
+    uint8_t m = (a - cREGADDR_CiFIFOCON) / CiFIFO_OFFSET;
+    uint8_t r = (a - cREGADDR_CiFIFOCON) % CiFIFO_OFFSET;
+
+    if (r < 4) {
+      FifoConWrite(m, r, d);
+    } else if (r == 4) {
+      mem[a] &= d | 0x07;
+    }
+  } else if (a < SIM_REG_END) {
+    // Filter control, objects and masks
+    mem[a] = d;
+  } else if ((a >= cREGADDR_OSC) && (a < cREGADDR_IOCON)) {
+    if (byte == 0) {
+      mem[a] = d & 0x7D;
+
+      // Clearing OSCDIS wakes the device into configuration mode
+      if (!(d & 0x04) && (SIM_OPMOD(mem) == CAN_SLEEP_MODE)) {
+        ModeRequest(CAN_CONFIGURATION_MODE);
+      }
+    }
+  } else if ((a >= cREGADDR_IOCON) && (a < cREGADDR_CRC)) {
+    if (byte != 2) {
+      mem[a] = d;
+    }
+  } else if ((a >= cREGADDR_CRC) && (a < cREGADDR_ECCCON)) {
+    if (byte == 2) {
+      mem[a] &= d | ~0x03;
+    } else if (byte == 3) {
+      mem[a] = d;
+    }
+  } else if ((a >= cREGADDR_ECCCON) && (a < cREGADDR_ECCSTA)) {
+    mem[a] = d;
+  } else if ((a >= cREGADDR_ECCSTA) && (a < cREGADDR_ECCSTA + 4)) {
+    if (byte == 0) {
+      mem[a] &= d | ~0x06;
+    }
+  }
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: SPI Side
+void mcp2517fd_sim::Select()
+{
+  pthread_mutex_lock(&lock);
+
+  TimeBaseRefresh();
+  Update();
+
+  phase = SIM_CMD;
+  count = 0;
+}
+
+void mcp2517fd_sim::Deselect()
+{
+  if ((phase == SIM_DATA) && ((cmd == cINSTRUCTION_WRITE_CRC) || (cmd == cINSTRUCTION_WRITE_SAFE))) {
+    // Data is only committed when the trailing CRC matches
+    uint16_t n = (cmd == cINSTRUCTION_WRITE_CRC) ? data_len : (count >= 2 ? count - 2 : 0);
+    uint16_t c = CRCBASE;
+
+    for (uint8_t i = 0; i < ((cmd == cINSTRUCTION_WRITE_CRC) ? 3 : 2); i++) {
+      c = crc16_update(c, header[i]);
+    }
+
+    for (uint16_t i = 0; i < n; i++) {
+      c = crc16_update(c, wbuf[i]);
+    }
+
+    if ((count == n + 2) && (n > 0) && (wbuf[n] == (c >> 8)) && (wbuf[n + 1] == (c & 0xFF))) {
+      for (uint16_t i = 0; i < n; i++) {
+        MemWrite(addr + i, wbuf[i]);
+      }
+    } else {
+      mem[cREGADDR_CRC + 2] |= (count == n + 2) ? 0x01 : 0x02;   // CRCERRIF / FERRIF
+      RegSet(cREGADDR_CRC, (Reg(cREGADDR_CRC) & 0xFFFF0000) | c);
+      crc_errors++;
+    }
+  }
+
+  phase = SIM_IGNORE;
+  Update();
+
+  pthread_mutex_unlock(&lock);
+}
+
+void mcp2517fd_sim::Transfer(uint8_t *buf, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    uint8_t in = buf[i];
+    uint8_t out = 0;
+
+    switch (phase) {
+      case SIM_CMD:
+        cmd = in >> 4;
+        addr = (in & 0x0F) << 8;
+        header[0] = in;
+        phase = SIM_ADDR;
+        break;
+
+      case SIM_ADDR:
+        addr |= in;
+        header[1] = in;
+        count = 0;
+
+        if (cmd == cINSTRUCTION_RESET) {
+          PowerOnReset();
+          phase = SIM_IGNORE;
+        } else if ((cmd == cINSTRUCTION_READ_CRC) || (cmd == cINSTRUCTION_WRITE_CRC)) {
+          phase = SIM_LEN;
+        } else if ((cmd == cINSTRUCTION_READ) || (cmd == cINSTRUCTION_WRITE) || (cmd == cINSTRUCTION_WRITE_SAFE)) {
+          phase = SIM_DATA;
+        } else {
+          phase = SIM_IGNORE;
+        }
+        break;
+
+      case SIM_LEN:
+        header[2] = in;
+        // The length counts words when addressing RAM
+        data_len = ((addr >= cRAMADDR_START) && (addr < cRAMADDR_END)) ? in * 4 : in;
+        crc = crc16_update(crc16_update(crc16_update(CRCBASE, header[0]), header[1]), header[2]);
+        phase = SIM_DATA;
+        break;
+
+      case SIM_DATA:
+        switch (cmd) {
+          case cINSTRUCTION_READ:
+            out = MemRead(addr + count);
+            break;
+
+          case cINSTRUCTION_WRITE:
+            MemWrite(addr + count, in);
+            if (((addr + count) & 0xFFF) < cRAMADDR_START) {
+              Update();
+            }
+            break;
+
+          case cINSTRUCTION_READ_CRC:
+            if (count < data_len) {
+              out = MemRead(addr + count);
+              crc = crc16_update(crc, out);
+            } else if (count == data_len) {
+              out = crc >> 8;
+            } else if (count == data_len + 1) {
+              out = crc & 0xFF;
+            }
+            break;
+
+          default:
+            if (count < MCP2517FD_SIM_WBUF) {
+              wbuf[count] = in;
+            }
+            break;
+        }
+        count++;
+        break;
+
+      default:
+        break;
+    }
+
+    buf[i] = out;
+  }
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: CAN Side
+int8_t mcp2517fd_sim::TxPeek(MCP2517FD_SIM_FRAME *frame)
+{
+  int8_t best = -1;
+  uint8_t best_pri = 0;
+
+  pthread_mutex_lock(&lock);
+
+  uint8_t mode = SIM_OPMOD(mem);
+
+  if ((mode == CAN_CONFIGURATION_MODE) || (mode == CAN_SLEEP_MODE) || (mode == CAN_LISTEN_ONLY_MODE) ||
+      (mode == CAN_RESTRICTED_MODE) || (tec > 255)) {
+    pthread_mutex_unlock(&lock);
+    return -1;
+  }
+
+  for (uint8_t m = 0; m < CAN_FIFO_TOTAL_CHANNELS; m++) {
+    uint16_t a = cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET;
+    uint8_t pri = mem[a + 2] & 0x1F;
+
+    if (!IsTx(m) || !(mem[a + 1] & 0x02) || !fifo[m].count) {
+      continue;
+    }
+
+    if ((best < 0) || (pri > best_pri)) {
+      best = m;
+      best_pri = pri;
+    }
+  }
+
+  if (best == 0) {
+    TxqArbitrate();
+  }
+
+  if ((best >= 0) && frame) {
+    SIM_FIFO *f = &fifo[best];
+    uint8_t *obj = &mem[cRAMADDR_START + f->base + f->tail * f->obj_size];
+    uint32_t w0, w1;
+
+    memcpy(&w0, obj, 4);
+    memcpy(&w1, obj + 4, 4);
+
+    frame->ide = (w1 >> 4) & 1;
+    frame->id = MsgId(w0, frame->ide);
+    frame->dlc = w1 & 0x0F;
+    frame->rtr = (w1 >> 5) & 1;
+    frame->brs = (w1 >> 6) & 1;
+    frame->fdf = (w1 >> 7) & 1;
+
+    // Outside gateway mode ESI reflects the error passive state of the node
+    if ((Reg(cREGADDR_CiCON) >> 17) & 1) {
+      frame->esi = (w1 >> 8) & 1;
+    } else {
+      frame->esi = (tec >= 128) ? 1 : 0;
+    }
+
+    if (mode == CAN_CLASSIC_MODE) {
+      frame->fdf = 0;
+      frame->brs = 0;
+    }
+
+    memset(frame->data, 0, sizeof(frame->data));
+    memcpy(frame->data, obj + 8, f->obj_size - 8);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return best;
+}
+
+void mcp2517fd_sim::TxqArbitrate()
+{
+  SIM_FIFO *f = &fifo[0];
+  uint8_t best = f->tail;
+  uint32_t best_key = 0xFFFFFFFFUL;
+
+  // The TXQ sends the object with the lowest arbitration field first: SID,
+  // then standard before extended, then EID
+  for (uint8_t i = 0; i < f->count; i++) {
+    uint8_t slot = (f->tail + i) % f->depth;
+    uint8_t *obj = &mem[cRAMADDR_START + f->base + slot * f->obj_size];
+    uint32_t w0, w1;
+
+    memcpy(&w0, obj, 4);
+    memcpy(&w1, obj + 4, 4);
+
+    uint32_t key = (w0 & 0x7FF) << 19;
+
+    if ((w1 >> 4) & 1) {
+      key |= 0x40000UL | ((w0 >> 11) & 0x3FFFF);
+    }
+
+    if (key < best_key) {
+      best = slot;
+      best_key = key;
+    }
+  }
+
+  // Move the winner to the tail; the driver only ever writes at the head
+  if (best != f->tail) {
+    uint8_t tmp[8 + 64];
+    uint8_t *a = &mem[cRAMADDR_START + f->base + f->tail * f->obj_size];
+    uint8_t *b = &mem[cRAMADDR_START + f->base + best * f->obj_size];
+
+    memcpy(tmp, a, f->obj_size);
+    memcpy(a, b, f->obj_size);
+    memcpy(b, tmp, f->obj_size);
+  }
+}
+
+void mcp2517fd_sim::TefPush(uint32_t id, uint32_t ctrl)
+{
+  if (!tef.depth) {
+    return;
+  }
+
+  if (tef.count == tef.depth) {
+    mem[cREGADDR_CiTEFSTA] |= 0x08;   // TEFOVIF
+    return;
+  }
+
+  uint8_t *obj = &mem[cRAMADDR_START + tef.base + tef.head * tef.obj_size];
+
+  memcpy(obj, &id, 4);
+  memcpy(obj + 4, &ctrl, 4);
+
+  if (tef.obj_size > 8) {
+    uint32_t ts = TimeStamp();
+
+    memcpy(obj + 8, &ts, 4);
+  }
+
+  tef.head = (tef.head + 1) % tef.depth;
+  tef.count++;
+}
+
+void mcp2517fd_sim::TxComplete(uint8_t m)
+{
+  pthread_mutex_lock(&lock);
+
+  SIM_FIFO *f = &fifo[m];
+
+  if ((m < CAN_FIFO_TOTAL_CHANNELS) && f->count) {
+    uint8_t *obj = &mem[cRAMADDR_START + f->base + f->tail * f->obj_size];
+    uint32_t w0, w1;
+
+    memcpy(&w0, obj, 4);
+    memcpy(&w1, obj + 4, 4);
+
+    if ((Reg(cREGADDR_CiCON) >> 19) & 1) {
+      TefPush(w0, w1);
+    }
+
+    f->tail = (f->tail + 1) % f->depth;
+    f->count--;
+
+    // Error free message counter and TEC decrement
+    uint32_t bdiag1 = Reg(cREGADDR_CiBDIAG1);
+
+    RegSet(cREGADDR_CiBDIAG1, (bdiag1 & 0xFFFF0000) | ((bdiag1 + 1) & 0xFFFF));
+    ErrorCountersSet(tec - 1, rec);
+  }
+
+  Update();
+
+  pthread_mutex_unlock(&lock);
+}
+
+void mcp2517fd_sim::TxArbitrationLost(uint8_t m)
+{
+  pthread_mutex_lock(&lock);
+
+  if (m < CAN_FIFO_TOTAL_CHANNELS) {
+    mem[cREGADDR_CiFIFOSTA + m * CiFIFO_OFFSET] |= 0x40;   // TXLARB
+  }
+
+  Update();
+
+  pthread_mutex_unlock(&lock);
+}
+
+uint8_t mcp2517fd_sim::Receive(const MCP2517FD_SIM_FRAME *frame)
+{
+  uint8_t stored = 0;
+
+  pthread_mutex_lock(&lock);
+
+  uint8_t mode = SIM_OPMOD(mem);
+
+  if (mode == CAN_SLEEP_MODE) {
+    // Bus activity wakes the device
+    mem[cREGADDR_CiINT + 1] |= 0x40;   // WAKIF
+    ModeRequest(CAN_CONFIGURATION_MODE);
+    Update();
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+
+  if ((mode == CAN_CONFIGURATION_MODE) || ((mode == CAN_CLASSIC_MODE) && frame->fdf)) {
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+
+  uint32_t bdiag1 = Reg(cREGADDR_CiBDIAG1);
+
+  RegSet(cREGADDR_CiBDIAG1, (bdiag1 & 0xFFFF0000) | ((bdiag1 + 1) & 0xFFFF));
+  ErrorCountersSet(tec, rec - 1);
+
+  // Acceptance filtering: first enabled matching filter wins
+  uint32_t w0 = MsgWord0(frame->id, frame->ide);
+
+  for (uint8_t flt = 0; flt < CAN_FILTER_TOTAL; flt++) {
+    uint8_t fltcon = mem[cREGADDR_CiFLTCON + flt];
+
+    if (!(fltcon & 0x80)) {
+      continue;
+    }
+
+    uint32_t obj = Reg(cREGADDR_CiFLTOBJ + flt * CiFILTER_OFFSET);
+    uint32_t mask = Reg(cREGADDR_CiMASK + flt * CiFILTER_OFFSET);
+
+    if ((w0 ^ obj) & mask & 0x1FFFFFFF) {
+      continue;
+    }
+
+    if ((mask & (1UL << 30)) && (((obj >> 30) & 1) != frame->ide)) {
+      continue;
+    }
+
+    uint8_t m = fltcon & 0x1F;
+    uint16_t c = cREGADDR_CiFIFOCON + m * CiFIFO_OFFSET;
+    SIM_FIFO *f = &fifo[m];
+
+    mem[cREGADDR_CiVEC + 1] = flt;
+
+    if (IsTx(m)) {
+      // Remote request answered by an RTR enabled transmit FIFO
+      if (frame->rtr && (mem[c] & 0x40) && f->count) {
+        mem[c + 1] |= 0x02;
+      }
+      break;
+    }
+
+    if (!f->depth) {
+      break;
+    }
+
+    if (f->count == f->depth) {
+      mem[c + 4] |= 0x08;   // RXOVIF
+      break;
+    }
+
+    uint8_t *o = &mem[cRAMADDR_START + f->base + f->head * f->obj_size];
+    uint8_t payload = f->obj_size - 8;
+    uint32_t w1 = frame->dlc | (frame->ide << 4) | (frame->rtr << 5) | (frame->brs << 6) |
+                  (frame->fdf << 7) | (frame->esi << 8) | ((uint32_t) flt << 11);
+
+    memcpy(o, &w0, 4);
+    memcpy(o + 4, &w1, 4);
+
+    if (mem[c] & 0x20) {
+      uint32_t ts = TimeStamp();
+
+      memcpy(o + 8, &ts, 4);
+      o += 4;
+      payload -= 4;
+    }
+
+    memcpy(o + 8, frame->data, payload);
+
+    f->head = (f->head + 1) % f->depth;
+    f->count++;
+    stored = 1;
+    break;
+  }
+
+  Update();
+
+  pthread_mutex_unlock(&lock);
+
+  return stored;
+}
+
+void mcp2517fd_sim::BusError(MCP2517FD_SIM_ERROR kind, bool transmitter, bool data_phase)
+{
+  static const uint8_t flag_bit[6] = {16, 17, 18, 19, 20, 21};
+
+  pthread_mutex_lock(&lock);
+
+  uint32_t bdiag0 = Reg(cREGADDR_CiBDIAG0);
+  uint32_t bdiag1 = Reg(cREGADDR_CiBDIAG1);
+  uint8_t shift = (data_phase ? 16 : 0) + (transmitter ? 8 : 0);
+  uint8_t cnt = (bdiag0 >> shift) & 0xFF;
+
+  if (cnt < 0xFF) {
+    cnt++;
+  }
+
+  bdiag0 = (bdiag0 & ~(0xFFUL << shift)) | ((uint32_t) cnt << shift);
+  bdiag1 |= 1UL << (flag_bit[kind] + (data_phase ? 8 : 0));
+
+  if (transmitter) {
+    ErrorCountersSet(tec + 8, rec);
+  } else {
+    ErrorCountersSet(tec, rec + 1);
+  }
+
+  if (tec > 255) {
+    bdiag1 |= 1UL << 23;   // TXBOERR
+  }
+
+  RegSet(cREGADDR_CiBDIAG0, bdiag0);
+  RegSet(cREGADDR_CiBDIAG1, bdiag1);
+  mem[cREGADDR_CiINT + 1] |= 0x20;   // CERRIF
+
+  Update();
+
+  pthread_mutex_unlock(&lock);
+}
+
+uint16_t mcp2517fd_sim::Loopback()
+{
+  MCP2517FD_SIM_FRAME frame;
+  uint16_t n = 0;
+  int8_t ch;
+
+  CAN_OPERATION_MODE mode = Mode();
+
+  if ((mode != CAN_INTERNAL_LOOPBACK_MODE) && (mode != CAN_EXTERNAL_LOOPBACK_MODE)) {
+    return 0;
+  }
+
+  while ((ch = TxPeek(&frame)) >= 0) {
+    TxComplete(ch);
+    Receive(&frame);
+    n++;
+  }
+
+  return n;
+}
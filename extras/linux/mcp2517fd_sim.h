@@ -0,0 +1,215 @@
+/*
+  mcp2517fd_sim.h - Register level model of the MCP2517FD behind an SPI transport
+
+  Models the SPI instruction set (including the CRC and SAFE variants), the
+  control registers, message RAM with TEF/TXQ/FIFO layout, filters, time base,
+  interrupt flags/pins and error counters closely enough to run the driver
+  unmodified. The CAN side is driven by the caller through the bus interface.
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_SIM_H
+#define	MCP2517FD_SIM_H
+
+#include <pthread.h>
+
+#include "mcp2517fd_transport.h"
+#include "../../drv_canfdspi_defines.h"
+#include "../../drv_canfdspi_register.h"
+
+#define MCP2517FD_SIM_SYSCLK 40000000UL
+#define MCP2517FD_SIM_WBUF   (255 * 4 + 2)   // longest WRITE_CRC: 255 words + CRC
+
+// *****************************************************************************
+//! CAN frame on the simulated bus
+
+typedef struct {
+  uint32_t id;      // 11 or 29 bit identifier
+  uint8_t ide;
+  uint8_t rtr;
+  uint8_t fdf;
+  uint8_t brs;
+  uint8_t esi;
+  uint8_t dlc;
+  uint8_t data[64];
+} MCP2517FD_SIM_FRAME;
+
+// *****************************************************************************
+//! Bus error kinds for BusError()
+
+typedef enum {
+  MCP2517FD_SIM_BIT0_ERR,
+  MCP2517FD_SIM_BIT1_ERR,
+  MCP2517FD_SIM_ACK_ERR,
+  MCP2517FD_SIM_FORM_ERR,
+  MCP2517FD_SIM_STUFF_ERR,
+  MCP2517FD_SIM_CRC_ERR
+} MCP2517FD_SIM_ERROR;
+
+// *****************************************************************************
+//! Time source in nanoseconds
+
+typedef uint64_t (*mcp2517fd_sim_clock)(void *context);
+
+class mcp2517fd_sim : public mcp2517fd_transport {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: SPI side
+
+    void Select();
+    void Deselect();
+    void Transfer(uint8_t *buf, size_t n);
+
+    // *****************************************************************************
+    //! INT1 pin: RX interrupt, 0 == asserted
+    uint8_t InterruptLevel();
+
+    // *****************************************************************************
+    //! INT pin: any enabled interrupt, 0 == asserted
+    uint8_t MainInterruptLevel();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: CAN side
+
+    // *****************************************************************************
+    //! Current operation mode
+    CAN_OPERATION_MODE Mode();
+
+    // *****************************************************************************
+    //! Next frame the controller would put on the bus
+    /*!
+       Picks the pending transmit FIFO with the highest TXPRI; the TXQ and lower
+       FIFO numbers win ties. Within the TXQ the lowest ID goes first, within a
+       FIFO the oldest object. Returns the FIFO index or -1 if nothing is pending.
+       The frame stays queued until TxComplete().
+    */
+
+    int8_t TxPeek(MCP2517FD_SIM_FRAME *frame);
+
+    // *****************************************************************************
+    //! Frame of FIFO channel was sent and acknowledged
+    /*!
+       Releases the object, writes the TEF entry if StoreInTEF is set and
+       updates the error counters.
+    */
+
+    void TxComplete(uint8_t channel);
+
+    // *****************************************************************************
+    //! Frame of FIFO channel lost arbitration; it stays queued
+    void TxArbitrationLost(uint8_t channel);
+
+    // *****************************************************************************
+    //! Frame seen on the bus
+    /*!
+       Runs acceptance filtering and stores the frame in the linked FIFO, or
+       answers a remote request from an RTR enabled transmit FIFO.
+       Returns 1 if the frame was stored, 0 otherwise.
+    */
+
+    uint8_t Receive(const MCP2517FD_SIM_FRAME *frame);
+
+    // *****************************************************************************
+    //! Inject a bus error
+    /*!
+       transmitter: error detected while this node was sending
+       data_phase: error in the FD data phase
+    */
+
+    void BusError(MCP2517FD_SIM_ERROR kind, bool transmitter, bool data_phase);
+
+    // *****************************************************************************
+    //! Send pending frames in internal or external loopback mode
+    /*!
+       Returns number of frames looped back.
+    */
+
+    uint16_t Loopback();
+
+    // *****************************************************************************
+    //! Replace the time source (default: CLOCK_MONOTONIC)
+    void ClockSet(mcp2517fd_sim_clock clock, void *context = NULL);
+
+    // *****************************************************************************
+    //! SPI CRC errors seen since power up
+    inline uint32_t CrcErrorCount()
+    {
+      return crc_errors;
+    }
+
+    mcp2517fd_sim();
+    ~mcp2517fd_sim();
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private
+
+    typedef struct {
+      uint16_t base;      // offset into RAM
+      uint8_t depth;      // 0: not allocated
+      uint8_t obj_size;
+      uint8_t head;       // next object written by the producer
+      uint8_t tail;       // next object read by the consumer
+      uint8_t count;
+    } SIM_FIFO;
+
+    typedef enum {
+      SIM_CMD,
+      SIM_ADDR,
+      SIM_LEN,
+      SIM_DATA,
+      SIM_IGNORE
+    } SIM_PHASE;
+
+    void PowerOnReset();
+    void Layout();
+    void FifoReset(SIM_FIFO *f);
+    void ModeRequest(uint8_t mode);
+    void Update();
+    void TimeBaseRefresh();
+    uint32_t TimeStamp();
+
+    uint8_t MemRead(uint16_t a);
+    void MemWrite(uint16_t a, uint8_t d);
+    void RegWrite(uint16_t a, uint8_t d);
+    void FifoConWrite(uint8_t m, uint8_t byte, uint8_t d);
+    void TxqArbitrate();
+    void TefPush(uint32_t id, uint32_t ctrl);
+    void ErrorCountersSet(int tec, int rec);
+
+    bool IsTx(uint8_t m);
+    uint32_t Reg(uint16_t a);
+    void RegSet(uint16_t a, uint32_t v);
+    uint32_t MsgId(uint32_t word0, uint8_t ide);
+    uint32_t MsgWord0(uint32_t id, uint8_t ide);
+
+    uint8_t mem[4096];
+    SIM_FIFO fifo[CAN_FIFO_TOTAL_CHANNELS];   // 0 == TXQ
+    SIM_FIFO tef;
+    int tec, rec;
+
+    // SPI state
+    SIM_PHASE phase;
+    uint8_t cmd;
+    uint16_t addr;
+    uint16_t data_len;
+    uint16_t count;
+    uint16_t crc;
+    uint8_t header[3];
+    uint8_t wbuf[MCP2517FD_SIM_WBUF];
+    uint32_t crc_errors;
+
+    // Time base
+    mcp2517fd_sim_clock clock;
+    void *clock_context;
+    uint64_t tbc_epoch_ns;
+    uint32_t tbc_epoch;
+
+    pthread_mutex_t lock;
+};
+
+#endif
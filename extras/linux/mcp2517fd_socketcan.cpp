@@ -0,0 +1,452 @@
+/*
+  mcp2517fd_socketcan.cpp - Bridge between an MCP2517FD and a SocketCAN interface
+
+  Runs the mcp2517fd driver in user space over spidev (or the simulated
+  controller) and exchanges frames with a CAN/CAN FD netdev, typically vcan:
+
+    ip link add dev vcan0 type vcan && ip link set vcan0 mtu 72 up
+    mcp2517fd_socketcan -d /dev/spidev0.0 -g /dev/gpiochip0 -l 25 vcan0
+    candump vcan0 & cangen -f vcan0
+
+  Frames read from the socket are loaded into the TX FIFO without TXREQ and
+  flushed once per batch; received frames are drained in one pass and handed
+  to the socket with a single sendmmsg().
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "../../mcp2517fd.h"
+#include "mcp2517fd_sim.h"
+#include "mcp2517fd_spidev.h"
+
+#define BRIDGE_CS_PIN   10
+#define BRIDGE_INT_PIN  11
+#define BRIDGE_TX_CH    CAN_FIFO_CH1
+#define BRIDGE_RX_CH    CAN_FIFO_CH2
+#define BRIDGE_BATCH    32
+
+static volatile sig_atomic_t running = 1;
+
+static const struct {
+  const char *name;
+  CAN_BITTIME_SETUP setup;
+} bittimes[] = {
+  {"125k-500k", CAN_125K_500K},
+  {"250k-500k", CAN_250K_500K},
+  {"250k-1m", CAN_250K_1M},
+  {"250k-2m", CAN_250K_2M},
+  {"500k-1m", CAN_500K_1M},
+  {"500k-2m", CAN_500K_2M},
+  {"500k-4m", CAN_500K_4M},
+  {"500k-8m", CAN_500K_8M},
+  {"1000k-4m", CAN_1000K_4M},
+  {"1000k-8m", CAN_1000K_8M},
+};
+
+static void on_signal(int sig)
+{
+  running = 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options] <ifname>\n"
+          "  -d <spidev>     SPI device (default /dev/spidev0.0)\n"
+          "  -s <hz>         SPI clock (default 10000000)\n"
+          "  -g <gpiochip>   GPIO chip of the INT1 line; without it the RX FIFO is polled\n"
+          "  -l <line>       INT1 line offset on the GPIO chip\n"
+          "  -b <bittime>    nominal-data bit rates, e.g. 500k-2m (default)\n"
+          "  -p <us>         poll period (default 1000)\n"
+          "  -S              simulated controller in internal loopback\n",
+          prog);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Frame Conversion
+static uint8_t len_to_dlc(mcp2517fd &can, uint8_t len)
+{
+  int8_t dlc = can.DataLengthtoDLC(len);
+
+  // CAN FD lengths between DLC steps are padded up
+  if (dlc < 0) {
+    for (dlc = 9; (dlc < 15) && (can.DLCtoDataLength(dlc) < len); dlc++) {
+    }
+  }
+
+  return dlc;
+}
+
+static uint8_t frame_to_obj(mcp2517fd &can, const struct canfd_frame *cf, bool fd, CAN_TX_MSGOBJ *obj)
+{
+  obj->word[0] = 0;
+  obj->word[1] = 0;
+
+  if (cf->can_id & CAN_EFF_FLAG) {
+    obj->bF.id.SID = (cf->can_id >> 18) & 0x7FF;
+    obj->bF.id.EID = cf->can_id & 0x3FFFF;
+    obj->bF.ctrl.IDE = 1;
+  } else {
+    obj->bF.id.SID = cf->can_id & CAN_SFF_MASK;
+  }
+
+  obj->bF.ctrl.DLC = len_to_dlc(can, cf->len);
+
+  if (fd) {
+    obj->bF.ctrl.FDF = 1;
+    obj->bF.ctrl.BRS = (cf->flags & CANFD_BRS) ? 1 : 0;
+    obj->bF.ctrl.ESI = (cf->flags & CANFD_ESI) ? 1 : 0;
+  } else if (cf->can_id & CAN_RTR_FLAG) {
+    obj->bF.ctrl.RTR = 1;
+    return 0;
+  }
+
+  return can.DLCtoDataLength(obj->bF.ctrl.DLC);
+}
+
+static uint8_t obj_to_frame(mcp2517fd &can, const CAN_RX_MSGOBJ *obj, const uint8_t *data, struct canfd_frame *cf)
+{
+  memset(cf, 0, sizeof(*cf));
+
+  if (obj->bF.ctrl.IDE) {
+    cf->can_id = CAN_EFF_FLAG | ((uint32_t) obj->bF.id.SID << 18) | obj->bF.id.EID;
+  } else {
+    cf->can_id = obj->bF.id.SID;
+  }
+
+  cf->len = can.DLCtoDataLength(obj->bF.ctrl.DLC);
+
+  if (obj->bF.ctrl.FDF) {
+    cf->flags = (obj->bF.ctrl.BRS ? CANFD_BRS : 0) | (obj->bF.ctrl.ESI ? CANFD_ESI : 0);
+    memcpy(cf->data, data, cf->len);
+    return 1;
+  }
+
+  if (cf->len > CAN_MAX_DLEN) {
+    cf->len = CAN_MAX_DLEN;
+  }
+
+  if (obj->bF.ctrl.RTR) {
+    cf->can_id |= CAN_RTR_FLAG;
+  } else {
+    memcpy(cf->data, data, cf->len);
+  }
+
+  return 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Bridge
+typedef struct {
+  mcp2517fd *can;
+  mcp2517fd_sim *sim;
+  int sock;
+
+  // Socket frames read but not yet loaded: rx[rx_next .. rx_count-1]
+  int rx_next;
+  int rx_count;
+
+  struct canfd_frame rx[BRIDGE_BATCH];
+  struct iovec rx_iov[BRIDGE_BATCH];
+  struct mmsghdr rx_msg[BRIDGE_BATCH];
+
+  struct canfd_frame tx[BRIDGE_BATCH];
+  struct iovec tx_iov[BRIDGE_BATCH];
+  struct mmsghdr tx_msg[BRIDGE_BATCH];
+
+  unsigned long to_can, to_sock, dropped;
+} BRIDGE;
+
+static bool load_frame(BRIDGE *b, const struct canfd_frame *cf, bool fd)
+{
+  CAN_TX_MSGOBJ obj;
+  uint8_t n = frame_to_obj(*b->can, cf, fd, &obj);
+  uint8_t data[MAX_DATA_BYTES];
+
+  memset(data, 0, sizeof(data));
+  memcpy(data, cf->data, (cf->len < n) ? cf->len : n);
+
+  if (!(b->can->TransmitChannelStatusGet(BRIDGE_TX_CH) & CAN_TX_FIFO_NOT_FULL)) {
+    return false;
+  }
+
+  b->can->TransmitChannelLoad(&obj, data, n, BRIDGE_TX_CH, false);
+  b->to_can++;
+
+  return true;
+}
+
+// Socket -> controller: read a batch, load without TXREQ, flush once
+static void socket_to_can(BRIDGE *b)
+{
+  uint16_t loaded = 0;
+
+  if (b->rx_next == b->rx_count) {
+    int n = recvmmsg(b->sock, b->rx_msg, BRIDGE_BATCH, MSG_DONTWAIT, NULL);
+
+    b->rx_next = 0;
+    b->rx_count = (n > 0) ? n : 0;
+  }
+
+  // Stop at a full FIFO; the rest of the batch waits for the next wakeup
+  while (b->rx_next < b->rx_count) {
+    int i = b->rx_next;
+
+    if (!load_frame(b, &b->rx[i], b->rx_msg[i].msg_len == CANFD_MTU)) {
+      break;
+    }
+
+    b->rx_next++;
+    loaded++;
+  }
+
+  if (loaded) {
+    b->can->TransmitChannelFlush(BRIDGE_TX_CH);
+  }
+}
+
+// Controller -> socket: drain the RX FIFO, one sendmmsg per batch
+static void can_to_socket(BRIDGE *b)
+{
+  CAN_RX_MSGOBJ obj;
+  uint8_t data[MAX_DATA_BYTES];
+
+  while (b->can->available()) {
+    int n = 0;
+
+    while ((n < BRIDGE_BATCH) && (b->can->ReceiveChannelStatusGet(BRIDGE_RX_CH) & CAN_RX_FIFO_NOT_EMPTY)) {
+      b->can->ReceiveMessageGet(&obj, data, MAX_DATA_BYTES, BRIDGE_RX_CH);
+
+      bool fd = obj_to_frame(*b->can, &obj, data, &b->tx[n]);
+
+      b->tx_iov[n].iov_len = fd ? CANFD_MTU : CAN_MTU;
+      n++;
+    }
+
+    if (!n) {
+      break;
+    }
+
+    int sent = sendmmsg(b->sock, b->tx_msg, n, MSG_DONTWAIT);
+
+    if (sent > 0) {
+      b->to_sock += sent;
+    }
+
+    if (sent < n) {
+      b->dropped += n - ((sent > 0) ? sent : 0);
+    }
+  }
+}
+
+static int socket_open(const char *ifname)
+{
+  struct sockaddr_can addr;
+  int enable = 1;
+  int s = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+
+  if (s < 0) {
+    return -1;
+  }
+
+  setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = if_nametoindex(ifname);
+
+  if (!addr.can_ifindex || (bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0)) {
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int main(int argc, char **argv)
+{
+  const char *spidev = "/dev/spidev0.0";
+  const char *gpiochip = NULL;
+  uint32_t line = 0;
+  uint32_t speed = 10000000;
+  uint32_t poll_us = 1000;
+  CAN_BITTIME_SETUP bittime = CAN_500K_2M;
+  bool simulate = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:s:g:l:b:p:Sh")) != -1) {
+    switch (opt) {
+      case 'd': spidev = optarg; break;
+      case 's': speed = strtoul(optarg, NULL, 0); break;
+      case 'g': gpiochip = optarg; break;
+      case 'l': line = strtoul(optarg, NULL, 0); break;
+      case 'p': poll_us = strtoul(optarg, NULL, 0); break;
+      case 'S': simulate = true; break;
+      case 'b': {
+        size_t i;
+
+        for (i = 0; i < sizeof(bittimes) / sizeof(bittimes[0]); i++) {
+          if (!strcmp(optarg, bittimes[i].name)) {
+            bittime = bittimes[i].setup;
+            break;
+          }
+        }
+
+        if (i == sizeof(bittimes) / sizeof(bittimes[0])) {
+          fprintf(stderr, "unknown bit time %s\n", optarg);
+          return 1;
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Transport
+  mcp2517fd_spidev spi;
+  mcp2517fd_sim sim;
+
+  if (simulate) {
+    mcp2517fd_host_attach(BRIDGE_CS_PIN, BRIDGE_INT_PIN, &sim);
+  } else {
+    if (spi.Open(spidev, speed, gpiochip, line) < 0) {
+      perror(spidev);
+      return 1;
+    }
+    mcp2517fd_host_attach(BRIDGE_CS_PIN, BRIDGE_INT_PIN, &spi);
+  }
+
+  // Controller: Init() plus an accept-all filter into the RX FIFO
+  mcp2517fd can(BRIDGE_CS_PIN, BRIDGE_INT_PIN, speed);
+  CAN_FILTEROBJ_ID fobj;
+  CAN_MASKOBJ_ID mobj;
+
+  can.Init(bittime, BRIDGE_TX_CH, BRIDGE_RX_CH);
+
+  memset(&fobj, 0, sizeof(fobj));
+  memset(&mobj, 0, sizeof(mobj));
+  can.FilterObjectConfigure(CAN_FILTER0, &fobj);
+  can.FilterMaskConfigure(CAN_FILTER0, &mobj);
+  can.FilterToFifoLink(CAN_FILTER0, true, BRIDGE_RX_CH);
+
+  // Also catches a controller that is not there
+  if (can.OperationModeSwitch(simulate ? CAN_INTERNAL_LOOPBACK_MODE : CAN_NORMAL_MODE) < 0) {
+    fprintf(stderr, "controller does not leave configuration mode\n");
+    return 1;
+  }
+
+  // Socket
+  BRIDGE b;
+
+  memset(&b, 0, sizeof(b));
+  b.can = &can;
+  b.sim = simulate ? &sim : NULL;
+  b.sock = socket_open(argv[optind]);
+
+  if (b.sock < 0) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  for (int i = 0; i < BRIDGE_BATCH; i++) {
+    b.rx_iov[i].iov_base = &b.rx[i];
+    b.rx_iov[i].iov_len = sizeof(b.rx[i]);
+    b.rx_msg[i].msg_hdr.msg_iov = &b.rx_iov[i];
+    b.rx_msg[i].msg_hdr.msg_iovlen = 1;
+
+    b.tx_iov[i].iov_base = &b.tx[i];
+    b.tx_msg[i].msg_hdr.msg_iov = &b.tx_iov[i];
+    b.tx_msg[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // Event loop: socket, INT line and a poll timer for what INT cannot signal
+  int ep = epoll_create1(EPOLL_CLOEXEC);
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  int ifd = simulate ? -1 : spi.InterruptFd();
+  struct itimerspec its;
+  struct epoll_event ev;
+
+  memset(&its, 0, sizeof(its));
+  its.it_interval.tv_sec = poll_us / 1000000;
+  its.it_interval.tv_nsec = (poll_us % 1000000) * 1000;
+  its.it_value = its.it_interval;
+  timerfd_settime(tfd, 0, &its, NULL);
+
+  ev.events = EPOLLIN;
+  ev.data.fd = b.sock;
+  epoll_ctl(ep, EPOLL_CTL_ADD, b.sock, &ev);
+  ev.data.fd = tfd;
+  epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev);
+  if (ifd >= 0) {
+    ev.data.fd = ifd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, ifd, &ev);
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  while (running) {
+    struct epoll_event events[4];
+    int n = epoll_wait(ep, events, 4, -1);
+
+    if ((n < 0) && (errno != EINTR)) {
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == tfd) {
+        uint64_t expirations;
+
+        if (read(tfd, &expirations, sizeof(expirations)) < 0) {
+          continue;
+        }
+      } else if (fd == ifd) {
+        spi.InterruptAck();
+      }
+    }
+
+    // Both directions run on every wakeup so a full FIFO retries on the timer
+    socket_to_can(&b);
+
+    if (b.sim) {
+      b.sim->Loopback();
+    }
+
+    can_to_socket(&b);
+  }
+
+  fprintf(stderr, "to can %lu, to socket %lu, dropped %lu\n", b.to_can, b.to_sock, b.dropped);
+
+  close(ep);
+  close(tfd);
+  close(b.sock);
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+/*
+  mcp2517fd_spidev.cpp - spidev transport with optional gpiochip INT line
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "mcp2517fd_spidev.h"
+
+int mcp2517fd_spidev::Open(const char *device, uint32_t speed_hz, const char *gpiochip, uint32_t intr_line)
+{
+  uint8_t mode = SPI_MODE_0;
+  uint8_t bits = 8;
+
+  fd = open(device, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  speed = speed_hz;
+
+  if ((ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0) ||
+      (ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0)) {
+    Close();
+    return -1;
+  }
+
+  if (!gpiochip) {
+    return 0;
+  }
+
+  // INT is active low: wake on both edges, read the level on demand
+  struct gpioevent_request req;
+  int chip = open(gpiochip, O_RDONLY | O_CLOEXEC);
+
+  if (chip < 0) {
+    Close();
+    return -1;
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.lineoffset = intr_line;
+  req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+  strncpy(req.consumer_label, "mcp2517fd-int", sizeof(req.consumer_label) - 1);
+
+  int r = ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &req);
+  int err = errno;
+
+  close(chip);
+
+  if (r < 0) {
+    Close();
+    errno = err;
+    return -1;
+  }
+
+  intr_fd = req.fd;
+  fcntl(intr_fd, F_SETFL, fcntl(intr_fd, F_GETFL) | O_NONBLOCK);
+
+  return 0;
+}
+
+void mcp2517fd_spidev::Close()
+{
+  if (intr_fd >= 0) {
+    close(intr_fd);
+    intr_fd = -1;
+  }
+
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void mcp2517fd_spidev::Select()
+{
+  in_transaction = true;
+}
+
+void mcp2517fd_spidev::Deselect()
+{
+  struct spi_ioc_transfer xfer;
+
+  if (!in_transaction) {
+    return;
+  }
+
+  in_transaction = false;
+
+  // Zero length transfer that drops CS after the transfers kept it asserted
+  memset(&xfer, 0, sizeof(xfer));
+  xfer.speed_hz = speed;
+  xfer.bits_per_word = 8;
+  xfer.cs_change = 0;
+
+  ioctl(fd, SPI_IOC_MESSAGE(1), &xfer);
+}
+
+void mcp2517fd_spidev::Transfer(uint8_t *buf, size_t n)
+{
+  struct spi_ioc_transfer xfer;
+
+  // One ioctl per driver block; CS stays low until Deselect()
+  memset(&xfer, 0, sizeof(xfer));
+  xfer.tx_buf = (unsigned long) buf;
+  xfer.rx_buf = (unsigned long) buf;
+  xfer.len = n;
+  xfer.speed_hz = speed;
+  xfer.bits_per_word = 8;
+  xfer.cs_change = 1;
+
+  if (ioctl(fd, SPI_IOC_MESSAGE(1), &xfer) < 0) {
+    memset(buf, 0xFF, n);
+  }
+}
+
+uint8_t mcp2517fd_spidev::InterruptLevel()
+{
+  struct gpiohandle_data data;
+
+  // Without an INT line the driver falls back to polling over SPI
+  if (intr_fd < 0) {
+    return 0;
+  }
+
+  if (ioctl(intr_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) {
+    return 0;
+  }
+
+  return data.values[0] ? 1 : 0;
+}
+
+int mcp2517fd_spidev::InterruptFd()
+{
+  return intr_fd;
+}
+
+void mcp2517fd_spidev::InterruptAck()
+{
+  struct gpioevent_data ev[16];
+
+  while (read(intr_fd, ev, sizeof(ev)) > 0) {
+  }
+}
@@ -0,0 +1,52 @@
+/*
+  mcp2517fd_spidev.h - spidev transport with optional gpiochip INT line
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_SPIDEV_H
+#define	MCP2517FD_SPIDEV_H
+
+#include "mcp2517fd_transport.h"
+
+class mcp2517fd_spidev : public mcp2517fd_transport {
+  public:
+    // *****************************************************************************
+    //! Open the SPI device
+    /*!
+       device: e.g. /dev/spidev0.0
+       gpiochip: e.g. /dev/gpiochip0 for the INT line, NULL to poll over SPI
+       Returns 0 on success, -1 on error (errno set)
+    */
+
+    int Open(const char *device, uint32_t speed_hz, const char *gpiochip = NULL, uint32_t intr_line = 0);
+
+    void Close();
+
+    void Select();
+    void Deselect();
+    void Transfer(uint8_t *buf, size_t n);
+    uint8_t InterruptLevel();
+    int InterruptFd();
+    void InterruptAck();
+
+    mcp2517fd_spidev()
+    {
+      fd = -1;
+      intr_fd = -1;
+      in_transaction = false;
+    }
+
+    ~mcp2517fd_spidev()
+    {
+      Close();
+    }
+
+  private:
+    int fd;
+    int intr_fd;
+    uint32_t speed;
+    bool in_transaction;
+};
+
+#endif
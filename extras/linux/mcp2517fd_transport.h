@@ -0,0 +1,49 @@
+/*
+  mcp2517fd_transport.h - SPI transport interface for the Linux host build
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_TRANSPORT_H
+#define	MCP2517FD_TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class mcp2517fd_transport {
+  public:
+    virtual ~mcp2517fd_transport() {}
+
+    // *****************************************************************************
+    //! Start an SPI transaction (CS low)
+    virtual void Select() = 0;
+
+    // *****************************************************************************
+    //! End the SPI transaction (CS high)
+    virtual void Deselect() = 0;
+
+    // *****************************************************************************
+    //! Full duplex transfer inside the current transaction
+    /*!
+       Received bytes replace the transmitted ones in buf. A transaction may
+       consist of several transfers.
+    */
+    virtual void Transfer(uint8_t *buf, size_t n) = 0;
+
+    // *****************************************************************************
+    //! Level of the INT pin: 0 == asserted
+    virtual uint8_t InterruptLevel() = 0;
+
+    // *****************************************************************************
+    //! File descriptor that becomes readable on INT edges, -1 if none
+    virtual int InterruptFd()
+    {
+      return -1;
+    }
+
+    // *****************************************************************************
+    //! Consume the pending edge events of InterruptFd()
+    virtual void InterruptAck() {}
+};
+
+#endif
@@ -0,0 +1,428 @@
+/*
+  mcp2517fd_vbus.cpp - Virtual CAN FD bus connecting several simulated MCP2517FD
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mcp2517fd_vbus.h"
+
+#define VBUS_TAIL_BITS   13   // CRC delimiter, ACK slot and delimiter, EOF, intermission
+#define VBUS_ERROR_BITS  17   // error flag, delimiter, intermission
+
+// Bit stream of one frame with dynamic stuff bits and the classic CRC-15
+typedef struct {
+  uint16_t bits;
+  uint16_t crc;
+  uint8_t run;
+  uint8_t level;
+} VBUS_STREAM;
+
+static uint64_t monotonic_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ns / 1000000000ULL;
+  ts.tv_nsec = ns % 1000000000ULL;
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+static void stream_put(VBUS_STREAM *s, uint8_t bit)
+{
+  uint8_t next = bit ^ ((s->crc >> 14) & 1);
+
+  s->crc = (s->crc << 1) & 0x7FFF;
+  if (next) {
+    s->crc ^= 0x4599;
+  }
+
+  s->bits++;
+
+  if (bit != s->level) {
+    s->level = bit;
+    s->run = 1;
+  } else if (++s->run == 5) {
+    // Stuff bit of the opposite level starts the next run
+    s->bits++;
+    s->level = !bit;
+    s->run = 1;
+  }
+}
+
+static void stream_field(VBUS_STREAM *s, uint32_t v, uint8_t n)
+{
+  while (n--) {
+    stream_put(s, (v >> n) & 1);
+  }
+}
+
+static bool mode_on_bus(CAN_OPERATION_MODE mode)
+{
+  return (mode != CAN_CONFIGURATION_MODE) && (mode != CAN_INTERNAL_LOOPBACK_MODE) && (mode != CAN_EXTERNAL_LOOPBACK_MODE);
+}
+
+static bool mode_acks(CAN_OPERATION_MODE mode)
+{
+  return (mode == CAN_NORMAL_MODE) || (mode == CAN_CLASSIC_MODE) || (mode == CAN_RESTRICTED_MODE);
+}
+
+mcp2517fd_vbus::mcp2517fd_vbus(uint32_t nominal_bps, uint32_t data_bps)
+{
+  pthread_mutex_init(&lock, NULL);
+
+  node_count = 0;
+  nominal_ns = 1000000000UL / nominal_bps;
+  data_ns = 1000000000UL / data_bps;
+  monitor = NULL;
+  monitor_context = NULL;
+  inject_count = 0;
+  error_ppm = 0;
+  running = false;
+  last_end_ns = 0;
+
+  StatsClear();
+}
+
+mcp2517fd_vbus::~mcp2517fd_vbus()
+{
+  Stop();
+  pthread_mutex_destroy(&lock);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+int8_t mcp2517fd_vbus::Attach(mcp2517fd_sim *node)
+{
+  if (node_count == MCP2517FD_VBUS_NODES_MAX) {
+    return -1;
+  }
+
+  nodes[node_count] = node;
+
+  return node_count++;
+}
+
+void mcp2517fd_vbus::MonitorSet(mcp2517fd_vbus_monitor m, void *context)
+{
+  pthread_mutex_lock(&lock);
+  monitor = m;
+  monitor_context = context;
+  pthread_mutex_unlock(&lock);
+}
+
+int8_t mcp2517fd_vbus::Start()
+{
+  if (running) {
+    return 0;
+  }
+
+  running = true;
+  StatsClear();
+
+  if (pthread_create(&thread, NULL, Thread, this) != 0) {
+    running = false;
+    return -1;
+  }
+
+  return 0;
+}
+
+void mcp2517fd_vbus::Stop()
+{
+  if (!running) {
+    return;
+  }
+
+  running = false;
+  pthread_join(thread, NULL);
+}
+
+void *mcp2517fd_vbus::Thread(void *context)
+{
+  mcp2517fd_vbus *bus = (mcp2517fd_vbus *) context;
+
+  while (bus->running) {
+    if (bus->Round(true) == 0) {
+      // Idle bus: look again after an intermission's worth of bits
+      sleep_until(monotonic_ns() + 11 * bus->nominal_ns);
+    }
+  }
+
+  return NULL;
+}
+
+uint32_t mcp2517fd_vbus::Step()
+{
+  return Round(false);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Bus
+uint32_t mcp2517fd_vbus::ArbitrationKey(const MCP2517FD_SIM_FRAME *frame)
+{
+  // Arbitration field in bus order, dominant (0) wins: SID, RTR or SRR,
+  // IDE, EID, RTR. FD frames have a dominant RRS in place of RTR.
+  uint32_t rtr = frame->fdf ? 0 : frame->rtr;
+
+  if (frame->ide) {
+    return ((frame->id >> 18) << 21) | (1UL << 20) | (1UL << 19) | ((frame->id & 0x3FFFF) << 1) | rtr;
+  }
+
+  return (frame->id << 21) | (rtr << 20);
+}
+
+void mcp2517fd_vbus::FrameBits(const MCP2517FD_SIM_FRAME *frame, uint16_t *nominal, uint16_t *data)
+{
+  VBUS_STREAM s = {0, 0, 0, 1};
+  uint8_t len = DLC_DataLength[frame->dlc];
+
+  if (!frame->fdf) {
+    len = frame->rtr ? 0 : ((len > 8) ? 8 : len);
+  }
+
+  stream_put(&s, 0);   // SOF
+
+  if (frame->ide) {
+    stream_field(&s, frame->id >> 18, 11);
+    stream_put(&s, 1);   // SRR
+    stream_put(&s, 1);   // IDE
+    stream_field(&s, frame->id & 0x3FFFF, 18);
+  } else {
+    stream_field(&s, frame->id, 11);
+  }
+
+  if (frame->fdf) {
+    stream_put(&s, 0);   // RRS
+    if (!frame->ide) {
+      stream_put(&s, 0);   // IDE
+    }
+    stream_put(&s, 1);   // FDF
+    stream_put(&s, 0);   // res
+    stream_put(&s, frame->brs);
+
+    uint16_t arbitration = s.bits;
+
+    stream_put(&s, frame->esi);
+    stream_field(&s, frame->dlc, 4);
+    for (uint8_t i = 0; i < len; i++) {
+      stream_field(&s, frame->data[i], 8);
+    }
+
+    // Stuff count and CRC-17/21 with a fixed stuff bit every fourth bit
+    uint16_t crc_field = (len <= 16) ? (4 + 17 + 6) : (4 + 21 + 7);
+
+    if (frame->brs) {
+      *nominal = arbitration + VBUS_TAIL_BITS;
+      *data = s.bits - arbitration + crc_field;
+    } else {
+      *nominal = s.bits + crc_field + VBUS_TAIL_BITS;
+      *data = 0;
+    }
+    return;
+  }
+
+  stream_put(&s, frame->rtr);
+  stream_put(&s, 0);   // IDE, r1
+  stream_put(&s, 0);   // r0
+  stream_field(&s, frame->dlc, 4);
+  for (uint8_t i = 0; i < len; i++) {
+    stream_field(&s, frame->data[i], 8);
+  }
+
+  stream_field(&s, s.crc, 15);
+
+  *nominal = s.bits + VBUS_TAIL_BITS;
+  *data = 0;
+}
+
+uint32_t mcp2517fd_vbus::Round(bool pace)
+{
+  CAN_OPERATION_MODE mode[MCP2517FD_VBUS_NODES_MAX];
+  int8_t ch[MCP2517FD_VBUS_NODES_MAX];
+  MCP2517FD_SIM_FRAME frame, f;
+  int8_t winner = -1;
+  uint32_t best_key = 0;
+
+  // Arbitration among the frames each node would send next
+  for (uint8_t i = 0; i < node_count; i++) {
+    mode[i] = nodes[i]->Mode();
+    ch[i] = mode_on_bus(mode[i]) ? nodes[i]->TxPeek(&f) : -1;
+
+    if (ch[i] < 0) {
+      continue;
+    }
+
+    uint32_t key = ArbitrationKey(&f);
+
+    // Equal arbitration fields would end in a bit error; the lower node goes
+    if ((winner < 0) || (key < best_key)) {
+      winner = i;
+      best_key = key;
+      frame = f;
+    }
+  }
+
+  if (winner < 0) {
+    return 0;
+  }
+
+  uint16_t nominal_bits, data_bits;
+
+  FrameBits(&frame, &nominal_bits, &data_bits);
+
+  uint32_t duration = nominal_bits * nominal_ns + data_bits * data_ns;
+  bool ack = false;
+  bool error = false;
+  bool data_phase = false;
+  MCP2517FD_SIM_ERROR kind = MCP2517FD_SIM_CRC_ERR;
+
+  for (uint8_t i = 0; i < node_count; i++) {
+    if (i == winner) {
+      continue;
+    }
+
+    if (ch[i] >= 0) {
+      nodes[i]->TxArbitrationLost(ch[i]);
+    }
+
+    if (mode_acks(mode[i])) {
+      ack = true;
+    }
+
+    // A classic node flags the reserved bit after IDE of an FD frame
+    if ((mode[i] == CAN_CLASSIC_MODE) && frame.fdf) {
+      error = true;
+      kind = MCP2517FD_SIM_FORM_ERR;
+    }
+  }
+
+  pthread_mutex_lock(&lock);
+
+  for (uint8_t i = 0; i < node_count; i++) {
+    if ((i != winner) && (ch[i] >= 0)) {
+      stats.arbitration_lost++;
+    }
+  }
+
+  if (!error && inject_count && ((inject_node < 0) || (inject_node == winner))) {
+    error = true;
+    kind = inject_kind;
+    data_phase = inject_data_phase && frame.brs;
+    inject_count--;
+  } else if (!error && error_ppm && ((uint32_t) rand_r(&seed) % 1000000UL < error_ppm)) {
+    error = true;
+    kind = error_kind;
+    data_phase = frame.brs && ((uint32_t) rand_r(&seed) % (nominal_bits + data_bits) < data_bits);
+  }
+
+  if (error || !ack) {
+    duration += VBUS_ERROR_BITS * nominal_ns;
+    if (error) {
+      stats.errors++;
+    } else {
+      stats.ack_errors++;
+    }
+  } else {
+    stats.frames++;
+  }
+
+  stats.busy_ns += duration;
+
+  mcp2517fd_vbus_monitor m = monitor;
+  void *m_context = monitor_context;
+
+  pthread_mutex_unlock(&lock);
+
+  // The frame ends duration after the later of now and the end of the last one
+  uint64_t now = monotonic_ns();
+  uint64_t end = ((last_end_ns > now) ? last_end_ns : now) + duration;
+
+  last_end_ns = end;
+
+  if (pace) {
+    sleep_until(end);
+  }
+
+  if (error) {
+    nodes[winner]->BusError(kind, true, data_phase);
+    for (uint8_t i = 0; i < node_count; i++) {
+      if ((i != winner) && mode_on_bus(mode[i])) {
+        nodes[i]->BusError(kind, false, data_phase);
+      }
+    }
+    return duration;
+  }
+
+  if (!ack) {
+    nodes[winner]->BusError(MCP2517FD_SIM_ACK_ERR, true, false);
+    return duration;
+  }
+
+  nodes[winner]->TxComplete(ch[winner]);
+
+  for (uint8_t i = 0; i < node_count; i++) {
+    if ((i != winner) && mode_on_bus(mode[i])) {
+      nodes[i]->Receive(&frame);
+    }
+  }
+
+  if (m) {
+    m(&frame, winner, end, m_context);
+  }
+
+  return duration;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Error Injection
+void mcp2517fd_vbus::ErrorInject(MCP2517FD_SIM_ERROR kind, bool data_phase, uint32_t count, int8_t node)
+{
+  pthread_mutex_lock(&lock);
+  inject_kind = kind;
+  inject_data_phase = data_phase;
+  inject_count = count;
+  inject_node = node;
+  pthread_mutex_unlock(&lock);
+}
+
+void mcp2517fd_vbus::ErrorRateSet(uint32_t ppm, MCP2517FD_SIM_ERROR kind, unsigned int s)
+{
+  pthread_mutex_lock(&lock);
+  error_ppm = ppm;
+  error_kind = kind;
+  seed = s;
+  pthread_mutex_unlock(&lock);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Statistics
+void mcp2517fd_vbus::StatsGet(MCP2517FD_VBUS_STATS *s)
+{
+  pthread_mutex_lock(&lock);
+  *s = stats;
+  s->elapsed_ns = monotonic_ns() - stats_start_ns;
+  pthread_mutex_unlock(&lock);
+}
+
+void mcp2517fd_vbus::StatsClear()
+{
+  pthread_mutex_lock(&lock);
+  memset(&stats, 0, sizeof(stats));
+  stats_start_ns = monotonic_ns();
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,159 @@
+/*
+  mcp2517fd_vbus.h - Virtual CAN FD bus connecting several simulated MCP2517FD
+
+  Each node is an mcp2517fd_sim driven by an unmodified mcp2517fd instance,
+  typically one per thread. The bus collects the frame each node would send
+  next, arbitrates by identifier, occupies the bus for the frame's duration
+  at the nominal and (after BRS) data bit rate, and hands the frame to the
+  other nodes. A frame nobody acknowledges, or one hit by an injected error,
+  stays queued and is sent again like on a real bus.
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_VBUS_H
+#define	MCP2517FD_VBUS_H
+
+#include "mcp2517fd_sim.h"
+
+#define MCP2517FD_VBUS_NODES_MAX 64
+
+// *****************************************************************************
+//! Bus statistics
+
+typedef struct {
+  uint32_t frames;           // sent and acknowledged
+  uint32_t arbitration_lost; // frames that lost arbitration, counted per round and node
+  uint32_t ack_errors;       // frames nobody acknowledged
+  uint32_t errors;           // frames destroyed by an error frame
+  uint64_t busy_ns;          // bus time taken by frames and error frames
+  uint64_t elapsed_ns;       // bus time since Start()/StatsClear()
+} MCP2517FD_VBUS_STATS;
+
+// *****************************************************************************
+//! Called for every frame acknowledged on the bus
+/*!
+   node: the transmitter; end_ns: bus time at the end of the frame, on the
+   clock of the simulated time bases (CLOCK_MONOTONIC unless changed).
+*/
+
+typedef void (*mcp2517fd_vbus_monitor)(const MCP2517FD_SIM_FRAME *frame, uint8_t node, uint64_t end_ns, void *context);
+
+class mcp2517fd_vbus {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Add a node
+    /*!
+       Call before Start(). Returns the node number, -1 if the bus is full.
+    */
+
+    int8_t Attach(mcp2517fd_sim *node);
+
+    // *****************************************************************************
+    //! Observe acknowledged frames; called from the bus thread
+    void MonitorSet(mcp2517fd_vbus_monitor monitor, void *context = NULL);
+
+    // *****************************************************************************
+    //! Run the bus in its own thread
+    /*!
+       Frames take their real duration: the thread sleeps until each frame
+       has ended before delivering it. Returns 0 on success, -1 if the thread
+       cannot be created.
+    */
+
+    int8_t Start();
+
+    // *****************************************************************************
+    //! Stop the bus thread
+    void Stop();
+
+    // *****************************************************************************
+    //! One arbitration round, without pacing
+    /*!
+       For single threaded tests that drive the bus themselves. Returns the
+       bus time taken in ns, 0 if no node had anything to send.
+    */
+
+    uint32_t Step();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Error Injection
+
+    // *****************************************************************************
+    //! Destroy the next count frames
+    /*!
+       node limits the errors to frames of one transmitter, -1 for any. The
+       transmitter counts a transmit error, every other active node a receive
+       error, and the frame is sent again.
+    */
+
+    void ErrorInject(MCP2517FD_SIM_ERROR kind, bool data_phase = false, uint32_t count = 1, int8_t node = -1);
+
+    // *****************************************************************************
+    //! Destroy frames at random
+    /*!
+       ppm: frame error rate in parts per million, 0 to turn off. Errors hit
+       the data phase in proportion to its share of the frame's bits.
+    */
+
+    void ErrorRateSet(uint32_t ppm, MCP2517FD_SIM_ERROR kind = MCP2517FD_SIM_CRC_ERR, unsigned int seed = 1);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Statistics
+
+    // *****************************************************************************
+    //! Snapshot of the statistics
+    void StatsGet(MCP2517FD_VBUS_STATS *stats);
+
+    // *****************************************************************************
+    //! Reset the statistics
+    void StatsClear();
+
+    // *****************************************************************************
+    //! Nominal and data bit rates in bit/s
+    mcp2517fd_vbus(uint32_t nominal_bps = 500000, uint32_t data_bps = 2000000);
+    ~mcp2517fd_vbus();
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private
+
+    static void *Thread(void *context);
+    static uint32_t ArbitrationKey(const MCP2517FD_SIM_FRAME *frame);
+    static void FrameBits(const MCP2517FD_SIM_FRAME *frame, uint16_t *nominal, uint16_t *data);
+    uint32_t Round(bool pace);
+
+    mcp2517fd_sim *nodes[MCP2517FD_VBUS_NODES_MAX];
+    uint8_t node_count;
+    uint32_t nominal_ns;      // bit times
+    uint32_t data_ns;
+
+    mcp2517fd_vbus_monitor monitor;
+    void *monitor_context;
+
+    // Error injection
+    MCP2517FD_SIM_ERROR inject_kind;
+    bool inject_data_phase;
+    uint32_t inject_count;
+    int8_t inject_node;
+    uint32_t error_ppm;
+    MCP2517FD_SIM_ERROR error_kind;
+    unsigned int seed;
+
+    MCP2517FD_VBUS_STATS stats;
+    uint64_t stats_start_ns;
+    uint64_t last_end_ns;     // end of the last frame on the bus
+
+    pthread_t thread;
+    volatile bool running;
+    pthread_mutex_t lock;
+};
+
+#endif
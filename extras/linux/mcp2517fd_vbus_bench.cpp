@@ -0,0 +1,317 @@
+/*
+  mcp2517fd_vbus_bench.cpp - Throughput and latency of many nodes on a virtual bus
+
+  Starts one thread per node, each running the unmodified driver against its
+  own simulated MCP2517FD on an mcp2517fd_vbus. Every node sends frames at a
+  fixed rate with its send time in the first four data bytes; every other
+  node measures the latency from TransmitChannelLoad() to its receive loop.
+  Nodes sleep until their next send time or the next frame on the bus.
+
+    mcp2517fd_vbus_bench -n 64 -r 50 -t 10
+    mcp2517fd_vbus_bench -n 16 -b 500k-2m -f -l 64 -e 1000
+
+  Node i sends ID 0x100 + i, so lower nodes win arbitration.
+*/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../mcp2517fd.h"
+#include "mcp2517fd_sim.h"
+#include "mcp2517fd_vbus.h"
+
+#define BENCH_TX_CH     CAN_FIFO_CH1
+#define BENCH_RX_CH     CAN_FIFO_CH2
+#define BENCH_BASE_ID   0x100
+
+static volatile sig_atomic_t running = 1;
+
+// Bumped for every frame on the bus to wake the nodes
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bus_cond;
+static uint32_t bus_frames;
+
+static const struct {
+  const char *name;
+  CAN_BITTIME_SETUP setup;
+  uint32_t nominal;
+  uint32_t data;
+} bittimes[] = {
+  {"125k-500k", CAN_125K_500K, 125000, 500000},
+  {"250k-500k", CAN_250K_500K, 250000, 500000},
+  {"250k-1m", CAN_250K_1M, 250000, 1000000},
+  {"250k-2m", CAN_250K_2M, 250000, 2000000},
+  {"500k-1m", CAN_500K_1M, 500000, 1000000},
+  {"500k-2m", CAN_500K_2M, 500000, 2000000},
+  {"500k-4m", CAN_500K_4M, 500000, 4000000},
+  {"500k-8m", CAN_500K_8M, 500000, 8000000},
+  {"1000k-4m", CAN_1000K_4M, 1000000, 4000000},
+  {"1000k-8m", CAN_1000K_8M, 1000000, 8000000},
+};
+
+typedef struct {
+  mcp2517fd *can;
+  uint8_t index;
+  uint32_t period_us;
+  uint8_t len;
+  bool fd;
+  volatile bool ready;
+  uint32_t sent;
+  uint32_t tx_full;
+  uint32_t received;
+  uint64_t latency_sum;
+  uint32_t latency_max;
+} NODE;
+
+static void on_signal(int sig)
+{
+  running = 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n <nodes>      nodes on the bus, up to %d (default 16)\n"
+          "  -b <bittime>    nominal-data bit rates, e.g. 500k-2m (default)\n"
+          "  -r <fps>        frames per second per node (default 100)\n"
+          "  -l <bytes>      payload, at least 4 (default 8)\n"
+          "  -f              CAN FD frames with bit rate switch\n"
+          "  -e <ppm>        random frame error rate\n"
+          "  -t <s>          run time (default 5)\n",
+          prog, MCP2517FD_VBUS_NODES_MAX);
+}
+
+static void on_frame(const MCP2517FD_SIM_FRAME *frame, uint8_t node, uint64_t end_ns, void *context)
+{
+  pthread_mutex_lock(&bus_lock);
+  bus_frames++;
+  pthread_cond_broadcast(&bus_cond);
+  pthread_mutex_unlock(&bus_lock);
+}
+
+static void *node_thread(void *context)
+{
+  NODE *n = (NODE *) context;
+  mcp2517fd &can = *n->can;
+  CAN_TX_MSGOBJ txObj;
+  CAN_RX_MSGOBJ rxObj;
+  uint8_t txd[MAX_DATA_BYTES];
+  uint8_t rxd[MAX_DATA_BYTES];
+
+  memset(txd, 0, sizeof(txd));
+  txObj.word[0] = 0;
+  txObj.word[1] = 0;
+  txObj.bF.id.SID = BENCH_BASE_ID + n->index;
+  txObj.bF.ctrl.DLC = can.DataLengthtoDLC(n->len);
+  txObj.bF.ctrl.FDF = n->fd ? 1 : 0;
+  txObj.bF.ctrl.BRS = n->fd ? 1 : 0;
+
+  // Wait for main to put every node on the bus
+  while (running && !n->ready) {
+    usleep(1000);
+  }
+
+  unsigned long next = micros();
+  uint32_t seen = 0;
+
+  while (running) {
+    unsigned long now = micros();
+
+    if ((long) (now - next) >= 0) {
+      txd[0] = (uint8_t) now;
+      txd[1] = (uint8_t) (now >> 8);
+      txd[2] = (uint8_t) (now >> 16);
+      txd[3] = (uint8_t) (now >> 24);
+
+      if (can.TransmitChannelLoad(&txObj, txd, n->len, BENCH_TX_CH, true) < 0) {
+        n->tx_full++;
+      } else {
+        n->sent++;
+      }
+      next += n->period_us;
+    }
+
+    while (can.available()) {
+      can.ReceiveMessageGet(&rxObj, rxd, sizeof(rxd), BENCH_RX_CH);
+
+      uint32_t stamp = rxd[0] | ((uint32_t) rxd[1] << 8) | ((uint32_t) rxd[2] << 16) | ((uint32_t) rxd[3] << 24);
+      uint32_t latency = (uint32_t) micros() - stamp;
+
+      n->received++;
+      n->latency_sum += latency;
+      if (latency > n->latency_max) {
+        n->latency_max = latency;
+      }
+    }
+
+    // Sleep until the next send time unless a frame went by meanwhile
+    struct timespec ts;
+    long wait_us = (long) (next - micros());
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (wait_us > 0) {
+      ts.tv_sec += (ts.tv_nsec + wait_us * 1000L) / 1000000000L;
+      ts.tv_nsec = (ts.tv_nsec + wait_us * 1000L) % 1000000000L;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    while (running && (seen == bus_frames) && (wait_us > 0)) {
+      if (pthread_cond_timedwait(&bus_cond, &bus_lock, &ts) != 0) {
+        break;
+      }
+    }
+    seen = bus_frames;
+    pthread_mutex_unlock(&bus_lock);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned nodes = 16;
+  unsigned rate = 100;
+  unsigned len = 8;
+  unsigned seconds = 5;
+  unsigned ppm = 0;
+  bool fd = false;
+  unsigned bt = 5;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:b:r:l:fe:t:h")) != -1) {
+    switch (opt) {
+      case 'n': nodes = strtoul(optarg, NULL, 0); break;
+      case 'r': rate = strtoul(optarg, NULL, 0); break;
+      case 'l': len = strtoul(optarg, NULL, 0); break;
+      case 'f': fd = true; break;
+      case 'e': ppm = strtoul(optarg, NULL, 0); break;
+      case 't': seconds = strtoul(optarg, NULL, 0); break;
+      case 'b': {
+        for (bt = 0; bt < sizeof(bittimes) / sizeof(bittimes[0]); bt++) {
+          if (!strcmp(optarg, bittimes[bt].name)) {
+            break;
+          }
+        }
+
+        if (bt == sizeof(bittimes) / sizeof(bittimes[0])) {
+          fprintf(stderr, "unknown bit time %s\n", optarg);
+          return 2;
+        }
+        break;
+      }
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+
+  if ((nodes < 2) || (nodes > MCP2517FD_VBUS_NODES_MAX) || !rate || (len < 4) || (len > (fd ? 64U : 8U))) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&bus_cond, &attr);
+
+  mcp2517fd_vbus bus(bittimes[bt].nominal, bittimes[bt].data);
+  mcp2517fd_sim *sims = new mcp2517fd_sim[nodes];
+  mcp2517fd **cans = new mcp2517fd *[nodes];
+  NODE *node = new NODE[nodes];
+  pthread_t *threads = new pthread_t[nodes];
+
+  // Node i: CS on pin 2i, INT1 on pin 2i + 1
+  for (unsigned i = 0; i < nodes; i++) {
+    CAN_FILTEROBJ_ID fobj;
+    CAN_MASKOBJ_ID mobj;
+
+    mcp2517fd_host_attach(2 * i, 2 * i + 1, &sims[i]);
+    bus.Attach(&sims[i]);
+
+    cans[i] = new mcp2517fd(2 * i, 2 * i + 1);
+    cans[i]->Init(bittimes[bt].setup, BENCH_TX_CH, BENCH_RX_CH);
+
+    memset(&fobj, 0, sizeof(fobj));
+    memset(&mobj, 0, sizeof(mobj));
+    cans[i]->FilterObjectConfigure(CAN_FILTER0, &fobj);
+    cans[i]->FilterMaskConfigure(CAN_FILTER0, &mobj);
+    cans[i]->FilterToFifoLink(CAN_FILTER0, true, BENCH_RX_CH);
+
+    if (cans[i]->OperationModeSwitch(fd ? CAN_NORMAL_MODE : CAN_CLASSIC_MODE) < 0) {
+      fprintf(stderr, "node %u does not leave configuration mode\n", i);
+      return 1;
+    }
+
+    memset(&node[i], 0, sizeof(node[i]));
+    node[i].can = cans[i];
+    node[i].index = i;
+    node[i].period_us = 1000000UL / rate;
+    node[i].len = len;
+    node[i].fd = fd;
+  }
+
+  // Init() runs in the main thread; from here on each controller is driven by its own
+  for (unsigned i = 0; i < nodes; i++) {
+    pthread_create(&threads[i], NULL, node_thread, &node[i]);
+  }
+
+  bus.ErrorRateSet(ppm);
+  bus.MonitorSet(on_frame);
+  bus.Start();
+
+  for (unsigned i = 0; i < nodes; i++) {
+    node[i].ready = true;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  for (unsigned s = 0; running && (s < seconds); s++) {
+    sleep(1);
+  }
+
+  running = 0;
+
+  pthread_mutex_lock(&bus_lock);
+  pthread_cond_broadcast(&bus_cond);
+  pthread_mutex_unlock(&bus_lock);
+
+  for (unsigned i = 0; i < nodes; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  MCP2517FD_VBUS_STATS stats;
+
+  bus.Stop();
+  bus.StatsGet(&stats);
+
+  uint32_t sent = 0, tx_full = 0, received = 0, latency_max = 0;
+  uint64_t latency_sum = 0;
+
+  for (unsigned i = 0; i < nodes; i++) {
+    sent += node[i].sent;
+    tx_full += node[i].tx_full;
+    received += node[i].received;
+    latency_sum += node[i].latency_sum;
+    if (node[i].latency_max > latency_max) {
+      latency_max = node[i].latency_max;
+    }
+  }
+
+  double elapsed = stats.elapsed_ns * 1e-9;
+
+  printf("nodes %u, %s, %u %s bytes at %u fps each, %.1f s\n", nodes, bittimes[bt].name, len, fd ? "FD" : "classic", rate, elapsed);
+  printf("bus: %u frames (%.0f fps), load %.1f %%, arbitration lost %u, errors %u, ack errors %u\n",
+         stats.frames, stats.frames / elapsed, 100.0 * stats.busy_ns / stats.elapsed_ns,
+         stats.arbitration_lost, stats.errors, stats.ack_errors);
+  printf("nodes: sent %u, TX FIFO full %u, received %u (expected %u)\n", sent, tx_full, received, stats.frames * (nodes - 1));
+  printf("latency: avg %.0f us, max %u us\n", received ? (double) latency_sum / received : 0.0, latency_max);
+
+  return 0;
+}
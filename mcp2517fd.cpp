@@ -9,10 +9,11 @@
 // Section: Reset
 void mcp2517fd::Reset()
 {
+  uint8_t b[2] = {(uint8_t) (cINSTRUCTION_RESET << 4), 0x00};
+
   RESET_CS();
 
-  SPI.transfer((uint8_t) (cINSTRUCTION_RESET << 4));
-  SPI.transfer(0x00);
+  SPI.transfer(b, 2);
 
   SET_CS();
 
@@ -22,143 +23,127 @@ void mcp2517fd::Reset()
 // *****************************************************************************
 // Section: SPI Access Functions
 
+// Every access is clocked out as a block: one SPI.transfer() call per buffer
+// instead of one per byte. Data follows the 2 byte instruction/address header
+// directly; the device does not insert a dummy byte on reads.
+
 uint8_t mcp2517fd::ReadByte(uint16_t address)
 {
-  uint8_t rxd;
+  uint8_t b[3] = {(uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0x00};
 
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(0x00);
-  rxd = SPI.transfer(0x00);
+  SPI.transfer(b, 3);
 
   SET_CS();
 
-  return rxd;
+  return b[2];
 }
 
 void mcp2517fd::WriteByte(uint16_t address, uint8_t txd)
 {
+  uint8_t b[3] = {(uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), txd};
+
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(txd);
+  SPI.transfer(b, 3);
 
   SET_CS();
 }
 
 uint16_t mcp2517fd::ReadWord(uint16_t address)
 {
-  union {
-    uint16_t val;
-    uint8_t bytes[2];
-  } rxd;
+  uint16_t rxd;
+  uint8_t b[4] = {(uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0x00, 0x00};
 
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(0x00);
-
-  for (uint8_t i = 0; i < sizeof(uint16_t); ++i) {
-    rxd.bytes[i] = SPI.transfer(0x00);
-  }
+  SPI.transfer(b, 4);
 
   SET_CS();
 
-  return rxd.val;
+  memcpy ( &rxd, &b[2], sizeof(rxd) );
+
+  return rxd;
 }
 
 void mcp2517fd::WriteWord(uint16_t address, uint16_t txd)
 {
-  union {
-    uint16_t val;
-    uint8_t bytes[2];
-  } tx;
+  uint8_t b[4] = {(uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0x00, 0x00};
 
-  tx.val = txd;
+  memcpy ( &b[2], &txd, sizeof(txd) );
 
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-
-  for (uint8_t i = 0; i < sizeof(uint16_t); ++i) {
-    SPI.transfer(tx.bytes[i]);
-  }
+  SPI.transfer(b, 4);
 
   SET_CS();
 }
 
 uint32_t mcp2517fd::ReadDWord(uint16_t address)
 {
-  union {
-    uint32_t val;
-    uint8_t bytes[4];
-  } rxd;
+  uint32_t rxd;
+  uint8_t b[6] = {(uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0x00, 0x00, 0x00, 0x00};
 
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(0x00);
-
-  for (uint8_t i = 0; i < sizeof(uint32_t); ++i) {
-    rxd.bytes[i] = SPI.transfer(0x00);
-  }
+  SPI.transfer(b, 6);
 
   SET_CS();
 
-  return rxd.val;
+  memcpy ( &rxd, &b[2], sizeof(rxd) );
+
+  return rxd;
 }
 
 void mcp2517fd::WriteDWord(uint16_t address, uint32_t txd)
 {
-  union {
-    uint32_t val;
-    uint8_t bytes[4];
-  } tx;
+  uint8_t b[6] = {(uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0x00, 0x00, 0x00, 0x00};
 
-  tx.val = txd;
+  memcpy ( &b[2], &txd, sizeof(txd) );
 
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-
-  for (uint8_t i = 0; i < sizeof(uint32_t); ++i) {
-    SPI.transfer(tx.bytes[i]);
-  }
+  SPI.transfer(b, 6);
 
   SET_CS();
 }
 
 void mcp2517fd::ReadByteArray(uint16_t address, uint8_t *rxd, uint16_t nBytes)
 {
+  uint8_t b[2] = {(uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF)};
+
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(0x00);
+  SPI.transfer(b, 2);
 
-  for (uint8_t i = 0; i < nBytes; ++i) {
-    *(rxd + i) = SPI.transfer(0x00);
-  }
+  // Clock the data straight into the caller's buffer
+  SPI.transfer(rxd, nBytes);
 
   SET_CS();
 }
 
 void mcp2517fd::WriteByteArray(uint16_t address, uint8_t *txd, uint16_t nBytes)
 {
+  uint16_t n = 2;
+
+  spiTransmitBuffer[0] = (uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF));
+  spiTransmitBuffer[1] = (uint8_t) (address & 0xFF);
+
   RESET_CS();
 
-  SPI.transfer((uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
+  // SPI.transfer() overwrites its buffer, so stage the data in chunks
+  for (uint16_t i = 0; i < nBytes; ++i) {
+    spiTransmitBuffer[n++] = txd[i];
 
-  for (uint8_t i = 0; i < nBytes; ++i) {
-    SPI.transfer(*(txd + i));
+    if (n == SPI_DEFAULT_BUFFER_LENGTH) {
+      SPI.transfer(spiTransmitBuffer, n);
+      n = 0;
+    }
+  }
+
+  if (n) {
+    SPI.transfer(spiTransmitBuffer, n);
   }
 
   SET_CS();
@@ -171,18 +156,17 @@ void mcp2517fd::WriteByteSafe(uint16_t address, uint8_t txd)
     uint8_t bytes[2];
   } crc;
 
-  uint8_t spiTransmitBuffer[3] = {(uint8_t) ((cINSTRUCTION_WRITE_SAFE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), txd};
+  uint8_t spiTransmitBuffer[5] = {(uint8_t) ((cINSTRUCTION_WRITE_SAFE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), txd, 0, 0};
 
   //calc CRC
   crc.result = CalculateCRC16(spiTransmitBuffer, 3);
 
+  spiTransmitBuffer[3] = crc.bytes[1];
+  spiTransmitBuffer[4] = crc.bytes[0];
+
   RESET_CS();
 
-  SPI.transfer(spiTransmitBuffer[0]);
-  SPI.transfer(spiTransmitBuffer[1]);
-  SPI.transfer(spiTransmitBuffer[2]);
-  SPI.transfer(crc.bytes[1]);
-  SPI.transfer(crc.bytes[0]);
+  SPI.transfer(spiTransmitBuffer, 5);
 
   SET_CS();
 }
@@ -194,36 +178,27 @@ void mcp2517fd::WriteDWordSafe(uint16_t address, uint32_t txd)
     uint8_t bytes[2];
   } crc;
 
-  uint8_t spiTransmitBuffer[6] = {(uint8_t) ((cINSTRUCTION_WRITE_SAFE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0, 0, 0, 0};
+  uint8_t spiTransmitBuffer[8] = {(uint8_t) ((cINSTRUCTION_WRITE_SAFE << 4) + ((address >> 8) & 0xF)), (uint8_t) (address & 0xFF), 0, 0, 0, 0, 0, 0};
 
   memcpy ( &spiTransmitBuffer[2], &txd, sizeof(txd) );
 
   //calc CRC
   crc.result = CalculateCRC16(spiTransmitBuffer, 6);
 
-  RESET_CS();
+  spiTransmitBuffer[6] = crc.bytes[1];
+  spiTransmitBuffer[7] = crc.bytes[0];
 
-  for (uint8_t i = 0; i < 6; ++i) {
-    SPI.transfer(spiTransmitBuffer[i]);
-  }
+  RESET_CS();
 
-  SPI.transfer(crc.bytes[1]);
-  SPI.transfer(crc.bytes[0]);
+  SPI.transfer(spiTransmitBuffer, 8);
 
   SET_CS();
 }
 
 uint8_t mcp2517fd::ReadByteArrayWithCRC(uint16_t address, uint8_t *rxd, uint16_t nBytes, bool fromRam)
 {
-  union {
-    uint16_t result;
-    uint8_t bytes[2];
-  } crc;
-
   uint8_t spiBuffer[nBytes + 5]; //first two bytes for sending command & address, third for size, last two bytes for CRC
 
-  RESET_CS();
-
   // Compose command
   spiBuffer[0] = (uint8_t) ((cINSTRUCTION_READ_CRC << 4) + ((address >> 8) & 0xF));
   spiBuffer[1] = (uint8_t) (address & 0xFF);
@@ -233,15 +208,11 @@ uint8_t mcp2517fd::ReadByteArrayWithCRC(uint16_t address, uint8_t *rxd, uint16_t
     spiBuffer[2] = nBytes;
   }
 
-  SPI.transfer(spiBuffer[0]);
-  SPI.transfer(spiBuffer[1]);
-  SPI.transfer(spiBuffer[2]);
+  memset ( &spiBuffer[3], 0, nBytes + 2 );
 
-  SPI.transfer(0x00);
+  RESET_CS();
 
-  for (uint8_t i = 3; i < nBytes + 5; i++) {
-    spiBuffer[i] = SPI.transfer(0x00);
-  }
+  SPI.transfer(spiBuffer, nBytes + 5);
 
   SET_CS();
 
@@ -249,17 +220,21 @@ uint8_t mcp2517fd::ReadByteArrayWithCRC(uint16_t address, uint8_t *rxd, uint16_t
   uint16_t crcFromSpiSlave = (uint16_t) (spiBuffer[nBytes + 3] << 8) + (uint16_t) (spiBuffer[nBytes + 4]);
 
   // Use the buffer to calculate CRC
+  // The command bytes were overwritten by the transfer, so restore them first
+  spiBuffer[0] = (uint8_t) ((cINSTRUCTION_READ_CRC << 4) + ((address >> 8) & 0xF));
+  spiBuffer[1] = (uint8_t) (address & 0xFF);
+  spiBuffer[2] = fromRam ? (nBytes >> 2) : nBytes;
+
   uint16_t crcAtController = CalculateCRC16(spiBuffer, nBytes + 3);
 
   // Compare CRC readings
-  if (crcFromSpiSlave == crcAtController) {
-    return 1;
-  }
-  else {
+  if (crcFromSpiSlave != crcAtController) {
     return 0;
   }
 
   memcpy ( rxd, &spiBuffer[3], nBytes );
+
+  return 1;
 }
 
 void mcp2517fd::WriteByteArrayWithCRC(uint16_t address, uint8_t *txd, uint16_t nBytes, bool fromRam)
@@ -269,7 +244,7 @@ void mcp2517fd::WriteByteArrayWithCRC(uint16_t address, uint8_t *txd, uint16_t n
     uint8_t bytes[2];
   } crc;
 
-  uint8_t spiTransmitBuffer[nBytes + 3];
+  uint8_t spiTransmitBuffer[nBytes + 5];
 
   spiTransmitBuffer[0] = (uint8_t) ((cINSTRUCTION_WRITE_CRC << 4) + ((address >> 8) & 0xF));
   spiTransmitBuffer[1] = (uint8_t) (address & 0xFF);
@@ -284,62 +259,27 @@ void mcp2517fd::WriteByteArrayWithCRC(uint16_t address, uint8_t *txd, uint16_t n
   //calc CRC
   crc.result = CalculateCRC16(spiTransmitBuffer, nBytes + 3);
 
-  RESET_CS();
+  spiTransmitBuffer[nBytes + 3] = crc.bytes[1];
+  spiTransmitBuffer[nBytes + 4] = crc.bytes[0];
 
-  for (uint8_t i = 0; i < nBytes + 3; ++i) {
-    SPI.transfer(spiTransmitBuffer[i]);
-  }
+  RESET_CS();
 
-  SPI.transfer(crc.bytes[1]);
-  SPI.transfer(crc.bytes[0]);
+  SPI.transfer(spiTransmitBuffer, nBytes + 5);
 
   SET_CS();
 }
 
 void mcp2517fd::ReadDWordArray(uint16_t address, uint32_t *rxd, uint16_t nWords)
 {
-  union {
-    uint32_t val;
-    uint8_t bytes[4];
-  } dword;
-
-  RESET_CS();
-
-  SPI.transfer((uint8_t) ((cINSTRUCTION_READ << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-  SPI.transfer(0x00);
-
-  for (uint16_t i = 0; i < nWords; ++i) {
-    for (uint8_t j = 0; j < sizeof(uint32_t); ++j) {
-      dword.bytes[j] = SPI.transfer(0x00);
-    }
-    *(rxd + i) = dword.val;
-  }
-
-  SET_CS();
+  // RAM and SFRs are little endian, like the MCU
+  ReadByteArray(address, (uint8_t*) rxd, nWords * sizeof(uint32_t));
 }
 
 void mcp2517fd::WriteDWordArray(uint16_t address, uint32_t *txd, uint16_t nWords)
 {
-  union {
-    uint32_t val;
-    uint8_t bytes[4];
-  } dword;
-
-  RESET_CS();
-
-  SPI.transfer((uint8_t) ((cINSTRUCTION_WRITE << 4) + ((address >> 8) & 0xF)));
-  SPI.transfer((uint8_t) (address & 0xFF));
-
-  for (uint16_t i = 0; i < nWords; ++i) {
-    dword.val = *(txd + i);
-    for (uint8_t j = 0; j < sizeof(uint32_t); ++j) {
-      SPI.transfer(dword.bytes[j]);
-    }
-  }
-
-  SET_CS();
+  WriteByteArray(address, (uint8_t*) txd, nWords * sizeof(uint32_t));
 }
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: Configuration
@@ -402,46 +342,24 @@ void mcp2517fd::OperationModeSelect(CAN_OPERATION_MODE opMode)
 
 CAN_OPERATION_MODE mcp2517fd::OperationModeGet()
 {
-  CAN_OPERATION_MODE mode = CAN_INVALID_MODE;
+  // OPMOD sits in bits 5..7 of the third CiCON byte; its codes are the enum values
+  return (CAN_OPERATION_MODE) ((ReadByte(cREGADDR_CiCON + 2) >> 5) & 0x7);
+}
 
-  // Read Opmode
-  uint8_t d = ReadByte(cREGADDR_CiCON + 3);
+int32_t mcp2517fd::OperationModeSwitch(CAN_OPERATION_MODE opMode, uint32_t timeout_us)
+{
+  unsigned long start = micros();
 
-  // Get Opmode bits
-  d = (d >> 5) & 0x7;
+  OperationModeSelect(opMode);
 
-  // Decode Opmode
-  switch (d) {
-    case CAN_NORMAL_MODE:
-      mode = CAN_NORMAL_MODE;
-      break;
-    case CAN_SLEEP_MODE:
-      mode = CAN_SLEEP_MODE;
-      break;
-    case CAN_INTERNAL_LOOPBACK_MODE:
-      mode = CAN_INTERNAL_LOOPBACK_MODE;
-      break;
-    case CAN_EXTERNAL_LOOPBACK_MODE:
-      mode = CAN_EXTERNAL_LOOPBACK_MODE;
-      break;
-    case CAN_LISTEN_ONLY_MODE:
-      mode = CAN_LISTEN_ONLY_MODE;
-      break;
-    case CAN_CONFIGURATION_MODE:
-      mode = CAN_CONFIGURATION_MODE;
-      break;
-    case CAN_CLASSIC_MODE:
-      mode = CAN_CLASSIC_MODE;
-      break;
-    case CAN_RESTRICTED_MODE:
-      mode = CAN_RESTRICTED_MODE;
-      break;
-    default:
-      mode = CAN_INVALID_MODE;
-      break;
+  // One byte per poll: the shortest read the controller allows
+  while (((ReadByte(cREGADDR_CiCON + 2) >> 5) & 0x7) != opMode) {
+    if (micros() - start > timeout_us) {
+      return -1;
+    }
   }
 
-  return mode;
+  return micros() - start;
 }
 
 // *****************************************************************************
@@ -451,7 +369,7 @@ void mcp2517fd::TransmitChannelConfigure(CAN_TX_FIFO_CONFIG* config, CAN_FIFO_CH
 {
   // Setup FIFO
   REG_CiFIFOCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
   ciFifoCon.txBF.TxEnable = 1;
   ciFifoCon.txBF.FifoSize = config->FifoSize;
   ciFifoCon.txBF.PayLoadSize = config->PayLoadSize;
@@ -467,7 +385,7 @@ void mcp2517fd::TransmitChannelConfigure(CAN_TX_FIFO_CONFIG* config, CAN_FIFO_CH
 void mcp2517fd::TransmitChannelConfigureObjectReset(CAN_TX_FIFO_CONFIG* config)
 {
   REG_CiFIFOCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
 
   config->RTREnable = ciFifoCon.txBF.RTREnable;
   config->TxPriority = ciFifoCon.txBF.TxPriority;
@@ -483,7 +401,7 @@ uint8_t mcp2517fd::TransmitQueueConfigure(CAN_TX_QUEUE_CONFIG* config)
 #else
   // Setup FIFO
   REG_CiTXQCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
 
   ciFifoCon.txBF.TxEnable = 1;
   ciFifoCon.txBF.FifoSize = config->FifoSize;
@@ -501,7 +419,7 @@ uint8_t mcp2517fd::TransmitQueueConfigure(CAN_TX_QUEUE_CONFIG* config)
 void mcp2517fd::TransmitQueueConfigureObjectReset(CAN_TX_QUEUE_CONFIG* config)
 {
   REG_CiFIFOCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
 
   config->TxPriority = ciFifoCon.txBF.TxPriority;
   config->TxAttempts = ciFifoCon.txBF.TxAttempts;
@@ -526,7 +444,7 @@ void mcp2517fd::TransmitChannelUpdate(CAN_FIFO_CHANNEL channel, bool flush)
   WriteByte(a, ciFifoCon.bytes[1]);
 }
 
-int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32_t txdNumBytes, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1, bool flush = true)
+int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32_t txdNumBytes, CAN_FIFO_CHANNEL channel, bool flush)
 {
   uint32_t fifoReg[3];
   REG_CiFIFOCON ciFifoCon;
@@ -536,7 +454,13 @@ int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32
   // Get FIFO registers
   uint16_t a = cREGADDR_CiFIFOCON + (channel * CiFIFO_OFFSET);
 
-  ReadDWordArray(a, fifoReg, 3);
+  if (crc_retries) {
+    if (!CrcRead(a, (uint8_t*) fifoReg, sizeof(fifoReg), false)) {
+      return -4;
+    }
+  } else {
+    ReadDWordArray(a, fifoReg, 3);
+  }
 
   // Check that it is a transmit buffer
   ciFifoCon.dword = fifoReg[0];
@@ -553,6 +477,9 @@ int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32
 
   // Get status
   ciFifoSta.dword = fifoReg[1];
+  if (!ciFifoSta.txBF.TxNotFullIF) {
+    return -3;
+  }
 
   // Get address
   ciFifoUa.dword = fifoReg[2];
@@ -563,6 +490,20 @@ int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32
 #endif
   a += cRAMADDR_START;
 
+  if (crc_retries) {
+    return (TransmitObjectWrite(a, txObj, txd, txdNumBytes) && CrcFifoUpdate(channel, flush)) ? 1 : -4;
+  }
+
+  TransmitObjectWrite(a, txObj, txd, txdNumBytes);
+
+  // Set UINC and TXREQ
+  TransmitChannelUpdate(channel, flush);
+
+  return 1;
+}
+
+uint8_t mcp2517fd::TransmitObjectWrite(uint16_t a, CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32_t txdNumBytes)
+{
   uint8_t txBuffer[MAX_MSG_SIZE];
 
   txBuffer[0] = txObj->byte[0]; //not using 'for' to reduce no of instructions
@@ -588,12 +529,150 @@ int8_t mcp2517fd::TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32
     uint8_t i = txdNumBytes + 8;
 
     for (j = 0; j < n; j++) {
-      txBuffer[i + 8 + j] = 0;
+      txBuffer[i + j] = 0;
     }
   }
 
+  if (crc_retries) {
+    return CrcWrite(a, txBuffer, txdNumBytes + 8 + n, true);
+  }
+
   WriteByteArray(a, txBuffer, txdNumBytes + 8 + n);
 
+  return 1;
+}
+
+int8_t mcp2517fd::TransmitQueueLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint8_t txdNumBytes, bool flush)
+{
+#ifndef CAN_TXQUEUE_IMPLEMENTED
+  return -2;
+#else
+  uint32_t fifoReg[2];
+  REG_CiTXQSTA ciTxqSta;
+  REG_CiFIFOUA ciFifoUa;
+
+  // Check that DLC is big enough for data
+  if (DLCtoDataLength(txObj->bF.ctrl.DLC) < txdNumBytes) {
+    return -1;
+  }
+
+  // The TXQ is always a transmit queue: status and address only
+  if (crc_retries) {
+    if (!CrcRead(cREGADDR_CiTXQSTA, (uint8_t*) fifoReg, sizeof(fifoReg), false)) {
+      return -4;
+    }
+  } else {
+    ReadDWordArray(cREGADDR_CiTXQSTA, fifoReg, 2);
+  }
+
+  ciTxqSta.dword = fifoReg[0];
+  if (!ciTxqSta.txBF.TxNotFullIF) {
+    return -3;
+  }
+
+  ciFifoUa.dword = fifoReg[1];
+#ifdef USERADDRESS_TIMES_FOUR
+  uint16_t a = 4 * ciFifoUa.bF.UserAddress;
+#else
+  uint16_t a = ciFifoUa.bF.UserAddress;
+#endif
+  a += cRAMADDR_START;
+
+  if (crc_retries) {
+    return (TransmitObjectWrite(a, txObj, txd, txdNumBytes) && CrcFifoUpdate(CAN_TXQUEUE_CH0, flush)) ? 1 : -4;
+  }
+
+  TransmitObjectWrite(a, txObj, txd, txdNumBytes);
+
+  // Set UINC and TXREQ
+  TransmitChannelUpdate(CAN_TXQUEUE_CH0, flush);
+
+  return 1;
+#endif
+}
+
+void mcp2517fd::TransmitClassSet(uint8_t txClass, CAN_FIFO_CHANNEL channel)
+{
+  if (txClass < CAN_TX_CLASSES) {
+    tx_class_ch[txClass] = channel;
+  }
+}
+
+int8_t mcp2517fd::TransmitClassLoad(uint8_t txClass, CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint8_t txdNumBytes, bool flush)
+{
+  CAN_FIFO_CHANNEL channel = TransmitClassGet(txClass);
+
+#ifdef CAN_TXQUEUE_IMPLEMENTED
+  if (channel == CAN_TXQUEUE_CH0) {
+    return TransmitQueueLoad(txObj, txd, txdNumBytes, flush);
+  }
+#endif
+
+  return TransmitChannelLoad(txObj, txd, txdNumBytes, channel, flush);
+}
+
+int8_t mcp2517fd::TransmitObjectLoad(uint8_t *obj, CAN_FIFO_CHANNEL channel, bool flush)
+{
+  uint32_t fifoReg[3];
+  REG_CiFIFOCON ciFifoCon;
+  REG_CiFIFOSTA ciFifoSta;
+  REG_CiFIFOUA ciFifoUa;
+
+  // Get FIFO registers
+  uint16_t a = cREGADDR_CiFIFOCON + (channel * CiFIFO_OFFSET);
+
+  if (crc_retries) {
+    if (!CrcRead(a, (uint8_t*) fifoReg, sizeof(fifoReg), false)) {
+      return -4;
+    }
+  } else {
+    ReadDWordArray(a, fifoReg, 3);
+  }
+
+  // Check that it is a transmit buffer with room
+  ciFifoCon.dword = fifoReg[0];
+  if (!ciFifoCon.txBF.TxEnable) {
+    return -2;
+  }
+
+  // Check that the frame fits the object slot: payload sizes 8..64 are
+  // the data lengths of DLC 8..15
+  uint8_t n = DLC_DataLength[obj[4] & 0x0F];
+
+  if (n > DLC_DataLength[8 + ciFifoCon.txBF.PayLoadSize]) {
+    return -1;
+  }
+
+  ciFifoSta.dword = fifoReg[1];
+  if (!ciFifoSta.txBF.TxNotFullIF) {
+    return -3;
+  }
+
+  // Get address
+  ciFifoUa.dword = fifoReg[2];
+#ifdef USERADDRESS_TIMES_FOUR
+  a = 4 * ciFifoUa.bF.UserAddress;
+#else
+  a = ciFifoUa.bF.UserAddress;
+#endif
+  a += cRAMADDR_START;
+
+  // Header and data, rounded up to whole RAM words
+  n = 8 + ((n + 3) & ~3);
+
+  if (crc_retries) {
+    return (CrcWrite(a, obj, n, true) && CrcFifoUpdate(channel, flush)) ? 1 : -4;
+  }
+
+  obj[-2] = (uint8_t) ((cINSTRUCTION_WRITE << 4) + ((a >> 8) & 0xF));
+  obj[-1] = (uint8_t) (a & 0xFF);
+
+  RESET_CS();
+
+  SPI.transfer(obj - 2, n + 2);
+
+  SET_CS();
+
   // Set UINC and TXREQ
   TransmitChannelUpdate(channel, flush);
 
@@ -796,7 +875,7 @@ uint8_t mcp2517fd::ReceiveChannelConfigure(CAN_RX_FIFO_CONFIG* config, CAN_FIFO_
 
   // Setup FIFO
   REG_CiFIFOCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
 
   ciFifoCon.rxBF.TxEnable = 0;
   ciFifoCon.rxBF.FifoSize = config->FifoSize;
@@ -813,7 +892,7 @@ uint8_t mcp2517fd::ReceiveChannelConfigure(CAN_RX_FIFO_CONFIG* config, CAN_FIFO_
 void mcp2517fd::ReceiveChannelConfigureObjectReset(CAN_RX_FIFO_CONFIG* config)
 {
   REG_CiFIFOCON ciFifoCon;
-  ciFifoCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciFifoCon.dword = canFifoResetValues[0];
 
   config->FifoSize = ciFifoCon.rxBF.FifoSize;
   config->PayLoadSize = ciFifoCon.rxBF.PayLoadSize;
@@ -848,7 +927,13 @@ uint8_t mcp2517fd::ReceiveMessageGet(CAN_RX_MSGOBJ* rxObj, uint8_t *rxd, uint8_t
   // Get FIFO registers
   a = cREGADDR_CiFIFOCON + (channel * CiFIFO_OFFSET);
 
-  ReadDWordArray(a, fifoReg, 3);
+  if (crc_retries) {
+    if (!CrcRead(a, (uint8_t*) fifoReg, sizeof(fifoReg), false)) {
+      return 0;
+    }
+  } else {
+    ReadDWordArray(a, fifoReg, 3);
+  }
 
   // Check that it is a receive buffer
   ciFifoCon.dword = fifoReg[0];
@@ -856,8 +941,11 @@ uint8_t mcp2517fd::ReceiveMessageGet(CAN_RX_MSGOBJ* rxObj, uint8_t *rxd, uint8_t
     return 0;
   }
 
-  // Get Status
+  // Check that there is a message to read
   ciFifoSta.dword = fifoReg[1];
+  if (!ciFifoSta.rxBF.RxNotEmptyIF) {
+    return 0;
+  }
 
   // Get address
   ciFifoUa.dword = fifoReg[2];
@@ -887,7 +975,13 @@ uint8_t mcp2517fd::ReceiveMessageGet(CAN_RX_MSGOBJ* rxObj, uint8_t *rxd, uint8_t
     n = MAX_MSG_SIZE;
   }
 
-  ReadByteArray(a, ba, n);
+  if (crc_retries) {
+    if (!CrcRead(a, ba, n, true)) {
+      return 0;
+    }
+  } else {
+    ReadByteArray(a, ba, n);
+  }
 
   // Assign message header
   REG_t myReg;
@@ -925,11 +1019,128 @@ uint8_t mcp2517fd::ReceiveMessageGet(CAN_RX_MSGOBJ* rxObj, uint8_t *rxd, uint8_t
   }
 
   // UINC channel
+  if (crc_retries) {
+    return CrcFifoUpdate(channel, false);
+  }
+
   ReceiveChannelUpdate(channel);
 
   return 1;
 }
 
+uint8_t *mcp2517fd::ReceiveMessageBufferGet(CAN_RX_MSGOBJ* rxObj, CAN_FIFO_CHANNEL channel)
+{
+  uint8_t h = ReceiveObjectFetch(channel, spiReceiveBuffer);
+
+  if (!h) {
+    return NULL;
+  }
+
+  memcpy(rxObj->word, spiReceiveBuffer, 8);
+  if (h > 8) {
+    memcpy(&rxObj->word[2], &spiReceiveBuffer[8], 4);
+  } else {
+    rxObj->word[2] = 0;
+  }
+
+  return &spiReceiveBuffer[h];
+}
+
+uint8_t *mcp2517fd::ReceiveObjectRead(CAN_FIFO_CHANNEL channel, uint8_t *buf)
+{
+  // Leave room for a write instruction in front of the transmit object
+  uint8_t *obj = buf + 2;
+  uint8_t h = ReceiveObjectFetch(channel, obj);
+
+  if (!h) {
+    return NULL;
+  }
+
+  // Header over the time stamp, so it is followed by the data
+  if (h > 8) {
+    memmove(obj + 4, obj, 8);
+    obj += 4;
+  }
+
+  // Filter hit and unimplemented bits become SEQ 0; ESI stays
+  obj[5] &= 0x01;
+  obj[6] = 0;
+  obj[7] = 0;
+
+  return obj;
+}
+
+uint8_t mcp2517fd::ReceiveObjectFetch(CAN_FIFO_CHANNEL channel, uint8_t *obj)
+{
+  uint8_t h = 8;
+  uint16_t a;
+  uint32_t fifoReg[3];
+  REG_CiFIFOCON ciFifoCon;
+  REG_CiFIFOSTA ciFifoSta;
+  REG_CiFIFOUA ciFifoUa;
+
+  // Get FIFO registers
+  a = cREGADDR_CiFIFOCON + (channel * CiFIFO_OFFSET);
+
+  if (crc_retries) {
+    if (!CrcRead(a, (uint8_t*) fifoReg, sizeof(fifoReg), false)) {
+      return 0;
+    }
+  } else {
+    ReadDWordArray(a, fifoReg, 3);
+  }
+
+  // Check that it is a receive buffer holding a message
+  ciFifoCon.dword = fifoReg[0];
+  ciFifoSta.dword = fifoReg[1];
+  if (ciFifoCon.txBF.TxEnable || !ciFifoSta.rxBF.RxNotEmptyIF) {
+    return 0;
+  }
+
+  // Get address
+  ciFifoUa.dword = fifoReg[2];
+#ifdef USERADDRESS_TIMES_FOUR
+  a = 4 * ciFifoUa.bF.UserAddress;
+#else
+  a = ciFifoUa.bF.UserAddress;
+#endif
+  a += cRAMADDR_START;
+
+  if (ciFifoCon.rxBF.RxTimeStampEnable) {
+    h += 4; // Add 4 time stamp bytes
+  }
+
+  // Header and the first 8 data bytes in one access, then the rest of an
+  // FD payload; both are whole RAM words
+  uint8_t n;
+
+  if (crc_retries) {
+    if (!CrcRead(a, obj, h + 8, true)) {
+      return 0;
+    }
+
+    n = DLC_DataLength[obj[4] & 0x0F];
+    if ((n > 8) && !CrcRead(a + h + 8, &obj[h + 8], n - 8, true)) {
+      return 0;
+    }
+
+    // UINC channel
+    return CrcFifoUpdate(channel, false) ? h : 0;
+  }
+
+  ReadByteArray(a, obj, h + 8);
+
+  n = DLC_DataLength[obj[4] & 0x0F];
+  if (n > 8) {
+    ReadByteArray(a + h + 8, &obj[h + 8], n - 8);
+  }
+
+  // UINC channel
+  ReceiveChannelUpdate(channel);
+
+  return h;
+}
+
 void mcp2517fd::ReceiveChannelReset(CAN_FIFO_CHANNEL channel)
 {
   REG_CiFIFOCON ciFifoCon;
@@ -989,10 +1200,17 @@ CAN_TEF_MSGOBJ mcp2517fd::TefMessageGet()
   REG_CiTEFCON ciTefCon;
   ciTefCon.dword = fifoReg[0];
 
-  // Get status
+  // Get status: nothing to read or UINC when empty
   REG_CiTEFSTA ciTefSta;
   ciTefSta.dword = fifoReg[1];
 
+  if (!ciTefSta.bF.TEFNotEmptyIF) {
+    tefObj.dword[0] = 0;
+    tefObj.dword[1] = 0;
+    tefObj.dword[2] = 0;
+    return tefObj;
+  }
+
   // Get address
   REG_CiFIFOUA ciTefUa;
   ciTefUa.dword = fifoReg[2];
@@ -1086,7 +1304,7 @@ void mcp2517fd::TefConfigure(CAN_TEF_CONFIG* config)
 void mcp2517fd::TefConfigureObjectReset(CAN_TEF_CONFIG* config)
 {
   REG_CiTEFCON ciTefCon;
-  ciTefCon.dword = canControlResetValues[cREGADDR_CiFIFOCON / 4];
+  ciTefCon.dword = canControlResetValues[cREGADDR_CiTEFCON / 4];
 
   config->FifoSize = ciTefCon.bF.FifoSize;
   config->TimeStampEnable = ciTefCon.bF.TimeStampEnable;
@@ -1693,6 +1911,75 @@ CAN_CRC_EVENT mcp2517fd::CrcEventGet()
   return (CAN_CRC_EVENT) (crc & CAN_CRC_ALL_EVENTS);
 }
 
+uint8_t mcp2517fd::CrcRead(uint16_t address, uint8_t *rxd, uint16_t nBytes, bool fromRam)
+{
+  // Wider than crc_retries: 255 retries must still end
+  for (uint16_t i = 0; i <= crc_retries; i++) {
+    if (ReadByteArrayWithCRC(address, rxd, nBytes, fromRam)) {
+      return 1;
+    }
+
+    crc_error_count++;
+  }
+
+  return 0;
+}
+
+uint8_t mcp2517fd::CrcWrite(uint16_t address, uint8_t *txd, uint16_t nBytes, bool fromRam)
+{
+  uint8_t flags;
+
+  for (uint16_t i = 0; i <= crc_retries; i++) {
+    // Start from clear flags so that a flag set afterwards belongs to this
+    // write: repeating an accepted UINC would skip an object
+    if (!crc_flags_clear) {
+      if (!CrcRead(cREGADDR_CRC + 2, &flags, 1, false)) {
+        return 0;
+      }
+
+      if (flags & CAN_CRC_ALL_EVENTS) {
+        WriteByteSafe(cREGADDR_CRC + 2, flags & ~CAN_CRC_ALL_EVENTS);
+        continue;
+      }
+
+      crc_flags_clear = true;
+    }
+
+    if (fromRam) {
+      WriteByteArrayWithCRC(address, txd, nBytes, true);
+    } else {
+      WriteByteSafe(address, txd[0]);
+    }
+
+    // Unknown whether the write landed if the flags cannot be read
+    if (!CrcRead(cREGADDR_CRC + 2, &flags, 1, false)) {
+      crc_flags_clear = false;
+      return 0;
+    }
+
+    if (!(flags & CAN_CRC_ALL_EVENTS)) {
+      return 1;
+    }
+
+    crc_flags_clear = false;
+    crc_error_count++;
+  }
+
+  return 0;
+}
+
+uint8_t mcp2517fd::CrcFifoUpdate(CAN_FIFO_CHANNEL channel, bool flush)
+{
+  REG_CiFIFOCON ciFifoCon;
+
+  // UINC and TXREQ are set-only bits in the same place for TX and RX FIFOs
+  ciFifoCon.dword = 0;
+  ciFifoCon.txBF.UINC = 1;
+  ciFifoCon.txBF.TxRequest = flush ? 1 : 0;
+
+  return CrcWrite(cREGADDR_CiFIFOCON + (channel * CiFIFO_OFFSET) + 1, &ciFifoCon.bytes[1], 1, false);
+}
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: Time Stamp
@@ -1792,7 +2079,7 @@ CAN_OSC_STATUS mcp2517fd::OscillatorStatusGet()
   return stat;
 }
 
-void mcp2517fd::BitTimeConfigure(CAN_BITTIME_SETUP bitTime, CAN_SSP_MODE sspMode, CAN_SYSCLK_SPEED clk)
+uint8_t mcp2517fd::BitTimeConfigure(CAN_BITTIME_SETUP bitTime, CAN_SSP_MODE sspMode, CAN_SYSCLK_SPEED clk)
 {
   // Decode clk
   switch (clk) {
@@ -2665,22 +2952,26 @@ void mcp2517fd::Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo
   CAN_CONFIG config;
   CAN_TX_FIFO_CONFIG txConfig;
   CAN_RX_FIFO_CONFIG rxConfig;
+#ifdef CAN_TXQUEUE_IMPLEMENTED
+  CAN_TX_QUEUE_CONFIG txqConfig;
+#endif
 
-  #ifndef SPI_Init
-  #define SPI_Init
-  //SPI clock speed:speed, Data Shift:MSB First, Data Clock Idle: SPI_MODE0
-  SPI.beginTransaction(SPISettings(spi_speed, MSBFIRST, SPI_MODE0));
-  #endif
+  if (!shared_bus) {
+    //SPI clock speed:speed, Data Shift:MSB First, Data Clock Idle: SPI_MODE0
+    SPI.beginTransaction(spi_settings);
+  }
   
   pinMode(cs_pin, OUTPUT);
   digitalWrite(cs_pin,HIGH);
   pinMode(intr_pin, INPUT_PULLUP);
 
+#ifndef MCP2517FD_PORTLESS_IO
   cs_mask = digitalPinToBitMask(cs_pin);
   cs_reg = portOutputRegister(digitalPinToPort(cs_pin));
   
   intr_mask = digitalPinToBitMask(intr_pin);
   intr_reg = portInputRegister(digitalPinToPort(intr_pin));
+#endif
 
   // Reset device
   Reset();
@@ -2693,12 +2984,25 @@ void mcp2517fd::Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo
   ConfigureObjectReset(&config);
   config.IsoCrcEnable = ISO_CRC;
   config.StoreInTEF = 0;
+#ifdef CAN_TXQUEUE_IMPLEMENTED
+  config.TXQEnable = 1;
+#endif
 
   Configure(&config);
 
+  // Setup TXQ: the controller picks the lowest ID queued
+#ifdef CAN_TXQUEUE_IMPLEMENTED
+  TransmitQueueConfigureObjectReset(&txqConfig);
+  txqConfig.FifoSize = 3;
+  txqConfig.PayLoadSize = CAN_PLSIZE_64;
+  txqConfig.TxPriority = 1;
+
+  TransmitQueueConfigure(&txqConfig);
+#endif
+
   // Setup TX FIFO
   TransmitChannelConfigureObjectReset(&txConfig);
-  txConfig.FifoSize = 7;
+  txConfig.FifoSize = 3;
   txConfig.PayLoadSize = CAN_PLSIZE_64;
   txConfig.TxPriority = 1;
 
@@ -2722,8 +3026,8 @@ void mcp2517fd::Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo
   TransmitChannelEventEnable(CAN_TX_FIFO_NOT_FULL_EVENT, tx_fifo_ch);
   ReceiveChannelEventEnable(CAN_RX_FIFO_NOT_EMPTY_EVENT, rx_fifo_ch);
 
-  ModuleEventEnable(CAN_TX_EVENT | CAN_RX_EVENT);
+  ModuleEventEnable((CAN_MODULE_EVENT) (CAN_TX_EVENT | CAN_RX_EVENT));
 
   // Select Normal Mode
   OperationModeSelect(CAN_NORMAL_MODE);
-}
+}
@@ -6,7 +6,7 @@
   ver1.0 - Newly created
 */
 #ifndef	MCP2517FD_H
-#define	MCP2517FD
+#define	MCP2517FD_H
 
 #include "Arduino.h"
 #include "drv_canfdspi_defines.h"
@@ -14,6 +14,8 @@
 #include "SPI.h"
 
 #define SPI_DEFAULT_BUFFER_LENGTH 128
+#define CAN_TX_CLASSES 8   // message classes routed by TransmitClassLoad()
+#define CAN_OBJECT_BUFFER_SIZE (2 + 4 + 8 + MAX_DATA_BYTES)   // buffer of ReceiveObjectRead()
 
 #ifdef ARDUINO_ARCH_AVR
   #define REGTYPE uint8_t   // AVR uses 8-bit registers
@@ -21,6 +23,10 @@
   #define REGTYPE uint32_t
 #endif
 
+// Define MCP2517FD_PORTLESS_IO on targets without direct port register access
+// (e.g. the Linux host build in extras/linux): CS and INT then go through
+// digitalWrite()/digitalRead().
+
 class mcp2517fd {
   public:
     // *****************************************************************************
@@ -140,6 +146,15 @@ class mcp2517fd {
 
     CAN_OPERATION_MODE OperationModeGet();
 
+    // *****************************************************************************
+    //! Switch Operation Mode and wait for the controller to get there
+    /*!
+       Returns the transition time in us, -1 on timeout.
+       Leaving normal mode waits for a frame in progress to complete.
+    */
+
+    int32_t OperationModeSwitch(CAN_OPERATION_MODE opMode, uint32_t timeout_us = 10000);
+
 
     // *****************************************************************************
     // *****************************************************************************
@@ -178,10 +193,65 @@ class mcp2517fd {
     /*!
        Loads data into Transmit channel
        Requests transmission, if flush==true
+       Returns 1 on success, -1 if the DLC is too small for the data,
+       -2 if channel is not a transmit channel, -3 if it is full,
+       -4 if SPI CRC retries ran out (see SpiCrcRetriesSet())
     */
 
     int8_t TransmitChannelLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32_t txdNumBytes, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1, bool flush = true);
 
+    // *****************************************************************************
+    //! TX Queue Load
+    /*!
+       Fast path of TransmitChannelLoad() for the TXQ: reads only its status
+       and user address. Frames in the TXQ are sent in ID order, lowest first.
+       Returns 1 on success, -1 if the DLC is too small for the data,
+       -2 if the TXQ is not implemented, -3 if it is full, -4 as for
+       TransmitChannelLoad()
+    */
+
+    int8_t TransmitQueueLoad(CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint8_t txdNumBytes, bool flush = true);
+
+    // *****************************************************************************
+    //! Route a message class to a transmit channel
+    /*!
+       channel is CAN_TXQUEUE_CH0 or a FIFO configured for transmit, whose
+       TxPriority ranks the class against the other channels.
+       All classes start on the TXQ.
+    */
+
+    void TransmitClassSet(uint8_t txClass, CAN_FIFO_CHANNEL channel);
+
+    // *****************************************************************************
+    //! Transmit channel of a message class
+    inline CAN_FIFO_CHANNEL TransmitClassGet(uint8_t txClass)
+    {
+      return (txClass < CAN_TX_CLASSES) ? tx_class_ch[txClass] : CAN_TXQUEUE_CH0;
+    }
+
+    // *****************************************************************************
+    //! Load a frame into the channel of its message class
+    /*!
+       Returns as TransmitChannelLoad()
+    */
+
+    int8_t TransmitClassLoad(uint8_t txClass, CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint8_t txdNumBytes, bool flush = true);
+
+    // *****************************************************************************
+    //! Load a message object as returned by ReceiveObjectRead()
+    /*!
+       obj is a transmit object (header followed by data) with two writable
+       bytes in front of it; instruction and address go there and the object
+       leaves in a single SPI transfer, without being copied. The buffer is
+       overwritten by the transfer. With SPI CRC on (SpiCrcRetriesSet()) the
+       object is copied and written with WRITE_CRC instead.
+       Returns 1 on success, -1 if the frame is longer than the payload size
+       of channel, -2 if channel is not a transmit channel, -3 if it is full,
+       -4 if SPI CRC retries ran out
+    */
+
+    int8_t TransmitObjectLoad(uint8_t *obj, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1, bool flush = true);
+
     // *****************************************************************************
     //! TX Channel Flush
     /*!
@@ -286,10 +356,38 @@ class mcp2517fd {
     //! Get Received Message
     /*!
        Reads Received message from channel
+       Returns 1 on success, 0 if channel is empty, is not a receive FIFO or
+       SPI CRC retries ran out; the message then stays in the FIFO.
     */
 
     uint8_t ReceiveMessageGet(CAN_RX_MSGOBJ* rxObj, uint8_t *rxd, uint8_t nBytes, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
 
+    // *****************************************************************************
+    //! Get Received Message without copying its data
+    /*!
+       Reads the next message of channel into the driver's receive buffer;
+       frames of up to 8 data bytes take a single RAM read.
+       Returns a pointer to the message data, valid until the next call, or
+       NULL if channel is empty, not a receive FIFO or SPI CRC retries ran
+       out; the message then stays in the FIFO.
+    */
+
+    uint8_t *ReceiveMessageBufferGet(CAN_RX_MSGOBJ* rxObj, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Read the next message of a receive FIFO as a transmit object
+    /*!
+       Reads the message object into buf (CAN_OBJECT_BUFFER_SIZE bytes) and
+       turns it into a transmit object in place: the time stamp is dropped by
+       moving the header over it and the filter hit is cleared, leaving SEQ 0.
+       ESI is kept, so a controller with EsiInGatewayMode passes it on.
+       Returns a pointer to the object for TransmitObjectLoad() of this or
+       another controller, or NULL if channel is empty, not a receive FIFO or
+       SPI CRC retries ran out.
+    */
+
+    uint8_t *ReceiveObjectRead(CAN_FIFO_CHANNEL channel, uint8_t *buf);
+
     // *****************************************************************************
     //! Receive FIFO Reset
 
@@ -317,6 +415,7 @@ class mcp2517fd {
     //! Get Transmit Event FIFO Message
     /*!
        Reads Transmit Event FIFO message
+       Returns an all zero object, leaving the FIFO alone, if it is empty
     */
 
     CAN_TEF_MSGOBJ TefMessageGet();
@@ -693,6 +792,32 @@ class mcp2517fd {
       return ReadWord(cREGADDR_CRC);
     }
 
+    // *****************************************************************************
+    //! Protect the message paths with SPI CRC
+    /*!
+       With retries > 0, TransmitChannelLoad(), TransmitQueueLoad(),
+       TransmitObjectLoad(), ReceiveMessageGet(), ReceiveMessageBufferGet()
+       and ReceiveObjectRead() read FIFO registers and objects with READ_CRC,
+       write objects with WRITE_CRC and UINC/TXREQ with WRITE_SAFE. A read
+       failing its CRC is repeated and a write the controller rejected
+       (CRCERRIF/FERRIF) is sent again, up to retries times each; then the
+       call fails with the FIFO untouched. Costs two short reads per write.
+       0 (default) keeps the plain accesses.
+    */
+
+    inline void SpiCrcRetriesSet(uint8_t retries)
+    {
+      crc_retries = retries;
+      crc_flags_clear = false;
+    }
+
+    // *****************************************************************************
+    //! CRC mismatches and rejected writes seen on the protected paths
+    inline uint32_t SpiCrcErrorCount()
+    {
+      return crc_error_count;
+    }
+
 
     // *****************************************************************************
     // *****************************************************************************
@@ -762,7 +887,7 @@ class mcp2517fd {
     // *****************************************************************************
     //! Configure Bit Time registers (based on CAN clock speed)
 
-    void BitTimeConfigure(CAN_BITTIME_SETUP bitTime, CAN_SSP_MODE sspMode, CAN_SYSCLK_SPEED clk);
+    uint8_t BitTimeConfigure(CAN_BITTIME_SETUP bitTime, CAN_SSP_MODE sspMode, CAN_SYSCLK_SPEED clk);
 
     // *****************************************************************************
     //! Configure Nominal bit time for 40MHz system clock
@@ -874,30 +999,52 @@ class mcp2517fd {
 
 	// *****************************************************************************
     //! Hardware Initialisation Routine
+    /*!
+       Sets up the TXQ (4 objects), the transmit FIFO tx_fifo_ch (4 objects)
+       and the receive FIFO rx_fifo_ch (16 objects), all with 64 byte payloads.
+    */
     void Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo_ch = CAN_FIFO_CH1, CAN_FIFO_CHANNEL rx_fifo_ch = CAN_FIFO_CH2);
 	
 	// *****************************************************************************
     //! De-assert CS
+    /*!
+       On a shared bus every transaction claims the SPI with this device's own settings
+    */
     inline void RESET_CS()
     {
+      if (shared_bus) {
+        SPI.beginTransaction(spi_settings);
+      }
+#ifdef MCP2517FD_PORTLESS_IO
+      digitalWrite(cs_pin, LOW);
+#else
 	    *cs_reg &= ~cs_mask;
-      //digitalWrite(cs_pin, LOW);
+#endif
     }
 
     // *****************************************************************************
     //! Assert CS
     inline void SET_CS()
     {	  
+#ifdef MCP2517FD_PORTLESS_IO
+      digitalWrite(cs_pin, HIGH);
+#else
 	    *cs_reg |= cs_mask;
-	    //digitalWrite(cs_pin, HIGH);
+#endif
+      if (shared_bus) {
+        SPI.endTransaction();
+      }
     }
 	
 	// *****************************************************************************
     //! Read int1 pin on MCP2517FD
     inline uint8_t available()
     {  
+#ifdef MCP2517FD_PORTLESS_IO
+      return (digitalRead(intr_pin) ? 0 : 1);
+#else
 	    return ((*intr_reg & intr_mask) ? 0 : 1); //int1 LOW == Data available
-	    //return (digitalRead(intr_pin) ? 0 : 1);
+#endif
     }
 
     // *****************************************************************************
@@ -907,31 +1054,69 @@ class mcp2517fd {
       cs_pin = cs;
       intr_pin = intr;
       spi_speed = spi;
+      spi_settings = SPISettings(spi, MSBFIRST, SPI_MODE0);
+      shared_bus = false;
+      crc_retries = 0;
+      crc_flags_clear = false;
+      crc_error_count = 0;
+
+      for (uint8_t i = 0; i < CAN_TX_CLASSES; i++) {
+        tx_class_ch[i] = CAN_TXQUEUE_CH0;
+      }
     }
 
     // *****************************************************************************
     //! Deconstructor
+    /*!
+       A device attached to an mcp2517fd_bus leaves the SPI bus to the bus manager
+    */
     ~mcp2517fd()
     {
-      #ifdef SPI_Init
-      #undef SPI_Init
-      SPI.end();
-      #endif
+      if (!shared_bus) {
+        SPI.end();
+      }
     }
     // *****************************************************************************
 
   private:
+    friend class mcp2517fd_bus;
+
     // *****************************************************************************
     // *****************************************************************************
     // Section: Private Variables
 
+    // *****************************************************************************
+    //! Write a transmit object at RAM address a
+    uint8_t TransmitObjectWrite(uint16_t a, CAN_TX_MSGOBJ* txObj, uint8_t *txd, uint32_t txdNumBytes);
+
+    // *****************************************************************************
+    //! Read the next object of a receive FIFO into obj and set UINC
+    /*!
+       Shared by ReceiveMessageBufferGet() and ReceiveObjectRead().
+       Returns the header length (8, 12 with time stamp), 0 if nothing was read.
+    */
+
+    uint8_t ReceiveObjectFetch(CAN_FIFO_CHANNEL channel, uint8_t *obj);
+
+    // *****************************************************************************
+    //! SPI CRC protected accesses with retries; return 1 on success
+    uint8_t CrcRead(uint16_t address, uint8_t *rxd, uint16_t nBytes, bool fromRam);
+    uint8_t CrcWrite(uint16_t address, uint8_t *txd, uint16_t nBytes, bool fromRam);
+    uint8_t CrcFifoUpdate(CAN_FIFO_CHANNEL channel, bool flush);
+
     uint8_t spiTransmitBuffer[SPI_DEFAULT_BUFFER_LENGTH];
     uint8_t spiReceiveBuffer[SPI_DEFAULT_BUFFER_LENGTH];
     unsigned long spi_speed;
+    SPISettings spi_settings;
+    bool shared_bus;
 	uint8_t cs_pin;
     uint8_t intr_pin;
 	REGTYPE cs_mask, intr_mask;
 	volatile REGTYPE *cs_reg, *intr_reg;
+    CAN_FIFO_CHANNEL tx_class_ch[CAN_TX_CLASSES];
+    uint8_t crc_retries;
+    bool crc_flags_clear;     // CRCERRIF/FERRIF known clear
+    uint32_t crc_error_count;
 };
 
-#endif
+#endif
@@ -0,0 +1,243 @@
+/*
+  mcp2517fd_bus.cpp - Shared SPI bus manager for several mcp2517fd controllers
+*/
+#include "mcp2517fd_bus.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_bus::Begin()
+{
+  SPI.begin();
+}
+
+void mcp2517fd_bus::End()
+{
+  SPI.end();
+}
+
+int8_t mcp2517fd_bus::Attach(mcp2517fd &dev, uint8_t priority, CAN_FIFO_CHANNEL rx_fifo_ch)
+{
+  if (device_count >= MCP2517FD_BUS_MAX_DEVICES) {
+    return -1;
+  }
+
+  // Every transaction of this device now carries its own SPI settings
+  dev.shared_bus = true;
+
+  // Keep devices sorted by priority, equal priorities in attach order
+  uint8_t i = device_count;
+
+  while ((i > 0) && (devices[i - 1].priority > priority)) {
+    devices[i] = devices[i - 1];
+    i--;
+  }
+
+  devices[i].dev = &dev;
+  devices[i].id = device_count;
+  devices[i].priority = priority;
+  devices[i].rx_fifo_ch = rx_fifo_ch;
+  devices[i].handler = NULL;
+  devices[i].context = NULL;
+
+  // Entries have moved: PendingGet() maps the ports again
+  mapped = false;
+
+  return device_count++;
+}
+
+void mcp2517fd_bus::Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo_ch)
+{
+  for (uint8_t i = 0; i < device_count; i++) {
+    devices[i].dev->Init(selectedBitTime, tx_fifo_ch, devices[i].rx_fifo_ch);
+  }
+}
+
+void mcp2517fd_bus::SharedInterruptConfigure(uint8_t pin)
+{
+  for (uint8_t i = 0; i < device_count; i++) {
+    devices[i].dev->GpioInterruptPinsOpenDrainConfigure(GPIO_OPEN_DRAIN);
+  }
+
+  pinMode(pin, INPUT_PULLUP);
+
+#ifdef MCP2517FD_PORTLESS_IO
+  shared_intr_pin = pin;
+#endif
+  shared_intr_mask = digitalPinToBitMask(pin);
+  shared_intr_reg = portInputRegister(digitalPinToPort(pin));
+}
+
+void mcp2517fd_bus::PortMapBuild()
+{
+  port_count = 0;
+
+#ifndef MCP2517FD_PORTLESS_IO
+  // From the pin numbers, so controllers initialised one by one (or not yet) map too
+  for (uint8_t i = 0; i < device_count; i++) {
+    uint8_t pin = devices[i].dev->intr_pin;
+    volatile REGTYPE *reg = portInputRegister(digitalPinToPort(pin));
+    uint8_t p = 0;
+
+    while ((p < port_count) && (ports[p] != reg)) {
+      p++;
+    }
+
+    if (p == port_count) {
+      ports[port_count++] = reg;
+    }
+
+    devices[i].port = p;
+    devices[i].mask = digitalPinToBitMask(pin);
+  }
+#endif
+
+  mapped = true;
+}
+
+void mcp2517fd_bus::HandlerSet(uint8_t id, mcp2517fd_bus_handler handler, void *context)
+{
+  for (uint8_t i = 0; i < device_count; i++) {
+    if (devices[i].id == id) {
+      devices[i].handler = handler;
+      devices[i].context = context;
+      return;
+    }
+  }
+}
+
+mcp2517fd *mcp2517fd_bus::DeviceGet(uint8_t id)
+{
+  for (uint8_t i = 0; i < device_count; i++) {
+    if (devices[i].id == id) {
+      return devices[i].dev;
+    }
+  }
+
+  return NULL;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Servicing
+uint8_t mcp2517fd_bus::PendingGet()
+{
+  uint8_t pending = 0;
+
+  if (shared_intr_reg) {
+    // Shared line: nothing to do unless it is pulled low
+#ifdef MCP2517FD_PORTLESS_IO
+    if (digitalRead(shared_intr_pin)) {
+#else
+    if (*shared_intr_reg & shared_intr_mask) {
+#endif
+      return 0;
+    }
+
+    // Ask each controller whether one of its RX FIFOs is interrupting
+    for (uint8_t i = 0; i < device_count; i++) {
+      if (devices[i].dev->ModuleEventRxCodeGet() != CAN_RXCODE_NO_INT) {
+        pending |= (1 << devices[i].id);
+      }
+    }
+
+    return pending;
+  }
+
+#ifdef MCP2517FD_PORTLESS_IO
+  // No port registers: read each pin
+  for (uint8_t i = 0; i < device_count; i++) {
+    if (devices[i].dev->available()) {
+      pending |= (1 << devices[i].id);
+    }
+  }
+#else
+  if (!mapped) {
+    PortMapBuild();
+  }
+
+  // Sample every port once
+  REGTYPE sample[MCP2517FD_BUS_MAX_DEVICES];
+
+  for (uint8_t p = 0; p < port_count; p++) {
+    sample[p] = *ports[p];
+  }
+
+  // Decode: INT low == service needed
+  for (uint8_t i = 0; i < device_count; i++) {
+    if (!(sample[devices[i].port] & devices[i].mask)) {
+      pending |= (1 << devices[i].id);
+    }
+  }
+#endif
+
+  return pending;
+}
+
+uint8_t mcp2517fd_bus::Service()
+{
+  uint8_t serviced = 0;
+  uint8_t pending = PendingGet();
+
+  // Dispatch only to asserted devices, in priority order
+  for (uint8_t i = 0; (i < device_count) && pending; i++) {
+    DEVICE_ENTRY *e = &devices[i];
+    uint8_t bit = (1 << e->id);
+
+    if (!(pending & bit)) {
+      continue;
+    }
+
+    pending &= ~bit;
+
+    if (e->handler) {
+      e->handler(*e->dev, e->id, e->context);
+      serviced++;
+    }
+  }
+
+  return serviced;
+}
+
+uint16_t mcp2517fd_bus::Drain(mcp2517fd_bus_rx_handler handler, void *context, uint16_t budget)
+{
+  uint16_t drained = 0;
+  uint8_t idle = 0;
+  uint8_t i = rr_next;
+
+  if (device_count == 0) {
+    return 0;
+  }
+
+  if (i >= device_count) {
+    i = 0;
+  }
+
+  // Stop after one complete round without any frame
+  while ((drained < budget) && (idle < device_count)) {
+    DEVICE_ENTRY *e = &devices[i];
+
+    if (++i >= device_count) {
+      i = 0;
+    }
+
+    // The pin read is free; only touch SPI when the RX interrupt is asserted
+    if (!e->dev->available() || !(e->dev->ReceiveChannelStatusGet(e->rx_fifo_ch) & CAN_RX_FIFO_NOT_EMPTY)) {
+      idle++;
+      continue;
+    }
+
+    if (!e->dev->ReceiveMessageGet(&rxObj, rxd, MAX_DATA_BYTES, e->rx_fifo_ch)) {
+      idle++;
+      continue;
+    }
+
+    handler(e->id, &rxObj, rxd, context);
+
+    drained++;
+    idle = 0;
+    rr_next = i;
+  }
+
+  return drained;
+}
@@ -0,0 +1,163 @@
+/*
+  mcp2517fd_bus.h - Shared SPI bus manager for several mcp2517fd controllers
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_BUS_H
+#define	MCP2517FD_BUS_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_BUS_MAX_DEVICES 8   // pending bitmap is one bit per device id
+
+// *****************************************************************************
+//! Called for a device whose interrupt pin is asserted
+
+typedef void (*mcp2517fd_bus_handler)(mcp2517fd &dev, uint8_t id, void *context);
+
+// *****************************************************************************
+//! Called for every frame drained from a device's receive FIFO
+
+typedef void (*mcp2517fd_bus_rx_handler)(uint8_t id, CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+class mcp2517fd_bus {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Start the SPI bus; the bus owns SPI from here on
+
+    void Begin();
+
+    // *****************************************************************************
+    //! Release the SPI bus
+
+    void End();
+
+    // *****************************************************************************
+    //! Attach a controller
+    /*!
+       priority: 0 is serviced first
+       Returns the device id passed to the handlers, -1 if the bus is full
+    */
+
+    int8_t Attach(mcp2517fd &dev, uint8_t priority, CAN_FIFO_CHANNEL rx_fifo_ch = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Initialise all attached controllers with the same bit time
+
+    void Init(CAN_BITTIME_SETUP selectedBitTime, CAN_FIFO_CHANNEL tx_fifo_ch = CAN_FIFO_CH1);
+
+    // *****************************************************************************
+    //! Set interrupt handler of a device
+
+    void HandlerSet(uint8_t id, mcp2517fd_bus_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Number of attached devices
+
+    inline uint8_t DeviceCount()
+    {
+      return device_count;
+    }
+
+    // *****************************************************************************
+    //! Device by id
+
+    mcp2517fd *DeviceGet(uint8_t id);
+
+    // *****************************************************************************
+    //! Route the RX interrupt of all controllers onto one shared line
+    /*!
+       The INT pins of every controller are switched to open drain and wired
+       together onto pin. Call after Init().
+    */
+
+    void SharedInterruptConfigure(uint8_t pin);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Servicing
+
+    // *****************************************************************************
+    //! Get pending interrupts of all devices
+    /*!
+       Returns a bitmap with bit n set when device id n needs service.
+       Each MCU port register is sampled once, however many INT pins sit on it.
+       On a shared line, only the devices behind an asserted line are queried.
+       The port map is built on the first call after an Attach(), from the
+       INT pin numbers, however the controllers were initialised.
+    */
+
+    uint8_t PendingGet();
+
+    // *****************************************************************************
+    //! Service interrupts
+    /*!
+       Calls the handler of every device with its interrupt pin asserted,
+       in priority order. Returns number of devices serviced.
+    */
+
+    uint8_t Service();
+
+    // *****************************************************************************
+    //! Round-robin RX drain
+    /*!
+       Reads at most one frame per controller per round, so a busy channel cannot
+       starve the others. Stops after budget frames or when all FIFOs are empty.
+       Returns number of frames drained.
+    */
+
+    uint16_t Drain(mcp2517fd_bus_rx_handler handler, void *context = NULL, uint16_t budget = 0xFFFF);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_bus()
+    {
+      device_count = 0;
+      rr_next = 0;
+      port_count = 0;
+      mapped = false;
+      shared_intr_reg = NULL;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      mcp2517fd *dev;
+      uint8_t id;
+      uint8_t priority;
+      CAN_FIFO_CHANNEL rx_fifo_ch;
+      mcp2517fd_bus_handler handler;
+      void *context;
+      uint8_t port;            // index into ports
+      REGTYPE mask;            // INT pin within that port
+    } DEVICE_ENTRY;
+
+    // *****************************************************************************
+    //! Group INT pins by MCU port register
+
+    void PortMapBuild();
+
+    DEVICE_ENTRY devices[MCP2517FD_BUS_MAX_DEVICES];  // sorted by priority
+    uint8_t device_count;
+    uint8_t rr_next;
+    volatile REGTYPE *ports[MCP2517FD_BUS_MAX_DEVICES];
+    uint8_t port_count;
+    bool mapped;                                     // ports and port/mask of every device valid
+    volatile REGTYPE *shared_intr_reg;
+    REGTYPE shared_intr_mask;
+#ifdef MCP2517FD_PORTLESS_IO
+    uint8_t shared_intr_pin;
+#endif
+    CAN_RX_MSGOBJ rxObj;
+    uint8_t rxd[MAX_DATA_BYTES];
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+  mcp2517fd_busload.cpp - Bus load estimator for mcp2517fd
+*/
+#include "mcp2517fd_busload.h"
+
+#define BUSLOAD_EOF_BITS 13   // CRC delimiter, ACK, EOF, intermission
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_busload::Clear(uint32_t window_units)
+{
+  window = window_units;
+  bucket_len = window_units / MCP2517FD_BUSLOAD_BUCKETS;
+  if (!bucket_len) {
+    bucket_len = 1;
+  }
+
+  bucket = 0;
+  bucket_start = 0;
+  started = false;
+  memset(busy, 0, sizeof(busy));
+  memset(frames, 0, sizeof(frames));
+  accounted = 0;
+  efmsgcnt = 0;
+}
+
+void mcp2517fd_busload::Begin(uint16_t window_ms, uint32_t sysclk)
+{
+  uint32_t w[5];
+  REG_CiNBTCFG nbt;
+  REG_CiDBTCFG dbt;
+  REG_CiTSCON tscon;
+
+  // CiNBTCFG, CiDBTCFG, CiTDC, CiTBC and CiTSCON in one access
+  can->ReadDWordArray(cREGADDR_CiNBTCFG, w, 5);
+  nbt.dword = w[0];
+  dbt.dword = w[1];
+  tscon.dword = w[4];
+
+  nbt_clk = (nbt.bF.BRP + 1) * (nbt.bF.TSEG1 + nbt.bF.TSEG2 + 3);
+  dbt_clk = (dbt.bF.BRP + 1) * (dbt.bF.TSEG1 + dbt.bF.TSEG2 + 3);
+
+  use_timestamps = tscon.bF.TBCEnable;
+  unit_clk = use_timestamps ? tscon.bF.TBCPrescaler + 1 : sysclk / 1000000UL;
+
+  Clear((uint32_t) window_ms * (sysclk / 1000) / unit_clk);
+
+  efmsgcnt = can->ReadWord(cREGADDR_CiBDIAG1);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Accounting
+uint16_t mcp2517fd_busload::FrameBits(bool ide, bool fdf, bool brs, bool rtr, uint8_t dlc, uint16_t *data_bits)
+{
+  uint8_t n = DLC_DataLength[dlc & 0x0F];
+
+  *data_bits = 0;
+
+  if (!fdf) {
+    // SOF to CRC: the part subject to bit stuffing
+    if (rtr) {
+      n = 0;
+    } else if (n > 8) {
+      n = 8;
+    }
+
+    uint16_t s = (ide ? 54 : 34) + (8 * n);
+
+    return s + ((s - 1) / MCP2517FD_BUSLOAD_STUFF_DIV) + BUSLOAD_EOF_BITS;
+  }
+
+  // SOF to BRS at the nominal rate
+  uint16_t arb = ide ? 36 : 17;
+
+  arb += (arb - 1) / MCP2517FD_BUSLOAD_STUFF_DIV;
+
+  // ESI, DLC and data with dynamic stuffing; stuff count and CRC with fixed stuff bits
+  uint8_t crc = (n > 16) ? 21 : 17;
+  uint16_t dat = 5 + (8 * n);
+
+  dat += (dat / MCP2517FD_BUSLOAD_STUFF_DIV) + 4 + crc + ((4 + crc) / 4) + 1;
+
+  if (brs) {
+    *data_bits = dat;
+    return arb + BUSLOAD_EOF_BITS;
+  }
+
+  return arb + dat + BUSLOAD_EOF_BITS;
+}
+
+uint32_t mcp2517fd_busload::Now()
+{
+  return use_timestamps ? can->ReadDWord(cREGADDR_CiTBC) : micros();
+}
+
+void mcp2517fd_busload::Advance(uint32_t now)
+{
+  if (!started) {
+    bucket_start = now;
+    started = true;
+    return;
+  }
+
+  // Late frames (TEF entries read after newer RX frames) go to the current bucket
+  if ((int32_t) (now - bucket_start) < 0) {
+    return;
+  }
+
+  uint8_t steps = 0;
+
+  while ((now - bucket_start >= bucket_len) && (steps < MCP2517FD_BUSLOAD_BUCKETS)) {
+    bucket = (bucket + 1) % MCP2517FD_BUSLOAD_BUCKETS;
+    busy[bucket] = 0;
+    frames[bucket] = 0;
+    bucket_start += bucket_len;
+    steps++;
+  }
+
+  if (now - bucket_start >= bucket_len) {
+    bucket_start = now;
+  }
+}
+
+void mcp2517fd_busload::Add(uint32_t ctrl, uint32_t ts)
+{
+  CAN_TX_MSGOBJ_CTRL c;
+  uint16_t dbits;
+
+  // RX and TX control words agree in the bits used here
+  memcpy(&c, &ctrl, sizeof(c));
+
+  uint16_t nbits = FrameBits(c.IDE, c.FDF, c.BRS, c.RTR, c.DLC, &dbits);
+
+  Advance(use_timestamps ? ts : micros());
+
+  busy[bucket] += ((uint32_t) nbits * nbt_clk) + ((uint32_t) dbits * dbt_clk);
+  frames[bucket]++;
+  accounted++;
+}
+
+void mcp2517fd_busload::Account(const CAN_RX_MSGOBJ *rxObj)
+{
+  Add(rxObj->word[1], rxObj->word[2]);
+}
+
+void mcp2517fd_busload::Account(const CAN_TEF_MSGOBJ *tefObj)
+{
+  Add(tefObj->dword[1], tefObj->dword[2]);
+}
+
+uint16_t mcp2517fd_busload::CrossCheck()
+{
+  uint16_t cnt = can->ReadWord(cREGADDR_CiBDIAG1);
+  uint16_t seen = cnt - efmsgcnt;
+  uint16_t missing = (seen > accounted) ? seen - accounted : 0;
+  uint32_t total_busy = 0, total_frames = 0;
+
+  efmsgcnt = cnt;
+  accounted = 0;
+
+  if (!missing) {
+    return 0;
+  }
+
+  for (uint8_t b = 0; b < MCP2517FD_BUSLOAD_BUCKETS; b++) {
+    total_busy += busy[b];
+    total_frames += frames[b];
+  }
+
+  // Nothing to take the mean from: assume classic frames with 8 bytes
+  uint32_t mean;
+
+  if (total_frames) {
+    mean = total_busy / total_frames;
+  } else {
+    uint16_t dbits;
+
+    mean = (uint32_t) FrameBits(false, false, false, false, 8, &dbits) * nbt_clk;
+  }
+
+  Advance(Now());
+
+  busy[bucket] += mean * missing;
+  frames[bucket] += missing;
+
+  return missing;
+}
+
+uint16_t mcp2517fd_busload::LoadGet()
+{
+  uint32_t total = 0;
+
+  Advance(Now());
+
+  for (uint8_t b = 0; b < MCP2517FD_BUSLOAD_BUCKETS; b++) {
+    total += busy[b];
+  }
+
+  return (uint16_t) (((uint64_t) total * 1000) / ((uint64_t) window * unit_clk));
+}
+
+uint32_t mcp2517fd_busload::FrameCountGet()
+{
+  uint32_t n = 0;
+
+  Advance(Now());
+
+  for (uint8_t b = 0; b < MCP2517FD_BUSLOAD_BUCKETS; b++) {
+    n += frames[b];
+  }
+
+  return n;
+}
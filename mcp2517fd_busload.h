@@ -0,0 +1,107 @@
+/*
+  mcp2517fd_busload.h - Bus load estimator for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_BUSLOAD_H
+#define	MCP2517FD_BUSLOAD_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_BUSLOAD_BUCKETS 8      // the window slides in steps of window / BUCKETS
+
+#ifndef MCP2517FD_BUSLOAD_STUFF_DIV
+#define MCP2517FD_BUSLOAD_STUFF_DIV 8    // one stuff bit per 8 stuffable bits: half the worst case
+#endif
+
+class mcp2517fd_busload {
+  public:
+    // *****************************************************************************
+    //! Start estimating
+    /*!
+       Reads the nominal and data bit timing and the time base setup from the
+       controller, so call after Init() and after the time base is configured.
+       With the time base running, frames are placed in the window by their
+       time stamp: enable time stamps on every FIFO and the TEF accounted here.
+       Otherwise micros() at accounting time is used.
+    */
+
+    void Begin(uint16_t window_ms = 1000, uint32_t sysclk = 40000000UL);
+
+    // *****************************************************************************
+    //! Account a received frame
+    void Account(const CAN_RX_MSGOBJ *rxObj);
+
+    // *****************************************************************************
+    //! Account a transmitted frame from the TEF
+    void Account(const CAN_TEF_MSGOBJ *tefObj);
+
+    // *****************************************************************************
+    //! Account frames the MCU did not see
+    /*!
+       Reads the error-free message counter of CiBDIAG1. Frames the controller
+       counted since the last call beyond those accounted (filtered out, not
+       stored in the TEF, ...) are added at the mean cost of the accounted
+       ones. Call about once per bucket. Returns number of frames added.
+    */
+
+    uint16_t CrossCheck();
+
+    // *****************************************************************************
+    //! Bus load over the last window in per mille
+    uint16_t LoadGet();
+
+    // *****************************************************************************
+    //! Frames in the last window
+    uint32_t FrameCountGet();
+
+    // *****************************************************************************
+    //! Bits of a frame on the wire
+    /*!
+       Returns bits sent at the nominal bit rate; data_bits receives the bits
+       sent at the data bit rate (0 without BRS). Stuff bits are estimated.
+    */
+
+    static uint16_t FrameBits(bool ide, bool fdf, bool brs, bool rtr, uint8_t dlc, uint16_t *data_bits);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_busload(mcp2517fd &dev)
+    {
+      can = &dev;
+      nbt_clk = 0;
+      dbt_clk = 0;
+      unit_clk = 1;
+      use_timestamps = false;
+      Clear(1000);
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    void Clear(uint32_t window_units);
+    void Add(uint32_t ctrl, uint32_t ts);
+    uint32_t Now();
+    void Advance(uint32_t now);
+
+    mcp2517fd *can;
+    uint16_t nbt_clk;          // SYSCLK cycles per nominal bit
+    uint16_t dbt_clk;          // SYSCLK cycles per data bit
+    uint16_t unit_clk;         // SYSCLK cycles per time unit (time stamp tick or us)
+    bool use_timestamps;
+
+    uint32_t window;           // in time units
+    uint32_t bucket_len;
+    uint32_t bucket_start;
+    uint8_t bucket;
+    bool started;
+    uint32_t busy[MCP2517FD_BUSLOAD_BUCKETS];    // SYSCLK cycles on the wire
+    uint16_t frames[MCP2517FD_BUSLOAD_BUCKETS];
+    uint16_t accounted;        // frames since the last CrossCheck()
+    uint16_t efmsgcnt;
+};
+
+#endif
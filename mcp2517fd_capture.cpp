@@ -0,0 +1,191 @@
+/*
+  mcp2517fd_capture.cpp - Frame capture into a compact binary log for mcp2517fd
+*/
+#include "mcp2517fd_capture.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Capture
+void mcp2517fd_capture::Begin(mcp2517fd_capture_sink sink, void *context, uint8_t *buf, uint16_t size)
+{
+  uint32_t tick_ps = ts->TickPeriodGet();
+
+  this->sink = sink;
+  sink_context = context;
+  this->buf = buf;
+  this->size = size;
+  last = 0;
+  records = 0;
+
+  buf[0] = 'M';
+  buf[1] = '2';
+  buf[2] = 'F';
+  buf[3] = 'D';
+  buf[4] = MCP2517FD_CAPTURE_VERSION;
+  buf[5] = (uint8_t) tick_ps;
+  buf[6] = (uint8_t) (tick_ps >> 8);
+  buf[7] = (uint8_t) (tick_ps >> 16);
+  buf[8] = (uint8_t) (tick_ps >> 24);
+  used = MCP2517FD_CAPTURE_HEADER_SIZE;
+}
+
+void mcp2517fd_capture::Record(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd)
+{
+  uint8_t flags = (rxObj->bF.ctrl.IDE ? MCP2517FD_CAPTURE_IDE : 0) | (rxObj->bF.ctrl.RTR ? MCP2517FD_CAPTURE_RTR : 0) |
+                  (rxObj->bF.ctrl.FDF ? MCP2517FD_CAPTURE_FDF : 0) | (rxObj->bF.ctrl.BRS ? MCP2517FD_CAPTURE_BRS : 0) |
+                  (rxObj->bF.ctrl.ESI ? MCP2517FD_CAPTURE_ESI : 0);
+  uint8_t len = rxObj->bF.ctrl.RTR ? 0 : DLC_DataLength[rxObj->bF.ctrl.DLC];
+
+  // Classic frames with DLC 9..15 still carry 8 bytes
+  if (!rxObj->bF.ctrl.FDF && (len > 8)) {
+    len = 8;
+  }
+
+  Append(flags, rxObj->bF.ctrl.DLC, &rxObj->bF.id, rxObj->bF.timeStamp, rxd, len);
+}
+
+void mcp2517fd_capture::Record(const CAN_TEF_MSGOBJ *tefObj)
+{
+  uint8_t flags = MCP2517FD_CAPTURE_TX |
+                  (tefObj->bF.ctrl.IDE ? MCP2517FD_CAPTURE_IDE : 0) | (tefObj->bF.ctrl.RTR ? MCP2517FD_CAPTURE_RTR : 0) |
+                  (tefObj->bF.ctrl.FDF ? MCP2517FD_CAPTURE_FDF : 0) | (tefObj->bF.ctrl.BRS ? MCP2517FD_CAPTURE_BRS : 0) |
+                  (tefObj->bF.ctrl.ESI ? MCP2517FD_CAPTURE_ESI : 0);
+
+  Append(flags, tefObj->bF.ctrl.DLC, &tefObj->bF.id, tefObj->bF.timeStamp, NULL, 0);
+}
+
+uint16_t mcp2517fd_capture::TefDrain(uint16_t budget)
+{
+  uint16_t n = 0;
+
+  while ((n < budget) && (can->TefStatusGet() & CAN_TEF_FIFO_NOT_EMPTY)) {
+    CAN_TEF_MSGOBJ tefObj = can->TefMessageGet();
+
+    Record(&tefObj);
+    n++;
+  }
+
+  return n;
+}
+
+void mcp2517fd_capture::Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context)
+{
+  ((mcp2517fd_capture *) context)->Record(rxObj, rxd);
+}
+
+void mcp2517fd_capture::Flush()
+{
+  if (used && sink) {
+    sink(buf, used, sink_context);
+  }
+
+  used = 0;
+}
+
+void mcp2517fd_capture::Append(uint8_t flags, uint8_t dlc, const CAN_MSGOBJ_ID *id, uint32_t stamp, const uint8_t *data, uint8_t len)
+{
+  if (buf == NULL) {
+    return;
+  }
+
+  if (used + MCP2517FD_CAPTURE_RECORD_MAX > size) {
+    Flush();
+  }
+
+  uint64_t ticks = ts->Extend(stamp);
+  int64_t delta = (int64_t) (ticks - last);
+  uint64_t z = ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63);
+  uint8_t *p = &buf[used + 1];
+
+  last = ticks;
+
+  *p++ = flags;
+  *p++ = dlc;
+
+  do {
+    *p = z & 0x7F;
+    z >>= 7;
+    if (z) {
+      *p |= 0x80;
+    }
+    p++;
+  } while (z);
+
+  uint32_t v = id->SID;
+
+  if (flags & MCP2517FD_CAPTURE_IDE) {
+    v = (v << 18) | id->EID;
+    *p++ = (uint8_t) v;
+    *p++ = (uint8_t) (v >> 8);
+    *p++ = (uint8_t) (v >> 16);
+    *p++ = (uint8_t) (v >> 24);
+  } else {
+    *p++ = (uint8_t) v;
+    *p++ = (uint8_t) (v >> 8);
+  }
+
+  if (len) {
+    memcpy(p, data, len);
+    p += len;
+  }
+
+  buf[used] = (uint8_t) (p - &buf[used + 1]);
+  used = p - buf;
+  records++;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Decoding
+uint32_t mcp2517fd_capture::HeaderParse(const uint8_t *hdr)
+{
+  if ((hdr[0] != 'M') || (hdr[1] != '2') || (hdr[2] != 'F') || (hdr[3] != 'D') || (hdr[4] != MCP2517FD_CAPTURE_VERSION)) {
+    return 0;
+  }
+
+  return hdr[5] | ((uint32_t) hdr[6] << 8) | ((uint32_t) hdr[7] << 16) | ((uint32_t) hdr[8] << 24);
+}
+
+uint8_t mcp2517fd_capture::RecordParse(const uint8_t *rec, uint64_t *ticks, MCP2517FD_CAPTURE_RECORD *r)
+{
+  uint8_t n = rec[0];
+  const uint8_t *p = rec + 1;
+  const uint8_t *end = p + n;
+  uint64_t z = 0;
+  uint8_t shift = 0;
+
+  if (n < 5) {
+    return 0;
+  }
+
+  r->flags = *p++;
+  r->dlc = *p++ & 0x0F;
+
+  do {
+    if ((p >= end) || (shift > 63)) {
+      return 0;
+    }
+    z |= (uint64_t) (*p & 0x7F) << shift;
+    shift += 7;
+  } while (*p++ & 0x80);
+
+  *ticks += (uint64_t) ((int64_t) (z >> 1) ^ -(int64_t) (z & 1));
+  r->ticks = *ticks;
+
+  uint8_t id_len = (r->flags & MCP2517FD_CAPTURE_IDE) ? 4 : 2;
+
+  if (p + id_len > end) {
+    return 0;
+  }
+
+  r->id = p[0] | ((uint32_t) p[1] << 8);
+  if (id_len == 4) {
+    r->id |= ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+  p += id_len;
+
+  r->data = p;
+  r->len = end - p;
+
+  return n + 1;
+}
@@ -0,0 +1,157 @@
+/*
+  mcp2517fd_capture.h - Frame capture into a compact binary log for mcp2517fd
+
+  Log format, little endian throughout:
+
+    header   "M2FD", version (1), tick period in ps (4 bytes)
+    record   length of the rest of the record (1 byte)
+             flags (MCP2517FD_CAPTURE_TX ...), DLC
+             ticks since the previous record, zigzag LEB128 since TEF and
+             receive entries may arrive out of order (the first: since 0)
+             identifier, 2 bytes for 11 bit, 4 bytes with MCP2517FD_CAPTURE_IDE
+             data, whatever is left of the record; TEF entries carry none
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_CAPTURE_H
+#define	MCP2517FD_CAPTURE_H
+
+#include "mcp2517fd_timestamp.h"
+
+#define MCP2517FD_CAPTURE_HEADER_SIZE 9
+#define MCP2517FD_CAPTURE_RECORD_MAX  (1 + 2 + 10 + 4 + MAX_DATA_BYTES)
+#define MCP2517FD_CAPTURE_VERSION     1
+
+// Record flags
+#define MCP2517FD_CAPTURE_TX          0x01   // TEF entry: sent by this node
+#define MCP2517FD_CAPTURE_IDE         0x02
+#define MCP2517FD_CAPTURE_RTR         0x04
+#define MCP2517FD_CAPTURE_FDF         0x08
+#define MCP2517FD_CAPTURE_BRS         0x10
+#define MCP2517FD_CAPTURE_ESI         0x20
+
+// *****************************************************************************
+//! Decoded record
+
+typedef struct {
+  uint64_t ticks;         // controller time base
+  uint32_t id;            // 11 or 29 bit
+  uint8_t flags;
+  uint8_t dlc;
+  uint8_t len;            // data bytes in the record
+  const uint8_t *data;    // into the record
+} MCP2517FD_CAPTURE_RECORD;
+
+// *****************************************************************************
+//! Receives the log as it is produced
+/*!
+   Called with whole records only, at least every buffer size bytes.
+*/
+
+typedef void (*mcp2517fd_capture_sink)(const uint8_t *data, uint16_t len, void *context);
+
+class mcp2517fd_capture {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Capture
+
+    // *****************************************************************************
+    //! Start a log
+    /*!
+       Records are collected in buf and passed to the sink when the next one
+       would not fit, so the sink sees a few large writes instead of one per
+       frame. size must be at least MCP2517FD_CAPTURE_RECORD_MAX.
+       Receive FIFOs need time stamps (mcp2517fd_timestamp::Begin()).
+    */
+
+    void Begin(mcp2517fd_capture_sink sink, void *context, uint8_t *buf, uint16_t size);
+
+    // *****************************************************************************
+    //! Log a received frame
+    void Record(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd);
+
+    // *****************************************************************************
+    //! Log a TEF entry
+    void Record(const CAN_TEF_MSGOBJ *tefObj);
+
+    // *****************************************************************************
+    //! Read and log TEF entries
+    /*!
+       For setups that do not run the TEF engine. Returns number of entries.
+    */
+
+    uint16_t TefDrain(uint16_t budget = 0xFFFF);
+
+    // *****************************************************************************
+    //! Router handler; context is the mcp2517fd_capture instance
+    static void Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+    // *****************************************************************************
+    //! Pass buffered records to the sink
+    void Flush();
+
+    // *****************************************************************************
+    //! Records logged
+    inline uint32_t RecordCount()
+    {
+      return records;
+    }
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Decoding
+
+    // *****************************************************************************
+    //! Check a log header
+    /*!
+       Returns the tick period in ps, 0 if hdr is not a log header.
+    */
+
+    static uint32_t HeaderParse(const uint8_t *hdr);
+
+    // *****************************************************************************
+    //! Decode a record
+    /*!
+       rec points at the length byte; ticks carries the time of the previous
+       record in and this record's time out (start at 0).
+       Returns bytes taken by the record, 0 if it is malformed.
+    */
+
+    static uint8_t RecordParse(const uint8_t *rec, uint64_t *ticks, MCP2517FD_CAPTURE_RECORD *r);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_capture(mcp2517fd &dev, mcp2517fd_timestamp &timestamp)
+    {
+      can = &dev;
+      ts = &timestamp;
+      sink = NULL;
+      sink_context = NULL;
+      buf = NULL;
+      size = 0;
+      used = 0;
+      last = 0;
+      records = 0;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    void Append(uint8_t flags, uint8_t dlc, const CAN_MSGOBJ_ID *id, uint32_t stamp, const uint8_t *data, uint8_t len);
+
+    mcp2517fd *can;
+    mcp2517fd_timestamp *ts;
+    mcp2517fd_capture_sink sink;
+    void *sink_context;
+    uint8_t *buf;
+    uint16_t size;
+    uint16_t used;
+    uint64_t last;          // ticks of the previous record
+    uint32_t records;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+  mcp2517fd_cyclic.cpp - Periodic message scheduler with deadline tracking for mcp2517fd
+*/
+#include "mcp2517fd_cyclic.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_cyclic::Begin(CAN_FIFO_CHANNEL channel, uint32_t lead_us)
+{
+  tx_ch = channel;
+  lead = lead_us;
+  armed = false;
+}
+
+int8_t mcp2517fd_cyclic::Add(const CAN_TX_MSGOBJ *txObj, uint32_t period_us, uint32_t offset_us,
+                             mcp2517fd_cyclic_source source, void *context, uint32_t deadline_us)
+{
+  if ((entry_count >= MCP2517FD_CYCLIC_MAX_ENTRIES) || (period_us == 0)) {
+    return -1;
+  }
+
+  CYCLIC_ENTRY *e = &entries[entry_count];
+
+  e->obj = *txObj;
+  e->period = period_us;
+  e->deadline = deadline_us ? deadline_us : period_us;
+  e->due = micros() + offset_us;
+  e->source = source;
+  e->context = context;
+  e->enabled = true;
+  e->in_flight = false;
+  StatsReset(&e->stats);
+
+  return entry_count++;
+}
+
+void mcp2517fd_cyclic::Enable(uint8_t id, bool enable, uint32_t offset_us)
+{
+  if (id >= entry_count) {
+    return;
+  }
+
+  if (enable && !entries[id].enabled) {
+    entries[id].due = micros() + offset_us;
+  }
+
+  entries[id].enabled = enable;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Scheduling
+uint8_t mcp2517fd_cyclic::Service()
+{
+  uint8_t data[MAX_DATA_BYTES];
+  uint8_t loaded = 0;
+
+  tef->Drain();
+
+  unsigned long now = micros();
+
+  // Release what was loaded ahead before loading the next batch behind it
+  if (armed && ((long) (now - release) >= 0)) {
+    can->TransmitChannelFlush(tx_ch);
+    armed = false;
+  }
+
+  for (uint8_t i = 0; i < entry_count; i++) {
+    CYCLIC_ENTRY *e = &entries[i];
+
+    if (!e->enabled || ((long) (now + lead - e->due) < 0)) {
+      continue;
+    }
+
+    unsigned long due = e->due;
+
+    // Next instance; cycles already over are left out rather than sent in a burst
+    e->due += e->period;
+    while ((long) (now - e->due) >= 0) {
+      e->due += e->period;
+      e->stats.skipped++;
+    }
+
+    if (e->in_flight) {
+      e->stats.skipped++;
+      continue;
+    }
+
+    uint8_t n = e->source ? e->source(i, data, e->context) : 0;
+
+    if (n == 0) {
+      continue;
+    }
+
+    int8_t seq = tef->Submit(&e->obj, data, n, tx_ch, false, Sent, this);
+
+    if (seq < 0) {
+      e->stats.skipped++;
+      continue;
+    }
+
+    seq_entry[seq % MCP2517FD_TEF_MAX_PENDING] = i;
+    e->in_flight = true;
+    e->sent_due = due;
+    loaded++;
+
+    if (!armed || ((long) (due - release) < 0)) {
+      release = due;
+    }
+    armed = true;
+  }
+
+  if (armed && ((long) (now - release) >= 0)) {
+    can->TransmitChannelFlush(tx_ch);
+    armed = false;
+  }
+
+  return loaded;
+}
+
+void mcp2517fd_cyclic::Sent(uint8_t seq, MCP2517FD_TEF_STATUS status, const MCP2517FD_TIMESTAMP *stamp, uint32_t latency_us, void *context)
+{
+  (void) latency_us;
+
+  mcp2517fd_cyclic *self = (mcp2517fd_cyclic *) context;
+  CYCLIC_ENTRY *e = &self->entries[self->seq_entry[seq % MCP2517FD_TEF_MAX_PENDING]];
+  MCP2517FD_CYCLIC_STATS *s = &e->stats;
+
+  e->in_flight = false;
+
+  if (status != MCP2517FD_TEF_SENT) {
+    s->missed++;
+    return;
+  }
+
+  int32_t lateness = (int32_t) (stamp->micros - (uint32_t) e->sent_due);
+
+  s->sent++;
+  s->lateness_sum += lateness;
+  if (lateness < s->lateness_min) s->lateness_min = lateness;
+  if (lateness > s->lateness_max) s->lateness_max = lateness;
+  if (lateness > (int32_t) e->deadline) s->missed++;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Status
+void mcp2517fd_cyclic::StatsGet(uint8_t id, MCP2517FD_CYCLIC_STATS *stats)
+{
+  if (id < entry_count) {
+    *stats = entries[id].stats;
+  }
+}
+
+void mcp2517fd_cyclic::StatsClear()
+{
+  for (uint8_t i = 0; i < entry_count; i++) {
+    StatsReset(&entries[i].stats);
+  }
+}
+
+void mcp2517fd_cyclic::StatsReset(MCP2517FD_CYCLIC_STATS *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->lateness_min = 0x7FFFFFFF;
+  stats->lateness_max = -0x7FFFFFFF - 1;
+}
@@ -0,0 +1,143 @@
+/*
+  mcp2517fd_cyclic.h - Periodic message scheduler with deadline tracking for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_CYCLIC_H
+#define	MCP2517FD_CYCLIC_H
+
+#include "mcp2517fd_tef.h"
+
+#define MCP2517FD_CYCLIC_MAX_ENTRIES 16
+
+// *****************************************************************************
+//! Fills the data of a periodic frame
+/*!
+   Called shortly before the frame is due. Returns number of bytes written,
+   0 to leave this cycle out.
+*/
+
+typedef uint8_t (*mcp2517fd_cyclic_source)(uint8_t id, uint8_t *data, void *context);
+
+// *****************************************************************************
+//! Statistics of a periodic frame
+/*!
+   Lateness is the bus time stamp from the TEF minus the due time; jitter is
+   lateness_max - lateness_min.
+*/
+
+typedef struct {
+  uint32_t sent;
+  uint32_t missed;        // sent after the deadline, or expired in the TEF engine
+  uint32_t skipped;       // cycles left out: previous frame still in flight, FIFO full or Service() too late
+  int32_t lateness_min;   // us
+  int32_t lateness_max;
+  int64_t lateness_sum;
+} MCP2517FD_CYCLIC_STATS;
+
+class mcp2517fd_cyclic {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Select the transmit FIFO and the load lead time
+    /*!
+       The FIFO should be dedicated to the scheduler. Frames due within
+       lead_us are loaded without TXREQ and released together by one flush at
+       the earliest of their due times; keep lead_us well below the shortest
+       period. Frames go through the TEF engine, which needs its Begin() run.
+    */
+
+    void Begin(CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1, uint32_t lead_us = 500);
+
+    // *****************************************************************************
+    //! Add a periodic frame
+    /*!
+       txObj: identifier and format; the DLC must cover the longest data.
+       offset_us: first due time after now, to spread frames of equal period.
+       deadline_us: latest acceptable send time after the due time, 0 for
+       one period.
+       Returns the entry id, -1 if the table is full.
+    */
+
+    int8_t Add(const CAN_TX_MSGOBJ *txObj, uint32_t period_us, uint32_t offset_us,
+               mcp2517fd_cyclic_source source, void *context = NULL, uint32_t deadline_us = 0);
+
+    // *****************************************************************************
+    //! Start or stop an entry; starting makes it due offset_us from now
+    void Enable(uint8_t id, bool enable, uint32_t offset_us = 0);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Scheduling
+
+    // *****************************************************************************
+    //! Load due frames, release them and collect their time stamps
+    /*!
+       Drains the TEF engine, loads frames due within the lead time in one
+       batch and sets TXREQ once the earliest of them is due. Call at least
+       every lead_us / 2 for tight release times.
+       Returns number of frames loaded.
+    */
+
+    uint8_t Service();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Status
+
+    // *****************************************************************************
+    //! Get statistics of an entry
+    void StatsGet(uint8_t id, MCP2517FD_CYCLIC_STATS *stats);
+
+    // *****************************************************************************
+    //! Clear statistics of all entries
+    void StatsClear();
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_cyclic(mcp2517fd &dev, mcp2517fd_tef &tef_engine)
+    {
+      can = &dev;
+      tef = &tef_engine;
+      entry_count = 0;
+      armed = false;
+      Begin();
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      CAN_TX_MSGOBJ obj;
+      uint32_t period;
+      uint32_t deadline;
+      unsigned long due;         // micros() of the next instance
+      unsigned long sent_due;    // due time of the instance in flight
+      mcp2517fd_cyclic_source source;
+      void *context;
+      bool enabled;
+      bool in_flight;            // loaded, TEF entry not seen yet
+      MCP2517FD_CYCLIC_STATS stats;
+    } CYCLIC_ENTRY;
+
+    static void Sent(uint8_t seq, MCP2517FD_TEF_STATUS status, const MCP2517FD_TIMESTAMP *stamp, uint32_t latency_us, void *context);
+    void StatsReset(MCP2517FD_CYCLIC_STATS *stats);
+
+    mcp2517fd *can;
+    mcp2517fd_tef *tef;
+    CAN_FIFO_CHANNEL tx_ch;
+    uint32_t lead;
+    CYCLIC_ENTRY entries[MCP2517FD_CYCLIC_MAX_ENTRIES];
+    uint8_t entry_count;
+    uint8_t seq_entry[MCP2517FD_TEF_MAX_PENDING];   // entry of each TEF slot
+    bool armed;                  // frames loaded without TXREQ
+    unsigned long release;       // when to set TXREQ
+};
+
+#endif
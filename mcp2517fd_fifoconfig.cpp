@@ -0,0 +1,159 @@
+/*
+  mcp2517fd_fifoconfig.cpp - FIFO reconfiguration without re-Init for mcp2517fd
+*/
+#include "mcp2517fd_fifoconfig.h"
+
+#define FIFOCONFIG_BURST           8      // channels per register read
+#define FIFOCONFIG_RX_IE           0x0F   // RXOVIE..TFNRFNIE
+#define FIFOCONFIG_TX_IE           0x17   // TXATIE, TFERFFIE..TFNRFNIE
+#define FIFOCONFIG_STEF            0x08   // CiCON byte 2
+#define FIFOCONFIG_TXQEN           0x10
+#define FIFOCONFIG_SELF_CLEAR      0x00000700UL   // FRESET, TXREQ, UINC
+#define FIFOCONFIG_RESET           0x00600000UL   // CiFIFOCON after reset, FRESET cleared
+
+static const uint8_t payload_bytes[8] = {8, 12, 16, 20, 24, 32, 48, 64};
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Staging
+void mcp2517fd_fifoconfig::Load()
+{
+  uint32_t fifoReg[3 * FIFOCONFIG_BURST];
+
+  ci_con2 = can->ReadByte(cREGADDR_CiCON + 2);
+  tef_con = can->ReadDWord(cREGADDR_CiTEFCON);
+
+  // CON/STA/UA triplets: keep only CON
+  for (uint8_t ch = 0; ch < CAN_FIFO_TOTAL_CHANNELS; ch += FIFOCONFIG_BURST) {
+    can->ReadDWordArray(cREGADDR_CiFIFOCON + (ch * CiFIFO_OFFSET), fifoReg, 3 * FIFOCONFIG_BURST);
+
+    for (uint8_t i = 0; i < FIFOCONFIG_BURST; i++) {
+      con[ch + i] = fifoReg[3 * i] & ~FIFOCONFIG_SELF_CLEAR;
+    }
+  }
+
+  dirty = 0;
+}
+
+void mcp2517fd_fifoconfig::Stage(CAN_FIFO_CHANNEL channel, uint32_t fifoCon, uint32_t keep)
+{
+  fifoCon |= con[channel] & keep;
+
+  if (fifoCon != con[channel]) {
+    con[channel] = fifoCon;
+    dirty |= (1UL << channel);
+  }
+}
+
+void mcp2517fd_fifoconfig::TransmitChannelSet(CAN_TX_FIFO_CONFIG *config, CAN_FIFO_CHANNEL channel)
+{
+  REG_CiFIFOCON ciFifoCon;
+
+  ciFifoCon.dword = 0;
+  ciFifoCon.txBF.TxEnable = 1;
+  ciFifoCon.txBF.FifoSize = config->FifoSize;
+  ciFifoCon.txBF.PayLoadSize = config->PayLoadSize;
+  ciFifoCon.txBF.TxAttempts = config->TxAttempts;
+  ciFifoCon.txBF.TxPriority = config->TxPriority;
+  if (channel != CAN_TXQUEUE_CH0) {
+    ciFifoCon.txBF.RTREnable = config->RTREnable;
+  }
+
+  Stage(channel, ciFifoCon.dword, FIFOCONFIG_TX_IE);
+}
+
+void mcp2517fd_fifoconfig::ReceiveChannelSet(CAN_RX_FIFO_CONFIG *config, CAN_FIFO_CHANNEL channel)
+{
+  REG_CiFIFOCON ciFifoCon;
+
+  if (channel == CAN_TXQUEUE_CH0) {
+    return;
+  }
+
+  ciFifoCon.dword = 0;
+  ciFifoCon.rxBF.FifoSize = config->FifoSize;
+  ciFifoCon.rxBF.PayLoadSize = config->PayLoadSize;
+  ciFifoCon.rxBF.RxTimeStampEnable = config->RxTimeStampEnable;
+
+  Stage(channel, ciFifoCon.dword, FIFOCONFIG_RX_IE);
+}
+
+uint16_t mcp2517fd_fifoconfig::RamUsage()
+{
+  REG_CiTEFCON ciTefCon;
+  uint16_t bytes = 0;
+
+  // Allocation order: TEF, TXQ, FIFO1..31
+  ciTefCon.dword = tef_con;
+  if (ci_con2 & FIFOCONFIG_STEF) {
+    bytes += (ciTefCon.bF.FifoSize + 1) * (ciTefCon.bF.TimeStampEnable ? 12 : 8);
+  }
+
+  // FIFOs past the last configured one only get what is left over
+  uint8_t last = CAN_FIFO_TOTAL_CHANNELS;
+
+  while ((last > 1) && (con[last - 1] == FIFOCONFIG_RESET)) {
+    last--;
+  }
+
+  for (uint8_t ch = 0; ch < last; ch++) {
+    REG_CiFIFOCON ciFifoCon;
+    uint8_t obj;
+
+    if ((ch == CAN_TXQUEUE_CH0) && !(ci_con2 & FIFOCONFIG_TXQEN)) {
+      continue;
+    }
+
+    ciFifoCon.dword = con[ch];
+    obj = 8 + payload_bytes[ciFifoCon.rxBF.PayLoadSize];
+    if (!ciFifoCon.rxBF.TxEnable && ciFifoCon.rxBF.RxTimeStampEnable) {
+      obj += 4;
+    }
+
+    bytes += (ciFifoCon.rxBF.FifoSize + 1) * obj;
+  }
+
+  return bytes;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Apply
+int8_t mcp2517fd_fifoconfig::Apply()
+{
+  int8_t written = 0;
+  uint32_t diag[2];
+
+  if (!dirty) {
+    return 0;
+  }
+
+  if (RamUsage() > cRAM_SIZE) {
+    return -1;
+  }
+
+  CAN_OPERATION_MODE mode = can->OperationModeGet();
+
+  can->ReadDWordArray(cREGADDR_CiBDIAG0, diag, 2);
+
+  if (can->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+    return -2;
+  }
+
+  for (uint8_t ch = 0; ch < CAN_FIFO_TOTAL_CHANNELS; ch++) {
+    if (dirty & (1UL << ch)) {
+      can->WriteDWord(cREGADDR_CiFIFOCON + (ch * CiFIFO_OFFSET), con[ch]);
+      written++;
+    }
+  }
+
+  dirty = 0;
+
+  can->WriteDWordArray(cREGADDR_CiBDIAG0, diag, 2);
+
+  if (can->OperationModeSwitch(mode) < 0) {
+    return -2;
+  }
+
+  return written;
+}
@@ -0,0 +1,89 @@
+/*
+  mcp2517fd_fifoconfig.h - FIFO reconfiguration without re-Init for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_FIFOCONFIG_H
+#define	MCP2517FD_FIFOCONFIG_H
+
+#include "mcp2517fd.h"
+
+class mcp2517fd_fifoconfig {
+  public:
+    // *****************************************************************************
+    //! Read the current FIFO layout
+    /*!
+       Reads CiCON, the TEF and all FIFO control registers in a few bursts.
+       Call before staging changes.
+    */
+
+    void Load();
+
+    // *****************************************************************************
+    //! Stage a transmit FIFO (or the TXQ on CAN_TXQUEUE_CH0)
+    /*!
+       Interrupt enables of the FIFO are kept.
+    */
+
+    void TransmitChannelSet(CAN_TX_FIFO_CONFIG *config, CAN_FIFO_CHANNEL channel);
+
+    // *****************************************************************************
+    //! Stage a receive FIFO
+    /*!
+       Interrupt enables of the FIFO are kept. Filters pointing at a FIFO
+       turned from receive into transmit must be relinked by the caller.
+    */
+
+    void ReceiveChannelSet(CAN_RX_FIFO_CONFIG *config, CAN_FIFO_CHANNEL channel);
+
+    // *****************************************************************************
+    //! Message RAM needed by the staged layout, in bytes
+    /*!
+       FIFOs above the last one configured keep their reset value and are
+       not counted; the controller gives them whatever RAM is left.
+    */
+
+    uint16_t RamUsage();
+
+    // *****************************************************************************
+    //! Apply staged changes
+    /*!
+       Checks the layout against the 2 KB message RAM, passes through
+       configuration mode and rewrites only the FIFO control registers that
+       changed, then returns to the previous mode. Filters and CiINT enables
+       are registers the mode change leaves alone; the bus diagnostic
+       counters are saved and written back. All FIFOs are emptied by the
+       mode change.
+       Returns number of FIFOs rewritten, -1 if the layout does not fit,
+       -2 if a mode change timed out.
+    */
+
+    int8_t Apply();
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_fifoconfig(mcp2517fd &dev)
+    {
+      can = &dev;
+      dirty = 0;
+      ci_con2 = 0;
+      tef_con = 0;
+      memset(con, 0, sizeof(con));
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    void Stage(CAN_FIFO_CHANNEL channel, uint32_t fifoCon, uint32_t keep);
+
+    mcp2517fd *can;
+    uint32_t con[CAN_FIFO_TOTAL_CHANNELS];   // staged CiFIFOCON, 0 == TXQ
+    uint32_t dirty;                          // bit n: con[n] differs from the controller
+    uint8_t ci_con2;                         // CiCON bits 16..23: STEF, TXQEN
+    uint32_t tef_con;
+};
+
+#endif
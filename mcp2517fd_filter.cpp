@@ -0,0 +1,313 @@
+/*
+  mcp2517fd_filter.cpp - Acceptance filter compiler for mcp2517fd
+*/
+#include "mcp2517fd_filter.h"
+
+#define FILTER_STD_BITS 11
+#define FILTER_EXT_BITS 29
+
+static uint8_t id_bits(uint8_t ext)
+{
+  return ext ? FILTER_EXT_BITS : FILTER_STD_BITS;
+}
+
+static uint32_t id_full(uint8_t ext)
+{
+  return (1UL << id_bits(ext)) - 1;
+}
+
+// Number of identifiers accepted by a mask
+static uint32_t block_size(uint32_t mask, uint8_t ext)
+{
+  uint8_t free_bits = id_bits(ext);
+
+  mask &= id_full(ext);
+  while (mask) {
+    free_bits -= mask & 1;
+    mask >>= 1;
+  }
+
+  return 1UL << free_bits;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Rules
+void mcp2517fd_filter::Clear()
+{
+  entry_count = 0;
+  requested = 0;
+}
+
+int8_t mcp2517fd_filter::Add(uint32_t id, bool ext, CAN_FIFO_CHANNEL channel)
+{
+  return AddMasked(id, id_full(ext), ext, channel);
+}
+
+int8_t mcp2517fd_filter::AddMasked(uint32_t id, uint32_t mask, bool ext, CAN_FIFO_CHANNEL channel)
+{
+  if (id > id_full(ext)) {
+    return -2;
+  }
+
+  mask &= id_full(ext);
+  if (Insert(id & mask, mask, ext, channel) < 0) {
+    return -1;
+  }
+
+  requested += block_size(mask, ext);
+
+  return 0;
+}
+
+int8_t mcp2517fd_filter::AddRange(uint32_t first, uint32_t last, bool ext, CAN_FIFO_CHANNEL channel)
+{
+  uint32_t full = id_full(ext);
+
+  if ((first > last) || (last > full)) {
+    return -2;
+  }
+
+  // Split into the largest aligned blocks that fit
+  for (;;) {
+    uint8_t k = 0;
+
+    while ((k < id_bits(ext)) && !(first & (1UL << k)) && (first + (2UL << k) - 1 <= last)) {
+      k++;
+    }
+
+    uint32_t size = 1UL << k;
+
+    if (Insert(first, full & ~(size - 1), ext, channel) < 0) {
+      return -1;
+    }
+
+    requested += size;
+
+    if (first + size - 1 >= last) {
+      return 0;
+    }
+
+    first += size;
+  }
+}
+
+int8_t mcp2517fd_filter::Insert(uint32_t value, uint32_t mask, bool ext, uint8_t channel)
+{
+  // Already covered by a block of the same FIFO
+  for (uint8_t i = 0; i < entry_count; i++) {
+    FILTER_ENTRY *e = &entries[i];
+
+    if ((e->ext == ext) && (e->channel == channel) && ((e->mask & mask) == e->mask) && ((value & e->mask) == e->value)) {
+      return 0;
+    }
+  }
+
+  if ((entry_count == MCP2517FD_FILTER_MAX_ENTRIES) && (Reduce(MCP2517FD_FILTER_MAX_ENTRIES - 1) < 0)) {
+    return -1;
+  }
+
+  entries[entry_count].value = value;
+  entries[entry_count].mask = mask;
+  entries[entry_count].ext = ext;
+  entries[entry_count].channel = channel;
+  entry_count++;
+
+  return 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Compile
+bool mcp2517fd_filter::Conflicts(uint32_t value, uint32_t mask, uint8_t ext, uint8_t channel)
+{
+  for (uint8_t i = 0; i < entry_count; i++) {
+    FILTER_ENTRY *e = &entries[i];
+
+    // Two blocks intersect when they agree on every bit both care about
+    if ((e->ext == ext) && (e->channel != channel) && !((e->value ^ value) & e->mask & mask)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+int32_t mcp2517fd_filter::MergeCost(uint8_t a, uint8_t b)
+{
+  FILTER_ENTRY *ea = &entries[a];
+  FILTER_ENTRY *eb = &entries[b];
+
+  if ((ea->ext != eb->ext) || (ea->channel != eb->channel)) {
+    return -1;
+  }
+
+  uint32_t mask = ea->mask & eb->mask & ~(ea->value ^ eb->value);
+  uint32_t both = block_size(ea->mask, ea->ext) + block_size(eb->mask, eb->ext);
+
+  if (!((ea->value ^ eb->value) & ea->mask & eb->mask)) {
+    both -= block_size(ea->mask | eb->mask, ea->ext);
+  }
+
+  return block_size(mask, ea->ext) - both;
+}
+
+void mcp2517fd_filter::Merge(uint8_t a, uint8_t b)
+{
+  FILTER_ENTRY *ea = &entries[a];
+
+  ea->mask &= entries[b].mask & ~(ea->value ^ entries[b].value);
+  ea->value &= ea->mask;
+
+  // Drop b and every block the merged one now covers
+  for (uint8_t i = entry_count; i-- > 0;) {
+    FILTER_ENTRY *e = &entries[i];
+
+    if ((i == b) || ((i != a) && (e->ext == ea->ext) && (e->channel == ea->channel) &&
+                     ((e->mask & ea->mask) == ea->mask) && ((e->value & ea->mask) == ea->value))) {
+      entries[i] = entries[--entry_count];
+
+      if (a == entry_count) {
+        a = i;
+        ea = &entries[a];
+      }
+    }
+  }
+}
+
+int8_t mcp2517fd_filter::Reduce(uint8_t max_entries)
+{
+  for (;;) {
+    int32_t best_cost = -1;
+    uint8_t best_a = 0, best_b = 0;
+
+    for (uint8_t a = 0; (a < entry_count) && best_cost; a++) {
+      for (uint8_t b = a + 1; b < entry_count; b++) {
+        int32_t cost = MergeCost(a, b);
+
+        if ((cost < 0) || ((best_cost >= 0) && (cost >= best_cost))) {
+          continue;
+        }
+
+        // Checked last: it walks the whole table
+        FILTER_ENTRY *ea = &entries[a];
+        uint32_t mask = ea->mask & entries[b].mask & ~(ea->value ^ entries[b].value);
+
+        if (Conflicts(ea->value & mask, mask, ea->ext, ea->channel)) {
+          continue;
+        }
+
+        best_cost = cost;
+        best_a = a;
+        best_b = b;
+
+        if (!cost) {
+          break;
+        }
+      }
+    }
+
+    if ((best_cost < 0) || ((best_cost > 0) && (entry_count <= max_entries))) {
+      return (entry_count <= max_entries) ? entry_count : -1;
+    }
+
+    Merge(best_a, best_b);
+  }
+}
+
+int8_t mcp2517fd_filter::Compile(uint8_t max_filters)
+{
+  if (max_filters > CAN_FILTER_TOTAL) {
+    max_filters = CAN_FILTER_TOTAL;
+  }
+
+  return Reduce(max_filters);
+}
+
+uint32_t mcp2517fd_filter::OverAcceptanceGet()
+{
+  uint32_t accepted = 0;
+
+  for (uint8_t i = 0; i < entry_count; i++) {
+    accepted += block_size(entries[i].mask, entries[i].ext);
+  }
+
+  return (accepted > requested) ? accepted - requested : 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Program
+void mcp2517fd_filter::FilterGet(uint8_t n, CAN_FILTEROBJ_ID *id, CAN_MASKOBJ_ID *mask, CAN_FIFO_CHANNEL *channel)
+{
+  FILTER_ENTRY *e = &entries[n];
+  REG_CiFLTOBJ fObj;
+  REG_CiMASK mObj;
+
+  fObj.dword = 0;
+  mObj.dword = 0;
+
+  if (e->ext) {
+    fObj.bF.SID = e->value >> 18;
+    fObj.bF.EID = e->value & 0x3FFFF;
+    fObj.bF.EXIDE = 1;
+    mObj.bF.MSID = e->mask >> 18;
+    mObj.bF.MEID = e->mask & 0x3FFFF;
+  } else {
+    fObj.bF.SID = e->value;
+    mObj.bF.MSID = e->mask;
+  }
+
+  // Standard and extended blocks never match each other's frames
+  mObj.bF.MIDE = 1;
+
+  *id = fObj.bF;
+  *mask = mObj.bF;
+  *channel = (CAN_FIFO_CHANNEL) e->channel;
+}
+
+int8_t mcp2517fd_filter::Program(mcp2517fd &dev)
+{
+  uint8_t b[CAN_FILTER_TOTAL + (CAN_FILTER_TOTAL * CiFILTER_OFFSET)];
+  uint8_t *obj = &b[CAN_FILTER_TOTAL];
+  CAN_FIFO_CHANNEL channel[CAN_FILTER_TOTAL];
+
+  // Not compiled, or Compile() could not reduce the rules far enough
+  if (entry_count > CAN_FILTER_TOTAL) {
+    return -1;
+  }
+
+  // CiFLTCON0..7 end where CiFLTOBJ0 starts: disable and load in one write
+  memset(b, 0, CAN_FILTER_TOTAL);
+
+  for (uint8_t i = 0; i < entry_count; i++) {
+    REG_CiFLTOBJ fObj;
+    REG_CiMASK mObj;
+
+    fObj.dword = 0;
+    mObj.dword = 0;
+    FilterGet(i, &fObj.bF, &mObj.bF, &channel[i]);
+
+    memcpy(&obj[i * CiFILTER_OFFSET], fObj.bytes, 4);
+    memcpy(&obj[(i * CiFILTER_OFFSET) + 4], mObj.bytes, 4);
+  }
+
+  dev.WriteByteArray(cREGADDR_CiFLTCON, b, CAN_FILTER_TOTAL + (entry_count * CiFILTER_OFFSET));
+
+  if (!entry_count) {
+    return 0;
+  }
+
+  for (uint8_t i = 0; i < entry_count; i++) {
+    REG_CiFLTCON_BYTE fCtrl;
+
+    fCtrl.bytes = 0;
+    fCtrl.bF.Enable = 1;
+    fCtrl.bF.BufferPointer = channel[i];
+    b[i] = fCtrl.bytes;
+  }
+
+  dev.WriteByteArray(cREGADDR_CiFLTCON, b, entry_count);
+
+  return 0;
+}
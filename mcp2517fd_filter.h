@@ -0,0 +1,127 @@
+/*
+  mcp2517fd_filter.h - Acceptance filter compiler for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_FILTER_H
+#define	MCP2517FD_FILTER_H
+
+#include "mcp2517fd.h"
+
+#ifndef MCP2517FD_FILTER_MAX_ENTRIES
+#define MCP2517FD_FILTER_MAX_ENTRIES 48   // working set before compilation; ranges take one entry per aligned block
+#endif
+
+class mcp2517fd_filter {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Rules
+
+    // *****************************************************************************
+    //! Accept a single identifier
+    /*!
+       ext: 29 bit identifier
+       Returns 0 on success, -1 if the working set is full and cannot be
+       reduced, -2 if the identifier is out of range.
+    */
+
+    int8_t Add(uint32_t id, bool ext, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Accept all identifiers from first to last
+    /*!
+       The range is split into aligned power-of-two blocks, one filter each
+       before compilation merges them.
+    */
+
+    int8_t AddRange(uint32_t first, uint32_t last, bool ext, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Accept identifiers matching id in all bits set in mask
+    int8_t AddMasked(uint32_t id, uint32_t mask, bool ext, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Remove all rules
+    void Clear();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Compile and Program
+
+    // *****************************************************************************
+    //! Reduce the rules to at most max_filters filter/mask pairs
+    /*!
+       Blocks that combine without accepting extra identifiers are always
+       merged. While more than max_filters remain, the pair whose merge
+       accepts the fewest extra identifiers is merged. Merges never grow a
+       block over identifiers routed to another FIFO.
+       Returns number of filters, -1 if the rules cannot be reduced that far.
+    */
+
+    int8_t Compile(uint8_t max_filters = CAN_FILTER_TOTAL);
+
+    // *****************************************************************************
+    //! Identifiers accepted beyond those requested
+    /*!
+       Counted per rule and per filter, so it is exact when neither the rules
+       nor the compiled filters overlap.
+    */
+
+    uint32_t OverAcceptanceGet();
+
+    // *****************************************************************************
+    //! Number of filters in use
+    inline uint8_t FilterCount()
+    {
+      return entry_count;
+    }
+
+    // *****************************************************************************
+    //! Filter n as programmed
+    void FilterGet(uint8_t n, CAN_FILTEROBJ_ID *id, CAN_MASKOBJ_ID *mask, CAN_FIFO_CHANNEL *channel);
+
+    // *****************************************************************************
+    //! Write the compiled table to the controller
+    /*!
+       All 32 filters are disabled and the filter/mask objects written in a
+       single burst running from CiFLTCON0 into CiFLTOBJ/CiMASK; a second
+       write enables the filters in use. Filters not in use stay disabled.
+       Call Compile() first.
+       Returns 0, -1 and writes nothing if more than 32 filters remain.
+    */
+
+    int8_t Program(mcp2517fd &dev);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_filter()
+    {
+      Clear();
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      uint32_t value;
+      uint32_t mask;          // 1: bit must match
+      uint8_t ext;
+      uint8_t channel;
+    } FILTER_ENTRY;
+
+    int8_t Insert(uint32_t value, uint32_t mask, bool ext, uint8_t channel);
+    bool Conflicts(uint32_t value, uint32_t mask, uint8_t ext, uint8_t channel);
+    void Merge(uint8_t a, uint8_t b);
+    int32_t MergeCost(uint8_t a, uint8_t b);
+    int8_t Reduce(uint8_t max_entries);
+
+    FILTER_ENTRY entries[MCP2517FD_FILTER_MAX_ENTRIES];
+    uint8_t entry_count;
+    uint32_t requested;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*
+  mcp2517fd_gateway.cpp - Frame forwarding between two mcp2517fd controllers
+*/
+#include "mcp2517fd_gateway.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+uint8_t mcp2517fd_gateway::Begin(CAN_FIFO_CHANNEL rx_fifo_ch_a, CAN_FIFO_CHANNEL rx_fifo_ch_b)
+{
+  rx_ch[0] = rx_fifo_ch_a;
+  rx_ch[1] = rx_fifo_ch_b;
+
+  for (uint8_t i = 0; i < 2; i++) {
+    CAN_OPERATION_MODE mode = can[i]->OperationModeGet();
+
+    // ESIGM can only change in configuration mode
+    if (can[i]->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+      return 0;
+    }
+
+    REG_CiCON ciCon;
+
+    ciCon.dword = 0;
+    ciCon.bytes[2] = can[i]->ReadByte(cREGADDR_CiCON + 2);
+    ciCon.bF.EsiInGatewayMode = 1;
+    can[i]->WriteByte(cREGADDR_CiCON + 2, ciCon.bytes[2]);
+
+    if (can[i]->OperationModeSwitch(mode) < 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int8_t mcp2517fd_gateway::RouteAdd(uint8_t from, uint32_t id, uint32_t mask, bool ext, CAN_FIFO_CHANNEL tx_fifo_ch,
+                                   uint32_t rate_fps, uint16_t burst)
+{
+  if ((route_count >= MCP2517FD_GATEWAY_MAX_ROUTES) || (from > 1)) {
+    return -1;
+  }
+
+  GATEWAY_ROUTE *r = &routes[route_count];
+
+  r->id = id & mask;
+  r->mask = mask;
+  r->from = from;
+  r->ext = ext;
+  r->tx_ch = tx_fifo_ch;
+  r->rate = rate_fps;
+  r->burst = burst ? burst : 1;
+  r->tokens = r->burst;
+  r->remainder = 0;
+  r->last = micros();
+  memset(&r->stats, 0, sizeof(r->stats));
+
+  return route_count++;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Forwarding
+uint16_t mcp2517fd_gateway::Service(uint8_t budget)
+{
+  return Forward(0, budget) + Forward(1, budget);
+}
+
+uint8_t mcp2517fd_gateway::Forward(uint8_t from, uint8_t budget)
+{
+  mcp2517fd *src = can[from];
+  mcp2517fd *dst = can[from ^ 1];
+  uint8_t forwarded = 0;
+
+  while (budget--) {
+    uint8_t *obj = src->ReceiveObjectRead(rx_ch[from], (uint8_t *) buf);
+
+    if (obj == NULL) {
+      break;
+    }
+
+    // Identifier straight from the object bytes: SID 0..10, EID 11..28, IDE in the control word
+    uint32_t sid = obj[0] | ((uint32_t) (obj[1] & 0x07) << 8);
+    bool ext = (obj[4] & 0x10) != 0;
+    uint32_t id = sid;
+
+    if (ext) {
+      uint32_t eid = (obj[1] >> 3) | ((uint32_t) obj[2] << 5) | ((uint32_t) (obj[3] & 0x1F) << 13);
+
+      id = (sid << 18) | eid;
+    }
+
+    GATEWAY_ROUTE *r = NULL;
+
+    for (uint8_t i = 0; i < route_count; i++) {
+      if ((routes[i].from == from) && (routes[i].ext == ext) && (((id & routes[i].mask) ^ routes[i].id) == 0)) {
+        r = &routes[i];
+        break;
+      }
+    }
+
+    if (r == NULL) {
+      unrouted++;
+      continue;
+    }
+
+    if (!Admit(r)) {
+      r->stats.rate_drops++;
+      continue;
+    }
+
+    if (dst->TransmitObjectLoad(obj, r->tx_ch, true) < 0) {
+      r->stats.full_drops++;
+      continue;
+    }
+
+    r->stats.forwarded++;
+    forwarded++;
+  }
+
+  return forwarded;
+}
+
+bool mcp2517fd_gateway::Admit(GATEWAY_ROUTE *r)
+{
+  if (!r->rate) {
+    return true;
+  }
+
+  unsigned long now = micros();
+  uint32_t elapsed = now - r->last;
+
+  r->last = now;
+
+  // Whole frames go into the bucket, the fraction is carried over
+  if (r->tokens < r->burst) {
+    uint64_t acc = ((uint64_t) elapsed * r->rate) + r->remainder;
+    uint64_t add = acc / 1000000UL;
+
+    r->remainder = acc - (add * 1000000UL);
+
+    if (add >= (uint64_t) (r->burst - r->tokens)) {
+      r->tokens = r->burst;
+      r->remainder = 0;
+    } else {
+      r->tokens += (uint16_t) add;
+    }
+  } else {
+    r->remainder = 0;
+  }
+
+  if (r->tokens == 0) {
+    return false;
+  }
+
+  r->tokens--;
+
+  return true;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Status
+void mcp2517fd_gateway::StatsGet(uint8_t route, MCP2517FD_GATEWAY_STATS *stats)
+{
+  if (route < route_count) {
+    *stats = routes[route].stats;
+  }
+}
+
+void mcp2517fd_gateway::StatsClear()
+{
+  for (uint8_t i = 0; i < route_count; i++) {
+    memset(&routes[i].stats, 0, sizeof(routes[i].stats));
+  }
+
+  unrouted = 0;
+}
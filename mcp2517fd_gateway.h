@@ -0,0 +1,133 @@
+/*
+  mcp2517fd_gateway.h - Frame forwarding between two mcp2517fd controllers
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_GATEWAY_H
+#define	MCP2517FD_GATEWAY_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_GATEWAY_MAX_ROUTES 16
+
+// *****************************************************************************
+//! Route statistics
+
+typedef struct {
+  uint32_t forwarded;
+  uint32_t rate_drops;      // over the route's rate
+  uint32_t full_drops;      // destination FIFO full, or its payload size too small for the frame
+} MCP2517FD_GATEWAY_STATS;
+
+class mcp2517fd_gateway {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Select the receive FIFOs and pass ESI on
+    /*!
+       rx_fifo_ch_a/b: receive FIFO of each controller frames are forwarded
+       from. Sets EsiInGatewayMode on both controllers through configuration
+       mode, so a frame keeps the ESI it was received with.
+       Returns 1 on success, 0 if a mode change timed out.
+    */
+
+    uint8_t Begin(CAN_FIFO_CHANNEL rx_fifo_ch_a = CAN_FIFO_CH2, CAN_FIFO_CHANNEL rx_fifo_ch_b = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Add a route
+    /*!
+       Frames received by controller from (0: a, 1: b) whose identifier
+       matches id under mask, with the same format, are loaded into tx_fifo_ch
+       of the other controller. Routes are tried in the order added; frames
+       matching none are dropped.
+       rate_fps caps the route at that many frames per second, 0 leaves it
+       uncapped; burst is how many frames may pass at once after being idle.
+       Returns the route id, -1 if the table is full.
+    */
+
+    int8_t RouteAdd(uint8_t from, uint32_t id, uint32_t mask, bool ext, CAN_FIFO_CHANNEL tx_fifo_ch,
+                    uint32_t rate_fps = 0, uint16_t burst = 1);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Forwarding
+
+    // *****************************************************************************
+    //! Forward received frames in both directions
+    /*!
+       Each frame is read into one buffer, turned into a transmit object in
+       place and written to the other controller in a single SPI transfer,
+       with TXREQ set right away. Frames over their route's rate or meeting a
+       full FIFO are dropped rather than held, so one busy route cannot stall
+       the others. Reads at most budget frames per direction.
+       Returns number of frames forwarded.
+    */
+
+    uint16_t Service(uint8_t budget = 16);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Status
+
+    // *****************************************************************************
+    //! Get statistics of a route
+    void StatsGet(uint8_t route, MCP2517FD_GATEWAY_STATS *stats);
+
+    // *****************************************************************************
+    //! Frames that matched no route
+    inline uint32_t UnroutedCount()
+    {
+      return unrouted;
+    }
+
+    // *****************************************************************************
+    //! Clear all statistics
+    void StatsClear();
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_gateway(mcp2517fd &dev_a, mcp2517fd &dev_b)
+    {
+      can[0] = &dev_a;
+      can[1] = &dev_b;
+      rx_ch[0] = CAN_FIFO_CH2;
+      rx_ch[1] = CAN_FIFO_CH2;
+      route_count = 0;
+      unrouted = 0;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      uint32_t id;
+      uint32_t mask;
+      uint8_t from;
+      bool ext;
+      CAN_FIFO_CHANNEL tx_ch;
+      uint32_t rate;             // frames per second, 0: uncapped
+      uint16_t burst;
+      uint16_t tokens;
+      uint32_t remainder;        // refill carried over, in frames * 1000000
+      unsigned long last;
+      MCP2517FD_GATEWAY_STATS stats;
+    } GATEWAY_ROUTE;
+
+    uint8_t Forward(uint8_t from, uint8_t budget);
+    bool Admit(GATEWAY_ROUTE *r);
+
+    mcp2517fd *can[2];
+    CAN_FIFO_CHANNEL rx_ch[2];
+    GATEWAY_ROUTE routes[MCP2517FD_GATEWAY_MAX_ROUTES];
+    uint8_t route_count;
+    uint32_t unrouted;
+    uint32_t buf[(CAN_OBJECT_BUFFER_SIZE + 3) / 4];   // the one frame buffer
+};
+
+#endif
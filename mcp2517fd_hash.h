@@ -0,0 +1,73 @@
+/*
+  mcp2517fd_hash.h - Open addressing hash helpers shared by the ID lookup tables
+
+  Tables hold a power of two number of slots, each starting with a 32 bit
+  key; a reserved key value marks free slots. Keys are placed by Fibonacci
+  hashing and collisions resolved by linear probing.
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_HASH_H
+#define	MCP2517FD_HASH_H
+
+#include <stdint.h>
+
+// *****************************************************************************
+//! log2 of a table size
+/*!
+   Returns -1 if size is not a power of two.
+*/
+
+static inline int8_t mcp2517fd_hash_bits(uint16_t size)
+{
+  int8_t bits = 0;
+
+  if (!size || (size & (size - 1))) {
+    return -1;
+  }
+
+  while (size > 1) {
+    size >>= 1;
+    bits++;
+  }
+
+  return bits;
+}
+
+// *****************************************************************************
+//! Home slot of key in a table of 1 << bits slots
+/*!
+   Fibonacci hashing: the top bits of the 32 bit product are the best mixed,
+   so the slot is taken from there.
+*/
+
+static inline uint16_t mcp2517fd_hash_slot(uint32_t key, uint8_t bits)
+{
+  return bits ? (uint16_t) ((uint32_t) (key * 2654435761UL) >> (32 - bits)) : 0;
+}
+
+// *****************************************************************************
+//! Slot holding key, or the free slot where it would go
+/*!
+   table points at the key of slot 0; slots are stride bytes apart and there
+   are 1 << bits of them. At least one slot must be free.
+*/
+
+static inline uint16_t mcp2517fd_hash_find(const void *table, uint16_t stride, uint8_t bits, uint32_t key, uint32_t empty)
+{
+  uint16_t mask = (uint16_t) ((1UL << bits) - 1);
+  uint16_t s = mcp2517fd_hash_slot(key, bits);
+
+  for (;;) {
+    uint32_t k = *(const uint32_t *) ((const uint8_t *) table + (uint32_t) s * stride);
+
+    if ((k == key) || (k == empty)) {
+      return s;
+    }
+
+    s = (s + 1) & mask;
+  }
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+  mcp2517fd_idfilter.cpp - Software second-stage ID filter for mcp2517fd
+*/
+#include "mcp2517fd_idfilter.h"
+#include "mcp2517fd_hash.h"
+
+#define IDFILTER_STD_MAX 0x7FFUL
+#define IDFILTER_EXT_MAX 0x1FFFFFFFUL
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+int8_t mcp2517fd_idfilter::Begin(uint32_t *table, uint16_t size)
+{
+  int8_t bits = size ? mcp2517fd_hash_bits(size) : 0;
+
+  if (bits < 0) {
+    ext_table = NULL;
+    ext_size = 0;
+    ext_bits = 0;
+    Clear();
+
+    return -1;
+  }
+
+  ext_table = table;
+  ext_size = size;
+  ext_bits = bits;
+  Clear();
+
+  return 0;
+}
+
+void mcp2517fd_idfilter::Clear()
+{
+  memset(std_map, 0, sizeof(std_map));
+
+  for (uint16_t i = 0; i < ext_size; i++) {
+    ext_table[i] = MCP2517FD_IDFILTER_EMPTY;
+  }
+
+  ext_count = 0;
+  passed = 0;
+  dropped = 0;
+}
+
+uint16_t mcp2517fd_idfilter::Find(uint32_t id)
+{
+  return mcp2517fd_hash_find(ext_table, sizeof(ext_table[0]), ext_bits, id, MCP2517FD_IDFILTER_EMPTY);
+}
+
+int8_t mcp2517fd_idfilter::Add(uint32_t id, bool ext)
+{
+  if (!ext) {
+    if (id > IDFILTER_STD_MAX) {
+      return -2;
+    }
+
+    std_map[id >> 3] |= (1 << (id & 7));
+
+    return 0;
+  }
+
+  if (id > IDFILTER_EXT_MAX) {
+    return -2;
+  }
+
+  if (!ext_size) {
+    return -1;
+  }
+
+  uint16_t s = Find(id);
+
+  if (ext_table[s] == id) {
+    return 0;
+  }
+
+  if (ext_count >= ext_size - ((ext_size + 3) / 4)) {
+    return -1;
+  }
+
+  ext_table[s] = id;
+  ext_count++;
+
+  return 0;
+}
+
+int8_t mcp2517fd_idfilter::AddRange(uint32_t first, uint32_t last, bool ext)
+{
+  for (uint32_t id = first; id <= last; id++) {
+    int8_t r = Add(id, ext);
+
+    if (r < 0) {
+      return r;
+    }
+
+    if (id == last) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Lookup
+bool mcp2517fd_idfilter::Match(uint32_t id, bool ext)
+{
+  if (!ext) {
+    return (id <= IDFILTER_STD_MAX) && (std_map[id >> 3] & (1 << (id & 7)));
+  }
+
+  if (!ext_size) {
+    return false;
+  }
+
+  return ext_table[Find(id)] == id;
+}
+
+uint8_t *mcp2517fd_idfilter::ReceiveMessageGet(mcp2517fd &dev, CAN_RX_MSGOBJ *rxObj, CAN_FIFO_CHANNEL channel)
+{
+  uint8_t *rxd;
+
+  while ((rxd = dev.ReceiveMessageBufferGet(rxObj, channel)) != NULL) {
+    if (Match(rxObj)) {
+      passed++;
+      return rxd;
+    }
+
+    dropped++;
+  }
+
+  return NULL;
+}
@@ -0,0 +1,116 @@
+/*
+  mcp2517fd_idfilter.h - Software second-stage ID filter for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_IDFILTER_H
+#define	MCP2517FD_IDFILTER_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_IDFILTER_EMPTY 0xFFFFFFFFUL   // free hash slot; no 29 bit ID has the top bits set
+
+class mcp2517fd_idfilter {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Provide storage for the 29 bit ID hash
+    /*!
+       size: number of slots, a power of two. At most 3/4 of the slots are
+       filled so probe sequences stay short. Without storage only 11 bit IDs
+       can be added.
+       Returns 0 on success, -1 if size is not a power of two; the filter is
+       then left without storage.
+    */
+
+    int8_t Begin(uint32_t *table, uint16_t size);
+
+    // *****************************************************************************
+    //! Accept an identifier
+    /*!
+       Returns 0 on success, -1 if the hash is full, -2 if the identifier is
+       out of range.
+    */
+
+    int8_t Add(uint32_t id, bool ext);
+
+    // *****************************************************************************
+    //! Accept all identifiers from first to last
+    int8_t AddRange(uint32_t first, uint32_t last, bool ext);
+
+    // *****************************************************************************
+    //! Remove all identifiers
+    void Clear();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Lookup
+
+    // *****************************************************************************
+    //! Check an identifier
+    bool Match(uint32_t id, bool ext);
+
+    // *****************************************************************************
+    //! Check the identifier of a received message
+    inline bool Match(const CAN_RX_MSGOBJ *rxObj)
+    {
+      if (rxObj->bF.ctrl.IDE) {
+        return Match(((uint32_t) rxObj->bF.id.SID << 18) | rxObj->bF.id.EID, true);
+      }
+
+      return Match(rxObj->bF.id.SID, false);
+    }
+
+    // *****************************************************************************
+    //! Get the next accepted message
+    /*!
+       Drains channel through ReceiveMessageBufferGet(), dropping frames that
+       do not match before any data is copied. Returns a pointer to the data
+       of the first match, NULL once the FIFO is empty.
+    */
+
+    uint8_t *ReceiveMessageGet(mcp2517fd &dev, CAN_RX_MSGOBJ *rxObj, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Frames passed and dropped by ReceiveMessageGet()
+    inline uint32_t PassedCount()
+    {
+      return passed;
+    }
+
+    inline uint32_t DroppedCount()
+    {
+      return dropped;
+    }
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_idfilter()
+    {
+      ext_table = NULL;
+      ext_size = 0;
+      ext_bits = 0;
+      Clear();
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    uint16_t Find(uint32_t id);
+
+    uint8_t std_map[2048 / 8];   // one bit per 11 bit ID
+    uint32_t *ext_table;
+    uint16_t ext_size;
+    uint8_t ext_bits;
+    uint16_t ext_count;
+    uint32_t passed;
+    uint32_t dropped;
+};
+
+#endif
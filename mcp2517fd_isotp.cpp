@@ -0,0 +1,455 @@
+/*
+  mcp2517fd_isotp.cpp - ISO 15765-2 (ISO-TP) transport over CAN FD for mcp2517fd
+*/
+#include "mcp2517fd_isotp.h"
+
+#define ISOTP_SF  0x00
+#define ISOTP_FF  0x10
+#define ISOTP_CF  0x20
+#define ISOTP_FC  0x30
+
+#define ISOTP_FS_CTS    0
+#define ISOTP_FS_WAIT   1
+#define ISOTP_FS_OVFLW  2
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_isotp::Begin(uint32_t tx_id, uint32_t rx_id, bool ext, uint8_t tx_dl, bool brs, CAN_FIFO_CHANNEL tx_fifo_ch)
+{
+  memset(&txObj, 0, sizeof(txObj));
+
+  if (ext) {
+    txObj.bF.id.SID = tx_id >> 18;
+    txObj.bF.id.EID = tx_id & 0x3FFFF;
+    txObj.bF.ctrl.IDE = 1;
+  } else {
+    txObj.bF.id.SID = tx_id;
+  }
+
+  // Largest valid frame length not above tx_dl
+  uint8_t dlc = 15;
+
+  while ((dlc > 8) && (DLC_DataLength[dlc] > tx_dl)) {
+    dlc--;
+  }
+
+  this->tx_dl = DLC_DataLength[dlc];
+
+  if (dlc > 8) {
+    txObj.bF.ctrl.FDF = 1;
+    txObj.bF.ctrl.BRS = brs;
+  }
+
+  this->rx_id = rx_id;
+  rx_ext = ext;
+  tx_ch = tx_fifo_ch;
+  tx_state = ISOTP_IDLE;
+  rx_state = ISOTP_IDLE;
+}
+
+void mcp2517fd_isotp::FlowControlSet(uint8_t block_size, uint8_t st_min)
+{
+  fc_bs = block_size;
+  fc_stmin = st_min;
+}
+
+void mcp2517fd_isotp::ReceiveBufferSet(uint8_t *buf, uint32_t size)
+{
+  rx_buf = buf;
+  rx_size = size;
+}
+
+void mcp2517fd_isotp::HandlerSet(mcp2517fd_isotp_rx_handler rx_handler, mcp2517fd_isotp_tx_handler tx_handler, void *context)
+{
+  this->rx_handler = rx_handler;
+  this->tx_handler = tx_handler;
+  handler_context = context;
+}
+
+uint32_t mcp2517fd_isotp::StMinMicros(uint8_t st_min)
+{
+  if (st_min <= 0x7F) {
+    return (uint32_t) st_min * 1000;
+  }
+
+  if ((st_min >= 0xF1) && (st_min <= 0xF9)) {
+    return (uint32_t) (st_min - 0xF0) * 100;
+  }
+
+  // Reserved values: the longest gap
+  return 0x7FUL * 1000;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Sender
+int8_t mcp2517fd_isotp::FrameLoad(uint8_t *frame, uint8_t len, bool flush)
+{
+  uint8_t dlc = 8;
+
+  // Pad to 8 bytes, FD frames up to the next valid length
+  while (DLC_DataLength[dlc] < len) {
+    dlc++;
+  }
+
+  memset(frame + len, MCP2517FD_ISOTP_PADDING, DLC_DataLength[dlc] - len);
+  txObj.bF.ctrl.DLC = dlc;
+
+  return can->TransmitChannelLoad(&txObj, frame, DLC_DataLength[dlc], tx_ch, flush);
+}
+
+int8_t mcp2517fd_isotp::Send(const uint8_t *data, uint32_t len)
+{
+  uint8_t sf_max = (tx_dl > 8) ? tx_dl - 2 : 7;
+  uint8_t hdr;
+
+  if (tx_state != ISOTP_IDLE) {
+    return -1;
+  }
+
+  if (!len) {
+    return -2;
+  }
+
+  // Single frame: 4 bit length up to 7 bytes, escaped length in FD frames
+  if (len <= sf_max) {
+    if (len <= 7) {
+      frame[0] = ISOTP_SF | len;
+      hdr = 1;
+    } else {
+      frame[0] = ISOTP_SF;
+      frame[1] = len;
+      hdr = 2;
+    }
+
+    memcpy(frame + hdr, data, len);
+
+    if (FrameLoad(frame, hdr + len, true) != 1) {
+      return -3;
+    }
+
+    tx_len = len;
+    TxEnd(MCP2517FD_ISOTP_OK);
+
+    return 0;
+  }
+
+  // First frame: 12 bit length, escaped 32 bit length above 4095 bytes
+  if (len <= 4095) {
+    frame[0] = ISOTP_FF | (len >> 8);
+    frame[1] = len;
+    hdr = 2;
+  } else {
+    frame[0] = ISOTP_FF;
+    frame[1] = 0;
+    frame[2] = len >> 24;
+    frame[3] = len >> 16;
+    frame[4] = len >> 8;
+    frame[5] = len;
+    hdr = 6;
+  }
+
+  memcpy(frame + hdr, data, tx_dl - hdr);
+
+  if (FrameLoad(frame, tx_dl, true) != 1) {
+    return -3;
+  }
+
+  tx_data = data;
+  tx_len = len;
+  tx_pos = tx_dl - hdr;
+  tx_sn = 1;
+  tx_wft = 0;
+  tx_timer = millis();
+  tx_state = ISOTP_WAIT_FC;
+
+  return 0;
+}
+
+int8_t mcp2517fd_isotp::ConsecutiveFrameLoad(bool flush)
+{
+  uint32_t n = tx_len - tx_pos;
+
+  if (n > (uint32_t) (tx_dl - 1)) {
+    n = tx_dl - 1;
+  }
+
+  frame[0] = ISOTP_CF | tx_sn;
+  memcpy(frame + 1, tx_data + tx_pos, n);
+
+  int8_t r = FrameLoad(frame, n + 1, flush);
+
+  if (r == 1) {
+    tx_pos += n;
+    tx_sn = (tx_sn + 1) & 0x0F;
+  }
+
+  return r;
+}
+
+void mcp2517fd_isotp::FlowControlReceive(const uint8_t *rxd, uint8_t len)
+{
+  if ((tx_state != ISOTP_WAIT_FC) || (len < 3)) {
+    return;
+  }
+
+  switch (rxd[0] & 0x0F) {
+    case ISOTP_FS_CTS:
+      tx_bs = rxd[1];
+      tx_bs_limited = (rxd[1] != 0);
+      tx_stmin_us = StMinMicros(rxd[2]);
+      tx_last_us = micros() - tx_stmin_us;
+      tx_wft = 0;
+      tx_state = ISOTP_SEND_CF;
+      break;
+
+    case ISOTP_FS_WAIT:
+      if (++tx_wft > MCP2517FD_ISOTP_WFT_MAX) {
+        TxEnd(MCP2517FD_ISOTP_WFT_OVRN);
+      } else {
+        tx_timer = millis();
+      }
+      break;
+
+    case ISOTP_FS_OVFLW:
+      TxEnd(MCP2517FD_ISOTP_BUFFER_OVFLW);
+      break;
+
+    default:
+      TxEnd(MCP2517FD_ISOTP_INVALID_FS);
+      break;
+  }
+}
+
+void mcp2517fd_isotp::TxEnd(MCP2517FD_ISOTP_RESULT result)
+{
+  tx_state = ISOTP_IDLE;
+
+  if (tx_handler) {
+    tx_handler(result, (result == MCP2517FD_ISOTP_OK) ? tx_len : tx_pos, handler_context);
+  }
+}
+
+uint8_t mcp2517fd_isotp::Service()
+{
+  uint8_t loaded = 0;
+
+  if ((tx_state == ISOTP_WAIT_FC) && (millis() - tx_timer > MCP2517FD_ISOTP_N_BS)) {
+    TxEnd(MCP2517FD_ISOTP_TIMEOUT_BS);
+  }
+
+  if ((rx_state == ISOTP_RECEIVE) && (millis() - rx_timer > MCP2517FD_ISOTP_N_CR)) {
+    RxEnd(MCP2517FD_ISOTP_TIMEOUT_CR);
+  }
+
+  if (tx_state != ISOTP_SEND_CF) {
+    return 0;
+  }
+
+  // With STmin one frame per gap, otherwise fill the FIFO and flush once
+  bool gap = (tx_stmin_us != 0);
+
+  if (gap && (micros() - tx_last_us < tx_stmin_us)) {
+    return 0;
+  }
+
+  while ((tx_pos < tx_len) && (!tx_bs_limited || tx_bs)) {
+    if (ConsecutiveFrameLoad(gap) != 1) {
+      break;
+    }
+
+    loaded++;
+
+    if (tx_bs_limited) {
+      tx_bs--;
+    }
+
+    if (gap) {
+      tx_last_us = micros();
+      break;
+    }
+  }
+
+  if (loaded && !gap) {
+    can->TransmitChannelFlush(tx_ch);
+  }
+
+  if (tx_pos >= tx_len) {
+    TxEnd(MCP2517FD_ISOTP_OK);
+  } else if (tx_bs_limited && !tx_bs) {
+    tx_timer = millis();
+    tx_state = ISOTP_WAIT_FC;
+  }
+
+  return loaded;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Receiver
+void mcp2517fd_isotp::FlowControlSend(uint8_t fs)
+{
+  frame[0] = ISOTP_FC | fs;
+  frame[1] = fc_bs;
+  frame[2] = fc_stmin;
+
+  FrameLoad(frame, 3, true);
+}
+
+void mcp2517fd_isotp::RxEnd(MCP2517FD_ISOTP_RESULT result)
+{
+  rx_state = ISOTP_IDLE;
+
+  if (rx_handler) {
+    rx_handler(result, rx_buf, (result == MCP2517FD_ISOTP_OK) ? rx_len : rx_pos, handler_context);
+  }
+}
+
+void mcp2517fd_isotp::SingleFrameReceive(const uint8_t *data, uint32_t len)
+{
+  if (rx_state == ISOTP_RECEIVE) {
+    RxEnd(MCP2517FD_ISOTP_UNEXP_PDU);
+  }
+
+  if (!rx_buf || (len > rx_size)) {
+    rx_pos = 0;
+    RxEnd(MCP2517FD_ISOTP_BUFFER_OVFLW);
+    return;
+  }
+
+  memcpy(rx_buf, data, len);
+  rx_len = len;
+  RxEnd(MCP2517FD_ISOTP_OK);
+}
+
+void mcp2517fd_isotp::FirstFrameReceive(const uint8_t *rxd, uint8_t len)
+{
+  uint32_t ff_dl = ((uint32_t) (rxd[0] & 0x0F) << 8) | rxd[1];
+  uint8_t hdr = 2;
+
+  if (rx_state == ISOTP_RECEIVE) {
+    RxEnd(MCP2517FD_ISOTP_UNEXP_PDU);
+  }
+
+  if (len < 8) {
+    return;
+  }
+
+  if (!ff_dl) {
+    ff_dl = ((uint32_t) rxd[2] << 24) | ((uint32_t) rxd[3] << 16) | ((uint32_t) rxd[4] << 8) | rxd[5];
+    hdr = 6;
+  }
+
+  // Would have fitted a single frame
+  if (ff_dl <= (uint32_t) ((len > 8) ? len - 2 : 7)) {
+    return;
+  }
+
+  if (!rx_buf || (ff_dl > rx_size)) {
+    FlowControlSend(ISOTP_FS_OVFLW);
+    rx_pos = 0;
+    RxEnd(MCP2517FD_ISOTP_BUFFER_OVFLW);
+    return;
+  }
+
+  // Straight into the caller's buffer
+  memcpy(rx_buf, rxd + hdr, len - hdr);
+  rx_pos = len - hdr;
+  rx_len = ff_dl;
+  rx_sn = 1;
+  rx_bs = fc_bs;
+  rx_timer = millis();
+  rx_state = ISOTP_RECEIVE;
+
+  FlowControlSend(ISOTP_FS_CTS);
+}
+
+void mcp2517fd_isotp::ConsecutiveFrameReceive(const uint8_t *rxd, uint8_t len)
+{
+  if (rx_state != ISOTP_RECEIVE) {
+    return;
+  }
+
+  if ((rxd[0] & 0x0F) != rx_sn) {
+    RxEnd(MCP2517FD_ISOTP_WRONG_SN);
+    return;
+  }
+
+  uint32_t n = rx_len - rx_pos;
+
+  if (n > (uint32_t) (len - 1)) {
+    n = len - 1;
+  }
+
+  memcpy(rx_buf + rx_pos, rxd + 1, n);
+  rx_pos += n;
+  rx_sn = (rx_sn + 1) & 0x0F;
+  rx_timer = millis();
+
+  if (rx_pos >= rx_len) {
+    RxEnd(MCP2517FD_ISOTP_OK);
+    return;
+  }
+
+  // End of block: let the sender go on
+  if (fc_bs && !--rx_bs) {
+    rx_bs = fc_bs;
+    FlowControlSend(ISOTP_FS_CTS);
+  }
+}
+
+bool mcp2517fd_isotp::Receive(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd)
+{
+  uint32_t id;
+
+  if (rxObj->bF.ctrl.IDE) {
+    id = ((uint32_t) rxObj->bF.id.SID << 18) | rxObj->bF.id.EID;
+  } else {
+    id = rxObj->bF.id.SID;
+  }
+
+  if ((rxObj->bF.ctrl.IDE != rx_ext) || (id != rx_id)) {
+    return false;
+  }
+
+  uint8_t len = DLC_DataLength[rxObj->bF.ctrl.DLC];
+
+  if (!len) {
+    return true;
+  }
+
+  switch (rxd[0] & 0xF0) {
+    case ISOTP_SF:
+      if (rxd[0] & 0x0F) {
+        if (((rxd[0] & 0x0F) < len) && (len <= 8)) {
+          SingleFrameReceive(rxd + 1, rxd[0] & 0x0F);
+        }
+      } else if ((len > 8) && rxd[1] && (rxd[1] <= len - 2)) {
+        SingleFrameReceive(rxd + 2, rxd[1]);
+      }
+      break;
+
+    case ISOTP_FF:
+      FirstFrameReceive(rxd, len);
+      break;
+
+    case ISOTP_CF:
+      ConsecutiveFrameReceive(rxd, len);
+      break;
+
+    case ISOTP_FC:
+      FlowControlReceive(rxd, len);
+      break;
+
+    default:
+      break;
+  }
+
+  return true;
+}
+
+void mcp2517fd_isotp::Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context)
+{
+  ((mcp2517fd_isotp *) context)->Receive(rxObj, rxd);
+}
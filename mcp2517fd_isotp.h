@@ -0,0 +1,193 @@
+/*
+  mcp2517fd_isotp.h - ISO 15765-2 (ISO-TP) transport over CAN FD for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_ISOTP_H
+#define	MCP2517FD_ISOTP_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_ISOTP_N_BS      1000   // ms to wait for a flow control frame
+#define MCP2517FD_ISOTP_N_CR      1000   // ms to wait for a consecutive frame
+#define MCP2517FD_ISOTP_WFT_MAX   16     // flow control WAIT frames accepted in a row
+#define MCP2517FD_ISOTP_PADDING   0xCC
+
+// *****************************************************************************
+//! Result of a transfer
+
+typedef enum {
+  MCP2517FD_ISOTP_OK,
+  MCP2517FD_ISOTP_TIMEOUT_BS,     // no flow control from the receiver
+  MCP2517FD_ISOTP_TIMEOUT_CR,     // consecutive frame overdue
+  MCP2517FD_ISOTP_WRONG_SN,       // consecutive frame out of sequence
+  MCP2517FD_ISOTP_INVALID_FS,     // unknown flow status
+  MCP2517FD_ISOTP_UNEXP_PDU,      // new message started before the last one ended
+  MCP2517FD_ISOTP_WFT_OVRN,       // too many WAIT flow control frames
+  MCP2517FD_ISOTP_BUFFER_OVFLW    // message does not fit the receive buffer
+} MCP2517FD_ISOTP_RESULT;
+
+// *****************************************************************************
+//! Called when a received message is complete or was abandoned
+/*!
+   data is the buffer passed to ReceiveBufferSet(); it may be reused once the
+   call returns.
+*/
+
+typedef void (*mcp2517fd_isotp_rx_handler)(MCP2517FD_ISOTP_RESULT result, uint8_t *data, uint32_t len, void *context);
+
+// *****************************************************************************
+//! Called when a message passed to Send() is fully loaded or was abandoned
+
+typedef void (*mcp2517fd_isotp_tx_handler)(MCP2517FD_ISOTP_RESULT result, uint32_t len, void *context);
+
+class mcp2517fd_isotp {
+  public:
+    // *****************************************************************************
+    //! Set up the connection
+    /*!
+       tx_id/rx_id: 11 bit or, with ext, 29 bit identifiers of the two directions
+       tx_dl: frame length sent, 8 for classic CAN or 12..64 for CAN FD
+       brs: switch to the data bit rate in FD frames
+    */
+
+    void Begin(uint32_t tx_id, uint32_t rx_id, bool ext = false, uint8_t tx_dl = 64, bool brs = true, CAN_FIFO_CHANNEL tx_fifo_ch = CAN_FIFO_CH1);
+
+    // *****************************************************************************
+    //! Flow control sent to the peer
+    /*!
+       block_size: consecutive frames between flow control frames, 0 for none
+       st_min: minimum gap between consecutive frames, ISO 15765-2 encoding
+    */
+
+    void FlowControlSet(uint8_t block_size, uint8_t st_min);
+
+    // *****************************************************************************
+    //! Buffer received messages are reassembled into
+    void ReceiveBufferSet(uint8_t *buf, uint32_t size);
+
+    // *****************************************************************************
+    //! Set completion handlers
+    void HandlerSet(mcp2517fd_isotp_rx_handler rx_handler, mcp2517fd_isotp_tx_handler tx_handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Start sending a message
+    /*!
+       data is read in place while the transfer runs and must stay valid until
+       the TX handler is called. Messages above 4095 bytes use the 32 bit
+       first frame length.
+       Returns 0 if started, -1 if a message is still being sent, -2 if len is 0,
+       -3 if the transmit FIFO is full.
+    */
+
+    int8_t Send(const uint8_t *data, uint32_t len);
+
+    // *****************************************************************************
+    //! Process a received frame
+    /*!
+       Returns true if the frame belongs to the connection.
+    */
+
+    bool Receive(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd);
+
+    // *****************************************************************************
+    //! Router handler; context is the mcp2517fd_isotp instance
+    static void Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+    // *****************************************************************************
+    //! Send consecutive frames and check timeouts
+    /*!
+       Without STmin, loads as many consecutive frames as the transmit FIFO
+       takes and flushes them together. Call often while Busy().
+       Returns number of frames loaded.
+    */
+
+    uint8_t Service();
+
+    // *****************************************************************************
+    //! Is a message being sent or received?
+    inline bool Busy()
+    {
+      return (tx_state != ISOTP_IDLE) || (rx_state != ISOTP_IDLE);
+    }
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_isotp(mcp2517fd &dev)
+    {
+      can = &dev;
+      tx_state = ISOTP_IDLE;
+      rx_state = ISOTP_IDLE;
+      rx_buf = NULL;
+      rx_size = 0;
+      rx_handler = NULL;
+      tx_handler = NULL;
+      handler_context = NULL;
+      fc_bs = 0;
+      fc_stmin = 0;
+      Begin(0x7E0, 0x7E8, false, 8, false);
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef enum {
+      ISOTP_IDLE,
+      ISOTP_WAIT_FC,       // TX: first frame or block sent
+      ISOTP_SEND_CF,       // TX: clear to send
+      ISOTP_RECEIVE        // RX: waiting for consecutive frames
+    } ISOTP_STATE;
+
+    int8_t FrameLoad(uint8_t *frame, uint8_t len, bool flush);
+    int8_t ConsecutiveFrameLoad(bool flush);
+    void FlowControlSend(uint8_t fs);
+    void FlowControlReceive(const uint8_t *rxd, uint8_t len);
+    void SingleFrameReceive(const uint8_t *data, uint32_t len);
+    void FirstFrameReceive(const uint8_t *rxd, uint8_t len);
+    void ConsecutiveFrameReceive(const uint8_t *rxd, uint8_t len);
+    void TxEnd(MCP2517FD_ISOTP_RESULT result);
+    void RxEnd(MCP2517FD_ISOTP_RESULT result);
+    static uint32_t StMinMicros(uint8_t st_min);
+
+    mcp2517fd *can;
+    CAN_TX_MSGOBJ txObj;         // identifier and format of every frame sent
+    uint32_t rx_id;
+    bool rx_ext;
+    uint8_t tx_dl;
+    CAN_FIFO_CHANNEL tx_ch;
+    uint8_t frame[MAX_DATA_BYTES];
+
+    mcp2517fd_isotp_rx_handler rx_handler;
+    mcp2517fd_isotp_tx_handler tx_handler;
+    void *handler_context;
+
+    // Sender
+    ISOTP_STATE tx_state;
+    const uint8_t *tx_data;
+    uint32_t tx_len;
+    uint32_t tx_pos;
+    uint8_t tx_sn;
+    uint8_t tx_bs;               // frames left in the block, 0: unlimited
+    bool tx_bs_limited;
+    uint32_t tx_stmin_us;
+    unsigned long tx_last_us;
+    unsigned long tx_timer;
+    uint8_t tx_wft;
+
+    // Receiver
+    ISOTP_STATE rx_state;
+    uint8_t *rx_buf;
+    uint32_t rx_size;
+    uint32_t rx_len;
+    uint32_t rx_pos;
+    uint8_t rx_sn;
+    uint8_t rx_bs;               // frames left before the next flow control
+    unsigned long rx_timer;
+    uint8_t fc_bs;
+    uint8_t fc_stmin;
+};
+
+#endif
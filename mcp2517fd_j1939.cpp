@@ -0,0 +1,717 @@
+/*
+  mcp2517fd_j1939.cpp - SAE J1939 address claim and transport protocol for mcp2517fd
+*/
+#include "mcp2517fd_j1939.h"
+
+#define J1939_CLAIM_TIME  250    // ms a claim must stand before sending
+#define J1939_T1          750    // ms between data packets
+#define J1939_T2          1250   // ms from CTS to data
+#define J1939_T3          1250   // ms from data to CTS or end of message acknowledge
+#define J1939_T4          1050   // ms a CTS hold may last
+#define J1939_BAM_GAP     50     // ms between BAM data packets
+
+#define J1939_TP_RTS      16
+#define J1939_TP_CTS      17
+#define J1939_TP_EOMA     19
+#define J1939_TP_BAM      32
+#define J1939_TP_ABORT    255
+
+#define J1939_ABORT_BUSY      1  // no session free
+#define J1939_ABORT_RESOURCES 2  // no pool memory or not subscribed
+#define J1939_ABORT_TIMEOUT   3
+#define J1939_ABORT_SEQUENCE  7
+
+#define J1939_MAX_SIZE    1785   // 255 packets of 7 bytes
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_j1939::Begin(uint64_t name, uint8_t address, CAN_FIFO_CHANNEL tx_fifo_ch)
+{
+  this->name = name;
+  this->address = address;
+  tx_ch = tx_fifo_ch;
+  claim_tries = 0;
+
+  AddressClaimSend();
+  AddressStateSet(MCP2517FD_J1939_CLAIMING);
+}
+
+void mcp2517fd_j1939::PoolSet(uint8_t *pool, uint16_t size)
+{
+  uint16_t blocks = size / MCP2517FD_J1939_BLOCK;
+
+  this->pool = pool;
+  pool_blocks = (blocks > MCP2517FD_J1939_POOL_BLOCKS) ? MCP2517FD_J1939_POOL_BLOCKS : blocks;
+  memset(pool_used, 0, sizeof(pool_used));
+  memset(sessions, 0, sizeof(sessions));
+}
+
+void mcp2517fd_j1939::HandlerSet(mcp2517fd_j1939_handler handler, mcp2517fd_j1939_tx_handler tx_handler,
+                                 mcp2517fd_j1939_address_handler address_handler, void *context)
+{
+  this->handler = handler;
+  this->tx_handler = tx_handler;
+  this->address_handler = address_handler;
+  handler_context = context;
+}
+
+int8_t mcp2517fd_j1939::Subscribe(uint32_t pgn)
+{
+  if (pgn_count >= MCP2517FD_J1939_MAX_PGNS) {
+    return -1;
+  }
+
+  pgns[pgn_count++] = pgn;
+
+  return 0;
+}
+
+bool mcp2517fd_j1939::Subscribed(uint32_t pgn)
+{
+  if (!pgn_count) {
+    return true;
+  }
+
+  for (uint8_t i = 0; i < pgn_count; i++) {
+    if (pgns[i] == pgn) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static int8_t j1939_rule(mcp2517fd_filter &filter, uint32_t pgn, CAN_FIFO_CHANNEL channel)
+{
+  // Priority and source address are don't care; so is the destination of PDU1 formats
+  uint32_t mask = (((pgn >> 8) & 0xFF) < 240) ? 0x03FF0000UL : 0x03FFFF00UL;
+
+  return filter.AddMasked(pgn << 8, mask, true, channel);
+}
+
+int8_t mcp2517fd_j1939::FiltersAdd(mcp2517fd_filter &filter, CAN_FIFO_CHANNEL channel)
+{
+  static const uint32_t protocol[] = {
+    MCP2517FD_J1939_PGN_ADDRESS, MCP2517FD_J1939_PGN_REQUEST, MCP2517FD_J1939_PGN_TP_CM, MCP2517FD_J1939_PGN_TP_DT
+  };
+
+  if (!pgn_count) {
+    return filter.AddMasked(0, 0, true, channel);
+  }
+
+  for (uint8_t i = 0; i < sizeof(protocol) / sizeof(protocol[0]); i++) {
+    if (j1939_rule(filter, protocol[i], channel) < 0) {
+      return -1;
+    }
+  }
+
+  for (uint8_t i = 0; i < pgn_count; i++) {
+    if (j1939_rule(filter, pgns[i], channel) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Identifiers
+void mcp2517fd_j1939::IdDecode(const CAN_MSGOBJ_ID *id, MCP2517FD_J1939_HEADER *header)
+{
+  uint32_t i = ((uint32_t) id->SID << 18) | id->EID;
+  uint8_t pf = (i >> 16) & 0xFF;
+
+  header->priority = (i >> 26) & 0x07;
+  header->sa = i & 0xFF;
+  header->pgn = (i >> 8) & 0x3FF00UL;
+
+  if (pf < 240) {
+    header->da = (i >> 8) & 0xFF;
+  } else {
+    header->pgn |= (i >> 8) & 0xFF;
+    header->da = MCP2517FD_J1939_GLOBAL;
+  }
+}
+
+void mcp2517fd_j1939::IdEncode(CAN_MSGOBJ_ID *id, const MCP2517FD_J1939_HEADER *header)
+{
+  uint32_t i = ((uint32_t) (header->priority & 0x07) << 26) | ((header->pgn & 0x3FF00UL) << 8) | header->sa;
+
+  if (((header->pgn >> 8) & 0xFF) < 240) {
+    i |= (uint32_t) header->da << 8;
+  } else {
+    i |= (header->pgn & 0xFF) << 8;
+  }
+
+  id->SID = i >> 18;
+  id->EID = i & 0x3FFFF;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Address Claim
+int8_t mcp2517fd_j1939::FrameLoad(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, uint8_t len, bool flush)
+{
+  CAN_TX_MSGOBJ txObj;
+  MCP2517FD_J1939_HEADER h;
+
+  h.pgn = pgn;
+  h.priority = priority;
+  h.sa = AddressGet();
+  h.da = da;
+
+  txObj.word[0] = 0;
+  txObj.word[1] = 0;
+  IdEncode(&txObj.bF.id, &h);
+  txObj.bF.ctrl.IDE = 1;
+  txObj.bF.ctrl.DLC = len;
+
+  return can->TransmitChannelLoad(&txObj, (uint8_t *) data, len, tx_ch, flush);
+}
+
+void mcp2517fd_j1939::AddressStateSet(MCP2517FD_J1939_ADDRESS_STATE state)
+{
+  address_state = state;
+  claim_time = millis();
+
+  if (address_handler) {
+    address_handler(state, AddressGet(), handler_context);
+  }
+}
+
+void mcp2517fd_j1939::AddressClaimSend()
+{
+  uint8_t data[8];
+
+  for (uint8_t i = 0; i < 8; i++) {
+    data[i] = name >> (8 * i);
+  }
+
+  FrameLoad(MCP2517FD_J1939_PGN_ADDRESS, 6, MCP2517FD_J1939_GLOBAL, data, 8);
+}
+
+void mcp2517fd_j1939::AddressClaimReceive(uint8_t sa, const uint8_t *rxd)
+{
+  uint64_t other = 0;
+
+  if ((sa != address) || (address_state == MCP2517FD_J1939_UNCLAIMED) ||
+      (address_state == MCP2517FD_J1939_CANNOT_CLAIM)) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < 8; i++) {
+    other |= (uint64_t) rxd[i] << (8 * i);
+  }
+
+  // Lower NAME wins; defend the address
+  if (name < other) {
+    AddressClaimSend();
+    return;
+  }
+
+  if (name == other) {
+    return;
+  }
+
+  // Lost: self-configurable nodes move on through 128..247
+  if ((name >> 63) && (++claim_tries < 120)) {
+    address = ((address < 128) || (address >= 247)) ? 128 : address + 1;
+    AddressClaimSend();
+    AddressStateSet(MCP2517FD_J1939_CLAIMING);
+    return;
+  }
+
+  AddressStateSet(MCP2517FD_J1939_CANNOT_CLAIM);
+  AddressClaimSend();
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Reassembly Pool
+int16_t mcp2517fd_j1939::PoolAlloc(uint8_t blocks)
+{
+  uint8_t run = 0;
+
+  // First fit over contiguous free blocks
+  for (uint8_t i = 0; i < pool_blocks; i++) {
+    if (pool_used[i >> 3] & (1 << (i & 7))) {
+      run = 0;
+      continue;
+    }
+
+    if (++run == blocks) {
+      uint8_t first = i + 1 - blocks;
+
+      for (uint8_t b = first; b <= i; b++) {
+        pool_used[b >> 3] |= (1 << (b & 7));
+      }
+
+      return first;
+    }
+  }
+
+  return -1;
+}
+
+void mcp2517fd_j1939::PoolFree(uint8_t block, uint8_t blocks)
+{
+  for (uint8_t b = block; b < block + blocks; b++) {
+    pool_used[b >> 3] &= ~(1 << (b & 7));
+  }
+}
+
+mcp2517fd_j1939::J1939_SESSION *mcp2517fd_j1939::SessionFind(uint8_t sa, uint8_t da)
+{
+  for (uint8_t i = 0; i < MCP2517FD_J1939_MAX_SESSIONS; i++) {
+    J1939_SESSION *s = &sessions[i];
+
+    if ((s->type != J1939_SESSION_FREE) && (s->sa == sa) && (s->da == da)) {
+      return s;
+    }
+  }
+
+  return NULL;
+}
+
+void mcp2517fd_j1939::SessionClose(J1939_SESSION *s)
+{
+  PoolFree(s->block, s->blocks);
+  s->type = J1939_SESSION_FREE;
+}
+
+uint8_t mcp2517fd_j1939::SessionCount()
+{
+  uint8_t n = 0;
+
+  for (uint8_t i = 0; i < MCP2517FD_J1939_MAX_SESSIONS; i++) {
+    if (sessions[i].type != J1939_SESSION_FREE) {
+      n++;
+    }
+  }
+
+  return n;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Transport Protocol Receiver
+int8_t mcp2517fd_j1939::ControlSend(uint8_t da, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint32_t pgn)
+{
+  uint8_t data[8];
+
+  data[0] = control;
+  data[1] = b1;
+  data[2] = b2;
+  data[3] = b3;
+  data[4] = b4;
+  data[5] = pgn;
+  data[6] = pgn >> 8;
+  data[7] = pgn >> 16;
+
+  return FrameLoad(MCP2517FD_J1939_PGN_TP_CM, 7, da, data, 8);
+}
+
+void mcp2517fd_j1939::ClearToSend(J1939_SESSION *s)
+{
+  uint8_t n = s->packets - s->next + 1;
+
+  if (n > s->max_cts) {
+    n = s->max_cts;
+  }
+
+  if (n > MCP2517FD_J1939_CTS_PACKETS) {
+    n = MCP2517FD_J1939_CTS_PACKETS;
+  }
+
+  s->window_end = s->next + n - 1;
+  s->timer = millis();
+
+  ControlSend(s->sa, J1939_TP_CTS, n, s->next, 0xFF, 0xFF, s->pgn);
+}
+
+void mcp2517fd_j1939::SessionOpen(uint8_t sa, uint8_t da, uint8_t priority, const uint8_t *rxd, bool bam)
+{
+  uint16_t size = rxd[1] | ((uint16_t) rxd[2] << 8);
+  uint8_t packets = rxd[3];
+  uint32_t pgn = rxd[5] | ((uint32_t) rxd[6] << 8) | ((uint32_t) rxd[7] << 16);
+  J1939_SESSION *s = SessionFind(sa, da);
+
+  // A new announcement from the same node replaces the old one
+  if (s) {
+    SessionClose(s);
+  }
+
+  if ((size < 9) || (size > J1939_MAX_SIZE) || (packets != (size + 6) / 7)) {
+    return;
+  }
+
+  uint8_t reason = J1939_ABORT_RESOURCES;
+
+  if (Subscribed(pgn)) {
+    s = NULL;
+
+    for (uint8_t i = 0; (i < MCP2517FD_J1939_MAX_SESSIONS) && !s; i++) {
+      if (sessions[i].type == J1939_SESSION_FREE) {
+        s = &sessions[i];
+      }
+    }
+
+    uint8_t blocks = (size + MCP2517FD_J1939_BLOCK - 1) / MCP2517FD_J1939_BLOCK;
+    int16_t block = s ? PoolAlloc(blocks) : -1;
+
+    if (block >= 0) {
+      s->type = bam ? J1939_SESSION_BAM : J1939_SESSION_CMDT;
+      s->sa = sa;
+      s->da = da;
+      s->priority = priority;
+      s->pgn = pgn;
+      s->size = size;
+      s->packets = packets;
+      s->next = 1;
+      s->max_cts = rxd[4] ? rxd[4] : 0xFF;
+      s->block = block;
+      s->blocks = blocks;
+      s->timer = millis();
+
+      if (!bam) {
+        ClearToSend(s);
+      }
+
+      return;
+    }
+
+    dropped++;
+    reason = s ? J1939_ABORT_RESOURCES : J1939_ABORT_BUSY;
+  }
+
+  if (!bam) {
+    ControlSend(sa, J1939_TP_ABORT, reason, 0xFF, 0xFF, 0xFF, pgn);
+  }
+}
+
+void mcp2517fd_j1939::SessionData(J1939_SESSION *s, const uint8_t *rxd)
+{
+  if (!s) {
+    return;
+  }
+
+  uint8_t seq = rxd[0];
+
+  if ((seq != s->next) || ((s->type == J1939_SESSION_CMDT) && (seq > s->window_end))) {
+    if (s->type == J1939_SESSION_CMDT) {
+      ControlSend(s->sa, J1939_TP_ABORT, J1939_ABORT_SEQUENCE, 0xFF, 0xFF, 0xFF, s->pgn);
+    }
+
+    dropped++;
+    SessionClose(s);
+    return;
+  }
+
+  // Straight into the pool
+  uint8_t *buf = pool + (uint16_t) s->block * MCP2517FD_J1939_BLOCK;
+  uint16_t offset = (uint16_t) (seq - 1) * 7;
+  uint16_t n = s->size - offset;
+
+  memcpy(buf + offset, rxd + 1, (n > 7) ? 7 : n);
+  s->next++;
+  s->timer = millis();
+
+  if (seq == s->packets) {
+    MCP2517FD_J1939_HEADER h;
+
+    if (s->type == J1939_SESSION_CMDT) {
+      ControlSend(s->sa, J1939_TP_EOMA, s->size, s->size >> 8, s->packets, 0xFF, s->pgn);
+    }
+
+    h.pgn = s->pgn;
+    h.priority = s->priority;
+    h.sa = s->sa;
+    h.da = s->da;
+
+    if (handler) {
+      handler(&h, buf, s->size, handler_context);
+    }
+
+    SessionClose(s);
+    return;
+  }
+
+  if ((s->type == J1939_SESSION_CMDT) && (seq == s->window_end)) {
+    ClearToSend(s);
+  }
+}
+
+void mcp2517fd_j1939::ConnectionReceive(const MCP2517FD_J1939_HEADER *h, const uint8_t *rxd)
+{
+  uint32_t pgn = rxd[5] | ((uint32_t) rxd[6] << 8) | ((uint32_t) rxd[7] << 16);
+  bool to_us = (h->da != MCP2517FD_J1939_GLOBAL);
+  bool ours = to_us && (tx_state != J1939_TX_IDLE) && (tx_state != J1939_TX_BAM) &&
+              (h->sa == tx_da) && (pgn == tx_pgn);
+
+  switch (rxd[0]) {
+    case J1939_TP_BAM:
+      if (!to_us) {
+        SessionOpen(h->sa, h->da, h->priority, rxd, true);
+      }
+      break;
+
+    case J1939_TP_RTS:
+      if (to_us) {
+        SessionOpen(h->sa, h->da, h->priority, rxd, false);
+      }
+      break;
+
+    case J1939_TP_CTS:
+      if (!ours || (tx_state == J1939_TX_WAIT_EOMA)) {
+        break;
+      }
+
+      if (!rxd[1]) {
+        tx_state = J1939_TX_HOLD;
+      } else if ((rxd[2] >= 1) && (rxd[2] <= tx_packets)) {
+        uint16_t end = rxd[2] + rxd[1] - 1;
+
+        tx_next = rxd[2];
+        tx_window_end = (end > tx_packets) ? tx_packets : end;
+        tx_state = J1939_TX_SEND;
+      }
+
+      tx_timer = millis();
+      break;
+
+    case J1939_TP_EOMA:
+      if (ours && (tx_state == J1939_TX_WAIT_EOMA)) {
+        TxEnd(MCP2517FD_J1939_TX_OK);
+      }
+      break;
+
+    case J1939_TP_ABORT:
+      if (ours) {
+        TxEnd(MCP2517FD_J1939_TX_ABORTED);
+      } else {
+        J1939_SESSION *s = SessionFind(h->sa, h->da);
+
+        if (s && (s->pgn == pgn)) {
+          SessionClose(s);
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+bool mcp2517fd_j1939::Receive(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd)
+{
+  MCP2517FD_J1939_HEADER h;
+
+  if (!rxObj->bF.ctrl.IDE) {
+    return false;
+  }
+
+  IdDecode(&rxObj->bF.id, &h);
+
+  // PDU1 traffic between other nodes
+  if ((h.da != MCP2517FD_J1939_GLOBAL) && (h.da != AddressGet())) {
+    return false;
+  }
+
+  uint8_t len = DLC_DataLength[rxObj->bF.ctrl.DLC];
+
+  if (len > 8) {
+    len = 8;
+  }
+
+  switch (h.pgn) {
+    case MCP2517FD_J1939_PGN_TP_CM:
+      if (len == 8) {
+        ConnectionReceive(&h, rxd);
+      }
+      return true;
+
+    case MCP2517FD_J1939_PGN_TP_DT:
+      if (len == 8) {
+        SessionData(SessionFind(h.sa, h.da), rxd);
+      }
+      return true;
+
+    case MCP2517FD_J1939_PGN_ADDRESS:
+      if (len == 8) {
+        AddressClaimReceive(h.sa, rxd);
+      }
+      break;
+
+    case MCP2517FD_J1939_PGN_REQUEST:
+      if ((len >= 3) && ((rxd[0] | ((uint32_t) rxd[1] << 8) | ((uint32_t) rxd[2] << 16)) == MCP2517FD_J1939_PGN_ADDRESS)) {
+        AddressClaimSend();
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (handler && Subscribed(h.pgn)) {
+    handler(&h, rxd, len, handler_context);
+  }
+
+  return true;
+}
+
+void mcp2517fd_j1939::Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context)
+{
+  ((mcp2517fd_j1939 *) context)->Receive(rxObj, rxd);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Transport Protocol Sender
+int8_t mcp2517fd_j1939::Send(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, uint16_t len)
+{
+  if (address_state != MCP2517FD_J1939_CLAIMED) {
+    return -4;
+  }
+
+  if (len <= 8) {
+    return (FrameLoad(pgn, priority, da, data, len) == 1) ? 0 : -3;
+  }
+
+  if (len > J1939_MAX_SIZE) {
+    return -2;
+  }
+
+  if (tx_state != J1939_TX_IDLE) {
+    return -1;
+  }
+
+  uint8_t packets = (len + 6) / 7;
+  bool bam = (da == MCP2517FD_J1939_GLOBAL);
+
+  if (ControlSend(da, bam ? J1939_TP_BAM : J1939_TP_RTS, len, len >> 8, packets, 0xFF, pgn) != 1) {
+    return -3;
+  }
+
+  tx_pgn = pgn;
+  tx_priority = priority;
+  tx_da = da;
+  tx_data = data;
+  tx_len = len;
+  tx_packets = packets;
+  tx_next = 1;
+  tx_window_end = bam ? 1 : 0;
+  tx_timer = millis();
+  tx_state = bam ? J1939_TX_BAM : J1939_TX_WAIT_CTS;
+
+  return 0;
+}
+
+uint8_t mcp2517fd_j1939::DataLoad(uint16_t last)
+{
+  uint8_t loaded = 0;
+  uint8_t data[8];
+
+  // Load the window without TXREQ, then flush once
+  while (tx_next <= last) {
+    uint16_t offset = (uint16_t) (tx_next - 1) * 7;
+    uint16_t n = tx_len - offset;
+
+    if (n > 7) {
+      n = 7;
+    }
+
+    data[0] = tx_next;
+    memcpy(data + 1, tx_data + offset, n);
+    memset(data + 1 + n, 0xFF, 7 - n);
+
+    if (FrameLoad(MCP2517FD_J1939_PGN_TP_DT, 7, tx_da, data, 8, false) != 1) {
+      break;
+    }
+
+    tx_next++;
+    loaded++;
+  }
+
+  if (loaded) {
+    can->TransmitChannelFlush(tx_ch);
+  }
+
+  return loaded;
+}
+
+void mcp2517fd_j1939::TxEnd(MCP2517FD_J1939_TX_RESULT result)
+{
+  tx_state = J1939_TX_IDLE;
+
+  if (tx_handler) {
+    tx_handler(tx_pgn, result, handler_context);
+  }
+}
+
+void mcp2517fd_j1939::Service()
+{
+  unsigned long now = millis();
+
+  if ((address_state == MCP2517FD_J1939_CLAIMING) && (now - claim_time >= J1939_CLAIM_TIME)) {
+    AddressStateSet(MCP2517FD_J1939_CLAIMED);
+  }
+
+  // Incoming sessions
+  for (uint8_t i = 0; i < MCP2517FD_J1939_MAX_SESSIONS; i++) {
+    J1939_SESSION *s = &sessions[i];
+
+    if (s->type == J1939_SESSION_FREE) {
+      continue;
+    }
+
+    // BAM packets come at T1 at most; RTS/CTS sessions also wait T2 after each CTS
+    uint16_t limit = (s->type == J1939_SESSION_BAM) ? J1939_T1 : J1939_T2;
+
+    if (now - s->timer > limit) {
+      if (s->type == J1939_SESSION_CMDT) {
+        ControlSend(s->sa, J1939_TP_ABORT, J1939_ABORT_TIMEOUT, 0xFF, 0xFF, 0xFF, s->pgn);
+      }
+
+      dropped++;
+      SessionClose(s);
+    }
+  }
+
+  // Outgoing transfer
+  switch (tx_state) {
+    case J1939_TX_BAM:
+      if (now - tx_timer >= J1939_BAM_GAP) {
+        if (DataLoad(tx_next)) {
+          tx_timer = now;
+        }
+
+        if (tx_next > tx_packets) {
+          TxEnd(MCP2517FD_J1939_TX_OK);
+        }
+      }
+      break;
+
+    case J1939_TX_SEND:
+      DataLoad(tx_window_end);
+
+      if (tx_next > tx_window_end) {
+        tx_state = (tx_next > tx_packets) ? J1939_TX_WAIT_EOMA : J1939_TX_WAIT_CTS;
+        tx_timer = now;
+      }
+      break;
+
+    case J1939_TX_WAIT_CTS:
+    case J1939_TX_WAIT_EOMA:
+    case J1939_TX_HOLD:
+      if (now - tx_timer > ((tx_state == J1939_TX_HOLD) ? J1939_T4 : J1939_T3)) {
+        ControlSend(tx_da, J1939_TP_ABORT, J1939_ABORT_TIMEOUT, 0xFF, 0xFF, 0xFF, tx_pgn);
+        TxEnd(MCP2517FD_J1939_TX_TIMEOUT);
+      }
+      break;
+
+    default:
+      break;
+  }
+}
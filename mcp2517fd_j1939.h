@@ -0,0 +1,316 @@
+/*
+  mcp2517fd_j1939.h - SAE J1939 address claim and transport protocol for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_J1939_H
+#define	MCP2517FD_J1939_H
+
+#include "mcp2517fd.h"
+#include "mcp2517fd_filter.h"
+
+#define MCP2517FD_J1939_MAX_SESSIONS  8     // concurrent incoming BAM and RTS/CTS transfers
+#define MCP2517FD_J1939_MAX_PGNS      16    // subscriptions
+#define MCP2517FD_J1939_BLOCK         64    // reassembly pool allocation unit in bytes
+#define MCP2517FD_J1939_POOL_BLOCKS   64    // largest pool: BLOCK * POOL_BLOCKS bytes
+#define MCP2517FD_J1939_CTS_PACKETS   16    // packets requested per CTS
+
+#define MCP2517FD_J1939_GLOBAL        0xFF  // destination address: all nodes
+#define MCP2517FD_J1939_NULL          0xFE  // source address of a node without one
+
+#define MCP2517FD_J1939_PGN_REQUEST   0xEA00UL
+#define MCP2517FD_J1939_PGN_ADDRESS   0xEE00UL
+#define MCP2517FD_J1939_PGN_TP_CM     0xEC00UL
+#define MCP2517FD_J1939_PGN_TP_DT     0xEB00UL
+
+// *****************************************************************************
+//! Header of a J1939 message
+
+typedef struct {
+  uint32_t pgn;         // parameter group number, PS cleared for PDU1 formats
+  uint8_t priority;
+  uint8_t sa;           // source address
+  uint8_t da;           // destination address, MCP2517FD_J1939_GLOBAL for PDU2 formats
+} MCP2517FD_J1939_HEADER;
+
+// *****************************************************************************
+//! Address claim state
+
+typedef enum {
+  MCP2517FD_J1939_UNCLAIMED,
+  MCP2517FD_J1939_CLAIMING,      // claim sent, waiting out contention
+  MCP2517FD_J1939_CLAIMED,
+  MCP2517FD_J1939_CANNOT_CLAIM   // lost every address it could use
+} MCP2517FD_J1939_ADDRESS_STATE;
+
+// *****************************************************************************
+//! Result of a multi-packet transmission
+
+typedef enum {
+  MCP2517FD_J1939_TX_OK,
+  MCP2517FD_J1939_TX_ABORTED,    // the receiver sent TP.Conn_Abort
+  MCP2517FD_J1939_TX_TIMEOUT
+} MCP2517FD_J1939_TX_RESULT;
+
+// *****************************************************************************
+//! Called for every received message, single frame or reassembled
+/*!
+   data is only valid during the call.
+*/
+
+typedef void (*mcp2517fd_j1939_handler)(const MCP2517FD_J1939_HEADER *header, const uint8_t *data, uint16_t len, void *context);
+
+// *****************************************************************************
+//! Called when a multi-packet transmission ends
+
+typedef void (*mcp2517fd_j1939_tx_handler)(uint32_t pgn, MCP2517FD_J1939_TX_RESULT result, void *context);
+
+// *****************************************************************************
+//! Called when the address changes or is lost
+
+typedef void (*mcp2517fd_j1939_address_handler)(MCP2517FD_J1939_ADDRESS_STATE state, uint8_t address, void *context);
+
+class mcp2517fd_j1939 {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Start address claim
+    /*!
+       name: 64 bit J1939 NAME; with the arbitrary address capable bit (63)
+       set, a lost address is replaced by one from 128..247.
+       Messages can be sent once the claim has stood for 250 ms.
+    */
+
+    void Begin(uint64_t name, uint8_t address, CAN_FIFO_CHANNEL tx_fifo_ch = CAN_FIFO_CH1);
+
+    // *****************************************************************************
+    //! Memory for reassembling multi-packet messages
+    /*!
+       Sessions take whole blocks of MCP2517FD_J1939_BLOCK bytes, contiguous,
+       so a pool of 2 KB holds one 1785 byte message or many small ones.
+    */
+
+    void PoolSet(uint8_t *pool, uint16_t size);
+
+    // *****************************************************************************
+    //! Set handlers
+    void HandlerSet(mcp2517fd_j1939_handler handler, mcp2517fd_j1939_tx_handler tx_handler = NULL,
+                    mcp2517fd_j1939_address_handler address_handler = NULL, void *context = NULL);
+
+    // *****************************************************************************
+    //! Receive a parameter group
+    /*!
+       Without subscriptions every parameter group is delivered.
+       Returns 0 on success, -1 if the list is full.
+    */
+
+    int8_t Subscribe(uint32_t pgn);
+
+    // *****************************************************************************
+    //! Add acceptance rules for the subscribed parameter groups
+    /*!
+       Adds one rule per subscription plus address claim, request and
+       transport protocol; destination addresses are checked in software, so
+       the rules survive an address change. Follow with Compile() and
+       Program(). Returns 0 on success, -1 if the filter set is full.
+    */
+
+    int8_t FiltersAdd(mcp2517fd_filter &filter, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Identifiers
+
+    // *****************************************************************************
+    //! Split a 29 bit identifier
+    static void IdDecode(const CAN_MSGOBJ_ID *id, MCP2517FD_J1939_HEADER *header);
+
+    // *****************************************************************************
+    //! Build a 29 bit identifier
+    static void IdEncode(CAN_MSGOBJ_ID *id, const MCP2517FD_J1939_HEADER *header);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Transfer
+
+    // *****************************************************************************
+    //! Send a message
+    /*!
+       Up to 8 bytes go out as one frame. Longer messages (up to 1785 bytes)
+       go out by TP.BAM to MCP2517FD_J1939_GLOBAL or TP.RTS/CTS to one node;
+       data is read in place until the TX handler is called.
+       Returns 0 on success, -1 if a multi-packet transmission is running,
+       -2 if len is too long, -3 if the transmit FIFO is full,
+       -4 if no address is claimed.
+    */
+
+    int8_t Send(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, uint16_t len);
+
+    // *****************************************************************************
+    //! Process a received frame
+    /*!
+       Returns true if the frame was J1939 traffic for this node.
+    */
+
+    bool Receive(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd);
+
+    // *****************************************************************************
+    //! Router handler; context is the mcp2517fd_j1939 instance
+    static void Deliver(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+    // *****************************************************************************
+    //! Run timers and send data packets
+    /*!
+       Call at least every few milliseconds.
+    */
+
+    void Service();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Status
+
+    // *****************************************************************************
+    //! Current source address, MCP2517FD_J1939_NULL without one
+    inline uint8_t AddressGet()
+    {
+      return (address_state == MCP2517FD_J1939_CANNOT_CLAIM) ? MCP2517FD_J1939_NULL : address;
+    }
+
+    // *****************************************************************************
+    //! Address claim state
+    inline MCP2517FD_J1939_ADDRESS_STATE AddressStateGet()
+    {
+      return address_state;
+    }
+
+    // *****************************************************************************
+    //! Incoming transfers in progress
+    uint8_t SessionCount();
+
+    // *****************************************************************************
+    //! Incoming transfers dropped for lack of a session or pool memory
+    inline uint32_t DroppedCount()
+    {
+      return dropped;
+    }
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_j1939(mcp2517fd &dev)
+    {
+      can = &dev;
+      address_state = MCP2517FD_J1939_UNCLAIMED;
+      address = MCP2517FD_J1939_NULL;
+      name = 0;
+      tx_ch = CAN_FIFO_CH1;
+      handler = NULL;
+      tx_handler = NULL;
+      address_handler = NULL;
+      handler_context = NULL;
+      pgn_count = 0;
+      pool = NULL;
+      pool_blocks = 0;
+      memset(pool_used, 0, sizeof(pool_used));
+      memset(sessions, 0, sizeof(sessions));
+      tx_state = J1939_TX_IDLE;
+      dropped = 0;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef enum {
+      J1939_SESSION_FREE,
+      J1939_SESSION_BAM,
+      J1939_SESSION_CMDT
+    } J1939_SESSION_TYPE;
+
+    typedef struct {
+      uint8_t type;
+      uint8_t sa;
+      uint8_t da;
+      uint8_t priority;
+      uint32_t pgn;
+      uint16_t size;
+      uint8_t packets;        // total
+      uint8_t next;           // next sequence number expected
+      uint8_t window_end;     // last sequence number of the current CTS
+      uint8_t max_cts;        // packets per CTS the sender accepts
+      uint8_t block;          // first pool block
+      uint8_t blocks;
+      unsigned long timer;
+    } J1939_SESSION;
+
+    typedef enum {
+      J1939_TX_IDLE,
+      J1939_TX_BAM,           // sending data packets at the BAM gap
+      J1939_TX_WAIT_CTS,
+      J1939_TX_HOLD,          // CTS for 0 packets
+      J1939_TX_SEND,          // sending the packets of a CTS
+      J1939_TX_WAIT_EOMA
+    } J1939_TX_STATE;
+
+    int8_t FrameLoad(uint32_t pgn, uint8_t priority, uint8_t da, const uint8_t *data, uint8_t len, bool flush = true);
+    int8_t ControlSend(uint8_t da, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint32_t pgn);
+    void AddressClaimSend();
+    void AddressClaimReceive(uint8_t sa, const uint8_t *rxd);
+    void AddressStateSet(MCP2517FD_J1939_ADDRESS_STATE state);
+    bool Subscribed(uint32_t pgn);
+
+    int16_t PoolAlloc(uint8_t blocks);
+    void PoolFree(uint8_t block, uint8_t blocks);
+    J1939_SESSION *SessionFind(uint8_t sa, uint8_t da);
+    void SessionClose(J1939_SESSION *s);
+    void SessionOpen(uint8_t sa, uint8_t da, uint8_t priority, const uint8_t *rxd, bool bam);
+    void SessionData(J1939_SESSION *s, const uint8_t *rxd);
+    void ClearToSend(J1939_SESSION *s);
+    void ConnectionReceive(const MCP2517FD_J1939_HEADER *h, const uint8_t *rxd);
+
+    void TxEnd(MCP2517FD_J1939_TX_RESULT result);
+    uint8_t DataLoad(uint16_t last);
+
+    mcp2517fd *can;
+    CAN_FIFO_CHANNEL tx_ch;
+    mcp2517fd_j1939_handler handler;
+    mcp2517fd_j1939_tx_handler tx_handler;
+    mcp2517fd_j1939_address_handler address_handler;
+    void *handler_context;
+
+    // Address claim
+    uint64_t name;
+    uint8_t address;
+    MCP2517FD_J1939_ADDRESS_STATE address_state;
+    unsigned long claim_time;
+    uint8_t claim_tries;
+
+    uint32_t pgns[MCP2517FD_J1939_MAX_PGNS];
+    uint8_t pgn_count;
+
+    // Reassembly
+    uint8_t *pool;
+    uint8_t pool_blocks;
+    uint8_t pool_used[MCP2517FD_J1939_POOL_BLOCKS / 8];
+    J1939_SESSION sessions[MCP2517FD_J1939_MAX_SESSIONS];
+    uint32_t dropped;
+
+    // Multi-packet transmission
+    J1939_TX_STATE tx_state;
+    uint32_t tx_pgn;
+    uint8_t tx_priority;
+    uint8_t tx_da;
+    const uint8_t *tx_data;
+    uint16_t tx_len;
+    uint8_t tx_packets;
+    uint16_t tx_next;         // next sequence number to send, tx_packets + 1 when done
+    uint16_t tx_window_end;
+    unsigned long tx_timer;
+};
+
+#endif
@@ -0,0 +1,301 @@
+/*
+  mcp2517fd_pdo.h - CANopen style PDO mapping with pack/unpack resolved at compile time
+
+  A PDO is a list of entries, each binding an application variable to a bit
+  offset and length in the frame (little endian, bit 0 is the LSB of byte 0,
+  as in CANopen). Offsets, masks and shifts are template arguments, so every
+  entry compiles into a fixed sequence of byte operations.
+
+    int16_t speed;
+    uint8_t state;
+    bool enable;
+
+    typedef mcp2517fd_pdo<
+      mcp2517fd_pdo_entry<int16_t, &speed, 0>,
+      mcp2517fd_pdo_entry<uint8_t, &state, 16, 4>,
+      mcp2517fd_pdo_entry<bool, &enable, 20, 1> > TPDO1;
+
+    TPDO1::Transmit(can, 0x181);          // pack and load
+    TPDO1::Receive(&rxObj, rxd);          // unpack from the receive buffer
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_PDO_H
+#define	MCP2517FD_PDO_H
+
+#include "mcp2517fd.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Bit Access
+
+// *****************************************************************************
+//! Narrowest word holding a field and its shift
+
+template <bool Wide> struct mcp2517fd_pdo_word {
+  typedef uint32_t type;
+};
+
+template <> struct mcp2517fd_pdo_word<true> {
+  typedef uint64_t type;
+};
+
+// *****************************************************************************
+//! Byte I..N-1 of a field, unrolled at compile time
+
+template <uint8_t I, uint8_t N> struct mcp2517fd_pdo_bytes {
+  template <typename W> static inline void Put(uint8_t *p, W v)
+  {
+    p[I] |= (uint8_t) (v >> (8 * I));
+    mcp2517fd_pdo_bytes<I + 1, N>::Put(p, v);
+  }
+
+  template <typename W> static inline W Get(const uint8_t *p)
+  {
+    return ((W) p[I] << (8 * I)) | mcp2517fd_pdo_bytes<I + 1, N>::template Get<W>(p);
+  }
+};
+
+template <uint8_t N> struct mcp2517fd_pdo_bytes<N, N> {
+  template <typename W> static inline void Put(uint8_t *, W)
+  {
+  }
+
+  template <typename W> static inline W Get(const uint8_t *)
+  {
+    return 0;
+  }
+};
+
+// *****************************************************************************
+//! Field of Length bits at bit Offset
+
+template <uint16_t Offset, uint8_t Length> struct mcp2517fd_pdo_bits {
+  static_assert((Length >= 1) && (Length <= 64), "PDO entry length must be 1..64 bits");
+  static_assert(Offset + Length <= 8 * MAX_DATA_BYTES, "PDO entry beyond the end of the frame");
+  static_assert((Offset % 8) + Length <= 64, "unaligned PDO entry spans more than 8 bytes");
+
+  typedef typename mcp2517fd_pdo_word<((Offset % 8) + Length > 32)>::type word;
+
+  static const uint8_t first = Offset / 8;
+  static const uint8_t shift = Offset % 8;
+  static const uint8_t bytes = (shift + Length + 7) / 8;
+  static const word mask = ~(word) 0 >> (8 * sizeof(word) - Length);
+
+  static inline void Put(uint8_t *buf, word v)
+  {
+    mcp2517fd_pdo_bytes<0, bytes>::Put(buf + first, (word) ((v & mask) << shift));
+  }
+
+  static inline word Get(const uint8_t *buf)
+  {
+    return (mcp2517fd_pdo_bytes<0, bytes>::template Get<word>(buf + first) >> shift) & mask;
+  }
+};
+
+// *****************************************************************************
+//! Raw bits of a variable; integers convert, floating point is copied
+
+template <typename T> struct mcp2517fd_pdo_raw {
+  static const bool is_signed = ((T) -1 < (T) 0);
+
+  template <typename W> static inline W To(T v)
+  {
+    return (W) v;
+  }
+
+  template <typename W, uint8_t Length> static inline T From(W w)
+  {
+    // Sign extend short signed fields
+    if (is_signed && (Length < 8 * sizeof(W))) {
+      const W sign = (W) 1 << ((Length - 1) % (8 * sizeof(W)));
+
+      w = (w ^ sign) - sign;
+    }
+
+    return (T) w;
+  }
+};
+
+template <> struct mcp2517fd_pdo_raw<bool> {
+  template <typename W> static inline W To(bool v)
+  {
+    return v ? 1 : 0;
+  }
+
+  template <typename W, uint8_t Length> static inline bool From(W w)
+  {
+    return w != 0;
+  }
+};
+
+template <> struct mcp2517fd_pdo_raw<float> {
+  template <typename W> static inline W To(float v)
+  {
+    uint32_t w;
+
+    memcpy(&w, &v, sizeof(w));
+    return w;
+  }
+
+  template <typename W, uint8_t Length> static inline float From(W w)
+  {
+    uint32_t u = w;
+    float v;
+
+    memcpy(&v, &u, sizeof(v));
+    return v;
+  }
+};
+
+template <> struct mcp2517fd_pdo_raw<double> {
+  template <typename W> static inline W To(double v)
+  {
+    uint64_t w = 0;
+
+    memcpy(&w, &v, sizeof(v));
+    return (W) w;
+  }
+
+  template <typename W, uint8_t Length> static inline double From(W w)
+  {
+    uint64_t u = w;
+    double v;
+
+    memcpy(&v, &u, sizeof(v));
+    return v;
+  }
+};
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Mapping
+
+// *****************************************************************************
+//! Application variable Var mapped to Length bits at bit Offset
+/*!
+   Var must have static storage duration. Floating point entries must be
+   their full size (32 bits for float).
+*/
+
+template <typename T, T *Var, uint16_t Offset, uint8_t Length = 8 * sizeof(T)>
+struct mcp2517fd_pdo_entry {
+  typedef mcp2517fd_pdo_bits<Offset, Length> bits;
+
+  static const uint16_t end = Offset + Length;
+
+  static inline void Pack(uint8_t *buf)
+  {
+    bits::Put(buf, mcp2517fd_pdo_raw<T>::template To<typename bits::word>(*Var));
+  }
+
+  static inline void Unpack(const uint8_t *buf)
+  {
+    *Var = mcp2517fd_pdo_raw<T>::template From<typename bits::word, Length>(bits::Get(buf));
+  }
+};
+
+// *****************************************************************************
+//! Entries of a PDO, expanded at compile time
+
+template <typename... Entries> struct mcp2517fd_pdo_list;
+
+template <> struct mcp2517fd_pdo_list<> {
+  static const uint16_t end = 0;
+
+  static inline void Pack(uint8_t *)
+  {
+  }
+
+  static inline void Unpack(const uint8_t *)
+  {
+  }
+};
+
+template <typename Head, typename... Tail> struct mcp2517fd_pdo_list<Head, Tail...> {
+  static const uint16_t end = (Head::end > mcp2517fd_pdo_list<Tail...>::end) ? Head::end : mcp2517fd_pdo_list<Tail...>::end;
+
+  static inline void Pack(uint8_t *buf)
+  {
+    Head::Pack(buf);
+    mcp2517fd_pdo_list<Tail...>::Pack(buf);
+  }
+
+  static inline void Unpack(const uint8_t *buf)
+  {
+    Head::Unpack(buf);
+    mcp2517fd_pdo_list<Tail...>::Unpack(buf);
+  }
+};
+
+// *****************************************************************************
+//! A PDO made of entries
+
+template <typename... Entries> class mcp2517fd_pdo {
+  public:
+    typedef mcp2517fd_pdo_list<Entries...> list;
+
+    //! Bytes covered by the entries
+    static const uint8_t size = (list::end + 7) / 8;
+
+    //! DLC of the frame; above 8 bytes the next CAN FD length
+    static const uint8_t dlc = (size <= 8) ? size : (size <= 24) ? 8 + (size - 5) / 4 : (size <= 32) ? 13 : (size <= 48) ? 14 : 15;
+
+    // *****************************************************************************
+    //! Pack all entries into buf, which holds at least DLC_DataLength[dlc] bytes
+    static inline void Pack(uint8_t *buf)
+    {
+      memset(buf, 0, DLC_DataLength[dlc]);
+      list::Pack(buf);
+    }
+
+    // *****************************************************************************
+    //! Unpack all entries from buf
+    static inline void Unpack(const uint8_t *buf)
+    {
+      list::Unpack(buf);
+    }
+
+    // *****************************************************************************
+    //! Pack and load into a transmit FIFO
+    /*!
+       cob_id: 11 bit identifier; PDOs above 8 bytes go out as FD frames.
+       Returns as TransmitChannelLoad()
+    */
+
+    static int8_t Transmit(mcp2517fd &can, uint16_t cob_id, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1, bool flush = true)
+    {
+      CAN_TX_MSGOBJ txObj;
+      uint8_t buf[(size <= 8) ? 8 : 64];
+
+      txObj.word[0] = 0;
+      txObj.word[1] = 0;
+      txObj.bF.id.SID = cob_id;
+      txObj.bF.ctrl.DLC = dlc;
+      txObj.bF.ctrl.FDF = (dlc > 8);
+
+      Pack(buf);
+
+      return can.TransmitChannelLoad(&txObj, buf, DLC_DataLength[dlc], channel, flush);
+    }
+
+    // *****************************************************************************
+    //! Unpack a received PDO, e.g. straight from ReceiveMessageBufferGet()
+    /*!
+       Returns false, leaving the variables alone, if the frame is too short.
+    */
+
+    static inline bool Receive(const CAN_RX_MSGOBJ *rxObj, const uint8_t *rxd)
+    {
+      if (DLC_DataLength[rxObj->bF.ctrl.DLC] < size) {
+        return false;
+      }
+
+      Unpack(rxd);
+
+      return true;
+    }
+};
+
+#endif
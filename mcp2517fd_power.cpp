@@ -0,0 +1,122 @@
+/*
+  mcp2517fd_power.cpp - Sleep/wake manager for mcp2517fd
+*/
+#include "mcp2517fd_power.h"
+
+#define POWER_WAKIF 0x40   // CiINT byte 1
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+uint8_t mcp2517fd_power::Begin(CAN_WAKEUP_FILTER_TIME filter_time, CAN_FIFO_CHANNEL rx_fifo_ch)
+{
+  CAN_OPERATION_MODE mode = can->OperationModeGet();
+  REG_CiCON ciCon;
+
+  rx_ch = rx_fifo_ch;
+
+  // WAKFIL and WFT can only change in configuration mode
+  if (can->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+    return 0;
+  }
+
+  ciCon.dword = 0;
+  ciCon.bytes[1] = can->ReadByte(cREGADDR_CiCON + 1);
+  ciCon.bF.WakeUpFilterEnable = 1;
+  ciCon.bF.WakeUpFilterTime = filter_time;
+  can->WriteByte(cREGADDR_CiCON + 1, ciCon.bytes[1]);
+
+  can->ModuleEventClear(CAN_BUS_WAKEUP_EVENT);
+  can->ModuleEventEnable(CAN_BUS_WAKEUP_EVENT);
+
+  return can->OperationModeSwitch(mode) >= 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Sleep and Wake
+uint8_t mcp2517fd_power::Sleep(mcp2517fd_power_rx_handler handler, void *context)
+{
+  Deliver(handler, context);
+
+  wake_mode = can->OperationModeGet();
+  can->ModuleEventClear(CAN_BUS_WAKEUP_EVENT);
+
+  return can->OperationModeSwitch(CAN_SLEEP_MODE) >= 0;
+}
+
+bool mcp2517fd_power::WakeDetected()
+{
+  return (can->ReadByte(cREGADDR_CiINT + 1) & POWER_WAKIF) != 0;
+}
+
+void mcp2517fd_power::Park(mcp2517fd_power_park park, void *context)
+{
+  while (!WakeDetected()) {
+    if (park) {
+      park(context);
+    }
+  }
+}
+
+int32_t mcp2517fd_power::Wake(uint32_t timeout_us)
+{
+  unsigned long start = micros();
+
+  // Clearing OSCDIS wakes the controller if the bus has not done so already
+  can->OscillatorEnable();
+
+  while (!can->OscillatorStatusGet().OscReady) {
+    if (micros() - start > timeout_us) {
+      return -1;
+    }
+  }
+
+  // Wake-up always lands in configuration mode
+  int32_t t = can->OperationModeSwitch(wake_mode, timeout_us);
+
+  if (t < 0) {
+    return -1;
+  }
+
+  t = micros() - start;
+
+  // Off the critical path
+  can->ModuleEventClear(CAN_BUS_WAKEUP_EVENT);
+
+  return t;
+}
+
+uint16_t mcp2517fd_power::Deliver(mcp2517fd_power_rx_handler handler, void *context, uint16_t budget)
+{
+  uint16_t n = 0;
+  CAN_RX_MSGOBJ rxObj;
+  uint8_t *rxd;
+
+  while ((n < budget) && ((rxd = can->ReceiveMessageBufferGet(&rxObj, rx_ch)) != NULL)) {
+    if (handler) {
+      handler(&rxObj, rxd, context);
+    }
+
+    n++;
+  }
+
+  return n;
+}
+
+int32_t mcp2517fd_power::Cycle(mcp2517fd_power_rx_handler handler, void *context, mcp2517fd_power_park park, void *park_context)
+{
+  if (!Sleep(handler, context)) {
+    return -2;
+  }
+
+  Park(park, park_context);
+
+  int32_t t = Wake();
+
+  if (t >= 0) {
+    Deliver(handler, context);
+  }
+
+  return t;
+}
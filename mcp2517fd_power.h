@@ -0,0 +1,110 @@
+/*
+  mcp2517fd_power.h - Sleep/wake manager for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_POWER_H
+#define	MCP2517FD_POWER_H
+
+#include "mcp2517fd.h"
+
+// *****************************************************************************
+//! Called for every frame delivered around a sleep cycle
+/*!
+   rxd points into the driver's receive buffer and is only valid during the call.
+*/
+
+typedef void (*mcp2517fd_power_rx_handler)(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+// *****************************************************************************
+//! Puts the MCU to sleep until an interrupt; returns after any wake source
+
+typedef void (*mcp2517fd_power_park)(void *context);
+
+class mcp2517fd_power {
+  public:
+    // *****************************************************************************
+    //! Configure bus wake-up
+    /*!
+       Enables the wake-up filter with filter_time and the bus wake-up
+       interrupt on the INT pin. Passes through configuration mode; call
+       after Init(). Returns 1 on success, 0 if a mode change timed out.
+    */
+
+    uint8_t Begin(CAN_WAKEUP_FILTER_TIME filter_time = CAN_WFT01, CAN_FIFO_CHANNEL rx_fifo_ch = CAN_FIFO_CH2);
+
+    // *****************************************************************************
+    //! Put the controller to sleep
+    /*!
+       Delivers the frames still in the RX FIFO first, since leaving sleep
+       passes through configuration mode, which empties the FIFOs.
+       Remembers the current mode for Wake().
+       Returns 1 once asleep, 0 if the controller did not get there (it waits
+       for the bus to become idle).
+    */
+
+    uint8_t Sleep(mcp2517fd_power_rx_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Has bus activity woken the controller?
+    bool WakeDetected();
+
+    // *****************************************************************************
+    //! Park the MCU until the controller wakes up
+    /*!
+       park is called repeatedly until bus activity has woken the controller;
+       it should sleep the MCU with the INT pin as wake-up source. Without a
+       park function this polls.
+    */
+
+    void Park(mcp2517fd_power_park park = NULL, void *context = NULL);
+
+    // *****************************************************************************
+    //! Bring the controller back to the mode it was in before Sleep()
+    /*!
+       Works for bus and host initiated wake-up: enables the oscillator,
+       waits for it and returns straight to the saved mode. The wake-up
+       flag is only cleared once the controller receives again.
+       Returns the time from the call until the controller receives, in us,
+       -1 if the oscillator or the mode change timed out.
+    */
+
+    int32_t Wake(uint32_t timeout_us = 10000);
+
+    // *****************************************************************************
+    //! Deliver received frames
+    /*!
+       Returns number of frames delivered.
+    */
+
+    uint16_t Deliver(mcp2517fd_power_rx_handler handler, void *context = NULL, uint16_t budget = 0xFFFF);
+
+    // *****************************************************************************
+    //! Full cycle: Sleep(), Park(), Wake() and delivery of the first frames
+    /*!
+       Returns the wake time as Wake(), -2 if the controller did not go to sleep.
+    */
+
+    int32_t Cycle(mcp2517fd_power_rx_handler handler, void *context = NULL, mcp2517fd_power_park park = NULL, void *park_context = NULL);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_power(mcp2517fd &dev)
+    {
+      can = &dev;
+      rx_ch = CAN_FIFO_CH2;
+      wake_mode = CAN_NORMAL_MODE;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    mcp2517fd *can;
+    CAN_FIFO_CHANNEL rx_ch;
+    CAN_OPERATION_MODE wake_mode;
+};
+
+#endif
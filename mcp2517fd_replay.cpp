@@ -0,0 +1,128 @@
+/*
+  mcp2517fd_replay.cpp - Replay of mcp2517fd_capture logs with their original timing
+*/
+#include "mcp2517fd_replay.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Replay
+int8_t mcp2517fd_replay::Begin(mcp2517fd_replay_source source, void *context, CAN_FIFO_CHANNEL tx_fifo_ch)
+{
+  uint8_t hdr[MCP2517FD_CAPTURE_HEADER_SIZE];
+
+  this->source = source;
+  source_context = context;
+  tx_ch = tx_fifo_ch;
+  ticks = 0;
+  started = false;
+  pending = false;
+  sent = 0;
+  failed = 0;
+  lateness_max = 0;
+
+  if (source(hdr, sizeof(hdr), context) != sizeof(hdr)) {
+    done = true;
+    return -1;
+  }
+
+  tick_ps = mcp2517fd_capture::HeaderParse(hdr);
+  done = (tick_ps == 0);
+
+  return done ? -1 : 0;
+}
+
+uint16_t mcp2517fd_replay::Service()
+{
+  uint16_t n = 0;
+  unsigned long now = micros();
+
+  // micros() wraps after about 71 minutes; the sum of the steps does not
+  if (started) {
+    elapsed += (unsigned long) (now - last_us);
+    last_us = now;
+  }
+
+  while (!done) {
+    if (!pending) {
+      if (!Next()) {
+        done = true;
+        break;
+      }
+      pending = true;
+    }
+
+    if (!started) {
+      first_ticks = record.ticks;
+      last_us = now;
+      elapsed = 0;
+      started = true;
+    }
+
+    // Stamps may run backwards (two RX FIFOs): anything older than the
+    // first frame is due at once
+    int64_t distance = (int64_t) (record.ticks - first_ticks);
+    uint64_t due = (distance > 0) ? ((uint64_t) distance * tick_ps) / 1000000UL : 0;
+
+    if (elapsed < due) {
+      break;
+    }
+
+    CAN_TX_MSGOBJ txObj;
+
+    txObj.word[0] = 0;
+    txObj.word[1] = 0;
+    if (record.flags & MCP2517FD_CAPTURE_IDE) {
+      txObj.bF.id.SID = record.id >> 18;
+      txObj.bF.id.EID = record.id & 0x3FFFF;
+      txObj.bF.ctrl.IDE = 1;
+    } else {
+      txObj.bF.id.SID = record.id;
+    }
+    txObj.bF.ctrl.DLC = record.dlc;
+    txObj.bF.ctrl.RTR = (record.flags & MCP2517FD_CAPTURE_RTR) ? 1 : 0;
+    txObj.bF.ctrl.FDF = (record.flags & MCP2517FD_CAPTURE_FDF) ? 1 : 0;
+    txObj.bF.ctrl.BRS = (record.flags & MCP2517FD_CAPTURE_BRS) ? 1 : 0;
+
+    int8_t r = can->TransmitChannelLoad(&txObj, (uint8_t *) record.data, record.len, tx_ch, true);
+
+    if (r == -3) {
+      break;
+    }
+
+    pending = false;
+
+    if (r < 0) {
+      failed++;
+      continue;
+    }
+
+    sent++;
+    n++;
+
+    if (elapsed - due > lateness_max) {
+      lateness_max = (elapsed - due > 0xFFFFFFFFUL) ? 0xFFFFFFFFUL : (uint32_t) (elapsed - due);
+    }
+  }
+
+  return n;
+}
+
+bool mcp2517fd_replay::Next()
+{
+  // Received frames only; TEF entries have no data to send
+  do {
+    if (source(rec, 1, source_context) != 1) {
+      return false;
+    }
+
+    if ((rec[0] == 0) || (rec[0] >= sizeof(rec)) || (source(&rec[1], rec[0], source_context) != rec[0])) {
+      return false;
+    }
+
+    if (mcp2517fd_capture::RecordParse(rec, &ticks, &record) == 0) {
+      return false;
+    }
+  } while (record.flags & MCP2517FD_CAPTURE_TX);
+
+  return true;
+}
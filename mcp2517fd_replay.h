@@ -0,0 +1,112 @@
+/*
+  mcp2517fd_replay.h - Replay of mcp2517fd_capture logs with their original timing
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_REPLAY_H
+#define	MCP2517FD_REPLAY_H
+
+#include "mcp2517fd_capture.h"
+
+// *****************************************************************************
+//! Supplies the log
+/*!
+   Reads up to len bytes into buf. Returns number of bytes read, 0 at the end.
+*/
+
+typedef uint16_t (*mcp2517fd_replay_source)(uint8_t *buf, uint16_t len, void *context);
+
+class mcp2517fd_replay {
+  public:
+    // *****************************************************************************
+    //! Start replaying a log
+    /*!
+       Received frames are sent again; TEF entries carry no data and are
+       skipped. The first frame goes out at the first Service() call.
+       Returns 0 on success, -1 if the source does not start with a log header.
+    */
+
+    int8_t Begin(mcp2517fd_replay_source source, void *context = NULL, CAN_FIFO_CHANNEL tx_fifo_ch = CAN_FIFO_CH1);
+
+    // *****************************************************************************
+    //! Send frames that are due
+    /*!
+       A frame is due when the time since the first one reaches its distance
+       from the first frame in the log. Frames meeting a full FIFO are
+       retried on the next call; frames the driver refuses otherwise are
+       dropped and counted in FailedCount(). Call often, and at least once
+       per micros() wrap; lateness shows in LatenessMax().
+       Returns number of frames loaded.
+    */
+
+    uint16_t Service();
+
+    // *****************************************************************************
+    //! Has the whole log been sent?
+    inline bool Done()
+    {
+      return done;
+    }
+
+    // *****************************************************************************
+    //! Frames sent
+    inline uint32_t SentCount()
+    {
+      return sent;
+    }
+
+    // *****************************************************************************
+    //! Frames dropped because TransmitChannelLoad() failed other than with a full FIFO
+    inline uint32_t FailedCount()
+    {
+      return failed;
+    }
+
+    // *****************************************************************************
+    //! Largest delay of a frame behind its original timing, in us
+    inline uint32_t LatenessMax()
+    {
+      return lateness_max;
+    }
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_replay(mcp2517fd &dev)
+    {
+      can = &dev;
+      source = NULL;
+      done = true;
+      pending = false;
+      sent = 0;
+      failed = 0;
+      lateness_max = 0;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    bool Next();
+
+    mcp2517fd *can;
+    mcp2517fd_replay_source source;
+    void *source_context;
+    CAN_FIFO_CHANNEL tx_ch;
+    uint32_t tick_ps;
+    uint64_t ticks;              // of the last record parsed
+    uint64_t first_ticks;        // of the first frame sent
+    unsigned long last_us;       // micros() at the last Service()
+    uint64_t elapsed;            // us since the first frame went out
+    bool started;
+    bool done;
+    bool pending;                // record holds the next frame
+    uint8_t rec[MCP2517FD_CAPTURE_RECORD_MAX];
+    MCP2517FD_CAPTURE_RECORD record;
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t lateness_max;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+  mcp2517fd_router.cpp - Receive dispatch by filter hit and identifier for mcp2517fd
+*/
+#include "mcp2517fd_router.h"
+#include "mcp2517fd_hash.h"
+
+#define ROUTER_KEY_EXT   0x80000000UL
+#define ROUTER_KEY_EMPTY 0xFFFFFFFFUL
+
+static uint32_t router_key(uint32_t id, bool ext)
+{
+  return ext ? (id | ROUTER_KEY_EXT) : id;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+int8_t mcp2517fd_router::Begin(MCP2517FD_ROUTER_ENTRY *table, uint16_t size)
+{
+  int8_t bits = size ? mcp2517fd_hash_bits(size) : 0;
+
+  id_count = 0;
+
+  if (bits < 0) {
+    id_table = NULL;
+    id_size = 0;
+    id_bits = 0;
+
+    return -1;
+  }
+
+  id_table = table;
+  id_size = size;
+  id_bits = bits;
+
+  for (uint16_t i = 0; i < size; i++) {
+    table[i].key = ROUTER_KEY_EMPTY;
+  }
+
+  return 0;
+}
+
+void mcp2517fd_router::FilterHandlerSet(CAN_FILTER filter, mcp2517fd_router_handler handler, void *context)
+{
+  filter_handler[filter] = handler;
+  filter_context[filter] = context;
+}
+
+void mcp2517fd_router::DefaultHandlerSet(mcp2517fd_router_handler handler, void *context)
+{
+  default_handler = handler;
+  default_context = context;
+}
+
+MCP2517FD_ROUTER_ENTRY *mcp2517fd_router::Lookup(uint32_t key)
+{
+  return &id_table[mcp2517fd_hash_find(&id_table[0].key, sizeof(id_table[0]), id_bits, key, ROUTER_KEY_EMPTY)];
+}
+
+int8_t mcp2517fd_router::IdHandlerSet(uint32_t id, bool ext, mcp2517fd_router_handler handler, void *context)
+{
+  if (!id_size) {
+    return -1;
+  }
+
+  uint32_t key = router_key(id, ext);
+  MCP2517FD_ROUTER_ENTRY *e = Lookup(key);
+
+  if (e->key == ROUTER_KEY_EMPTY) {
+    if (id_count >= id_size - ((id_size + 3) / 4)) {
+      return -1;
+    }
+
+    e->key = key;
+    id_count++;
+  }
+
+  e->handler = handler;
+  e->context = context;
+
+  return 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Dispatch
+bool mcp2517fd_router::Dispatch(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd)
+{
+  uint8_t f = rxObj->bF.ctrl.FilterHit;
+
+  // The controller tells which filter matched: no ID comparison needed
+  if (filter_handler[f]) {
+    filter_handler[f](rxObj, rxd, filter_context[f]);
+    return true;
+  }
+
+  if (id_size) {
+    uint32_t key;
+
+    if (rxObj->bF.ctrl.IDE) {
+      key = router_key(((uint32_t) rxObj->bF.id.SID << 18) | rxObj->bF.id.EID, true);
+    } else {
+      key = router_key(rxObj->bF.id.SID, false);
+    }
+
+    MCP2517FD_ROUTER_ENTRY *e = Lookup(key);
+
+    if ((e->key == key) && e->handler) {
+      e->handler(rxObj, rxd, e->context);
+      return true;
+    }
+  }
+
+  unhandled++;
+
+  if (default_handler) {
+    default_handler(rxObj, rxd, default_context);
+  }
+
+  return false;
+}
+
+uint16_t mcp2517fd_router::Service(mcp2517fd &dev, CAN_FIFO_CHANNEL channel, uint16_t budget)
+{
+  uint16_t n = 0;
+  CAN_RX_MSGOBJ rxObj;
+  uint8_t *rxd;
+
+  while ((n < budget) && ((rxd = dev.ReceiveMessageBufferGet(&rxObj, channel)) != NULL)) {
+    Dispatch(&rxObj, rxd);
+    n++;
+  }
+
+  return n;
+}
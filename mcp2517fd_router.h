@@ -0,0 +1,127 @@
+/*
+  mcp2517fd_router.h - Receive dispatch by filter hit and identifier for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_ROUTER_H
+#define	MCP2517FD_ROUTER_H
+
+#include "mcp2517fd.h"
+
+// *****************************************************************************
+//! Called for a received frame
+/*!
+   rxd points into the driver's receive buffer and is only valid during the call.
+*/
+
+typedef void (*mcp2517fd_router_handler)(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, void *context);
+
+// *****************************************************************************
+//! Identifier handler slot, storage provided by the application
+
+typedef struct {
+  uint32_t key;       // identifier, bit 31 set for 29 bit identifiers
+  mcp2517fd_router_handler handler;
+  void *context;
+} MCP2517FD_ROUTER_ENTRY;
+
+class mcp2517fd_router {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Provide storage for identifier handlers
+    /*!
+       size: number of slots, a power of two; at most 3/4 of them are used.
+       Returns 0 on success, -1 if size is not a power of two; no identifier
+       handlers can be set then.
+    */
+
+    int8_t Begin(MCP2517FD_ROUTER_ENTRY *table, uint16_t size);
+
+    // *****************************************************************************
+    //! Handle every frame accepted by filter
+    /*!
+       Takes precedence over identifier handlers. Route IDs that need no
+       distinction through one filter each to skip the ID lookup entirely.
+    */
+
+    void FilterHandlerSet(CAN_FILTER filter, mcp2517fd_router_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Handle frames with identifier id
+    /*!
+       Used for frames whose filter has no handler.
+       Returns 0 on success, -1 if the table is full.
+    */
+
+    int8_t IdHandlerSet(uint32_t id, bool ext, mcp2517fd_router_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Handle frames nobody else handles
+    void DefaultHandlerSet(mcp2517fd_router_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Dispatch
+
+    // *****************************************************************************
+    //! Call the handler of a frame
+    /*!
+       Returns true if a handler other than the default one was called.
+    */
+
+    bool Dispatch(const CAN_RX_MSGOBJ *rxObj, uint8_t *rxd);
+
+    // *****************************************************************************
+    //! Read and dispatch up to budget frames from channel
+    /*!
+       Returns number of frames read.
+    */
+
+    uint16_t Service(mcp2517fd &dev, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH2, uint16_t budget = 0xFFFF);
+
+    // *****************************************************************************
+    //! Frames that reached only the default handler
+    inline uint32_t UnhandledCount()
+    {
+      return unhandled;
+    }
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_router()
+    {
+      memset(filter_handler, 0, sizeof(filter_handler));
+      memset(filter_context, 0, sizeof(filter_context));
+      id_table = NULL;
+      id_size = 0;
+      id_bits = 0;
+      id_count = 0;
+      default_handler = NULL;
+      default_context = NULL;
+      unhandled = 0;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    MCP2517FD_ROUTER_ENTRY *Lookup(uint32_t key);
+
+    mcp2517fd_router_handler filter_handler[CAN_FILTER_TOTAL];
+    void *filter_context[CAN_FILTER_TOTAL];
+    MCP2517FD_ROUTER_ENTRY *id_table;
+    uint16_t id_size;
+    uint8_t id_bits;
+    uint16_t id_count;
+    mcp2517fd_router_handler default_handler;
+    void *default_context;
+    uint32_t unhandled;
+};
+
+#endif
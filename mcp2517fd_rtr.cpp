@@ -0,0 +1,199 @@
+/*
+  mcp2517fd_rtr.cpp - Remote frame auto-responder on RTR enabled transmit FIFOs for mcp2517fd
+*/
+#include "mcp2517fd_rtr.h"
+#include "mcp2517fd_fifoconfig.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+int8_t mcp2517fd_rtr::ResponderAdd(const CAN_TX_MSGOBJ *txObj, CAN_FILTER filter, CAN_FIFO_CHANNEL channel_a, CAN_FIFO_CHANNEL channel_b)
+{
+  if (responder_count >= MCP2517FD_RTR_MAX_RESPONDERS) {
+    return -1;
+  }
+
+  RTR_RESPONDER *r = &responders[responder_count];
+
+  r->obj = *txObj;
+  r->obj.bF.ctrl.RTR = 0;
+  r->obj.bF.ctrl.FDF = 0;
+  r->obj.bF.ctrl.BRS = 0;
+  if (r->obj.bF.ctrl.DLC > 8) {
+    r->obj.bF.ctrl.DLC = 8;
+  }
+
+  memset(r->data, 0, sizeof(r->data));
+  r->len = r->obj.bF.ctrl.DLC;
+  r->filter = filter;
+  r->channel[0] = channel_a;
+  r->channel[1] = channel_b;
+  r->active = 0;
+  r->generation = 0;
+  r->loaded[0] = 0;
+  r->loaded[1] = 0;
+  r->full[0] = false;
+  r->full[1] = false;
+  r->responses = 0;
+
+  return responder_count++;
+}
+
+int8_t mcp2517fd_rtr::Begin()
+{
+  mcp2517fd_fifoconfig fifos(*can);
+  CAN_TX_FIFO_CONFIG config;
+
+  fifos.Load();
+
+  for (uint8_t i = 0; i < responder_count; i++) {
+    for (uint8_t side = 0; side < 2; side++) {
+      can->TransmitChannelConfigureObjectReset(&config);
+      config.FifoSize = 0;
+      config.PayLoadSize = CAN_PLSIZE_8;
+      config.RTREnable = 1;
+      fifos.TransmitChannelSet(&config, responders[i].channel[side]);
+    }
+  }
+
+  int8_t r = fifos.Apply();
+
+  if (r < 0) {
+    return r;
+  }
+
+  started = true;
+
+  for (uint8_t i = 0; i < responder_count; i++) {
+    RTR_RESPONDER *p = &responders[i];
+    CAN_FILTEROBJ_ID fObj;
+    CAN_MASKOBJ_ID mObj;
+
+    // Match the identifier and its format exactly
+    memset(&fObj, 0, sizeof(fObj));
+    memset(&mObj, 0, sizeof(mObj));
+    fObj.SID = p->obj.bF.id.SID;
+    fObj.EID = p->obj.bF.id.EID;
+    fObj.EXIDE = p->obj.bF.ctrl.IDE;
+    mObj.MSID = 0x7FF;
+    mObj.MEID = p->obj.bF.ctrl.IDE ? 0x3FFFF : 0;
+    mObj.MIDE = 1;
+
+    can->FilterDisable(p->filter);
+    can->FilterObjectConfigure(p->filter, &fObj);
+    can->FilterMaskConfigure(p->filter, &mObj);
+
+    // The FIFOs came out of configuration mode empty; Refresh() loads one and enables the filter
+    p->full[0] = false;
+    p->full[1] = false;
+    Refresh(p);
+  }
+
+  return r;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Replies
+int8_t mcp2517fd_rtr::Update(uint8_t id, const uint8_t *data, uint8_t len)
+{
+  if ((id >= responder_count) || (len > DLC_DataLength[responders[id].obj.bF.ctrl.DLC])) {
+    return -1;
+  }
+
+  RTR_RESPONDER *r = &responders[id];
+
+  memcpy(r->data, data, len);
+  r->len = len;
+  r->generation++;
+
+  if (!started) {
+    return 1;
+  }
+
+  Refresh(r);
+
+  return (r->full[r->active] && (r->loaded[r->active] == r->generation)) ? 0 : 1;
+}
+
+uint8_t mcp2517fd_rtr::Service()
+{
+  uint8_t replies = 0;
+
+  if (!started) {
+    return 0;
+  }
+
+  for (uint8_t i = 0; i < responder_count; i++) {
+    replies += Refresh(&responders[i]);
+  }
+
+  return replies;
+}
+
+uint32_t mcp2517fd_rtr::ResponseCount(uint8_t id)
+{
+  return (id < responder_count) ? responders[id].responses : 0;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: FIFO Handling
+uint8_t mcp2517fd_rtr::Refresh(RTR_RESPONDER *r)
+{
+  uint8_t a = r->active;
+  uint8_t b = a ^ 1;
+  uint8_t replies = 0;
+
+  // The filter's FIFO empties once it has answered a request
+  if (r->full[a]) {
+    uint16_t sta = can->TransmitChannelStatusGet(r->channel[a]);
+
+    if ((sta & CAN_TX_FIFO_EMPTY) && !(sta & CAN_TX_FIFO_TRANSMITTING)) {
+      r->full[a] = false;
+      r->responses++;
+      replies++;
+    }
+  }
+
+  // Bring the idle FIFO up to date
+  if (!r->full[b] || (r->loaded[b] != r->generation)) {
+    uint16_t sta = can->TransmitChannelStatusGet(r->channel[b]);
+
+    if (r->full[b] && (sta & CAN_TX_FIFO_EMPTY) && !(sta & CAN_TX_FIFO_TRANSMITTING)) {
+      // Answered a request that came in just before the last switch
+      r->full[b] = false;
+      r->responses++;
+      replies++;
+    }
+
+    if (!(sta & CAN_TX_FIFO_TRANSMITTING)) {
+      Load(r, b);
+    }
+  }
+
+  // Move the filter when the idle FIFO holds a newer or the only reply
+  if (r->full[b] && (r->loaded[b] == r->generation) && (!r->full[a] || (r->loaded[a] != r->generation))) {
+    can->FilterToFifoLink(r->filter, true, r->channel[b]);
+    r->active = b;
+  }
+
+  return replies;
+}
+
+void mcp2517fd_rtr::Load(RTR_RESPONDER *r, uint8_t side)
+{
+  // Nothing points at this FIFO and it is not sending, so a stale reply can be dropped
+  if (r->full[side]) {
+    can->TransmitChannelReset(r->channel[side]);
+    r->full[side] = false;
+  }
+
+  // Loaded without TXREQ; the controller sets it when a remote frame hits the filter
+  if (can->TransmitChannelLoad(&r->obj, r->data, r->len, r->channel[side], false) < 0) {
+    return;
+  }
+
+  r->full[side] = true;
+  r->loaded[side] = r->generation;
+}
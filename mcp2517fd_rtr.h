@@ -0,0 +1,112 @@
+/*
+  mcp2517fd_rtr.h - Remote frame auto-responder on RTR enabled transmit FIFOs for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_RTR_H
+#define	MCP2517FD_RTR_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_RTR_MAX_RESPONDERS 4
+
+class mcp2517fd_rtr {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Add a responder
+    /*!
+       Remote frames with the identifier of txObj are answered by the
+       controller with txObj and the data set by Update(). Each responder owns
+       a filter and two transmit FIFOs holding one reply each: the filter
+       points at one of them while the other is reloaded, so a new payload
+       goes live with a single filter write and never races a reply on the
+       bus. Classic CAN only; remote frames do not exist in CAN FD.
+       Returns the responder id, -1 if all are in use.
+    */
+
+    int8_t ResponderAdd(const CAN_TX_MSGOBJ *txObj, CAN_FILTER filter, CAN_FIFO_CHANNEL channel_a, CAN_FIFO_CHANNEL channel_b);
+
+    // *****************************************************************************
+    //! Configure the FIFOs and filters and load the first replies
+    /*!
+       Rewrites the FIFO control registers through configuration mode; call
+       after Init() and after the first Update() of each responder.
+       Returns number of FIFOs rewritten, -1 if the layout does not fit the
+       message RAM, -2 if a mode change timed out.
+    */
+
+    int8_t Begin();
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Replies
+
+    // *****************************************************************************
+    //! Set the reply payload
+    /*!
+       Loads the idle FIFO and points the filter at it. If that FIFO is still
+       sending a reply to a request that came in before the last switch, the
+       change is left to Service().
+       Returns 0 if the new payload is live, 1 if pending, -1 if id is not a
+       responder or len exceeds the DLC.
+    */
+
+    int8_t Update(uint8_t id, const uint8_t *data, uint8_t len);
+
+    // *****************************************************************************
+    //! Reload answered FIFOs and finish pending updates
+    /*!
+       A FIFO is empty once it has answered a request; the filter moves to
+       the other FIFO and the empty one is reloaded. Call often: requests
+       arriving while both FIFOs are empty go unanswered.
+       Returns number of replies sent since the last call.
+    */
+
+    uint8_t Service();
+
+    // *****************************************************************************
+    //! Replies sent by a responder
+    uint32_t ResponseCount(uint8_t id);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_rtr(mcp2517fd &dev)
+    {
+      can = &dev;
+      responder_count = 0;
+      started = false;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      CAN_TX_MSGOBJ obj;
+      uint8_t data[8];
+      uint8_t len;
+      CAN_FILTER filter;
+      CAN_FIFO_CHANNEL channel[2];
+      uint8_t active;            // FIFO the filter points at
+      uint8_t generation;        // bumped by Update()
+      uint8_t loaded[2];         // generation each FIFO holds
+      bool full[2];              // FIFO holds an unanswered reply
+      uint32_t responses;
+    } RTR_RESPONDER;
+
+    uint8_t Refresh(RTR_RESPONDER *r);
+    void Load(RTR_RESPONDER *r, uint8_t side);
+
+    mcp2517fd *can;
+    RTR_RESPONDER responders[MCP2517FD_RTR_MAX_RESPONDERS];
+    uint8_t responder_count;
+    bool started;
+};
+
+#endif
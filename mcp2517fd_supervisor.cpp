@@ -0,0 +1,194 @@
+/*
+  mcp2517fd_supervisor.cpp - Bus error supervisor with bus-off recovery for mcp2517fd
+*/
+#include "mcp2517fd_supervisor.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+void mcp2517fd_supervisor::Reset(uint16_t window_ms, uint16_t backoff_min_ms, uint16_t backoff_max_ms)
+{
+  bucket_ms = window_ms / MCP2517FD_SUPERVISOR_BUCKETS;
+  if (!bucket_ms) {
+    bucket_ms = 1;
+  }
+
+  bucket = 0;
+  bucket_start = millis();
+  last_sample = bucket_start;
+  memset(hits, 0, sizeof(hits));
+  memset(frames, 0, sizeof(frames));
+  efmsgcnt = 0;
+
+  held = false;
+  bus_off_count = 0;
+  bus_off_at = 0;
+  backoff_min = backoff_min_ms;
+  backoff_max = backoff_max_ms;
+  backoff_ms = backoff_min_ms;
+
+  state = CAN_ERROR_FREE_STATE;
+  tec = 0;
+  rec = 0;
+  run_mode = CAN_NORMAL_MODE;
+}
+
+void mcp2517fd_supervisor::Begin(uint16_t window_ms, uint16_t backoff_min_ms, uint16_t backoff_max_ms)
+{
+  Reset(window_ms, backoff_min_ms, backoff_max_ms);
+
+  run_mode = can->OperationModeGet();
+  can->BusDiagnosticsClear();
+  can->ModuleEventClear(CAN_BUS_ERROR_EVENT);
+  can->ModuleEventEnable(CAN_BUS_ERROR_EVENT);
+}
+
+void mcp2517fd_supervisor::HandlerSet(mcp2517fd_supervisor_handler h, void *c)
+{
+  handler = h;
+  context = c;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Sampling
+void mcp2517fd_supervisor::Advance(unsigned long now)
+{
+  // Clear the buckets the window slid past
+  uint8_t steps = 0;
+
+  while ((now - bucket_start >= bucket_ms) && (steps < MCP2517FD_SUPERVISOR_BUCKETS)) {
+    bucket = (bucket + 1) % MCP2517FD_SUPERVISOR_BUCKETS;
+    memset(hits[bucket], 0, sizeof(hits[bucket]));
+    frames[bucket] = 0;
+    bucket_start += bucket_ms;
+    steps++;
+  }
+
+  if (now - bucket_start >= bucket_ms) {
+    bucket_start = now;
+  }
+}
+
+void mcp2517fd_supervisor::Sample()
+{
+  unsigned long now = millis();
+  uint32_t w[3];
+  CAN_ERROR_STATE prev = state;
+
+  // CiTREC, CiBDIAG0 and CiBDIAG1 are adjacent
+  can->ReadDWordArray(cREGADDR_CiTREC, w, 3);
+
+  // Clear the sticky flags; the error-free counter keeps running
+  if (w[2] >> 16) {
+    can->WriteWord(cREGADDR_CiBDIAG1 + 2, 0);
+  }
+
+  can->ModuleEventClear(CAN_BUS_ERROR_EVENT);
+
+  rec = w[0] & 0xFF;
+  tec = (w[0] >> 8) & 0xFF;
+  state = (CAN_ERROR_STATE) ((w[0] >> 16) & CAN_ERROR_ALL);
+  last_sample = now;
+
+  Advance(now);
+
+  uint16_t flags = w[2] >> 16;
+
+  for (uint8_t c = 0; flags; c++, flags >>= 1) {
+    if ((flags & 1) && (hits[bucket][c] < 0xFF)) {
+      hits[bucket][c]++;
+    }
+  }
+
+  uint16_t cnt = w[2] & 0xFFFF;
+
+  frames[bucket] += (uint16_t) (cnt - efmsgcnt);
+  efmsgcnt = cnt;
+
+  if ((state & CAN_TX_BUS_OFF_STATE) && !held) {
+    BusOff(now);
+  }
+
+  if ((state != prev) && handler) {
+    handler(state, held, context);
+  }
+}
+
+uint8_t mcp2517fd_supervisor::Poll(uint16_t interval_ms)
+{
+  unsigned long now = millis();
+
+  // Release after the backoff; retried on the next call if the switch fails
+  if (held && (now - bus_off_at >= backoff_ms)) {
+    if (can->OperationModeSwitch(run_mode) < 0) {
+      return 0;
+    }
+
+    held = false;
+
+    if (backoff_ms < backoff_max) {
+      backoff_ms = ((uint32_t) backoff_ms * 2 > backoff_max) ? backoff_max : backoff_ms * 2;
+    }
+
+    // Reports the fresh state
+    Sample();
+
+    return 1;
+  }
+
+  // Stable long enough: forgive earlier bus-offs
+  if (!held && bus_off_count && (now - bus_off_at >= (unsigned long) backoff_ms + backoff_max)) {
+    backoff_ms = backoff_min;
+  }
+
+  if (held || (now - last_sample < interval_ms)) {
+    return 0;
+  }
+
+  Sample();
+
+  return 1;
+}
+
+bool mcp2517fd_supervisor::BusOff(unsigned long now)
+{
+  // The controller would rejoin on its own after 128 x 11 recessive bits;
+  // configuration mode keeps it off the bus and resets TEC/REC. If the
+  // switch fails the next sample still sees bus-off and tries again.
+  if (can->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+    return false;
+  }
+
+  held = true;
+  bus_off_at = now;
+  bus_off_count++;
+
+  return true;
+}
+
+uint16_t mcp2517fd_supervisor::RateGet(MCP2517FD_SV_CATEGORY category)
+{
+  uint16_t n = 0;
+
+  Advance(millis());
+
+  for (uint8_t b = 0; b < MCP2517FD_SUPERVISOR_BUCKETS; b++) {
+    n += hits[b][category];
+  }
+
+  return n;
+}
+
+uint32_t mcp2517fd_supervisor::FrameRateGet()
+{
+  uint32_t n = 0;
+
+  Advance(millis());
+
+  for (uint8_t b = 0; b < MCP2517FD_SUPERVISOR_BUCKETS; b++) {
+    n += frames[b];
+  }
+
+  return n;
+}
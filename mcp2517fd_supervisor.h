@@ -0,0 +1,171 @@
+/*
+  mcp2517fd_supervisor.h - Bus error supervisor with bus-off recovery for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_SUPERVISOR_H
+#define	MCP2517FD_SUPERVISOR_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_SUPERVISOR_BUCKETS 4   // the rate window slides in steps of window / BUCKETS
+
+// *****************************************************************************
+//! Error categories, numbered like the flag bits of CiBDIAG1 bits 16..31
+
+typedef enum {
+  MCP2517FD_SV_NBIT0 = 0,
+  MCP2517FD_SV_NBIT1 = 1,
+  MCP2517FD_SV_NACK = 2,
+  MCP2517FD_SV_NFORM = 3,
+  MCP2517FD_SV_NSTUFF = 4,
+  MCP2517FD_SV_NCRC = 5,
+  MCP2517FD_SV_TXBO = 7,
+  MCP2517FD_SV_DBIT0 = 8,
+  MCP2517FD_SV_DBIT1 = 9,
+  MCP2517FD_SV_DFORM = 11,
+  MCP2517FD_SV_DSTUFF = 12,
+  MCP2517FD_SV_DCRC = 13,
+  MCP2517FD_SV_ESI = 14,
+  MCP2517FD_SV_DLC_MISMATCH = 15,
+  MCP2517FD_SV_CATEGORIES = 16
+} MCP2517FD_SV_CATEGORY;
+
+// *****************************************************************************
+//! Called when the error state changes
+/*!
+   bus_off_held: the controller is parked in configuration mode until the
+   backoff expires.
+*/
+
+typedef void (*mcp2517fd_supervisor_handler)(CAN_ERROR_STATE state, bool bus_off_held, void *context);
+
+class mcp2517fd_supervisor {
+  public:
+    // *****************************************************************************
+    //! Start supervision
+    /*!
+       window_ms: length of the rate window
+       backoff_min_ms, backoff_max_ms: time the controller is held off the bus
+       after a bus-off; doubles on every bus-off, back to the minimum after
+       backoff_max_ms without one.
+       Enables the bus error interrupt and clears the diagnostic registers.
+       The current operation mode is the one restored after a bus-off.
+       Parking the controller in configuration mode aborts all pending
+       transmissions: frames queued in the TX FIFOs and the TXQ are discarded
+       and must be queued again after the release.
+    */
+
+    void Begin(uint16_t window_ms = 1000, uint16_t backoff_min_ms = 10, uint16_t backoff_max_ms = 5000);
+
+    // *****************************************************************************
+    //! Sample the error registers
+    /*!
+       Call when CAN_BUS_ERROR_EVENT is flagged; clears it.
+       Reads CiTREC and CiBDIAG0/1 in one access and clears the sticky flags.
+    */
+
+    void Sample();
+
+    // *****************************************************************************
+    //! Sample every interval_ms and run bus-off recovery
+    /*!
+       Call from the main loop. Returns 1 if a sample was taken.
+       A failed switch into or out of configuration mode leaves the bus-off
+       state unchanged and is retried on the next call.
+    */
+
+    uint8_t Poll(uint16_t interval_ms = 100);
+
+    // *****************************************************************************
+    //! Sample intervals in the last window in which category was flagged
+    /*!
+       The controller only keeps one sticky flag per category, so several
+       errors of the same kind between two samples count once.
+    */
+
+    uint16_t RateGet(MCP2517FD_SV_CATEGORY category);
+
+    // *****************************************************************************
+    //! Frames sent or received without error in the last window
+    uint32_t FrameRateGet();
+
+    // *****************************************************************************
+    //! Last sampled state
+    inline CAN_ERROR_STATE ErrorStateGet()
+    {
+      return state;
+    }
+
+    inline uint8_t TecGet()
+    {
+      return tec;
+    }
+
+    inline uint8_t RecGet()
+    {
+      return rec;
+    }
+
+    // *****************************************************************************
+    //! Bus-off events since Begin()
+    inline uint32_t BusOffCount()
+    {
+      return bus_off_count;
+    }
+
+    // *****************************************************************************
+    //! Controller held off the bus after a bus-off
+    inline bool BusOffHeld()
+    {
+      return held;
+    }
+
+    // *****************************************************************************
+    //! Set state change handler
+    void HandlerSet(mcp2517fd_supervisor_handler handler, void *context = NULL);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_supervisor(mcp2517fd &dev)
+    {
+      can = &dev;
+      handler = NULL;
+      context = NULL;
+      Reset(1000, 10, 5000);
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    void Reset(uint16_t window_ms, uint16_t backoff_min_ms, uint16_t backoff_max_ms);
+    void Advance(unsigned long now);
+    bool BusOff(unsigned long now);
+
+    mcp2517fd *can;
+    mcp2517fd_supervisor_handler handler;
+    void *context;
+    CAN_OPERATION_MODE run_mode;
+    CAN_ERROR_STATE state;
+    uint8_t tec, rec;
+
+    // Rate window
+    uint16_t bucket_ms;
+    uint8_t bucket;
+    unsigned long bucket_start;
+    uint8_t hits[MCP2517FD_SUPERVISOR_BUCKETS][MCP2517FD_SV_CATEGORIES];
+    uint16_t frames[MCP2517FD_SUPERVISOR_BUCKETS];
+    uint16_t efmsgcnt;
+
+    // Bus-off recovery
+    bool held;
+    uint32_t bus_off_count;
+    unsigned long bus_off_at;
+    unsigned long last_sample;
+    uint16_t backoff_ms, backoff_min, backoff_max;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+  mcp2517fd_tef.cpp - Transmit Event FIFO engine: confirmed delivery and TX latency for mcp2517fd
+*/
+#include "mcp2517fd_tef.h"
+
+#define TEF_OBJ_SIZE        12   // header + time stamp
+#define TEF_SEQ_MASK        0x7F
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+uint8_t mcp2517fd_tef::Begin(uint8_t fifo_size)
+{
+  CAN_OPERATION_MODE mode = can->OperationModeGet();
+  CAN_TEF_CONFIG config;
+
+  if (can->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+    return 0;
+  }
+
+  // StoreInTEF
+  can->WriteByte(cREGADDR_CiCON + 2, can->ReadByte(cREGADDR_CiCON + 2) | 0x08);
+
+  config.FifoSize = fifo_size;
+  config.TimeStampEnable = 1;
+  can->TefConfigure(&config);
+
+  depth = fifo_size + 1;
+  seq_next = 0;
+  pending_count = 0;
+  memset(pending, 0, sizeof(pending));
+
+  return can->OperationModeSwitch(mode) >= 0;
+}
+
+void mcp2517fd_tef::StatsClear()
+{
+  memset(&stats, 0, sizeof(stats));
+  stats.latency_min = 0xFFFFFFFF;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Submit and Complete
+int8_t mcp2517fd_tef::Submit(CAN_TX_MSGOBJ *txObj, uint8_t *txd, uint32_t txdNumBytes, CAN_FIFO_CHANNEL channel,
+                             bool flush, mcp2517fd_tef_callback callback, void *context)
+{
+  uint8_t seq = seq_next;
+  TEF_PENDING *p = &pending[seq % MCP2517FD_TEF_MAX_PENDING];
+
+  if (p->used) {
+    return -3;
+  }
+
+  txObj->bF.ctrl.SEQ = seq;
+
+  p->word[0] = txObj->word[0];
+  p->word[1] = txObj->word[1];
+  p->submitted = micros();
+  p->callback = callback;
+  p->context = context;
+
+  int8_t r = can->TransmitChannelLoad(txObj, txd, txdNumBytes, channel, flush);
+
+  if (r < 0) {
+    return r;
+  }
+
+  p->used = true;
+  pending_count++;
+  seq_next = (seq + 1) & TEF_SEQ_MASK;
+
+  return seq;
+}
+
+void mcp2517fd_tef::Complete(uint8_t slot, MCP2517FD_TEF_STATUS status, const MCP2517FD_TIMESTAMP *stamp, uint32_t latency_us)
+{
+  TEF_PENDING *p = &pending[slot];
+  mcp2517fd_tef_callback callback = p->callback;
+  void *context = p->context;
+  uint8_t seq = ((CAN_TX_MSGOBJ *) p->word)->bF.ctrl.SEQ;
+
+  p->used = false;
+  pending_count--;
+
+  if (status == MCP2517FD_TEF_SENT) {
+    uint8_t bin = 0;
+
+    while ((bin < MCP2517FD_TEF_HIST_BINS - 1) && (latency_us >> (bin + 1))) {
+      bin++;
+    }
+
+    stats.sent++;
+    stats.histogram[bin]++;
+    stats.latency_sum += latency_us;
+    if (latency_us < stats.latency_min) stats.latency_min = latency_us;
+    if (latency_us > stats.latency_max) stats.latency_max = latency_us;
+  } else {
+    stats.expired++;
+  }
+
+  if (callback) {
+    callback(seq, status, stamp, latency_us, context);
+  }
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Drain
+uint16_t mcp2517fd_tef::Drain(uint16_t budget)
+{
+  uint16_t consumed = 0;
+  uint8_t ba[MCP2517FD_TEF_BURST * TEF_OBJ_SIZE];
+  uint32_t tefReg[3];
+
+  while ((consumed < budget) && depth) {
+    // TEFCON, TEFSTA and TEFUA in one access
+    can->ReadDWordArray(cREGADDR_CiTEFCON, tefReg, 3);
+
+    if (tefReg[1] & CAN_TEF_FIFO_OVERFLOW_EVENT) {
+      stats.overflows++;
+      can->TefEventOverflowClear();
+    }
+
+    if (!(tefReg[1] & CAN_TEF_FIFO_NOT_EMPTY)) {
+      break;
+    }
+
+    // Read ahead up to the end of the ring; entries beyond the filled ones hold
+    // stale objects whose header cannot match a frame in flight
+    uint16_t ua = tefReg[2] & 0xFFF;
+    uint8_t index = ua / TEF_OBJ_SIZE;
+    uint8_t n = depth - index;
+
+    if (n > MCP2517FD_TEF_BURST) {
+      n = MCP2517FD_TEF_BURST;
+    }
+
+    if (n > budget - consumed) {
+      n = budget - consumed;
+    }
+
+    can->ReadByteArray(cRAMADDR_START + ua, ba, n * TEF_OBJ_SIZE);
+
+    for (uint8_t i = 0; i < n; i++) {
+      CAN_TEF_MSGOBJ tefObj;
+
+      memcpy(tefObj.bytes, &ba[i * TEF_OBJ_SIZE], TEF_OBJ_SIZE);
+
+      uint8_t slot = tefObj.bF.ctrl.SEQ % MCP2517FD_TEF_MAX_PENDING;
+      TEF_PENDING *p = &pending[slot];
+      bool match = p->used && (p->word[0] == tefObj.dword[0]) && (p->word[1] == tefObj.dword[1]);
+
+      // The first entry is valid for sure: consume it even if it is foreign
+      if (!match && (i > 0)) {
+        break;
+      }
+
+      can->TefUpdate();
+      consumed++;
+
+      if (!match) {
+        stats.foreign++;
+        continue;
+      }
+
+      MCP2517FD_TIMESTAMP stamp;
+
+      ts->Stamp(tefObj.bF.timeStamp, &stamp);
+      Complete(slot, MCP2517FD_TEF_SENT, &stamp, stamp.micros - p->submitted);
+    }
+  }
+
+  return consumed;
+}
+
+uint8_t mcp2517fd_tef::Expire(uint32_t age_us)
+{
+  uint32_t now = micros();
+  uint8_t expired = 0;
+
+  for (uint8_t i = 0; i < MCP2517FD_TEF_MAX_PENDING; i++) {
+    if (pending[i].used && (now - pending[i].submitted > age_us)) {
+      Complete(i, MCP2517FD_TEF_EXPIRED, NULL, now - pending[i].submitted);
+      expired++;
+    }
+  }
+
+  return expired;
+}
@@ -0,0 +1,143 @@
+/*
+  mcp2517fd_tef.h - Transmit Event FIFO engine: confirmed delivery and TX latency for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_TEF_H
+#define	MCP2517FD_TEF_H
+
+#include "mcp2517fd_timestamp.h"
+
+#define MCP2517FD_TEF_MAX_PENDING 32   // frames in flight; with TEF depth <= 32 stays below the 128 SEQ values
+#define MCP2517FD_TEF_BURST       8    // TEF objects read per SPI access
+#define MCP2517FD_TEF_HIST_BINS   20   // bin n counts latencies in [2^n, 2^(n+1)) us
+
+// *****************************************************************************
+//! Completion status
+
+typedef enum {
+  MCP2517FD_TEF_SENT,
+  MCP2517FD_TEF_EXPIRED
+} MCP2517FD_TEF_STATUS;
+
+// *****************************************************************************
+//! Called when a submitted frame was sent, or given up by Expire()
+/*!
+   stamp is the TEF time stamp, NULL when expired. latency_us runs from
+   Submit() to the frame's time stamp on the bus.
+*/
+
+typedef void (*mcp2517fd_tef_callback)(uint8_t seq, MCP2517FD_TEF_STATUS status, const MCP2517FD_TIMESTAMP *stamp, uint32_t latency_us, void *context);
+
+// *****************************************************************************
+//! Statistics
+
+typedef struct {
+  uint32_t sent;
+  uint32_t expired;
+  uint32_t foreign;       // TEF entries without a matching submission
+  uint32_t overflows;
+  uint32_t latency_min;
+  uint32_t latency_max;
+  uint64_t latency_sum;
+  uint32_t histogram[MCP2517FD_TEF_HIST_BINS];
+} MCP2517FD_TEF_STATS;
+
+class mcp2517fd_tef {
+  public:
+    // *****************************************************************************
+    //! Enable the TEF with time stamps
+    /*!
+       fifo_size: TEF depth - 1 (0..31)
+       Passes through configuration mode; call right after Init() and the
+       time stamp service's Begin(). Returns 1 on success, 0 if a mode change
+       timed out.
+    */
+
+    uint8_t Begin(uint8_t fifo_size = 7);
+
+    // *****************************************************************************
+    //! Load a frame and track it until it shows up in the TEF
+    /*!
+       Assigns the SEQ field of txObj. Returns the SEQ, -1 if the DLC is too
+       small for the data, -2 if channel is not a TX FIFO, -3 if it is full or
+       too many frames are in flight.
+    */
+
+    int8_t Submit(CAN_TX_MSGOBJ *txObj, uint8_t *txd, uint32_t txdNumBytes, CAN_FIFO_CHANNEL channel = CAN_FIFO_CH1,
+                  bool flush = true, mcp2517fd_tef_callback callback = NULL, void *context = NULL);
+
+    // *****************************************************************************
+    //! Drain the TEF
+    /*!
+       Reads the TEF in bursts of up to MCP2517FD_TEF_BURST objects, matches
+       each entry to its submission and calls the callbacks.
+       Returns number of entries consumed.
+    */
+
+    uint16_t Drain(uint16_t budget = 0xFFFF);
+
+    // *****************************************************************************
+    //! Give up on frames in flight for longer than age_us
+    /*!
+       Covers entries lost to a TEF overflow or aborted transmissions.
+       Returns number of frames expired.
+    */
+
+    uint8_t Expire(uint32_t age_us);
+
+    // *****************************************************************************
+    //! Frames in flight
+    inline uint8_t PendingCount()
+    {
+      return pending_count;
+    }
+
+    // *****************************************************************************
+    //! Statistics
+    inline const MCP2517FD_TEF_STATS *StatsGet()
+    {
+      return &stats;
+    }
+
+    void StatsClear();
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_tef(mcp2517fd &dev, mcp2517fd_timestamp &timestamp)
+    {
+      can = &dev;
+      ts = &timestamp;
+      seq_next = 0;
+      pending_count = 0;
+      depth = 0;
+      memset(pending, 0, sizeof(pending));
+      StatsClear();
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      uint32_t word[2];       // header as loaded, matched against the TEF entry
+      uint32_t submitted;     // micros() at Submit()
+      mcp2517fd_tef_callback callback;
+      void *context;
+      bool used;
+    } TEF_PENDING;
+
+    void Complete(uint8_t slot, MCP2517FD_TEF_STATUS status, const MCP2517FD_TIMESTAMP *stamp, uint32_t latency_us);
+
+    mcp2517fd *can;
+    mcp2517fd_timestamp *ts;
+    TEF_PENDING pending[MCP2517FD_TEF_MAX_PENDING];   // indexed by SEQ
+    uint8_t seq_next;
+    uint8_t pending_count;
+    uint8_t depth;
+    MCP2517FD_TEF_STATS stats;
+};
+
+#endif
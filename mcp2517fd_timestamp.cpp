@@ -0,0 +1,154 @@
+/*
+  mcp2517fd_timestamp.cpp - 64-bit time stamps and micros() correlation for mcp2517fd
+*/
+#include "mcp2517fd_timestamp.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+uint8_t mcp2517fd_timestamp::Begin(CAN_FIFO_CHANNEL rx_fifo_ch, uint16_t prescaler, uint32_t sysclk)
+{
+  CAN_OPERATION_MODE mode = can->OperationModeGet();
+  uint16_t a;
+  REG_CiFIFOCON fifoCon;
+  REG_CiTEFCON tefCon;
+
+  tick_ps = (uint32_t) ((prescaler + 1) * (1000000000000ULL / sysclk));
+
+  // RXTSEN and TEFTSEN can only change in configuration mode
+  if (can->OperationModeSwitch(CAN_CONFIGURATION_MODE) < 0) {
+    return 0;
+  }
+
+  a = cREGADDR_CiFIFOCON + (rx_fifo_ch * CiFIFO_OFFSET);
+  fifoCon.dword = 0;
+  fifoCon.bytes[0] = can->ReadByte(a);
+  fifoCon.rxBF.RxTimeStampEnable = 1;
+  can->WriteByte(a, fifoCon.bytes[0]);
+
+  tefCon.dword = 0;
+  tefCon.bytes[0] = can->ReadByte(cREGADDR_CiTEFCON);
+  tefCon.bF.TimeStampEnable = 1;
+  can->WriteByte(cREGADDR_CiTEFCON, tefCon.bytes[0]);
+
+  can->TimeStampPrescalerSet(prescaler);
+  can->TimeStampSet(0);
+  can->TimeStampEnable();
+
+  last = 0;
+  synced = false;
+  drift_valid = false;
+  drift_ppm = 0;
+
+  if (can->OperationModeSwitch(mode) < 0) {
+    return 0;
+  }
+
+  Sync();
+
+  return 1;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Clock Correlation
+uint64_t mcp2517fd_timestamp::Extend(uint32_t ts)
+{
+  int32_t diff = (int32_t) (ts - (uint32_t) last);
+  uint64_t ext = last + (int64_t) diff;
+
+  if (diff > 0) {
+    last = ext;
+  }
+
+  return ext;
+}
+
+void mcp2517fd_timestamp::Sync()
+{
+  uint32_t t0 = micros();
+  uint32_t tbc = can->TimeStampGet();
+  uint32_t t1 = micros();
+
+  uint64_t ticks = Extend(tbc);
+  uint32_t now = t0 + (t1 - t0) / 2;
+
+  uncertainty_us = (t1 - t0) / 2;
+
+  // The offset always follows the newest sample
+  sync_ticks = ticks;
+  sync_micros = now;
+
+  if (!synced) {
+    base_ticks = ticks;
+    base_micros = now;
+    synced = true;
+    return;
+  }
+
+  // The drift is measured over a baseline of at least MCP2517FD_TS_MIN_SYNC_US
+  int64_t dt_nom = (int64_t) ((ticks - base_ticks) * tick_ps / 1000000UL);
+
+  if (dt_nom < (int64_t) MCP2517FD_TS_MIN_SYNC_US) {
+    return;
+  }
+
+  uint32_t dt_host = now - base_micros;
+  int32_t ppm = (int32_t) (((int64_t) dt_host - dt_nom) * 1000000 / dt_nom);
+
+  // First estimate is taken as is, later ones are smoothed
+  if (drift_valid) {
+    drift_ppm += (ppm - drift_ppm) / 4;
+  } else {
+    drift_ppm = ppm;
+    drift_valid = true;
+  }
+
+  base_ticks = ticks;
+  base_micros = now;
+}
+
+uint32_t mcp2517fd_timestamp::ToMicros(uint64_t ticks)
+{
+  int64_t dt = (int64_t) (ticks - sync_ticks);
+  int64_t us = dt * (int64_t) tick_ps / 1000000;
+
+  us += us * drift_ppm / 1000000;
+
+  return sync_micros + (uint32_t) us;
+}
+
+void mcp2517fd_timestamp::Stamp(uint32_t ts, MCP2517FD_TIMESTAMP *stamp)
+{
+  stamp->ticks = Extend(ts);
+  stamp->micros = ToMicros(stamp->ticks);
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Stamped Access
+uint8_t mcp2517fd_timestamp::ReceiveMessageGet(CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, uint8_t nBytes, CAN_FIFO_CHANNEL channel, MCP2517FD_TIMESTAMP *stamp)
+{
+  uint8_t r = can->ReceiveMessageGet(rxObj, rxd, nBytes, channel);
+
+  // Nothing read: rxObj holds no time stamp to extend
+  if (r) {
+    Stamp(rxObj->bF.timeStamp, stamp);
+  }
+
+  return r;
+}
+
+uint8_t mcp2517fd_timestamp::TefMessageGet(CAN_TEF_MSGOBJ *tefObj, MCP2517FD_TIMESTAMP *stamp)
+{
+  // An empty TEF has no time stamp to extend
+  if (!(can->TefStatusGet() & CAN_TEF_FIFO_NOT_EMPTY)) {
+    return 0;
+  }
+
+  *tefObj = can->TefMessageGet();
+
+  Stamp(tefObj->bF.timeStamp, stamp);
+
+  return 1;
+}
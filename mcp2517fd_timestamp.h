@@ -0,0 +1,143 @@
+/*
+  mcp2517fd_timestamp.h - 64-bit time stamps and micros() correlation for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_TIMESTAMP_H
+#define	MCP2517FD_TIMESTAMP_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_TS_MIN_SYNC_US 100000UL   // shorter sync intervals do not update the drift
+
+// *****************************************************************************
+//! Time stamp of one frame in both clock domains
+
+typedef struct {
+  uint64_t ticks;     // controller time base, widened to 64 bits
+  uint32_t micros;    // the same instant in micros()
+} MCP2517FD_TIMESTAMP;
+
+class mcp2517fd_timestamp {
+  public:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Setup
+
+    // *****************************************************************************
+    //! Start the time base and enable time stamps on RX FIFO and TEF
+    /*!
+       Passes through configuration mode, so call right after Init() while the
+       FIFOs are still empty. The time base runs at sysclk / (prescaler + 1),
+       1 MHz by default. Returns 1 on success, 0 if a mode change timed out.
+    */
+
+    uint8_t Begin(CAN_FIFO_CHANNEL rx_fifo_ch = CAN_FIFO_CH2, uint16_t prescaler = 39, uint32_t sysclk = 40000000UL);
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Clock Correlation
+
+    // *****************************************************************************
+    //! Sample CiTBC against micros()
+    /*!
+       The SPI read is bracketed by two micros() calls and its midpoint is taken
+       as the sample instant. Call periodically (about once a second); every
+       MCP2517FD_TS_MIN_SYNC_US of baseline also refines the drift estimate.
+       Must run at least once per 2^31 ticks (35 min at 1 MHz).
+    */
+
+    void Sync();
+
+    // *****************************************************************************
+    //! Widen a 32-bit CiTBC value to 64 bits
+    /*!
+       Valid for values within 2^31 ticks of the newest value seen, so frames
+       may be stamped out of order.
+    */
+
+    uint64_t Extend(uint32_t ts);
+
+    // *****************************************************************************
+    //! Map controller ticks to micros()
+    uint32_t ToMicros(uint64_t ticks);
+
+    // *****************************************************************************
+    //! Fill stamp from a raw 32-bit time stamp
+    void Stamp(uint32_t ts, MCP2517FD_TIMESTAMP *stamp);
+
+    // *****************************************************************************
+    //! Nominal period of one tick in ps
+    inline uint32_t TickPeriodGet()
+    {
+      return tick_ps;
+    }
+
+    // *****************************************************************************
+    //! Drift of the controller clock against micros() in ppm
+    inline int32_t DriftGet()
+    {
+      return drift_ppm;
+    }
+
+    // *****************************************************************************
+    //! Half width of the last Sync() bracket in us
+    inline uint32_t UncertaintyGet()
+    {
+      return uncertainty_us;
+    }
+
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Stamped Access
+
+    // *****************************************************************************
+    //! ReceiveMessageGet() that also returns the frame's time stamp
+    /*!
+       Returns 0, leaving stamp untouched, when nothing was read (channel
+       empty, not a receive FIFO, SPI CRC retries ran out).
+    */
+
+    uint8_t ReceiveMessageGet(CAN_RX_MSGOBJ *rxObj, uint8_t *rxd, uint8_t nBytes, CAN_FIFO_CHANNEL channel, MCP2517FD_TIMESTAMP *stamp);
+
+    // *****************************************************************************
+    //! TefMessageGet() that also returns the frame's time stamp
+    /*!
+       Returns 1, 0 leaving tefObj and stamp untouched if the TEF is empty.
+    */
+
+    uint8_t TefMessageGet(CAN_TEF_MSGOBJ *tefObj, MCP2517FD_TIMESTAMP *stamp);
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_timestamp(mcp2517fd &dev)
+    {
+      can = &dev;
+      last = 0;
+      synced = false;
+      drift_valid = false;
+      drift_ppm = 0;
+      uncertainty_us = 0;
+      tick_ps = 1000000UL;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    mcp2517fd *can;
+    uint64_t last;          // newest extended value
+    uint64_t sync_ticks;    // newest Sync() sample, anchors the offset
+    uint32_t sync_micros;
+    uint64_t base_ticks;    // start of the drift baseline
+    uint32_t base_micros;
+    bool synced;
+    bool drift_valid;
+    int32_t drift_ppm;
+    uint32_t uncertainty_us;
+    uint32_t tick_ps;       // nominal tick period
+};
+
+#endif
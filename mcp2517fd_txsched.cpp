@@ -0,0 +1,264 @@
+/*
+  mcp2517fd_txsched.cpp - Rate limited transmit scheduler per message class for mcp2517fd
+*/
+#include "mcp2517fd_txsched.h"
+#include "mcp2517fd_busload.h"
+#include "mcp2517fd_fifoconfig.h"
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Setup
+int8_t mcp2517fd_txsched::ClassAdd(CAN_FIFO_CHANNEL channel, uint8_t priority, uint32_t rate_bps, uint16_t burst_bits,
+                                   MCP2517FD_TXSCHED_FRAME *queue, uint8_t queue_size,
+                                   uint8_t depth, CAN_FIFO_PLSIZE payload)
+{
+  if (class_count >= MCP2517FD_TXSCHED_MAX_CLASSES) {
+    return -1;
+  }
+
+  uint8_t id = class_count;
+  TXSCHED_CLASS *c = &classes[id];
+
+  c->channel = channel;
+  c->priority = priority & 0x1F;
+  c->depth = ((depth < 1) ? 1 : ((depth > 32) ? 32 : depth));
+  c->payload = payload;
+  c->queue = queue;
+  c->queue_size = queue_size;
+  c->head = 0;
+  c->count = 0;
+  memset(&c->stats, 0, sizeof(c->stats));
+  c->rate = rate_bps;
+  c->burst = burst_bits;
+  c->tokens = burst_bits;
+  c->remainder = 0;
+  c->last = micros();
+
+  // Keep the service order sorted by priority, equal priorities in add order
+  uint8_t i = class_count;
+
+  while ((i > 0) && (classes[order[i - 1]].priority < c->priority)) {
+    order[i] = order[i - 1];
+    i--;
+  }
+
+  order[i] = id;
+
+  return class_count++;
+}
+
+int8_t mcp2517fd_txsched::Begin()
+{
+  mcp2517fd_fifoconfig fifos(*can);
+  CAN_TX_FIFO_CONFIG config;
+  REG_CiNBTCFG nbt;
+  REG_CiDBTCFG dbt;
+
+  fifos.Load();
+
+  for (uint8_t i = 0; i < class_count; i++) {
+    TXSCHED_CLASS *c = &classes[i];
+
+    can->TransmitChannelConfigureObjectReset(&config);
+    config.FifoSize = c->depth - 1;
+    config.PayLoadSize = c->payload;
+    config.TxPriority = c->priority;
+    fifos.TransmitChannelSet(&config, c->channel);
+  }
+
+  int8_t r = fifos.Apply();
+
+  if (r < 0) {
+    return r;
+  }
+
+  // BRS frames are costed in nominal bit times
+  nbt.dword = can->ReadDWord(cREGADDR_CiNBTCFG);
+  dbt.dword = can->ReadDWord(cREGADDR_CiDBTCFG);
+
+  uint32_t nbt_clk = (nbt.bF.BRP + 1) * (nbt.bF.TSEG1 + nbt.bF.TSEG2 + 3);
+  uint32_t dbt_clk = (dbt.bF.BRP + 1) * (dbt.bF.TSEG1 + dbt.bF.TSEG2 + 3);
+
+  dbt_ratio = (dbt_clk << 8) / nbt_clk;
+
+  // Start with full buckets
+  unsigned long now = micros();
+
+  for (uint8_t i = 0; i < class_count; i++) {
+    classes[i].tokens = classes[i].burst;
+    classes[i].remainder = 0;
+    classes[i].last = now;
+  }
+
+  return r;
+}
+
+void mcp2517fd_txsched::RateSet(uint8_t id, uint32_t rate_bps, uint16_t burst_bits)
+{
+  if (id >= class_count) {
+    return;
+  }
+
+  TXSCHED_CLASS *c = &classes[id];
+
+  c->rate = rate_bps;
+  c->burst = burst_bits;
+  c->tokens = burst_bits;
+  c->remainder = 0;
+  c->last = micros();
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Scheduling
+uint16_t mcp2517fd_txsched::Cost(const CAN_TX_MSGOBJ *txObj)
+{
+  uint16_t dbits;
+  uint16_t nbits = mcp2517fd_busload::FrameBits(txObj->bF.ctrl.IDE, txObj->bF.ctrl.FDF, txObj->bF.ctrl.BRS,
+                                                txObj->bF.ctrl.RTR, txObj->bF.ctrl.DLC, &dbits);
+
+  return nbits + (((uint32_t) dbits * dbt_ratio + 0xFF) >> 8);
+}
+
+void mcp2517fd_txsched::Refill(TXSCHED_CLASS *c, unsigned long now)
+{
+  uint32_t elapsed = now - c->last;
+
+  c->last = now;
+
+  if (!c->rate || (c->tokens >= c->burst)) {
+    c->remainder = 0;
+    return;
+  }
+
+  // Whole bit times go into the bucket, the fraction is carried over
+  uint64_t acc = ((uint64_t) elapsed * c->rate) + c->remainder;
+  uint64_t add = acc / 1000000UL;
+
+  c->remainder = acc - (add * 1000000UL);
+
+  if (add >= (uint64_t) (c->burst - c->tokens)) {
+    c->tokens = c->burst;
+    c->remainder = 0;
+  } else {
+    c->tokens += (int32_t) add;
+  }
+}
+
+int8_t mcp2517fd_txsched::Submit(uint8_t id, CAN_TX_MSGOBJ *txObj, uint8_t *txd, uint8_t txdNumBytes)
+{
+  if (id >= class_count) {
+    return -2;
+  }
+
+  TXSCHED_CLASS *c = &classes[id];
+
+  // Nothing of the class may overtake a queued frame
+  if (!c->count) {
+    Refill(c, micros());
+
+    if (!c->rate || (c->tokens > 0)) {
+      int8_t r = can->TransmitChannelLoad(txObj, txd, txdNumBytes, c->channel, true);
+
+      if (r == 1) {
+        if (c->rate) {
+          c->tokens -= Cost(txObj);
+        }
+        c->stats.sent++;
+        return 0;
+      }
+
+      if (r != -3) {
+        return r;
+      }
+    }
+  }
+
+  if ((txdNumBytes > MAX_DATA_BYTES) || (DLC_DataLength[txObj->bF.ctrl.DLC] < txdNumBytes)) {
+    return -1;
+  }
+
+  if (c->count >= c->queue_size) {
+    c->stats.rejected++;
+    return -3;
+  }
+
+  uint8_t tail = (c->head + c->count) % c->queue_size;
+  MCP2517FD_TXSCHED_FRAME *f = &c->queue[tail];
+
+  f->obj = *txObj;
+  f->len = txdNumBytes;
+  memcpy(f->data, txd, txdNumBytes);
+
+  if (++c->count > c->stats.queue_max) {
+    c->stats.queue_max = c->count;
+  }
+
+  return 1;
+}
+
+uint16_t mcp2517fd_txsched::Service()
+{
+  unsigned long now = micros();
+  uint16_t loaded = 0;
+
+  for (uint8_t i = 0; i < class_count; i++) {
+    TXSCHED_CLASS *c = &classes[order[i]];
+    bool flush = false;
+
+    Refill(c, now);
+
+    while (c->count && (!c->rate || (c->tokens > 0))) {
+      MCP2517FD_TXSCHED_FRAME *f = &c->queue[c->head];
+
+      // FIFO full: the rest waits for the next call
+      if (can->TransmitChannelLoad(&f->obj, f->data, f->len, c->channel, false) != 1) {
+        break;
+      }
+
+      if (c->rate) {
+        c->tokens -= Cost(&f->obj);
+      }
+
+      c->head = (c->head + 1) % c->queue_size;
+      c->count--;
+      c->stats.sent++;
+      loaded++;
+      flush = true;
+    }
+
+    if (c->count && c->rate && (c->tokens <= 0)) {
+      c->stats.throttled++;
+    }
+
+    if (flush) {
+      can->TransmitChannelFlush(c->channel);
+    }
+  }
+
+  return loaded;
+}
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Status
+uint8_t mcp2517fd_txsched::QueuedGet(uint8_t id)
+{
+  return (id < class_count) ? classes[id].count : 0;
+}
+
+void mcp2517fd_txsched::StatsGet(uint8_t id, MCP2517FD_TXSCHED_STATS *stats)
+{
+  if (id < class_count) {
+    *stats = classes[id].stats;
+  } else {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+void mcp2517fd_txsched::StatsClear()
+{
+  for (uint8_t i = 0; i < class_count; i++) {
+    memset(&classes[i].stats, 0, sizeof(classes[i].stats));
+  }
+}
@@ -0,0 +1,141 @@
+/*
+  mcp2517fd_txsched.h - Rate limited transmit scheduler per message class for mcp2517fd
+
+  Revision History
+  ver1.0 - Newly created
+*/
+#ifndef	MCP2517FD_TXSCHED_H
+#define	MCP2517FD_TXSCHED_H
+
+#include "mcp2517fd.h"
+
+#define MCP2517FD_TXSCHED_MAX_CLASSES 8
+
+// *****************************************************************************
+//! Frame waiting in a class queue
+
+typedef struct {
+  CAN_TX_MSGOBJ obj;
+  uint8_t data[MAX_DATA_BYTES];
+  uint8_t len;
+} MCP2517FD_TXSCHED_FRAME;
+
+// *****************************************************************************
+//! Message class statistics
+
+typedef struct {
+  uint32_t sent;          // frames loaded into the FIFO
+  uint32_t rejected;      // frames refused because the queue was full
+  uint32_t throttled;     // Service() calls that left frames queued for lack of tokens
+  uint8_t queue_max;      // queue high water mark
+} MCP2517FD_TXSCHED_STATS;
+
+class mcp2517fd_txsched {
+  public:
+    // *****************************************************************************
+    //! Add a message class
+    /*!
+       Each class owns a transmit FIFO; priority is its TXPRI (0..31, 31 is
+       sent first when several FIFOs are pending). rate_bps caps the class at
+       that many nominal bit times per second, 0 leaves it uncapped; burst_bits
+       is how far the class may run ahead of the rate after being idle.
+       queue holds frames waiting for tokens or FIFO space; depth is the
+       number of FIFO objects (1..32).
+       Returns the class id, -1 if all classes are in use.
+    */
+
+    int8_t ClassAdd(CAN_FIFO_CHANNEL channel, uint8_t priority, uint32_t rate_bps, uint16_t burst_bits,
+                    MCP2517FD_TXSCHED_FRAME *queue, uint8_t queue_size,
+                    uint8_t depth = 4, CAN_FIFO_PLSIZE payload = CAN_PLSIZE_64);
+
+    // *****************************************************************************
+    //! Configure the class FIFOs and start scheduling
+    /*!
+       Rewrites the FIFO control registers of all classes through configuration
+       mode and reads the bit timing used to cost BRS frames; call after Init().
+       Returns number of FIFOs rewritten, -1 if the layout does not fit the
+       message RAM, -2 if a mode change timed out.
+    */
+
+    int8_t Begin();
+
+    // *****************************************************************************
+    //! Transmit a frame of a class
+    /*!
+       The frame goes straight into the FIFO when nothing of the class is
+       queued and the class has tokens; otherwise it is queued for Service().
+       Returns 0 if loaded, 1 if queued, -1 if the DLC is too small for the
+       data, -2 if id is not a class, -3 if the queue is full.
+    */
+
+    int8_t Submit(uint8_t id, CAN_TX_MSGOBJ *txObj, uint8_t *txd, uint8_t txdNumBytes);
+
+    // *****************************************************************************
+    //! Move queued frames into the FIFOs
+    /*!
+       Refills the token buckets and drains the class queues, highest priority
+       first, each FIFO flushed once. Call often; at least once per frame time
+       of the fastest capped class keeps its spacing even.
+       Returns number of frames loaded.
+    */
+
+    uint16_t Service();
+
+    // *****************************************************************************
+    //! Frames waiting in the queue of a class
+    uint8_t QueuedGet(uint8_t id);
+
+    // *****************************************************************************
+    //! Change the rate of a class
+    void RateSet(uint8_t id, uint32_t rate_bps, uint16_t burst_bits);
+
+    // *****************************************************************************
+    //! Get statistics of a class
+    void StatsGet(uint8_t id, MCP2517FD_TXSCHED_STATS *stats);
+
+    // *****************************************************************************
+    //! Clear statistics of all classes
+    void StatsClear();
+
+    // *****************************************************************************
+    //! Constructor
+    mcp2517fd_txsched(mcp2517fd &dev)
+    {
+      can = &dev;
+      class_count = 0;
+      dbt_ratio = 1 << 8;
+    }
+
+  private:
+    // *****************************************************************************
+    // *****************************************************************************
+    // Section: Private Variables
+
+    typedef struct {
+      CAN_FIFO_CHANNEL channel;
+      uint8_t priority;
+      uint8_t depth;
+      CAN_FIFO_PLSIZE payload;
+      uint32_t rate;             // nominal bit times per second, 0: uncapped
+      int32_t burst;
+      int32_t tokens;            // in nominal bit times, may go negative by one frame
+      uint32_t remainder;        // refill carried over, in bit times * 1000000
+      unsigned long last;
+      MCP2517FD_TXSCHED_FRAME *queue;
+      uint8_t queue_size;
+      uint8_t head;              // oldest queued frame
+      uint8_t count;
+      MCP2517FD_TXSCHED_STATS stats;
+    } TXSCHED_CLASS;
+
+    void Refill(TXSCHED_CLASS *c, unsigned long now);
+    uint16_t Cost(const CAN_TX_MSGOBJ *txObj);
+
+    mcp2517fd *can;
+    TXSCHED_CLASS classes[MCP2517FD_TXSCHED_MAX_CLASSES];
+    uint8_t order[MCP2517FD_TXSCHED_MAX_CLASSES];    // class ids, highest priority first
+    uint8_t class_count;
+    uint16_t dbt_ratio;          // data bit time / nominal bit time, 8.8 fixed point
+};
+
+#endif